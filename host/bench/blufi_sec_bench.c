@@ -0,0 +1,397 @@
+/*
+    Host benchmark: BluFi key negotiation, 1024 bit DH against ECDH on X25519 and P-256
+
+    Each run opens a BluFi security session and feeds blufi_dh_negotiate_data_handler the
+    messages a phone sends, the way the Bluetooth stack does. The phone side is mbedTLS in
+    the same process and is not timed. The time is the handler's, on the host CPU, and the
+    heap peak is the most the handler had allocated at once, counted by the host build's
+    allocator. After each negotiation the phone decrypts a frame from blufi_aes_encrypt and
+    blufi_aes_decrypt decrypts one from the phone, so a run with a wrong key fails.
+
+    blufi_sec_bench [--runs N] [method ...]
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "esp_blufi_api.h"
+#include "blufi.h"
+#include "sim.h"
+#include "mbedtls/aes.h"
+#include "mbedtls/dhm.h"
+#include "mbedtls/ecdh.h"
+#include "mbedtls/md5.h"
+#include "mbedtls/sha256.h"
+
+#define DEFAULT_RUNS 20
+
+/* The messages of blufi_security.c */
+#define SEC_TYPE_DH_PARAM_LEN   0x00
+#define SEC_TYPE_DH_PARAM_DATA  0x01
+#define SEC_TYPE_ECDH_PUBLIC    0x05
+#define ECDH_CURVE_X25519       0x00
+#define ECDH_CURVE_P256         0x01
+
+#define KEY_LEN 16
+/* The longest frame, which ends in a partial AES block */
+#define FRAME_LEN 255
+
+/* RFC 2409 group 2, the 1024 bit group the BluFi apps send for DH */
+static const char dh_p[] =
+    "FFFFFFFFFFFFFFFFC90FDAA22168C234C4C6628B80DC1CD129024E088A67CC74020BBEA63B139B22514A08798E3404DD"
+    "EF9519B3CD3A431B302B0A6DF25F14374FE1356D6D51C245E485B576625E7EC6F44C42E9A637ED6B0BFF5CB6F406B7ED"
+    "EE386BFB5A899FA5AE9F24117C4B1FE649286651ECE65381FFFFFFFFFFFFFFFF";
+
+typedef struct {
+    uint32_t cpu_us;
+    size_t heap_peak;
+    int sent;               // Bytes of the device's public key
+} run_result_t;
+
+typedef struct {
+    const char *name;
+    const char *description;
+    int (*run)(run_result_t *result, uint8_t key[KEY_LEN]);   // Returns 0, and the key the phone derived
+} method_t;
+
+static int reported_error = -1;
+
+/* The Bluetooth stack, which would send the error to the phone */
+void btc_blufi_report_error(esp_blufi_error_state_t state)
+{
+    reported_error = state;
+}
+
+static int phone_rand(void *rng_state, unsigned char *output, size_t len)
+{
+    esp_fill_random(output, len);
+    return 0;
+}
+
+static void negotiate_begin(int64_t *start_us)
+{
+    reported_error = -1;
+    sim_heap_reset_minimum();
+    *start_us = esp_timer_get_time();
+}
+
+static void negotiate_end(run_result_t *result, int64_t start_us, uint32_t free_before)
+{
+    result->cpu_us = (uint32_t)(esp_timer_get_time() - start_us);
+    result->heap_peak = free_before - esp_get_minimum_free_heap_size();
+}
+
+static int run_dh(run_result_t *result, uint8_t key[KEY_LEN])
+{
+    mbedtls_dhm_context phone;
+    mbedtls_mpi p, g;
+    uint8_t params[1 + 3 * (2 + 128)];
+    uint8_t len_msg[3];
+    uint8_t secret[128];
+    size_t params_len = 0, secret_len = 0;
+    uint8_t *output = NULL;
+    int output_len = 0;
+    bool need_free = false;
+
+    mbedtls_dhm_init(&phone);
+    mbedtls_mpi_init(&p);
+    mbedtls_mpi_init(&g);
+    int ret = mbedtls_mpi_read_string(&p, 16, dh_p);
+    if (ret == 0)
+    {
+        ret = mbedtls_mpi_lset(&g, 2);
+    }
+    if (ret == 0)
+    {
+        ret = mbedtls_dhm_set_group(&phone, &p, &g);
+    }
+    if (ret == 0)
+    {
+        ret = mbedtls_dhm_make_params(&phone, (int)mbedtls_mpi_size(&phone.P), &params[1], &params_len, phone_rand,
+            NULL);
+    }
+    if (ret == 0)
+    {
+        params[0] = SEC_TYPE_DH_PARAM_DATA;
+        len_msg[0] = SEC_TYPE_DH_PARAM_LEN;
+        len_msg[1] = (uint8_t)(params_len >> 8);
+        len_msg[2] = (uint8_t)params_len;
+
+        int64_t start_us;
+        uint32_t free_before = esp_get_free_heap_size();
+        negotiate_begin(&start_us);
+        blufi_dh_negotiate_data_handler(len_msg, sizeof(len_msg), &output, &output_len, &need_free);
+        blufi_dh_negotiate_data_handler(params, (int)params_len + 1, &output, &output_len, &need_free);
+        negotiate_end(result, start_us, free_before);
+
+        ret = (reported_error < 0 && output != NULL) ? 0 : -1;
+    }
+    if (ret == 0)
+    {
+        result->sent = output_len;
+        ret = mbedtls_dhm_read_public(&phone, output, output_len);
+    }
+    if (ret == 0)
+    {
+        ret = mbedtls_dhm_calc_secret(&phone, secret, sizeof(secret), &secret_len, NULL, NULL);
+    }
+    if (ret == 0)
+    {
+        uint8_t digest[16];
+        mbedtls_md5(secret, secret_len, digest);
+        memcpy(key, digest, KEY_LEN);
+    }
+    if (need_free)
+    {
+        free(output);
+    }
+    mbedtls_mpi_free(&p);
+    mbedtls_mpi_free(&g);
+    mbedtls_dhm_free(&phone);
+    return ret;
+}
+
+static int run_ecdh(uint8_t curve, run_result_t *result, uint8_t key[KEY_LEN])
+{
+    mbedtls_ecp_group grp;
+    mbedtls_mpi d, z;
+    mbedtls_ecp_point q, peer;
+    uint8_t msg[2 + 65];
+    uint8_t secret[32];
+    size_t public_len = 0;
+    uint8_t *output = NULL;
+    int output_len = 0;
+    bool need_free = false;
+
+    mbedtls_ecp_group_init(&grp);
+    mbedtls_mpi_init(&d);
+    mbedtls_mpi_init(&z);
+    mbedtls_ecp_point_init(&q);
+    mbedtls_ecp_point_init(&peer);
+    int ret = mbedtls_ecp_group_load(&grp, (curve == ECDH_CURVE_X25519) ? MBEDTLS_ECP_DP_CURVE25519 :
+        MBEDTLS_ECP_DP_SECP256R1);
+    if (ret == 0)
+    {
+        ret = mbedtls_ecdh_gen_public(&grp, &d, &q, phone_rand, NULL);
+    }
+    if (ret == 0)
+    {
+        // X25519 keys are the little endian u-coordinate, P-256 keys uncompressed points
+        if (curve == ECDH_CURVE_X25519)
+        {
+            public_len = 32;
+            ret = mbedtls_mpi_write_binary_le(&q.X, &msg[2], public_len);
+        }
+        else
+        {
+            ret = mbedtls_ecp_point_write_binary(&grp, &q, MBEDTLS_ECP_PF_UNCOMPRESSED, &public_len, &msg[2],
+                sizeof(msg) - 2);
+        }
+    }
+    if (ret == 0)
+    {
+        msg[0] = SEC_TYPE_ECDH_PUBLIC;
+        msg[1] = curve;
+
+        int64_t start_us;
+        uint32_t free_before = esp_get_free_heap_size();
+        negotiate_begin(&start_us);
+        blufi_dh_negotiate_data_handler(msg, (int)public_len + 2, &output, &output_len, &need_free);
+        negotiate_end(result, start_us, free_before);
+
+        ret = (reported_error < 0 && output != NULL) ? 0 : -1;
+    }
+    if (ret == 0)
+    {
+        result->sent = output_len;
+        if (curve == ECDH_CURVE_X25519)
+        {
+            ret = mbedtls_mpi_read_binary_le(&peer.X, output, output_len);
+            if (ret == 0)
+            {
+                ret = mbedtls_mpi_lset(&peer.Z, 1);
+            }
+        }
+        else
+        {
+            ret = mbedtls_ecp_point_read_binary(&grp, &peer, output, output_len);
+        }
+    }
+    if (ret == 0)
+    {
+        ret = mbedtls_ecdh_compute_shared(&grp, &z, &peer, &d, phone_rand, NULL);
+    }
+    if (ret == 0)
+    {
+        ret = (curve == ECDH_CURVE_X25519) ? mbedtls_mpi_write_binary_le(&z, secret, sizeof(secret)) :
+            mbedtls_mpi_write_binary(&z, secret, sizeof(secret));
+    }
+    if (ret == 0)
+    {
+        uint8_t digest[32];
+        ret = mbedtls_sha256_ret(secret, sizeof(secret), digest, 0);
+        memcpy(key, digest, KEY_LEN);
+    }
+    if (need_free)
+    {
+        free(output);
+    }
+    mbedtls_ecp_point_free(&peer);
+    mbedtls_ecp_point_free(&q);
+    mbedtls_mpi_free(&z);
+    mbedtls_mpi_free(&d);
+    mbedtls_ecp_group_free(&grp);
+    return ret;
+}
+
+static int run_x25519(run_result_t *result, uint8_t key[KEY_LEN])
+{
+    return run_ecdh(ECDH_CURVE_X25519, result, key);
+}
+
+static int run_p256(run_result_t *result, uint8_t key[KEY_LEN])
+{
+    return run_ecdh(ECDH_CURVE_P256, result, key);
+}
+
+static const method_t methods[] = {
+    { "dh", "1024 bit DH, SEC_TYPE_DH_PARAM_LEN and SEC_TYPE_DH_PARAM_DATA", run_dh },
+    { "x25519", "ECDH on Curve25519, SEC_TYPE_ECDH_PUBLIC", run_x25519 },
+    { "p256", "ECDH on NIST P-256, SEC_TYPE_ECDH_PUBLIC", run_p256 },
+};
+
+#define METHOD_COUNT (sizeof(methods) / sizeof(methods[0]))
+
+/* The device encrypts a frame that the phone decrypts with its own key, and decrypts one the phone encrypted */
+static bool keys_match(const uint8_t key[KEY_LEN])
+{
+    uint8_t frame[FRAME_LEN], plain[FRAME_LEN], iv[16] = { 0 };
+    size_t iv_offset = 0;
+    mbedtls_aes_context aes;
+    bool match = false;
+
+    esp_fill_random(plain, sizeof(plain));
+    memcpy(frame, plain, sizeof(frame));
+    mbedtls_aes_init(&aes);
+    mbedtls_aes_setkey_enc(&aes, key, 128);
+    if (blufi_aes_encrypt(7, frame, sizeof(frame)) == sizeof(frame))
+    {
+        iv[0] = 7;
+        mbedtls_aes_crypt_cfb128(&aes, MBEDTLS_AES_DECRYPT, sizeof(frame), &iv_offset, iv, frame, frame);
+        match = memcmp(frame, plain, sizeof(frame)) == 0;
+    }
+    if (match)
+    {
+        memset(iv, 0, sizeof(iv));
+        iv[0] = 8;
+        iv_offset = 0;
+        mbedtls_aes_crypt_cfb128(&aes, MBEDTLS_AES_ENCRYPT, sizeof(frame), &iv_offset, iv, plain, frame);
+        match = blufi_aes_decrypt(8, frame, sizeof(frame)) == sizeof(frame) &&
+            memcmp(frame, plain, sizeof(frame)) == 0;
+    }
+    mbedtls_aes_free(&aes);
+    return match;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Returns the number of runs that failed */
+static int bench_method(const method_t *method, int runs)
+{
+    uint32_t *samples = calloc(runs, sizeof(uint32_t));
+    size_t heap_peak = 0;
+    int count = 0, failed = 0, sent = 0;
+    for (int i = 0; i < runs; i++)
+    {
+        run_result_t result = { 0 };
+        uint8_t key[KEY_LEN];
+        if (blufi_security_init() != ESP_OK)
+        {
+            failed++;
+            continue;
+        }
+        if (method->run(&result, key) != 0 || !keys_match(key))
+        {
+            failed++;
+        }
+        else
+        {
+            samples[count++] = result.cpu_us;
+            heap_peak = (result.heap_peak > heap_peak) ? result.heap_peak : heap_peak;
+            sent = result.sent;
+        }
+        blufi_security_deinit();
+    }
+    if (count == 0)
+    {
+        printf("%-7s %5d %9s %9s %10s %5s %6d  %s\n", method->name, runs, "-", "-", "-", "-", failed,
+            method->description);
+    }
+    else
+    {
+        qsort(samples, count, sizeof(uint32_t), compare_u32);
+        printf("%-7s %5d %9u %9u %10zu %5d %6d  %s\n", method->name, runs, samples[count / 2], samples[count - 1],
+            heap_peak, sent, failed, method->description);
+    }
+    free(samples);
+    return failed;
+}
+
+int main(int argc, char **argv)
+{
+    int runs = DEFAULT_RUNS;
+    bool selected[METHOD_COUNT] = { false };
+    bool any_selected = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+        {
+            runs = atoi(argv[++i]);
+            continue;
+        }
+        bool found = false;
+        for (size_t m = 0; m < METHOD_COUNT; m++)
+        {
+            if (strcmp(argv[i], methods[m].name) == 0)
+            {
+                selected[m] = true;
+                any_selected = found = true;
+            }
+        }
+        if (!found)
+        {
+            fprintf(stderr, "usage: %s [--runs N] [method ...]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (runs < 1)
+    {
+        runs = 1;
+    }
+    if (getenv("SIM_LOG_LEVEL") == NULL)
+    {
+        esp_log_level_set("*", ESP_LOG_ERROR);
+    }
+
+    printf("Device side of a BluFi key negotiation on the host CPU, %d runs per method\n", runs);
+    printf("%-7s %5s %9s %9s %10s %5s %6s\n", "method", "runs", "p50 us", "max us", "heap peak", "sent", "failed");
+    int failed = 0;
+    for (size_t m = 0; m < METHOD_COUNT; m++)
+    {
+        if (!any_selected || selected[m])
+        {
+            failed += bench_method(&methods[m], runs);
+        }
+    }
+    return (failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,104 @@
+/*
+    Host benchmark: the encryption and checksum of BluFi frames
+
+    Runs blufi_transport_benchmark, the same code a device runs with the security benchmarks
+    enabled, a number of times and keeps the best result of each operation, which takes out
+    most of the noise of a shared host. Cycles are TSC cycles of the host CPU. The CRC is
+    blufi_crc_checksum, and the ROM column is esp_crc16_be, the CRC it replaces off target.
+
+    blufi_transport_bench [--repeat N]
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_blufi_api.h"
+#include "blufi.h"
+
+#define DEFAULT_REPEAT 20
+
+/* The Bluetooth stack. The benchmark does not negotiate a key, so there is nothing to report. */
+void btc_blufi_report_error(esp_blufi_error_state_t state)
+{
+    fprintf(stderr, "BluFi error %d\n", state);
+    exit(1);
+}
+
+static void keep_best(blufi_op_bench_t *best, const blufi_op_bench_t *run)
+{
+    if (best->cycles_per_frame == 0 || run->cycles_per_frame < best->cycles_per_frame)
+    {
+        best->cycles_per_frame = run->cycles_per_frame;
+    }
+    if (run->bytes_per_sec > best->bytes_per_sec)
+    {
+        best->bytes_per_sec = run->bytes_per_sec;
+    }
+}
+
+static void print_op(const char *name, uint16_t frame_len, const blufi_op_bench_t *op)
+{
+    printf("%-8s %5u %13u %14u\n", name, frame_len, op->bytes_per_sec, op->cycles_per_frame);
+}
+
+int main(int argc, char **argv)
+{
+    int repeat = DEFAULT_REPEAT;
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 < argc && strcmp(argv[i], "--repeat") == 0)
+        {
+            repeat = atoi(argv[++i]);
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [--repeat N]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (repeat < 1)
+    {
+        repeat = 1;
+    }
+    if (getenv("SIM_LOG_LEVEL") == NULL)
+    {
+        esp_log_level_set("*", ESP_LOG_ERROR);
+    }
+
+    blufi_transport_bench_t best[BLUFI_TRANSPORT_BENCH_SIZES];
+    memset(best, 0, sizeof(best));
+    for (int run = 0; run < repeat; run++)
+    {
+        blufi_transport_bench_t results[BLUFI_TRANSPORT_BENCH_SIZES];
+        esp_err_t err = blufi_transport_benchmark(results);
+        if (err != ESP_OK)
+        {
+            fprintf(stderr, "blufi_transport_benchmark failed: %s\n", esp_err_to_name(err));
+            return 1;
+        }
+        for (int i = 0; i < BLUFI_TRANSPORT_BENCH_SIZES; i++)
+        {
+            best[i].frame_len = results[i].frame_len;
+            keep_best(&best[i].encrypt, &results[i].encrypt);
+            keep_best(&best[i].decrypt, &results[i].decrypt);
+            keep_best(&best[i].crc, &results[i].crc);
+            keep_best(&best[i].crc_rom, &results[i].crc_rom);
+        }
+    }
+
+    printf("BluFi frame operations on the host CPU, best of %d runs\n", repeat);
+    printf("%-8s %5s %13s %14s\n", "op", "bytes", "bytes/s", "cycles/frame");
+    for (int i = 0; i < BLUFI_TRANSPORT_BENCH_SIZES; i++)
+    {
+        print_op("encrypt", best[i].frame_len, &best[i].encrypt);
+        print_op("decrypt", best[i].frame_len, &best[i].decrypt);
+        print_op("crc", best[i].frame_len, &best[i].crc);
+        print_op("crc rom", best[i].frame_len, &best[i].crc_rom);
+    }
+    return 0;
+}
@@ -0,0 +1,328 @@
+/*
+    Host benchmark: reconnect latency under simulated faults
+
+    Each run boots a fresh device in its own process, with its own seed for the retry
+    jitter, applies one fault and measures the simulated time until the device is back on
+    the network. The percentiles over the runs are printed per scenario.
+
+    reconnect_bench [--runs N] [scenario ...]
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "network.h"
+#include "sim.h"
+
+#define DEFAULT_RUNS 50
+/* A run that takes longer than this counts as a failure */
+#define RUN_TIMEOUT_MS (10 * 60 * 1000)
+
+typedef struct {
+    const char *name;
+    const char *description;
+    uint32_t (*run)(void);      // Returns the latency in ms, or UINT32_MAX if the device did not come back
+} scenario_t;
+
+static const sim_ap_config_t ap_main = {
+    .ssid = "sim-net",
+    .password = "sim-pass",
+    .bssid = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 },
+    .channel = 6,
+    .rssi = -55
+};
+
+static const sim_ap_config_t ap_far = {
+    .ssid = "sim-net",
+    .password = "sim-pass",
+    .bssid = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 },
+    .channel = 11,
+    .rssi = -60
+};
+
+static bool wifi_up(void)
+{
+    return (network_connected_interfaces() & NETWORK_IF_WIFI) != 0;
+}
+
+/* Waits until check is true. Returns the ms waited since start_ms, or UINT32_MAX. */
+static uint32_t wait_for(bool (*check)(void), uint32_t start_ms)
+{
+    while (!check())
+    {
+        if (sim_elapsed_ms() - start_ms > RUN_TIMEOUT_MS)
+        {
+            return UINT32_MAX;
+        }
+        vTaskDelay(pdMS_TO_TICKS(5));
+    }
+    return sim_elapsed_ms() - start_ms;
+}
+
+static void boot_connected(void)
+{
+    ESP_ERROR_CHECK(nvs_flash_init());
+    network_setup();
+    network_waitforconnect();
+    // Let the state machine settle before the fault
+    vTaskDelay(pdMS_TO_TICKS(1000));
+}
+
+static uint32_t run_clean(void)
+{
+    sim_ap_add(&ap_main);
+    uint32_t start_ms = sim_elapsed_ms();
+    ESP_ERROR_CHECK(nvs_flash_init());
+    network_setup();
+    return wait_for(wifi_up, start_ms);
+}
+
+static uint32_t run_ap_reboot(void)
+{
+    int ap = sim_ap_add(&ap_main);
+    boot_connected();
+    const sim_step_t steps[] = {
+        { 0, SIM_STEP_AP_DOWN, ap, 0 },
+        { 30000, SIM_STEP_AP_UP, ap, 0 },
+    };
+    uint32_t start_ms = sim_elapsed_ms();
+    sim_run_script(steps, 2);
+    return wait_for(wifi_up, start_ms);
+}
+
+static bool wifi_down(void)
+{
+    return !wifi_up();
+}
+
+static uint32_t run_deauth(void)
+{
+    sim_ap_add(&ap_main);
+    boot_connected();
+    uint32_t start_ms = sim_elapsed_ms();
+    sim_wifi_kick(7);
+    wait_for(wifi_down, start_ms);
+    return wait_for(wifi_up, start_ms);
+}
+
+static uint32_t run_auth_flaky(void)
+{
+    sim_ap_add(&ap_main);
+    boot_connected();
+    uint32_t start_ms = sim_elapsed_ms();
+    sim_wifi_fail_next(3, 15);
+    sim_wifi_kick(7);
+    wait_for(wifi_down, start_ms);
+    return wait_for(wifi_up, start_ms);
+}
+
+static uint32_t run_dhcp_slow(void)
+{
+    sim_ap_add(&ap_main);
+    boot_connected();
+    uint32_t start_ms = sim_elapsed_ms();
+    sim_dhcp_set_delay(SIM_IF_WIFI, 4000);
+    sim_wifi_kick(7);
+    wait_for(wifi_down, start_ms);
+    return wait_for(wifi_up, start_ms);
+}
+
+static int roam_target;
+
+static bool roamed(void)
+{
+    return wifi_up() && sim_wifi_current_ap() == roam_target;
+}
+
+static uint32_t run_roam(void)
+{
+    int ap = sim_ap_add(&ap_main);
+    roam_target = sim_ap_add(&ap_far);
+    boot_connected();
+    uint32_t start_ms = sim_elapsed_ms();
+    sim_ap_set_rssi(ap, -82);
+    return wait_for(roamed, start_ms);
+}
+
+static bool wifi_active(void)
+{
+    return network_active_interface() == NETWORK_IF_WIFI;
+}
+
+static bool eth_active(void)
+{
+    return network_active_interface() == NETWORK_IF_ETHERNET;
+}
+
+static uint32_t run_eth_failover(void)
+{
+    sim_ap_add(&ap_main);
+    sim_eth_set_cable(true);
+    boot_connected();
+    if (wait_for(eth_active, sim_elapsed_ms()) == UINT32_MAX)
+    {
+        return UINT32_MAX;
+    }
+    uint32_t start_ms = sim_elapsed_ms();
+    sim_eth_set_cable(false);
+    return wait_for(wifi_active, start_ms);
+}
+
+static const scenario_t scenarios[] = {
+    { "clean", "boot to an IP number", run_clean },
+    { "ap_reboot", "AP off for 30 s, until back on it", run_ap_reboot },
+    { "deauth", "deauthenticated by the AP", run_deauth },
+    { "auth_flaky", "deauthenticated, then 3 failed authentications", run_auth_flaky },
+    { "dhcp_slow", "deauthenticated, DHCP answers after 4 s", run_dhcp_slow },
+    { "roam", "RSSI falls to -82 dBm, until on the other AP", run_roam },
+    { "eth_failover", "Ethernet cable pulled, until WIFI has the default route", run_eth_failover },
+};
+
+#define SCENARIO_COUNT (sizeof(scenarios) / sizeof(scenarios[0]))
+
+/* Runs one scenario in a child process and returns its latency */
+static uint32_t run_once(const scenario_t *scenario, uint32_t seed)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        perror("pipe");
+        exit(1);
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0)
+    {
+        close(fds[0]);
+        sim_init(seed);
+        if (getenv("SIM_LOG_LEVEL") == NULL)
+        {
+            esp_log_level_set("*", ESP_LOG_ERROR);
+        }
+        sim_set_time_limit(2 * RUN_TIMEOUT_MS);
+        uint32_t latency_ms = scenario->run();
+        if (write(fds[1], &latency_ms, sizeof(latency_ms)) != sizeof(latency_ms))
+        {
+            sim_exit(1);
+        }
+        sim_exit(0);
+    }
+    close(fds[1]);
+    uint32_t latency_ms = UINT32_MAX;
+    if (read(fds[0], &latency_ms, sizeof(latency_ms)) != sizeof(latency_ms))
+    {
+        latency_ms = UINT32_MAX;
+    }
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        latency_ms = UINT32_MAX;
+    }
+    return latency_ms;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t percentile(const uint32_t *sorted, int count, int p)
+{
+    int index = (count * p + 99) / 100 - 1;
+    return sorted[(index < 0) ? 0 : index];
+}
+
+/* Returns the number of runs that did not come back */
+static int bench_scenario(const scenario_t *scenario, int runs)
+{
+    uint32_t *samples = calloc(runs, sizeof(uint32_t));
+    int count = 0, failed = 0;
+    for (int i = 0; i < runs; i++)
+    {
+        uint32_t latency_ms = run_once(scenario, (uint32_t)i + 1);
+        if (latency_ms == UINT32_MAX)
+        {
+            failed++;
+        }
+        else
+        {
+            samples[count++] = latency_ms;
+        }
+    }
+    if (count == 0)
+    {
+        printf("%-13s %5d %7s %7s %7s %7s %6d  %s\n", scenario->name, runs, "-", "-", "-", "-", failed,
+            scenario->description);
+    }
+    else
+    {
+        qsort(samples, count, sizeof(uint32_t), compare_u32);
+        printf("%-13s %5d %7u %7u %7u %7u %6d  %s\n", scenario->name, runs, percentile(samples, count, 50),
+            percentile(samples, count, 90), percentile(samples, count, 99), samples[count - 1], failed,
+            scenario->description);
+    }
+    free(samples);
+    return failed;
+}
+
+int main(int argc, char **argv)
+{
+    int runs = DEFAULT_RUNS;
+    bool selected[SCENARIO_COUNT] = { false };
+    bool any_selected = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+        {
+            runs = atoi(argv[++i]);
+            continue;
+        }
+        bool found = false;
+        for (size_t s = 0; s < SCENARIO_COUNT; s++)
+        {
+            if (strcmp(argv[i], scenarios[s].name) == 0)
+            {
+                selected[s] = true;
+                any_selected = found = true;
+            }
+        }
+        if (!found)
+        {
+            fprintf(stderr, "usage: %s [--runs N] [scenario ...]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (runs < 1)
+    {
+        runs = 1;
+    }
+
+    printf("Reconnect latency in simulated ms, %d runs per scenario\n", runs);
+    printf("%-13s %5s %7s %7s %7s %7s %6s\n", "scenario", "runs", "p50", "p90", "p99", "max", "failed");
+    int failed = 0;
+    for (size_t s = 0; s < SCENARIO_COUNT; s++)
+    {
+        if (!any_selected || selected[s])
+        {
+            failed += bench_scenario(&scenarios[s], runs);
+        }
+    }
+    return (failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,290 @@
+/*
+    Host benchmark: a fleet of devices reconnecting to one AP under each retry policy
+
+    Every device loses the AP at the same moment, as when it reboots, and retries with its
+    own retry_policy_t until it gets back on. The AP is down for the outage, and after that
+    it accepts a limited number of connection attempts a second: the rest are rejected and
+    count as failed attempts. Time is a fake clock that jumps from one attempt to the next,
+    so an hour of a large fleet runs in a fraction of a second.
+
+    For each policy it prints the peak and total attempts the AP saw, the attempts it had
+    to reject, the attempts the devices made, and the mean and 99th percentile time from
+    the outage until a device was back on.
+
+    retry_fleet [--devices N] [--outage-ms MS] [--capacity PER_S] [--seed S] [--check]
+
+    --check exits with an error unless every device reconnects under every policy and
+    jitter lowers the peak load of exponential backoff.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "retry_policy.h"
+
+/* Scan, authentication and association before an attempt succeeds or fails */
+#define ATTEMPT_MS 1500
+/* Devices notice the AP is gone within one beacon timeout of each other */
+#define DETECT_SPREAD_MS 100
+#define HORIZON_MS (3600 * 1000)
+#define LOAD_BIN_MS 1000
+
+typedef struct {
+    const char *name;
+    retry_policy_config_t config;
+} fleet_policy_t;
+
+typedef struct {
+    uint32_t devices;
+    uint32_t outage_ms;
+    uint32_t capacity;      // Attempts the AP accepts each second
+    uint32_t seed;
+} fleet_config_t;
+
+typedef struct {
+    uint32_t peak_load;     // Most attempts the AP saw in one second
+    uint64_t load;          // Attempts the AP saw
+    uint64_t attempts;      // Attempts the devices made, including those while the AP was down
+    uint64_t rejected;      // Attempts turned away by the busy AP
+    uint32_t stranded;      // Devices not back on within the horizon
+    double mean_ms;
+    uint32_t p99_ms;
+} fleet_result_t;
+
+typedef struct {
+    uint32_t at_ms;
+    uint32_t device;
+} fleet_event_t;
+
+/* Min heap of pending attempts, by time */
+typedef struct {
+    fleet_event_t *events;
+    uint32_t count;
+} fleet_heap_t;
+
+static void heap_push(fleet_heap_t *heap, fleet_event_t event)
+{
+    uint32_t i = heap->count++;
+    while (i > 0)
+    {
+        uint32_t parent = (i - 1) / 2;
+        if (heap->events[parent].at_ms <= event.at_ms)
+        {
+            break;
+        }
+        heap->events[i] = heap->events[parent];
+        i = parent;
+    }
+    heap->events[i] = event;
+}
+
+static fleet_event_t heap_pop(fleet_heap_t *heap)
+{
+    fleet_event_t top = heap->events[0];
+    fleet_event_t last = heap->events[--heap->count];
+    uint32_t i = 0;
+    while (true)
+    {
+        uint32_t child = 2 * i + 1;
+        if (child >= heap->count)
+        {
+            break;
+        }
+        if (child + 1 < heap->count && heap->events[child + 1].at_ms < heap->events[child].at_ms)
+        {
+            child++;
+        }
+        if (last.at_ms <= heap->events[child].at_ms)
+        {
+            break;
+        }
+        heap->events[i] = heap->events[child];
+        i = child;
+    }
+    if (heap->count > 0)
+    {
+        heap->events[i] = last;
+    }
+    return top;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Seeds are spread over the fleet the way esp_fill_random would spread them */
+static uint32_t fleet_seed(uint32_t seed, uint32_t device)
+{
+    uint32_t x = (seed + device) * 0x9E3779B1u;
+    x ^= x >> 16;
+    x *= 0x85EBCA6Bu;
+    x ^= x >> 13;
+    return x ? x : 1;
+}
+
+static void fleet_run(const fleet_config_t *fleet, const retry_policy_config_t *config, fleet_result_t *result)
+{
+    retry_policy_t *policies = calloc(fleet->devices, sizeof(retry_policy_t));
+    uint32_t *reconnect_ms = calloc(fleet->devices, sizeof(uint32_t));
+    uint32_t *load = calloc(HORIZON_MS / LOAD_BIN_MS + 1, sizeof(uint32_t));
+    fleet_heap_t heap = { calloc(fleet->devices, sizeof(fleet_event_t)), 0 };
+    memset(result, 0, sizeof(*result));
+
+    for (uint32_t i = 0; i < fleet->devices; i++)
+    {
+        uint32_t seed = fleet_seed(fleet->seed, i);
+        retry_policy_init(&policies[i], config, seed);
+        // The disconnect is handled like any failed attempt: the first retry waits the policy's delay
+        uint32_t detect_ms = seed % (DETECT_SPREAD_MS + 1);
+        fleet_event_t event = { detect_ms + retry_policy_next_ms(&policies[i]), i };
+        heap_push(&heap, event);
+    }
+
+    uint32_t reconnected = 0;
+    while (heap.count > 0)
+    {
+        fleet_event_t event = heap_pop(&heap);
+        uint32_t now_ms = event.at_ms;
+        if (now_ms >= HORIZON_MS)
+        {
+            break;
+        }
+        result->attempts++;
+        if (now_ms >= fleet->outage_ms)
+        {
+            uint32_t *bin = &load[now_ms / LOAD_BIN_MS];
+            (*bin)++;
+            result->load++;
+            if (*bin > result->peak_load)
+            {
+                result->peak_load = *bin;
+            }
+            if (*bin <= fleet->capacity)
+            {
+                reconnect_ms[reconnected++] = now_ms + ATTEMPT_MS;
+                continue;
+            }
+            result->rejected++;
+        }
+        event.at_ms = now_ms + ATTEMPT_MS + retry_policy_next_ms(&policies[event.device]);
+        heap_push(&heap, event);
+    }
+
+    result->stranded = fleet->devices - reconnected;
+    if (reconnected > 0)
+    {
+        uint64_t total_ms = 0;
+        for (uint32_t i = 0; i < reconnected; i++)
+        {
+            total_ms += reconnect_ms[i];
+        }
+        result->mean_ms = (double)total_ms / reconnected;
+        qsort(reconnect_ms, reconnected, sizeof(uint32_t), compare_u32);
+        uint32_t index = (reconnected * 99 + 99) / 100 - 1;
+        result->p99_ms = reconnect_ms[index];
+    }
+
+    free(heap.events);
+    free(load);
+    free(reconnect_ms);
+    free(policies);
+}
+
+/* The defaults in menuconfig, and the fixed delay they replaced */
+static const fleet_policy_t policies[] = {
+    { "fixed 8 s", { .type = RETRY_POLICY_FIXED, .jitter = RETRY_JITTER_NONE, .base_ms = 8000 } },
+    { "exponential", { .type = RETRY_POLICY_EXPONENTIAL, .jitter = RETRY_JITTER_NONE, .immediate_first = true,
+        .base_ms = 500, .max_ms = 60000 } },
+    { "exp + full jitter", { .type = RETRY_POLICY_EXPONENTIAL, .jitter = RETRY_JITTER_FULL,
+        .immediate_first = true, .base_ms = 500, .max_ms = 60000 } },
+    { "exp + decorrelated", { .type = RETRY_POLICY_EXPONENTIAL, .jitter = RETRY_JITTER_DECORRELATED,
+        .immediate_first = true, .base_ms = 500, .max_ms = 60000 } },
+};
+
+#define POLICY_COUNT (sizeof(policies) / sizeof(policies[0]))
+#define POLICY_EXPONENTIAL 1
+
+int main(int argc, char **argv)
+{
+    fleet_config_t fleet = {
+        .devices = 1000,
+        .outage_ms = 30000,
+        .capacity = 50,
+        .seed = 1
+    };
+    bool check = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--check") == 0)
+        {
+            check = true;
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--devices") == 0)
+        {
+            fleet.devices = (uint32_t)strtoul(argv[++i], NULL, 0);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--outage-ms") == 0)
+        {
+            fleet.outage_ms = (uint32_t)strtoul(argv[++i], NULL, 0);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--capacity") == 0)
+        {
+            fleet.capacity = (uint32_t)strtoul(argv[++i], NULL, 0);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--seed") == 0)
+        {
+            fleet.seed = (uint32_t)strtoul(argv[++i], NULL, 0);
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [--devices N] [--outage-ms MS] [--capacity PER_S] [--seed S] [--check]\n",
+                argv[0]);
+            return 2;
+        }
+    }
+    if (fleet.devices == 0 || fleet.capacity == 0)
+    {
+        fprintf(stderr, "devices and capacity must be more than 0\n");
+        return 2;
+    }
+
+    printf("%u devices, AP down for %u ms, then accepting %u attempts/s\n", fleet.devices, fleet.outage_ms,
+        fleet.capacity);
+    printf("%-20s %9s %9s %9s %9s %9s %9s %9s\n", "policy", "peak/s", "AP load", "rejected", "attempts",
+        "mean ms", "p99 ms", "stranded");
+    fleet_result_t results[POLICY_COUNT];
+    for (size_t i = 0; i < POLICY_COUNT; i++)
+    {
+        fleet_run(&fleet, &policies[i].config, &results[i]);
+        printf("%-20s %9u %9llu %9llu %9llu %9.0f %9u %9u\n", policies[i].name, results[i].peak_load,
+            (unsigned long long)results[i].load, (unsigned long long)results[i].rejected,
+            (unsigned long long)results[i].attempts, results[i].mean_ms, results[i].p99_ms, results[i].stranded);
+    }
+
+    if (!check)
+    {
+        return 0;
+    }
+    int failed = 0;
+    for (size_t i = 0; i < POLICY_COUNT; i++)
+    {
+        if (results[i].stranded > 0)
+        {
+            fprintf(stderr, "%s: %u devices did not reconnect\n", policies[i].name, results[i].stranded);
+            failed = 1;
+        }
+        if (i > POLICY_EXPONENTIAL && results[i].peak_load >= results[POLICY_EXPONENTIAL].peak_load)
+        {
+            fprintf(stderr, "%s: peak load %u is not below exponential without jitter (%u)\n", policies[i].name,
+                results[i].peak_load, results[POLICY_EXPONENTIAL].peak_load);
+            failed = 1;
+        }
+    }
+    return failed;
+}
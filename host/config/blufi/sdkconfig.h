@@ -0,0 +1,17 @@
+/*
+    Host build: the configuration the BluFi security code is built with on the host
+
+    BluFi with its benchmarks, and the slice-by-4 CRC since the host has no CRC in ROM. Only
+    blufi_security.c is built, the rest of BluFi needs the Bluetooth stack.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#define CONFIG_IDF_TARGET_ESP32 1
+
+#define CONFIG_ESP_WIFI_ENABLED 1
+#define CONFIG_ESP_BLUFI_ENABLED 1
+#define CONFIG_ESP_BLUFI_SECURITY_BENCHMARK 1
+#define CONFIG_ESP_BLUFI_CRC_SLICE_BY_4 1
@@ -0,0 +1,85 @@
+/*
+    Host build: the configuration the component is built with on the host
+
+    Manual WIFI with two networks, fast reconnect and roaming, Ethernet on the internal MAC
+    with DHCP, the event dispatcher and fault injection. Building with
+    SIM_WIFI_IP_DHCP_CACHED switches WIFI to the cached DHCP lease, and with
+    SIM_NETWORK_HEALTH adds the health probe, pinging the gateway every 5 s.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#define CONFIG_IDF_TARGET_ESP32 1
+
+/* WIFI */
+#define CONFIG_ESP_WIFI_ENABLED 1
+#define CONFIG_ESP_MANUAL_WIFI_ENABLED 1
+#define CONFIG_ESP_WIFI_SSID "sim-net"
+#define CONFIG_ESP_WIFI_PASSWORD "sim-pass"
+#define CONFIG_ESP_WIFI_SSID2_ENABLED 1
+#define CONFIG_ESP_WIFI_SSID2 "sim-net2"
+#define CONFIG_ESP_WIFI_PASSWORD2 "sim-pass2"
+#define CONFIG_ESP_WIFI_STORE_MAX_NETWORKS 4
+#define CONFIG_ESP_WIFI_STORE_SAVE_INTERVAL 600
+#define CONFIG_ESP_WIFI_STORE_SUCCESS_WEIGHT 20
+#define CONFIG_ESP_WIFI_SCAN_MAX_RECORDS 20
+#define CONFIG_ESP_WIFI_SCAN_ACTIVE_MIN_TIME 0
+#define CONFIG_ESP_WIFI_SCAN_ACTIVE_MAX_TIME 120
+#define CONFIG_ESP_WIFI_SCAN_PASSIVE_TIME 360
+#define CONFIG_ESP_WIFI_SCAN_CACHE_TIME 10
+#define CONFIG_ESP_WIFI_RETRY_POLICY_EXPONENTIAL 1
+#define CONFIG_ESP_WIFI_RETRY_BASE_DELAY_MS 500
+#define CONFIG_ESP_WIFI_RETRY_MAX_DELAY 60
+#define CONFIG_ESP_WIFI_RETRY_IMMEDIATE_FIRST 1
+#define CONFIG_ESP_WIFI_RETRY_JITTER_FULL 1
+#define CONFIG_ESP_WIFI_FAST_RECONNECT_ENABLED 1
+#define CONFIG_ESP_WIFI_ROAM_ENABLED 1
+#define CONFIG_ESP_WIFI_ROAM_RSSI_THRESHOLD -70
+#define CONFIG_ESP_WIFI_ROAM_HYSTERESIS 8
+#define CONFIG_ESP_WIFI_ROAM_CHECK_INTERVAL 5000
+#define CONFIG_ESP_WIFI_ROAM_SCAN_CHANNELS 3
+#define CONFIG_ESP_WIFI_ROAM_SCAN_INTERVAL 30
+#define CONFIG_ESP_WIFI_POWER_BALANCED 1
+#define CONFIG_ESP_WIFI_LISTEN_INTERVAL 10
+#define CONFIG_ESP_WIFI_RECOVERY_STAGE_FAILURES 5
+#ifdef SIM_WIFI_IP_DHCP_CACHED
+#define CONFIG_ESP_WIFI_IP_DHCP_CACHED 1
+#else
+#define CONFIG_ESP_WIFI_IP_DHCP 1
+#endif
+
+/* Ethernet */
+#define CONFIG_ESP_ETHERNET_ENABLED 1
+#define CONFIG_ESP_USE_INTERNAL_ETHERNET 1
+#define CONFIG_ESP_ETH_PHY_LAN8720 1
+#define CONFIG_ESP_ETH_MDC_GPIO 23
+#define CONFIG_ESP_ETH_MDIO_GPIO 18
+#define CONFIG_ESP_ETH_PHY_RST_GPIO 5
+#define CONFIG_ESP_ETH_PHY_ADDR 0
+#define CONFIG_ESP_ETH_IP_DHCP 1
+
+/* Network */
+#define CONFIG_ESP_NETWORK_PREFER_ETHERNET 1
+#define CONFIG_ESP_NETWORK_LEASE_CACHE_TTL 3600
+#define CONFIG_ESP_NETWORK_LINK_LOCAL_RETRY_MS 5000
+#define CONFIG_ESP_NETWORK_LINK_LOCAL_RETRY_MAX 60
+#define CONFIG_ESP_NETWORK_MAX_SUBSCRIBERS 8
+#define CONFIG_ESP_NETWORK_DISPATCH_ENABLED 1
+#define CONFIG_ESP_NETWORK_DISPATCH_QUEUE_LEN 16
+#define CONFIG_ESP_NETWORK_DISPATCH_PRIORITY 5
+#define CONFIG_ESP_NETWORK_DISPATCH_CORE -1
+#define CONFIG_ESP_NETWORK_DISPATCH_STACKSIZE 4096
+#define CONFIG_ESP_NETWORK_TRACE_ENABLED 1
+#define CONFIG_ESP_NETWORK_TRACE_SAMPLES 64
+#define CONFIG_ESP_NETWORK_FAULT_INJECTION 1
+#ifdef SIM_NETWORK_HEALTH
+#define CONFIG_ESP_NETWORK_HEALTH_ENABLED 1
+#define CONFIG_ESP_NETWORK_HEALTH_PROBE_ICMP 1
+#define CONFIG_ESP_NETWORK_HEALTH_TARGET_GATEWAY 1
+#define CONFIG_ESP_NETWORK_HEALTH_INTERVAL 5
+#define CONFIG_ESP_NETWORK_HEALTH_TIMEOUT_MS 1000
+#define CONFIG_ESP_NETWORK_HEALTH_PROBE_COUNT 3
+#define CONFIG_ESP_NETWORK_HEALTH_FAIL_COUNT 2
+#endif
@@ -0,0 +1,231 @@
+/*
+    Host simulation: the Ethernet driver and its cable
+
+    The PHY reports the link up after autonegotiation when the cable is plugged in while
+    the driver runs, and down when its link check notices the cable is out. As in ESP-IDF
+    4.x, esp_eth_stop reports STOP but not the link going down.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_eth.h"
+#include "esp_timer.h"
+#include "sim_priv.h"
+
+ESP_EVENT_DEFINE_BASE(ETH_EVENT);
+
+struct esp_eth_mac_s {
+    int unused;
+};
+
+struct esp_eth_phy_s {
+    int unused;
+};
+
+typedef struct {
+    bool installed;
+    bool started;
+    bool link_up;
+    esp_timer_handle_t link_timer;
+} eth_driver_t;
+
+static struct esp_eth_mac_s mac;
+static struct esp_eth_phy_s phy;
+static eth_driver_t driver;
+static bool cable_plugged = false;
+static const uint8_t mac_addr[6] = { 0x24, 0x0a, 0xc4, 0x00, 0x00, 0x01 };
+
+static void eth_post(eth_event_t event)
+{
+    esp_eth_handle_t handle = &driver;
+    esp_event_post(ETH_EVENT, event, &handle, sizeof(handle), portMAX_DELAY);
+}
+
+bool sim_eth_carrier(void)
+{
+    return driver.started && driver.link_up && cable_plugged;
+}
+
+/* Autonegotiation finished, or the link check ran */
+static void eth_link_check(void *arg)
+{
+    if (!driver.started || driver.link_up == cable_plugged)
+    {
+        return;
+    }
+    driver.link_up = cable_plugged;
+    eth_post(cable_plugged ? ETHERNET_EVENT_CONNECTED : ETHERNET_EVENT_DISCONNECTED);
+}
+
+static void eth_schedule_link_check(void)
+{
+    esp_timer_stop(driver.link_timer);
+    if (driver.started && driver.link_up != cable_plugged)
+    {
+        uint32_t wait_ms = cable_plugged ? sim_timing.eth_link_up_ms : sim_timing.eth_link_down_ms;
+        esp_timer_start_once(driver.link_timer, wait_ms * 1000ULL);
+    }
+}
+
+void sim_eth_set_cable(bool plugged)
+{
+    cable_plugged = plugged;
+    if (driver.installed)
+    {
+        eth_schedule_link_check();
+    }
+}
+
+esp_eth_mac_t *esp_eth_mac_new_esp32(const eth_mac_config_t *config)
+{
+    return &mac;
+}
+
+esp_eth_phy_t *esp_eth_phy_new_ip101(const eth_phy_config_t *config)
+{
+    return &phy;
+}
+
+esp_eth_phy_t *esp_eth_phy_new_rtl8201(const eth_phy_config_t *config)
+{
+    return &phy;
+}
+
+esp_eth_phy_t *esp_eth_phy_new_lan8720(const eth_phy_config_t *config)
+{
+    return &phy;
+}
+
+esp_eth_phy_t *esp_eth_phy_new_dp83848(const eth_phy_config_t *config)
+{
+    return &phy;
+}
+
+esp_err_t esp_eth_driver_install(const esp_eth_config_t *config, esp_eth_handle_t *out_hdl)
+{
+    if (config == NULL || config->mac == NULL || config->phy == NULL || out_hdl == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (driver.installed)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    const esp_timer_create_args_t args = {
+        .callback = eth_link_check,
+        .name = "eth_link"
+    };
+    esp_err_t err = esp_timer_create(&args, &driver.link_timer);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    driver.installed = true;
+    *out_hdl = &driver;
+    return ESP_OK;
+}
+
+esp_err_t esp_eth_driver_uninstall(esp_eth_handle_t hdl)
+{
+    if (hdl != &driver || !driver.installed)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (driver.started)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_timer_delete(driver.link_timer);
+    memset(&driver, 0, sizeof(driver));
+    return ESP_OK;
+}
+
+esp_err_t esp_eth_start(esp_eth_handle_t hdl)
+{
+    if (hdl != &driver || !driver.installed)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (driver.started)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    driver.started = true;
+    driver.link_up = false;
+    eth_post(ETHERNET_EVENT_START);
+    eth_schedule_link_check();
+    return ESP_OK;
+}
+
+esp_err_t esp_eth_stop(esp_eth_handle_t hdl)
+{
+    if (hdl != &driver || !driver.installed)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!driver.started)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_timer_stop(driver.link_timer);
+    driver.started = false;
+    driver.link_up = false;
+    eth_post(ETHERNET_EVENT_STOP);
+    return ESP_OK;
+}
+
+esp_err_t esp_eth_ioctl(esp_eth_handle_t hdl, esp_eth_io_cmd_t cmd, void *data)
+{
+    if (hdl != &driver || data == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    switch (cmd)
+    {
+        case ETH_CMD_G_MAC_ADDR:
+            memcpy(data, mac_addr, sizeof(mac_addr));
+            return ESP_OK;
+        default:
+            return ESP_ERR_NOT_SUPPORTED;
+    }
+}
+
+void *esp_eth_new_netif_glue(esp_eth_handle_t eth_hdl)
+{
+    return eth_hdl;
+}
+
+esp_err_t esp_eth_set_default_handlers(void *esp_netif)
+{
+    if (esp_netif == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = esp_event_handler_register(ETH_EVENT, ETHERNET_EVENT_START, esp_netif_action_start, esp_netif);
+    if (err == ESP_OK)
+    {
+        err = esp_event_handler_register(ETH_EVENT, ETHERNET_EVENT_STOP, esp_netif_action_stop, esp_netif);
+    }
+    if (err == ESP_OK)
+    {
+        err = esp_event_handler_register(ETH_EVENT, ETHERNET_EVENT_CONNECTED, esp_netif_action_connected, esp_netif);
+    }
+    if (err == ESP_OK)
+    {
+        err = esp_event_handler_register(ETH_EVENT, ETHERNET_EVENT_DISCONNECTED, esp_netif_action_disconnected,
+            esp_netif);
+    }
+    return err;
+}
+
+esp_err_t esp_eth_clear_default_handlers(void *esp_netif)
+{
+    esp_event_handler_unregister(ETH_EVENT, ETHERNET_EVENT_START, esp_netif_action_start);
+    esp_event_handler_unregister(ETH_EVENT, ETHERNET_EVENT_STOP, esp_netif_action_stop);
+    esp_event_handler_unregister(ETH_EVENT, ETHERNET_EVENT_CONNECTED, esp_netif_action_connected);
+    esp_event_handler_unregister(ETH_EVENT, ETHERNET_EVENT_DISCONNECTED, esp_netif_action_disconnected);
+    return ESP_OK;
+}
@@ -0,0 +1,279 @@
+/*
+    Host simulation: the default event loop
+
+    Posting copies the event into the loop's queue, and the sys_evt task calls the handlers
+    in the order ESP-IDF does: those for any base, then those for the base and any id, then
+    those for the id, each group in the order it was registered. A handler unregistered by
+    another handler of the same event is not called.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "sim_priv.h"
+
+#define EVENT_TASK_PRIORITY 20
+#define EVENT_QUEUE_LEN 32
+#define EVENT_MAX_HANDLERS 64
+
+typedef struct {
+    bool used;
+    uint32_t generation;        // Bumped when the slot is freed, so an instance handle can not free its successor
+    uint64_t seq;
+    esp_event_base_t base;
+    int32_t id;
+    esp_event_handler_t handler;
+    void *arg;
+    bool instance;              // Registered with esp_event_handler_instance_register
+} event_handler_t;
+
+typedef struct {
+    esp_event_base_t base;
+    int32_t id;
+    void *data;                 // A copy, freed after the handlers ran
+} event_msg_t;
+
+static QueueHandle_t event_queue = NULL;
+static TaskHandle_t event_task = NULL;
+static event_handler_t handlers[EVENT_MAX_HANDLERS];
+static uint64_t handler_seq = 0;
+
+/* Group 0 is any base, 1 is the base with any id, 2 the base and id. -1 if the handler is not for the event. */
+static int event_handler_group(const event_handler_t *entry, esp_event_base_t base, int32_t id)
+{
+    if (entry->base == ESP_EVENT_ANY_BASE)
+    {
+        return 0;
+    }
+    if (entry->base != base)
+    {
+        return -1;
+    }
+    if (entry->id == ESP_EVENT_ANY_ID)
+    {
+        return 1;
+    }
+    return (entry->id == id) ? 2 : -1;
+}
+
+static void event_dispatch(const event_msg_t *msg)
+{
+    struct {
+        int slot;
+        uint32_t generation;
+    } calls[EVENT_MAX_HANDLERS];
+    int count = 0;
+    sim_lock();
+    for (int group = 0; group < 3; group++)
+    {
+        int first = count;
+        for (int i = 0; i < EVENT_MAX_HANDLERS; i++)
+        {
+            if (handlers[i].used && event_handler_group(&handlers[i], msg->base, msg->id) == group)
+            {
+                // Sorted by registration, by insertion into the group
+                int pos = count++;
+                while (pos > first && handlers[calls[pos - 1].slot].seq > handlers[i].seq)
+                {
+                    calls[pos] = calls[pos - 1];
+                    pos--;
+                }
+                calls[pos].slot = i;
+                calls[pos].generation = handlers[i].generation;
+            }
+        }
+    }
+    sim_unlock();
+    for (int i = 0; i < count; i++)
+    {
+        event_handler_t *entry = &handlers[calls[i].slot];
+        if (!entry->used || entry->generation != calls[i].generation)
+        {
+            continue;
+        }
+        entry->handler(entry->arg, msg->base, msg->id, msg->data);
+    }
+}
+
+static void event_loop_task(void *arg)
+{
+    event_msg_t msg;
+    while (true)
+    {
+        xQueueReceive(event_queue, &msg, portMAX_DELAY);
+        event_dispatch(&msg);
+        free(msg.data);
+    }
+}
+
+esp_err_t esp_event_loop_create_default(void)
+{
+    if (event_queue != NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    event_queue = xQueueCreate(EVENT_QUEUE_LEN, sizeof(event_msg_t));
+    if (event_queue == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    xTaskCreate(event_loop_task, "sys_evt", 2304, NULL, EVENT_TASK_PRIORITY, &event_task);
+    return ESP_OK;
+}
+
+esp_err_t esp_event_loop_delete_default(void)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+static esp_err_t event_register(esp_event_base_t base, int32_t id, esp_event_handler_t handler, void *arg,
+    bool instance, int *out_slot)
+{
+    if (handler == NULL || (base == ESP_EVENT_ANY_BASE && id != ESP_EVENT_ANY_ID))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (event_queue == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    sim_lock();
+    int slot = -1;
+    for (int i = 0; i < EVENT_MAX_HANDLERS; i++)
+    {
+        event_handler_t *entry = &handlers[i];
+        if (!instance && entry->used && !entry->instance && entry->base == base && entry->id == id &&
+            entry->handler == handler)
+        {
+            // As in ESP-IDF, registering the same handler again only replaces its argument
+            entry->arg = arg;
+            sim_unlock();
+            return ESP_OK;
+        }
+        if (!entry->used && slot < 0)
+        {
+            slot = i;
+        }
+    }
+    if (slot < 0)
+    {
+        sim_unlock();
+        return ESP_ERR_NO_MEM;
+    }
+    event_handler_t *entry = &handlers[slot];
+    entry->used = true;
+    entry->seq = handler_seq++;
+    entry->base = base;
+    entry->id = id;
+    entry->handler = handler;
+    entry->arg = arg;
+    entry->instance = instance;
+    sim_unlock();
+    if (out_slot != NULL)
+    {
+        *out_slot = slot;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_register(esp_event_base_t event_base, int32_t event_id,
+    esp_event_handler_t event_handler, void *event_handler_arg)
+{
+    return event_register(event_base, event_id, event_handler, event_handler_arg, false, NULL);
+}
+
+esp_err_t esp_event_handler_instance_register(esp_event_base_t event_base, int32_t event_id,
+    esp_event_handler_t event_handler, void *event_handler_arg, esp_event_handler_instance_t *instance)
+{
+    int slot;
+    esp_err_t err = event_register(event_base, event_id, event_handler, event_handler_arg, true, &slot);
+    if (err == ESP_OK && instance != NULL)
+    {
+        // Slot and generation, so a stale handle does not match a reused slot
+        *instance = (esp_event_handler_instance_t)(((uintptr_t)handlers[slot].generation << 8) | (slot + 1));
+    }
+    return err;
+}
+
+static void event_free(event_handler_t *entry)
+{
+    entry->used = false;
+    entry->generation++;
+    entry->handler = NULL;
+}
+
+esp_err_t esp_event_handler_unregister(esp_event_base_t event_base, int32_t event_id,
+    esp_event_handler_t event_handler)
+{
+    sim_lock();
+    for (int i = 0; i < EVENT_MAX_HANDLERS; i++)
+    {
+        event_handler_t *entry = &handlers[i];
+        if (entry->used && !entry->instance && entry->base == event_base && entry->id == event_id &&
+            entry->handler == event_handler)
+        {
+            event_free(entry);
+            break;
+        }
+    }
+    sim_unlock();
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_instance_unregister(esp_event_base_t event_base, int32_t event_id,
+    esp_event_handler_instance_t instance)
+{
+    uintptr_t handle = (uintptr_t)instance;
+    int slot = (int)(handle & 0xff) - 1;
+    uint32_t generation = (uint32_t)(handle >> 8);
+    if (slot < 0 || slot >= EVENT_MAX_HANDLERS)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sim_lock();
+    event_handler_t *entry = &handlers[slot];
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    if (entry->used && entry->instance && entry->generation == generation && entry->base == event_base &&
+        entry->id == event_id)
+    {
+        event_free(entry);
+        err = ESP_OK;
+    }
+    sim_unlock();
+    return err;
+}
+
+esp_err_t esp_event_post(esp_event_base_t event_base, int32_t event_id, const void *event_data,
+    size_t event_data_size, TickType_t ticks_to_wait)
+{
+    if (event_queue == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    event_msg_t msg = {
+        .base = event_base,
+        .id = event_id,
+        .data = NULL
+    };
+    if (event_data != NULL && event_data_size > 0)
+    {
+        msg.data = malloc(event_data_size);
+        if (msg.data == NULL)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+        memcpy(msg.data, event_data, event_data_size);
+    }
+    if (xQueueSend(event_queue, &msg, ticks_to_wait) != pdTRUE)
+    {
+        free(msg.data);
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
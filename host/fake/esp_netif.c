@@ -0,0 +1,724 @@
+/*
+    Host simulation: esp_netif, the parts of lwIP under it, and the DHCP servers
+
+    Follows the ESP-IDF 4.4 esp_netif on lwIP. The address lives in the lwIP netif while it
+    is up, and esp_netif keeps the last address DHCP or esp_netif_set_ip_info gave it. DHCP
+    reports an address when the lwIP netif has one that differs from that copy, as
+    esp_netif's DHCP callback does. The DNS servers are global, as in lwIP.
+
+    A DHCP run asks the server of its interface, which answers after its delay. Without a
+    server the request is sent again at 2 s, doubling up to dhcp_retry_ms, and AutoIP gives
+    the netif a link-local address autoip_ms after the run started.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_netif.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "lwip/netif.h"
+#include "lwip/tcpip.h"
+#include "lwip/inet_chksum.h"
+#include "sim_priv.h"
+
+#define TCPIP_TASK_PRIORITY 18
+#define TCPIP_QUEUE_LEN 32
+#define DHCP_FIRST_RETRY_MS 2000
+
+static const char *TAG = "esp_netif";
+
+ESP_EVENT_DEFINE_BASE(IP_EVENT);
+
+const esp_netif_inherent_config_t _g_esp_netif_inherent_sta_config = {
+    .flags = ESP_NETIF_DHCP_CLIENT,
+    .if_key = "WIFI_STA_DEF",
+    .if_desc = "sta",
+    .route_prio = 100,
+    .get_ip_event = IP_EVENT_STA_GOT_IP,
+    .lost_ip_event = IP_EVENT_STA_LOST_IP,
+};
+
+const esp_netif_inherent_config_t _g_esp_netif_inherent_eth_config = {
+    .flags = ESP_NETIF_DHCP_CLIENT,
+    .if_key = "ETH_DEF",
+    .if_desc = "eth",
+    .route_prio = 50,
+    .get_ip_event = IP_EVENT_ETH_GOT_IP,
+    .lost_ip_event = 0,
+};
+
+struct esp_netif_obj {
+    struct netif lwip_netif;
+    esp_netif_inherent_config_t base;
+    sim_if_t sim_if;
+    void *driver;
+    esp_netif_ip_info_t ip_info;
+    esp_netif_ip_info_t ip_info_old;
+    esp_netif_dhcp_status_t dhcpc_status;
+    // DHCP client run
+    esp_timer_handle_t dhcp_timer;
+    bool dhcp_running;
+    bool dhcp_supplied;         // The address on the lwIP netif came from DHCP or AutoIP
+    bool autoip;
+    int64_t dhcp_start_us;
+    uint32_t dhcp_retry_ms;
+    struct esp_netif_obj *next;
+};
+
+typedef struct {
+    bool up;
+    uint32_t delay_ms;
+    esp_netif_ip_info_t lease;
+    esp_ip4_addr_t dns;
+    uint32_t requests;
+} dhcp_server_t;
+
+static dhcp_server_t dhcp_servers[SIM_IF_MAX] = {
+    [SIM_IF_WIFI] = {
+        .up = true,
+        .delay_ms = 200,
+        .lease = {
+            .ip.addr = ESP_IP4TOADDR(192, 168, 1, 100),
+            .netmask.addr = ESP_IP4TOADDR(255, 255, 255, 0),
+            .gw.addr = ESP_IP4TOADDR(192, 168, 1, 1),
+        },
+        .dns.addr = ESP_IP4TOADDR(192, 168, 1, 1),
+    },
+    [SIM_IF_ETH] = {
+        .up = true,
+        .delay_ms = 200,
+        .lease = {
+            .ip.addr = ESP_IP4TOADDR(10, 0, 0, 100),
+            .netmask.addr = ESP_IP4TOADDR(255, 255, 255, 0),
+            .gw.addr = ESP_IP4TOADDR(10, 0, 0, 1),
+        },
+        .dns.addr = ESP_IP4TOADDR(10, 0, 0, 1),
+    },
+};
+
+typedef struct {
+    tcpip_callback_fn function;
+    void *ctx;
+} tcpip_msg_t;
+
+static QueueHandle_t tcpip_queue = NULL;
+static esp_netif_t *netifs = NULL;
+static esp_netif_t *default_netif = NULL;
+static esp_netif_t *last_default_netif = NULL;
+static esp_ip4_addr_t dns_servers[ESP_NETIF_DNS_MAX];
+static uint8_t netif_num = 0;
+
+/* lwIP */
+
+static void tcpip_thread(void *arg)
+{
+    tcpip_msg_t msg;
+    while (true)
+    {
+        xQueueReceive(tcpip_queue, &msg, portMAX_DELAY);
+        msg.function(msg.ctx);
+    }
+}
+
+err_t tcpip_callback(tcpip_callback_fn function, void *ctx)
+{
+    tcpip_msg_t msg = {
+        .function = function,
+        .ctx = ctx
+    };
+    if (tcpip_queue == NULL)
+    {
+        return ERR_VAL;
+    }
+    return (xQueueSend(tcpip_queue, &msg, portMAX_DELAY) == pdTRUE) ? ERR_OK : ERR_MEM;
+}
+
+void netif_set_addr(struct netif *netif, const ip4_addr_t *ipaddr, const ip4_addr_t *netmask, const ip4_addr_t *gw)
+{
+    netif->ip_addr = *ipaddr;
+    netif->netmask = *netmask;
+    netif->gw = *gw;
+}
+
+static void netif_clear_addr(struct netif *netif)
+{
+    const ip4_addr_t any = { 0 };
+    netif_set_addr(netif, &any, &any, &any);
+}
+
+uint16_t inet_chksum(const void *dataptr, uint16_t len)
+{
+    const uint8_t *data = dataptr;
+    uint32_t sum = 0;
+    for (uint16_t i = 0; i + 1 < len; i += 2)
+    {
+        sum += (uint32_t)((data[i] << 8) | data[i + 1]);
+    }
+    if (len & 1)
+    {
+        sum += (uint32_t)(data[len - 1] << 8);
+    }
+    while (sum >> 16)
+    {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return htons((uint16_t)~sum);
+}
+
+/* DHCP and the servers */
+
+static bool ip_info_equal(const esp_netif_ip_info_t *a, const esp_netif_ip_info_t *b)
+{
+    return a->ip.addr == b->ip.addr && a->netmask.addr == b->netmask.addr && a->gw.addr == b->gw.addr;
+}
+
+static void netif_post_got_ip(esp_netif_t *esp_netif, const esp_netif_ip_info_t *ip_info)
+{
+    ip_event_got_ip_t event = {
+        .if_index = -1,
+        .esp_netif = esp_netif,
+        .ip_info = *ip_info,
+        .ip_changed = !ip_info_equal(ip_info, &esp_netif->ip_info_old),
+    };
+    esp_netif->ip_info_old = *ip_info;
+    if (esp_event_post(IP_EVENT, esp_netif->base.get_ip_event, &event, sizeof(event), 0) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Unable to post GOT_IP");
+    }
+}
+
+/* esp_netif's DHCP callback: reports the address on the lwIP netif if it is new */
+static void netif_dhcpc_cb(esp_netif_t *esp_netif)
+{
+    struct netif *lwip_netif = &esp_netif->lwip_netif;
+    if (lwip_netif->ip_addr.addr == 0)
+    {
+        return;
+    }
+    esp_netif_ip_info_t ip_info = {
+        .ip.addr = lwip_netif->ip_addr.addr,
+        .netmask.addr = lwip_netif->netmask.addr,
+        .gw.addr = lwip_netif->gw.addr,
+    };
+    if (ip_info_equal(&ip_info, &esp_netif->ip_info))
+    {
+        return;
+    }
+    esp_netif->ip_info = ip_info;
+    netif_post_got_ip(esp_netif, &ip_info);
+}
+
+static void dhcp_request(esp_netif_t *esp_netif)
+{
+    dhcp_server_t *server = &dhcp_servers[esp_netif->sim_if];
+    server->requests++;
+    uint32_t wait_ms;
+    if (server->up)
+    {
+        wait_ms = server->delay_ms;
+    }
+    else
+    {
+        wait_ms = esp_netif->dhcp_retry_ms;
+        esp_netif->dhcp_retry_ms *= 2;
+        if (esp_netif->dhcp_retry_ms > sim_timing.dhcp_retry_ms)
+        {
+            esp_netif->dhcp_retry_ms = sim_timing.dhcp_retry_ms;
+        }
+        if (!esp_netif->autoip)
+        {
+            // AutoIP runs alongside
+            int64_t autoip_us = esp_netif->dhcp_start_us + sim_timing.autoip_ms * 1000LL;
+            int64_t wait_us = autoip_us - sim_now_us();
+            if (wait_us < (int64_t)wait_ms * 1000)
+            {
+                wait_ms = (wait_us > 0) ? (uint32_t)(wait_us / 1000) : 0;
+            }
+        }
+    }
+    esp_timer_start_once(esp_netif->dhcp_timer, (uint64_t)wait_ms * 1000);
+}
+
+/* Runs on the esp_timer task when the server answers, or a request goes unanswered */
+static void dhcp_timeout(void *arg)
+{
+    esp_netif_t *esp_netif = (esp_netif_t *)arg;
+    struct netif *lwip_netif = &esp_netif->lwip_netif;
+    dhcp_server_t *server = &dhcp_servers[esp_netif->sim_if];
+    if (!esp_netif->dhcp_running)
+    {
+        return;
+    }
+    if (server->up)
+    {
+        ip4_addr_t addr = { .addr = server->lease.ip.addr };
+        ip4_addr_t netmask = { .addr = server->lease.netmask.addr };
+        ip4_addr_t gw = { .addr = server->lease.gw.addr };
+        netif_set_addr(lwip_netif, &addr, &netmask, &gw);
+        dns_servers[ESP_NETIF_DNS_MAIN] = server->dns;
+        esp_netif->dhcp_supplied = true;
+        esp_netif->autoip = false;
+        esp_netif->dhcp_running = false;
+        ESP_LOGD(TAG, "%s bound " IPSTR, esp_netif->base.if_desc, IP2STR(&server->lease.ip));
+        netif_dhcpc_cb(esp_netif);
+        return;
+    }
+    if (!esp_netif->autoip && sim_now_us() >= esp_netif->dhcp_start_us + sim_timing.autoip_ms * 1000LL)
+    {
+        ip4_addr_t addr = { .addr = ESP_IP4TOADDR(169, 254, 1, 10 + esp_netif->sim_if) };
+        ip4_addr_t netmask = { .addr = ESP_IP4TOADDR(255, 255, 0, 0) };
+        ip4_addr_t gw = { 0 };
+        netif_set_addr(lwip_netif, &addr, &netmask, &gw);
+        esp_netif->dhcp_supplied = true;
+        esp_netif->autoip = true;
+        netif_dhcpc_cb(esp_netif);
+    }
+    dhcp_request(esp_netif);
+}
+
+static void dhcp_start(esp_netif_t *esp_netif)
+{
+    esp_timer_stop(esp_netif->dhcp_timer);
+    esp_netif->dhcp_running = true;
+    esp_netif->autoip = false;
+    esp_netif->dhcp_start_us = sim_now_us();
+    esp_netif->dhcp_retry_ms = DHCP_FIRST_RETRY_MS;
+    dhcp_request(esp_netif);
+}
+
+/* lwIP dhcp_stop: the address goes if DHCP or AutoIP gave it */
+static void dhcp_stop(esp_netif_t *esp_netif)
+{
+    esp_timer_stop(esp_netif->dhcp_timer);
+    esp_netif->dhcp_running = false;
+    esp_netif->autoip = false;
+    if (esp_netif->dhcp_supplied)
+    {
+        netif_clear_addr(&esp_netif->lwip_netif);
+        esp_netif->dhcp_supplied = false;
+    }
+}
+
+void sim_dhcp_set_delay(sim_if_t iface, uint32_t delay_ms)
+{
+    dhcp_servers[iface].delay_ms = delay_ms;
+}
+
+void sim_dhcp_set_server(sim_if_t iface, bool up)
+{
+    dhcp_servers[iface].up = up;
+}
+
+void sim_dhcp_set_lease(sim_if_t iface, const char *ip, const char *gw)
+{
+    dhcp_server_t *server = &dhcp_servers[iface];
+    server->lease.ip.addr = esp_ip4addr_aton(ip);
+    server->lease.gw.addr = esp_ip4addr_aton(gw);
+    server->lease.netmask.addr = ESP_IP4TOADDR(255, 255, 255, 0);
+    server->dns = server->lease.gw;
+}
+
+uint32_t sim_dhcp_requests(sim_if_t iface)
+{
+    return dhcp_servers[iface].requests;
+}
+
+/* esp_netif */
+
+uint32_t esp_ip4addr_aton(const char *addr)
+{
+    struct in_addr in;
+    return (addr != NULL && inet_aton(addr, &in)) ? in.s_addr : 0;
+}
+
+esp_err_t esp_netif_init(void)
+{
+    if (tcpip_queue != NULL)
+    {
+        return ESP_OK;
+    }
+    tcpip_queue = xQueueCreate(TCPIP_QUEUE_LEN, sizeof(tcpip_msg_t));
+    xTaskCreate(tcpip_thread, "tiT", 3072, NULL, TCPIP_TASK_PRIORITY, NULL);
+    return ESP_OK;
+}
+
+esp_netif_t *esp_netif_new(const esp_netif_config_t *esp_netif_config)
+{
+    if (esp_netif_config == NULL || esp_netif_config->base == NULL)
+    {
+        return NULL;
+    }
+    esp_netif_t *esp_netif = calloc(1, sizeof(esp_netif_t));
+    if (esp_netif == NULL)
+    {
+        return NULL;
+    }
+    esp_netif->base = *esp_netif_config->base;
+    bool eth = strcmp(esp_netif->base.if_key, "ETH_DEF") == 0;
+    esp_netif->sim_if = eth ? SIM_IF_ETH : SIM_IF_WIFI;
+    esp_netif->lwip_netif.name[0] = eth ? 'e' : 's';
+    esp_netif->lwip_netif.name[1] = eth ? 'n' : 't';
+    esp_netif->lwip_netif.state = esp_netif;
+    esp_netif->dhcpc_status = ESP_NETIF_DHCP_INIT;
+    const esp_timer_create_args_t args = {
+        .callback = dhcp_timeout,
+        .arg = esp_netif,
+        .name = "dhcp"
+    };
+    if (esp_timer_create(&args, &esp_netif->dhcp_timer) != ESP_OK)
+    {
+        free(esp_netif);
+        return NULL;
+    }
+    esp_netif->next = netifs;
+    netifs = esp_netif;
+    netif_num++;
+    return esp_netif;
+}
+
+static void netif_update_default(esp_netif_t *esp_netif, bool started);
+
+void esp_netif_destroy(esp_netif_t *esp_netif)
+{
+    if (esp_netif == NULL)
+    {
+        return;
+    }
+    dhcp_stop(esp_netif);
+    esp_timer_delete(esp_netif->dhcp_timer);
+    for (esp_netif_t **link = &netifs; *link != NULL; link = &(*link)->next)
+    {
+        if (*link == esp_netif)
+        {
+            *link = esp_netif->next;
+            break;
+        }
+    }
+    if (last_default_netif == esp_netif)
+    {
+        last_default_netif = NULL;
+    }
+    if (default_netif == esp_netif)
+    {
+        default_netif = NULL;
+        netif_update_default(NULL, false);
+    }
+    free(esp_netif);
+}
+
+esp_err_t esp_netif_attach(esp_netif_t *esp_netif, void *driver_handle)
+{
+    if (esp_netif == NULL)
+    {
+        return ESP_ERR_ESP_NETIF_INVALID_PARAMS;
+    }
+    esp_netif->driver = driver_handle;
+    return ESP_OK;
+}
+
+bool esp_netif_is_netif_up(esp_netif_t *esp_netif)
+{
+    return esp_netif != NULL && (esp_netif->lwip_netif.flags & NETIF_FLAG_UP) != 0;
+}
+
+/* esp_netif_update_default_netif: a started netif takes over unless the default has a higher priority, a
+ * stopped one hands over to the highest priority netif that is up */
+static void netif_update_default(esp_netif_t *esp_netif, bool started)
+{
+    if (started)
+    {
+        if (last_default_netif != NULL && esp_netif_is_netif_up(last_default_netif) &&
+            last_default_netif->base.route_prio > esp_netif->base.route_prio)
+        {
+            default_netif = last_default_netif;
+        }
+        else if (esp_netif_is_netif_up(esp_netif))
+        {
+            last_default_netif = esp_netif;
+            default_netif = esp_netif;
+        }
+        return;
+    }
+    last_default_netif = NULL;
+    for (esp_netif_t *netif = netifs; netif != NULL; netif = netif->next)
+    {
+        if (esp_netif_is_netif_up(netif) && (last_default_netif == NULL ||
+            netif->base.route_prio > last_default_netif->base.route_prio))
+        {
+            last_default_netif = netif;
+        }
+    }
+    if (last_default_netif != NULL)
+    {
+        default_netif = last_default_netif;
+    }
+}
+
+esp_err_t esp_netif_set_default_netif(esp_netif_t *esp_netif)
+{
+    if (esp_netif == NULL)
+    {
+        return ESP_ERR_ESP_NETIF_INVALID_PARAMS;
+    }
+    last_default_netif = esp_netif;
+    default_netif = esp_netif;
+    return ESP_OK;
+}
+
+esp_netif_t *esp_netif_get_default_netif(void)
+{
+    return default_netif;
+}
+
+esp_netif_t *esp_netif_get_handle_from_ifkey(const char *if_key)
+{
+    for (esp_netif_t *esp_netif = netifs; esp_netif != NULL; esp_netif = esp_netif->next)
+    {
+        if (strcmp(esp_netif->base.if_key, if_key) == 0)
+        {
+            return esp_netif;
+        }
+    }
+    return NULL;
+}
+
+esp_err_t esp_netif_get_ip_info(esp_netif_t *esp_netif, esp_netif_ip_info_t *ip_info)
+{
+    if (esp_netif == NULL || ip_info == NULL)
+    {
+        return ESP_ERR_ESP_NETIF_INVALID_PARAMS;
+    }
+    if (esp_netif_is_netif_up(esp_netif))
+    {
+        ip_info->ip.addr = esp_netif->lwip_netif.ip_addr.addr;
+        ip_info->netmask.addr = esp_netif->lwip_netif.netmask.addr;
+        ip_info->gw.addr = esp_netif->lwip_netif.gw.addr;
+        return ESP_OK;
+    }
+    *ip_info = esp_netif->ip_info;
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_set_ip_info(esp_netif_t *esp_netif, const esp_netif_ip_info_t *ip_info)
+{
+    if (esp_netif == NULL || ip_info == NULL)
+    {
+        return ESP_ERR_ESP_NETIF_INVALID_PARAMS;
+    }
+    if ((esp_netif->base.flags & ESP_NETIF_DHCP_CLIENT) && esp_netif->dhcpc_status != ESP_NETIF_DHCP_STOPPED)
+    {
+        return ESP_ERR_ESP_NETIF_DHCP_NOT_STOPPED;
+    }
+    esp_netif->ip_info = *ip_info;
+    ip4_addr_t addr = { .addr = ip_info->ip.addr };
+    ip4_addr_t netmask = { .addr = ip_info->netmask.addr };
+    ip4_addr_t gw = { .addr = ip_info->gw.addr };
+    netif_set_addr(&esp_netif->lwip_netif, &addr, &netmask, &gw);
+    esp_netif->dhcp_supplied = false;
+    if (ip_info->ip.addr != 0 && ip_info->netmask.addr != 0 && ip_info->gw.addr != 0)
+    {
+        netif_post_got_ip(esp_netif, ip_info);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_set_dns_info(esp_netif_t *esp_netif, esp_netif_dns_type_t type, esp_netif_dns_info_t *dns)
+{
+    if (esp_netif == NULL || dns == NULL || type >= ESP_NETIF_DNS_MAX)
+    {
+        return ESP_ERR_ESP_NETIF_INVALID_PARAMS;
+    }
+    dns_servers[type] = dns->ip.u_addr.ip4;
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_get_dns_info(esp_netif_t *esp_netif, esp_netif_dns_type_t type, esp_netif_dns_info_t *dns)
+{
+    if (esp_netif == NULL || dns == NULL || type >= ESP_NETIF_DNS_MAX)
+    {
+        return ESP_ERR_ESP_NETIF_INVALID_PARAMS;
+    }
+    memset(dns, 0, sizeof(esp_netif_dns_info_t));
+    dns->ip.type = ESP_IPADDR_TYPE_V4;
+    dns->ip.u_addr.ip4 = dns_servers[type];
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_dhcpc_start(esp_netif_t *esp_netif)
+{
+    if (esp_netif == NULL || !(esp_netif->base.flags & ESP_NETIF_DHCP_CLIENT))
+    {
+        return ESP_ERR_ESP_NETIF_INVALID_PARAMS;
+    }
+    if (esp_netif->dhcpc_status == ESP_NETIF_DHCP_STARTED)
+    {
+        return ESP_ERR_ESP_NETIF_DHCP_ALREADY_STARTED;
+    }
+    memset(&esp_netif->ip_info, 0, sizeof(esp_netif_ip_info_t));
+    memset(dns_servers, 0, sizeof(dns_servers));
+    if (!esp_netif_is_netif_up(esp_netif))
+    {
+        esp_netif->dhcpc_status = ESP_NETIF_DHCP_INIT;
+        return ESP_OK;
+    }
+    netif_clear_addr(&esp_netif->lwip_netif);
+    esp_netif->dhcp_supplied = false;
+    dhcp_start(esp_netif);
+    esp_netif->dhcpc_status = ESP_NETIF_DHCP_STARTED;
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_dhcpc_stop(esp_netif_t *esp_netif)
+{
+    if (esp_netif == NULL || !(esp_netif->base.flags & ESP_NETIF_DHCP_CLIENT))
+    {
+        return ESP_ERR_ESP_NETIF_INVALID_PARAMS;
+    }
+    if (esp_netif->dhcpc_status == ESP_NETIF_DHCP_STARTED)
+    {
+        dhcp_stop(esp_netif);
+        memset(&esp_netif->ip_info, 0, sizeof(esp_netif_ip_info_t));
+    }
+    else if (esp_netif->dhcpc_status == ESP_NETIF_DHCP_STOPPED)
+    {
+        return ESP_ERR_ESP_NETIF_DHCP_ALREADY_STOPPED;
+    }
+    esp_netif->dhcpc_status = ESP_NETIF_DHCP_STOPPED;
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_dhcpc_get_status(esp_netif_t *esp_netif, esp_netif_dhcp_status_t *status)
+{
+    if (esp_netif == NULL || status == NULL)
+    {
+        return ESP_ERR_ESP_NETIF_INVALID_PARAMS;
+    }
+    *status = esp_netif->dhcpc_status;
+    return ESP_OK;
+}
+
+void *esp_netif_get_netif_impl(esp_netif_t *esp_netif)
+{
+    return (esp_netif != NULL) ? &esp_netif->lwip_netif : NULL;
+}
+
+esp_err_t esp_netif_get_netif_impl_name(esp_netif_t *esp_netif, char *name)
+{
+    if (esp_netif == NULL || name == NULL)
+    {
+        return ESP_ERR_ESP_NETIF_INVALID_PARAMS;
+    }
+    name[0] = esp_netif->lwip_netif.name[0];
+    name[1] = esp_netif->lwip_netif.name[1];
+    name[2] = '1';
+    name[3] = '\0';
+    return ESP_OK;
+}
+
+bool sim_netif_route(const char *impl_name, sim_if_t *iface)
+{
+    for (esp_netif_t *esp_netif = netifs; esp_netif != NULL; esp_netif = esp_netif->next)
+    {
+        char name[4];
+        esp_netif_get_netif_impl_name(esp_netif, name);
+        if (strcmp(name, impl_name) == 0)
+        {
+            *iface = esp_netif->sim_if;
+            return esp_netif_is_netif_up(esp_netif) && esp_netif->lwip_netif.ip_addr.addr != 0;
+        }
+    }
+    return false;
+}
+
+int32_t esp_netif_get_event_id(esp_netif_t *esp_netif, esp_netif_ip_event_type_t event_type)
+{
+    if (esp_netif == NULL)
+    {
+        return -1;
+    }
+    return (event_type == ESP_NETIF_IP_EVENT_GOT_IP) ? esp_netif->base.get_ip_event : esp_netif->base.lost_ip_event;
+}
+
+/* The default handlers, registered by the WIFI and Ethernet glue */
+
+void esp_netif_action_start(void *esp_netif, esp_event_base_t base, int32_t event_id, void *data)
+{
+    ESP_LOGD(TAG, "start %s", ((esp_netif_t *)esp_netif)->base.if_desc);
+}
+
+/* esp_netif_up: the address esp_netif kept goes back on the lwIP netif, and the link comes up */
+static void netif_up(esp_netif_t *esp_netif)
+{
+    ip4_addr_t addr = { .addr = esp_netif->ip_info.ip.addr };
+    ip4_addr_t netmask = { .addr = esp_netif->ip_info.netmask.addr };
+    ip4_addr_t gw = { .addr = esp_netif->ip_info.gw.addr };
+    netif_set_addr(&esp_netif->lwip_netif, &addr, &netmask, &gw);
+    esp_netif->lwip_netif.flags |= NETIF_FLAG_UP | NETIF_FLAG_LINK_UP;
+    netif_update_default(esp_netif, true);
+}
+
+/* esp_netif_down */
+static void netif_down(esp_netif_t *esp_netif)
+{
+    if (esp_netif->dhcpc_status == ESP_NETIF_DHCP_STARTED)
+    {
+        dhcp_stop(esp_netif);
+        esp_netif->dhcpc_status = ESP_NETIF_DHCP_INIT;
+        memset(&esp_netif->ip_info, 0, sizeof(esp_netif_ip_info_t));
+    }
+    netif_clear_addr(&esp_netif->lwip_netif);
+    esp_netif->dhcp_supplied = false;
+    esp_netif->lwip_netif.flags &= ~(NETIF_FLAG_UP | NETIF_FLAG_LINK_UP);
+    netif_update_default(esp_netif, false);
+}
+
+void esp_netif_action_stop(void *esp_netif, esp_event_base_t base, int32_t event_id, void *data)
+{
+    esp_netif_t *netif = (esp_netif_t *)esp_netif;
+    dhcp_stop(netif);
+    netif->dhcpc_status = ESP_NETIF_DHCP_INIT;
+    memset(&netif->ip_info, 0, sizeof(esp_netif_ip_info_t));
+    netif_down(netif);
+}
+
+void esp_netif_action_connected(void *esp_netif, esp_event_base_t base, int32_t event_id, void *data)
+{
+    esp_netif_t *netif = (esp_netif_t *)esp_netif;
+    bool was_up = esp_netif_is_netif_up(netif);
+    netif_up(netif);
+    switch (netif->dhcpc_status)
+    {
+        case ESP_NETIF_DHCP_INIT:
+            esp_netif_dhcpc_start(netif);
+            break;
+        case ESP_NETIF_DHCP_STARTED:
+            // lwIP restarts DHCP when the link comes up
+            if (!was_up || !netif->dhcp_running)
+            {
+                dhcp_start(netif);
+            }
+            break;
+        case ESP_NETIF_DHCP_STOPPED: {
+            esp_netif_ip_info_t ip_info;
+            esp_netif_get_ip_info(netif, &ip_info);
+            if (ip_info.ip.addr != 0 && ip_info.netmask.addr != 0 && ip_info.gw.addr != 0)
+            {
+                netif_post_got_ip(netif, &ip_info);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void esp_netif_action_disconnected(void *esp_netif, esp_event_base_t base, int32_t event_id, void *data)
+{
+    netif_down((esp_netif_t *)esp_netif);
+}
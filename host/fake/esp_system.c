@@ -0,0 +1,286 @@
+/*
+    Host build: error names, logging, random numbers, restart and the ROM CRC routines
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_crc.h"
+#include "sim_priv.h"
+
+#define LOG_MAX_TAGS 32
+
+typedef struct {
+    esp_err_t code;
+    const char *name;
+} err_name_t;
+
+#define ERR_NAME(code) { code, #code }
+
+static const err_name_t err_names[] = {
+    ERR_NAME(ESP_OK),
+    ERR_NAME(ESP_FAIL),
+    ERR_NAME(ESP_ERR_NO_MEM),
+    ERR_NAME(ESP_ERR_INVALID_ARG),
+    ERR_NAME(ESP_ERR_INVALID_STATE),
+    ERR_NAME(ESP_ERR_INVALID_SIZE),
+    ERR_NAME(ESP_ERR_NOT_FOUND),
+    ERR_NAME(ESP_ERR_NOT_SUPPORTED),
+    ERR_NAME(ESP_ERR_TIMEOUT),
+    ERR_NAME(ESP_ERR_INVALID_RESPONSE),
+    ERR_NAME(ESP_ERR_INVALID_CRC),
+    ERR_NAME(ESP_ERR_INVALID_VERSION),
+    ERR_NAME(ESP_ERR_INVALID_MAC),
+    ERR_NAME(ESP_ERR_NVS_NOT_INITIALIZED),
+    ERR_NAME(ESP_ERR_NVS_NOT_FOUND),
+    ERR_NAME(ESP_ERR_NVS_TYPE_MISMATCH),
+    ERR_NAME(ESP_ERR_NVS_READ_ONLY),
+    ERR_NAME(ESP_ERR_NVS_NOT_ENOUGH_SPACE),
+    ERR_NAME(ESP_ERR_NVS_INVALID_NAME),
+    ERR_NAME(ESP_ERR_NVS_INVALID_HANDLE),
+    ERR_NAME(ESP_ERR_NVS_KEY_TOO_LONG),
+    ERR_NAME(ESP_ERR_NVS_INVALID_LENGTH),
+    ERR_NAME(ESP_ERR_NVS_NO_FREE_PAGES),
+    ERR_NAME(ESP_ERR_NVS_NEW_VERSION_FOUND),
+    ERR_NAME(ESP_ERR_WIFI_NOT_INIT),
+    ERR_NAME(ESP_ERR_WIFI_NOT_STARTED),
+    ERR_NAME(ESP_ERR_WIFI_NOT_STOPPED),
+    ERR_NAME(ESP_ERR_WIFI_IF),
+    ERR_NAME(ESP_ERR_WIFI_MODE),
+    ERR_NAME(ESP_ERR_WIFI_STATE),
+    ERR_NAME(ESP_ERR_WIFI_CONN),
+    ERR_NAME(ESP_ERR_WIFI_SSID),
+    ERR_NAME(ESP_ERR_WIFI_PASSWORD),
+    ERR_NAME(ESP_ERR_WIFI_TIMEOUT),
+    ERR_NAME(ESP_ERR_WIFI_NOT_CONNECT),
+    ERR_NAME(ESP_ERR_ESP_NETIF_INVALID_PARAMS),
+    ERR_NAME(ESP_ERR_ESP_NETIF_IF_NOT_READY),
+    ERR_NAME(ESP_ERR_ESP_NETIF_DHCPC_START_FAILED),
+    ERR_NAME(ESP_ERR_ESP_NETIF_DHCP_ALREADY_STARTED),
+    ERR_NAME(ESP_ERR_ESP_NETIF_DHCP_ALREADY_STOPPED),
+    ERR_NAME(ESP_ERR_ESP_NETIF_NO_MEM),
+    ERR_NAME(ESP_ERR_ESP_NETIF_DHCP_NOT_STOPPED),
+};
+
+typedef struct {
+    const char *tag;
+    esp_log_level_t level;
+} log_tag_level_t;
+
+static bool log_level_read = false;
+static esp_log_level_t log_default_level = ESP_LOG_WARN;
+static log_tag_level_t log_tag_levels[LOG_MAX_TAGS];
+static int log_tag_count = 0;
+static uint64_t random_state = 0x9e3779b97f4a7c15ULL;
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    for (size_t i = 0; i < sizeof(err_names) / sizeof(err_names[0]); i++)
+    {
+        if (err_names[i].code == code)
+        {
+            return err_names[i].name;
+        }
+    }
+    return "ERROR";
+}
+
+void _esp_error_check_failed(esp_err_t rc, const char *file, int line, const char *function, const char *expression)
+{
+    fflush(stdout);
+    fprintf(stderr, "ESP_ERROR_CHECK failed: esp_err_t 0x%x (%s)\nfile: \"%s\" line %d\nfunc: %s\nexpression: %s\n",
+        rc, esp_err_to_name(rc), file, line, function, expression);
+    abort();
+}
+
+void _esp_error_check_failed_without_abort(esp_err_t rc, const char *file, int line, const char *function,
+    const char *expression)
+{
+    fprintf(stderr, "ESP_ERROR_CHECK_WITHOUT_ABORT failed: esp_err_t 0x%x (%s)\nfile: \"%s\" line %d\nfunc: %s\n"
+        "expression: %s\n", rc, esp_err_to_name(rc), file, line, function, expression);
+}
+
+/* Logging */
+
+static esp_log_level_t log_level_from_char(char c)
+{
+    switch (c)
+    {
+        case 'N': return ESP_LOG_NONE;
+        case 'E': return ESP_LOG_ERROR;
+        case 'W': return ESP_LOG_WARN;
+        case 'I': return ESP_LOG_INFO;
+        case 'D': return ESP_LOG_DEBUG;
+        case 'V': return ESP_LOG_VERBOSE;
+        default: return ESP_LOG_WARN;
+    }
+}
+
+static esp_log_level_t log_level_for(const char *tag)
+{
+    if (!log_level_read)
+    {
+        const char *env = getenv("SIM_LOG_LEVEL");
+        if (env != NULL && env[0] != '\0')
+        {
+            log_default_level = log_level_from_char(env[0]);
+        }
+        log_level_read = true;
+    }
+    for (int i = 0; i < log_tag_count; i++)
+    {
+        if (strcmp(log_tag_levels[i].tag, tag) == 0)
+        {
+            return log_tag_levels[i].level;
+        }
+    }
+    return log_default_level;
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    log_level_for(tag);
+    if (strcmp(tag, "*") == 0)
+    {
+        log_default_level = level;
+        return;
+    }
+    for (int i = 0; i < log_tag_count; i++)
+    {
+        if (strcmp(log_tag_levels[i].tag, tag) == 0)
+        {
+            log_tag_levels[i].level = level;
+            return;
+        }
+    }
+    if (log_tag_count < LOG_MAX_TAGS)
+    {
+        log_tag_levels[log_tag_count].tag = tag;
+        log_tag_levels[log_tag_count].level = level;
+        log_tag_count++;
+    }
+}
+
+uint32_t esp_log_timestamp(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    static const char letters[] = "NEWIDV";
+    if (level > log_level_for(tag))
+    {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    printf("%c (%u) %s: ", letters[level], esp_log_timestamp(), tag);
+    vprintf(format, args);
+    printf("\n");
+    va_end(args);
+}
+
+void esp_log_buffer_hex(const char *tag, const void *buffer, uint16_t buff_len)
+{
+    const uint8_t *bytes = buffer;
+    if (ESP_LOG_INFO > log_level_for(tag))
+    {
+        return;
+    }
+    for (uint16_t line = 0; line < buff_len; line += 16)
+    {
+        printf("I (%u) %s: ", esp_log_timestamp(), tag);
+        for (uint16_t i = line; i < buff_len && i < line + 16; i++)
+        {
+            printf("%02x ", bytes[i]);
+        }
+        printf("\n");
+    }
+}
+
+/* System */
+
+void sim_random_seed(uint64_t seed)
+{
+    // xorshift never leaves zero
+    random_state = seed ? seed : 0x9e3779b97f4a7c15ULL;
+}
+
+uint32_t esp_random(void)
+{
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    return (uint32_t)((random_state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+void esp_fill_random(void *buf, size_t len)
+{
+    uint8_t *bytes = buf;
+    for (size_t i = 0; i < len; i += 4)
+    {
+        uint32_t value = esp_random();
+        memcpy(&bytes[i], &value, (len - i < 4) ? len - i : 4);
+    }
+}
+
+void esp_restart(void)
+{
+    fflush(stdout);
+    fprintf(stderr, "esp_restart called, ending the process\n");
+    fflush(stderr);
+    _exit(3);
+}
+
+/* The ROM CRCs. The value passed in and returned is inverted, as in the ROM. */
+
+uint16_t esp_crc16_be(uint16_t crc, uint8_t const *buf, uint32_t len)
+{
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        crc ^= (uint16_t)(buf[i] << 8);
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return ~crc;
+}
+
+uint16_t esp_crc16_le(uint16_t crc, uint8_t const *buf, uint32_t len)
+{
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        crc ^= buf[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? (uint16_t)((crc >> 1) ^ 0x8408) : (uint16_t)(crc >> 1);
+        }
+    }
+    return ~crc;
+}
+
+uint32_t esp_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len)
+{
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        crc ^= buf[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+        }
+    }
+    return ~crc;
+}
@@ -0,0 +1,176 @@
+/*
+    Host simulation: esp_timer
+
+    One task at a high priority runs the callbacks, as the esp_timer task does on the target.
+    It sleeps until the earliest alarm, and is woken when a timer is started or stopped.
+    Timers due at the same time run in the order they were started.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "sim_priv.h"
+
+#define TIMER_TASK_PRIORITY 22
+
+struct esp_timer {
+    esp_timer_cb_t callback;
+    void *arg;
+    const char *name;
+    bool armed;
+    int64_t alarm_us;
+    uint64_t period_us;         // 0 for a one shot timer
+    uint64_t arm_seq;
+    struct esp_timer *next;
+};
+
+static struct esp_timer *timers = NULL;
+static uint64_t arm_counter = 0;
+
+static struct esp_timer *timer_next_due(void)
+{
+    struct esp_timer *best = NULL;
+    for (struct esp_timer *timer = timers; timer != NULL; timer = timer->next)
+    {
+        if (timer->armed && (best == NULL || timer->alarm_us < best->alarm_us ||
+            (timer->alarm_us == best->alarm_us && timer->arm_seq < best->arm_seq)))
+        {
+            best = timer;
+        }
+    }
+    return best;
+}
+
+static void timer_task(void *arg)
+{
+    sim_lock();
+    while (true)
+    {
+        struct esp_timer *timer = timer_next_due();
+        if (timer == NULL || timer->alarm_us > sim_now_us())
+        {
+            sim_block_until(&timers, (timer == NULL) ? INT64_MAX : timer->alarm_us);
+            continue;
+        }
+        if (timer->period_us > 0)
+        {
+            timer->alarm_us += timer->period_us;
+            timer->arm_seq = arm_counter++;
+        }
+        else
+        {
+            timer->armed = false;
+        }
+        esp_timer_cb_t callback = timer->callback;
+        void *callback_arg = timer->arg;
+        sim_unlock();
+        callback(callback_arg);
+        sim_lock();
+    }
+}
+
+void sim_timer_init(void)
+{
+    xTaskCreate(timer_task, "esp_timer", 4096, NULL, TIMER_TASK_PRIORITY, NULL);
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+    if (create_args == NULL || create_args->callback == NULL || out_handle == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    struct esp_timer *timer = calloc(1, sizeof(struct esp_timer));
+    if (timer == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    timer->callback = create_args->callback;
+    timer->arg = create_args->arg;
+    timer->name = create_args->name;
+    sim_lock();
+    timer->next = timers;
+    timers = timer;
+    sim_unlock();
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+static esp_err_t timer_start(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period_us)
+{
+    if (timer == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sim_lock();
+    if (timer->armed)
+    {
+        sim_unlock();
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->armed = true;
+    timer->alarm_us = sim_now_us() + (int64_t)timeout_us;
+    timer->period_us = period_us;
+    timer->arm_seq = arm_counter++;
+    sim_wake(&timers);
+    sim_unlock();
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return timer_start(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+    return timer_start(timer, period, period);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    if (timer == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sim_lock();
+    esp_err_t err = timer->armed ? ESP_OK : ESP_ERR_INVALID_STATE;
+    timer->armed = false;
+    sim_wake(&timers);
+    sim_unlock();
+    return err;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    if (timer == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sim_lock();
+    if (timer->armed)
+    {
+        sim_unlock();
+        return ESP_ERR_INVALID_STATE;
+    }
+    for (struct esp_timer **link = &timers; *link != NULL; link = &(*link)->next)
+    {
+        if (*link == timer)
+        {
+            *link = timer->next;
+            break;
+        }
+    }
+    sim_unlock();
+    free(timer);
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer)
+{
+    return timer != NULL && timer->armed;
+}
@@ -0,0 +1,741 @@
+/*
+    Host simulation: the WIFI station driver and the access points around it
+
+    A connect scans for the configured network the way the scan method asks: a fast scan
+    stops on the first channel it finds the network on, starting from the configured
+    channel, an all channel scan takes the strongest AP it finds. The attempt ends after the
+    scan and the association time with a CONNECTED event, or a DISCONNECTED event with the
+    reason the ESP32 driver gives. Every event is posted from the esp_timer task, as the
+    driver posts them from its own task.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_system.h"
+#include "esp_wifi.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "sim_priv.h"
+
+#define SCAN_ACTIVE_DEFAULT_MS 120
+#define SCAN_PASSIVE_DEFAULT_MS 360
+
+static const char *TAG = "wifi";
+
+ESP_EVENT_DEFINE_BASE(WIFI_EVENT);
+
+typedef struct {
+    char ssid[33];
+    char password[65];
+    uint8_t bssid[6];
+    uint8_t channel;
+    int8_t rssi;
+    bool up;
+} sim_ap_t;
+
+typedef enum {
+    LINK_IDLE,
+    LINK_CONNECTING,
+    LINK_CONNECTED
+} link_state_t;
+
+static sim_ap_t aps[SIM_MAX_APS];
+static int ap_count = 0;
+
+static bool inited = false;
+static bool started = false;
+static wifi_mode_t mode = WIFI_MODE_NULL;
+static wifi_sta_config_t sta_config;
+static wifi_ps_type_t ps_type = WIFI_PS_MIN_MODEM;
+static wifi_country_t country = {
+    .cc = "01",
+    .schan = 1,
+    .nchan = 13,
+    .policy = WIFI_COUNTRY_POLICY_AUTO
+};
+
+static link_state_t link_state = LINK_IDLE;
+static int link_ap = -1;                // The AP of the attempt, or of the connection
+static uint8_t attempt_reason = 0;      // How the attempt ends, 0 if it associates
+static esp_timer_handle_t connect_timer = NULL;
+static esp_timer_handle_t beacon_timer = NULL;
+
+static esp_timer_handle_t scan_timer = NULL;
+static bool scanning = false;
+static wifi_scan_config_t scan_config;
+static wifi_ap_record_t *scan_records = NULL;
+static uint16_t scan_count = 0;
+static uint8_t scan_id = 0;
+
+static uint32_t fail_count = 0;
+static uint8_t fail_reason = 0;
+static sim_wifi_stats_t stats;
+
+static bool channel_allowed(uint8_t channel)
+{
+    return channel >= country.schan && channel < country.schan + country.nchan;
+}
+
+static bool ap_matches(const sim_ap_t *ap)
+{
+    if (!ap->up || !channel_allowed(ap->channel) ||
+        strncmp(ap->ssid, (const char *)sta_config.ssid, sizeof(sta_config.ssid)) != 0)
+    {
+        return false;
+    }
+    return !sta_config.bssid_set || memcmp(ap->bssid, sta_config.bssid, 6) == 0;
+}
+
+/* The strongest AP of the network on channel, or -1 */
+static int strongest_on_channel(uint8_t channel)
+{
+    int best = -1;
+    for (int i = 0; i < ap_count; i++)
+    {
+        if (aps[i].channel == channel && ap_matches(&aps[i]) && (best < 0 || aps[i].rssi > aps[best].rssi))
+        {
+            best = i;
+        }
+    }
+    return best;
+}
+
+/* The AP a connect picks, or -1. channels is set to the number of channels the scan took. */
+static int connect_pick_ap(uint32_t *channels)
+{
+    int best = -1;
+    uint8_t first = channel_allowed(sta_config.channel) ? sta_config.channel : country.schan;
+    *channels = 0;
+    for (int i = 0; i < country.nchan; i++)
+    {
+        uint8_t channel = country.schan + (first - country.schan + i) % country.nchan;
+        int ap = strongest_on_channel(channel);
+        (*channels)++;
+        if (ap >= 0 && (best < 0 || aps[ap].rssi > aps[best].rssi))
+        {
+            best = ap;
+        }
+        if (best >= 0 && sta_config.scan_method == WIFI_FAST_SCAN)
+        {
+            break;
+        }
+    }
+    return best;
+}
+
+static void post_disconnected(int ap, uint8_t reason)
+{
+    wifi_event_sta_disconnected_t event = {
+        .reason = reason
+    };
+    size_t len = strnlen((const char *)sta_config.ssid, sizeof(sta_config.ssid));
+    memcpy(event.ssid, sta_config.ssid, len);
+    event.ssid_len = (uint8_t)len;
+    if (ap >= 0)
+    {
+        memcpy(event.bssid, aps[ap].bssid, 6);
+    }
+    ESP_LOGD(TAG, "disconnected, reason %d", reason);
+    esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &event, sizeof(event), portMAX_DELAY);
+}
+
+/* Ends the attempt or the connection, and reports it */
+static void link_drop(uint8_t reason)
+{
+    int ap = link_ap;
+    esp_timer_stop(connect_timer);
+    esp_timer_stop(beacon_timer);
+    link_state = LINK_IDLE;
+    link_ap = -1;
+    post_disconnected(ap, reason);
+}
+
+static void connect_timeout(void *arg)
+{
+    if (link_state != LINK_CONNECTING)
+    {
+        return;
+    }
+    int ap = link_ap;
+    uint8_t reason = attempt_reason;
+    if (reason == 0 && !aps[ap].up)
+    {
+        reason = WIFI_REASON_AUTH_EXPIRE;
+    }
+    if (reason != 0)
+    {
+        link_drop(reason);
+        return;
+    }
+    link_state = LINK_CONNECTED;
+    stats.associations++;
+    wifi_event_sta_connected_t event = {
+        .channel = aps[ap].channel,
+        .authmode = (aps[ap].password[0] != '\0') ? WIFI_AUTH_WPA2_PSK : WIFI_AUTH_OPEN,
+        .aid = 1
+    };
+    size_t len = strlen(aps[ap].ssid);
+    memcpy(event.ssid, aps[ap].ssid, len);
+    event.ssid_len = (uint8_t)len;
+    memcpy(event.bssid, aps[ap].bssid, 6);
+    ESP_LOGD(TAG, "connected to " MACSTR " on channel %d", MAC2STR(aps[ap].bssid), aps[ap].channel);
+    esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, &event, sizeof(event), portMAX_DELAY);
+}
+
+static void beacon_timeout(void *arg)
+{
+    if (link_state == LINK_CONNECTED && !aps[link_ap].up)
+    {
+        link_drop(WIFI_REASON_BEACON_TIMEOUT);
+    }
+}
+
+static void scan_collect(void)
+{
+    free(scan_records);
+    scan_records = NULL;
+    scan_count = 0;
+    int found[SIM_MAX_APS];
+    int count = 0;
+    for (int i = 0; i < ap_count; i++)
+    {
+        const sim_ap_t *ap = &aps[i];
+        if (!ap->up || !channel_allowed(ap->channel) ||
+            (scan_config.channel != 0 && ap->channel != scan_config.channel) ||
+            (scan_config.ssid != NULL && strcmp(ap->ssid, (const char *)scan_config.ssid) != 0))
+        {
+            continue;
+        }
+        // Strongest first, as the driver sorts them
+        int pos = count++;
+        while (pos > 0 && aps[found[pos - 1]].rssi < ap->rssi)
+        {
+            found[pos] = found[pos - 1];
+            pos--;
+        }
+        found[pos] = i;
+    }
+    if (count == 0)
+    {
+        return;
+    }
+    scan_records = calloc(count, sizeof(wifi_ap_record_t));
+    if (scan_records == NULL)
+    {
+        return;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        const sim_ap_t *ap = &aps[found[i]];
+        wifi_ap_record_t *record = &scan_records[i];
+        memcpy(record->bssid, ap->bssid, 6);
+        memcpy(record->ssid, ap->ssid, strlen(ap->ssid));
+        record->primary = ap->channel;
+        record->rssi = ap->rssi;
+        record->authmode = (ap->password[0] != '\0') ? WIFI_AUTH_WPA2_PSK : WIFI_AUTH_OPEN;
+        record->pairwise_cipher = WIFI_CIPHER_TYPE_CCMP;
+        record->group_cipher = WIFI_CIPHER_TYPE_CCMP;
+        record->phy_11b = 1;
+        record->phy_11g = 1;
+        record->phy_11n = 1;
+        record->country = country;
+    }
+    scan_count = (uint16_t)count;
+}
+
+static void scan_timeout(void *arg)
+{
+    if (!scanning)
+    {
+        return;
+    }
+    scanning = false;
+    scan_collect();
+    wifi_event_sta_scan_done_t event = {
+        .status = 0,
+        .number = (uint8_t)scan_count,
+        .scan_id = ++scan_id
+    };
+    esp_event_post(WIFI_EVENT, WIFI_EVENT_SCAN_DONE, &event, sizeof(event), portMAX_DELAY);
+}
+
+/* The simulated world */
+
+int sim_ap_add(const sim_ap_config_t *config)
+{
+    if (ap_count >= SIM_MAX_APS)
+    {
+        sim_fatal("too many access points, at most %d", SIM_MAX_APS);
+    }
+    sim_ap_t *ap = &aps[ap_count];
+    memset(ap, 0, sizeof(sim_ap_t));
+    strncpy(ap->ssid, config->ssid, sizeof(ap->ssid) - 1);
+    if (config->password != NULL)
+    {
+        strncpy(ap->password, config->password, sizeof(ap->password) - 1);
+    }
+    memcpy(ap->bssid, config->bssid, 6);
+    ap->channel = config->channel;
+    ap->rssi = config->rssi;
+    ap->up = true;
+    return ap_count++;
+}
+
+void sim_ap_set_up(int ap, bool up)
+{
+    aps[ap].up = up;
+    if (link_state != LINK_CONNECTED || link_ap != ap)
+    {
+        return;
+    }
+    if (up)
+    {
+        esp_timer_stop(beacon_timer);
+    }
+    else if (!esp_timer_is_active(beacon_timer))
+    {
+        esp_timer_start_once(beacon_timer, sim_timing.beacon_timeout_ms * 1000ULL);
+    }
+}
+
+void sim_ap_set_rssi(int ap, int8_t rssi)
+{
+    aps[ap].rssi = rssi;
+}
+
+void sim_ap_set_channel(int ap, uint8_t channel)
+{
+    aps[ap].channel = channel;
+    if (link_state == LINK_CONNECTED && link_ap == ap)
+    {
+        link_drop(WIFI_REASON_BEACON_TIMEOUT);
+    }
+}
+
+int sim_wifi_current_ap(void)
+{
+    return (link_state == LINK_CONNECTED) ? link_ap : -1;
+}
+
+bool sim_wifi_carrier(void)
+{
+    return link_state == LINK_CONNECTED && aps[link_ap].up;
+}
+
+void sim_wifi_kick(uint8_t reason)
+{
+    if (link_state != LINK_IDLE)
+    {
+        link_drop(reason);
+    }
+}
+
+void sim_wifi_fail_next(uint32_t count, uint8_t reason)
+{
+    fail_count = count;
+    fail_reason = reason;
+}
+
+void sim_wifi_get_stats(sim_wifi_stats_t *out)
+{
+    *out = stats;
+}
+
+/* esp_wifi */
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *config)
+{
+    if (config == NULL || config->magic != WIFI_INIT_CONFIG_MAGIC)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (inited)
+    {
+        return ESP_OK;
+    }
+    const esp_timer_create_args_t connect_args = {
+        .callback = connect_timeout,
+        .name = "wifi_connect"
+    };
+    const esp_timer_create_args_t beacon_args = {
+        .callback = beacon_timeout,
+        .name = "wifi_beacon"
+    };
+    const esp_timer_create_args_t scan_args = {
+        .callback = scan_timeout,
+        .name = "wifi_scan"
+    };
+    if (esp_timer_create(&connect_args, &connect_timer) != ESP_OK ||
+        esp_timer_create(&beacon_args, &beacon_timer) != ESP_OK ||
+        esp_timer_create(&scan_args, &scan_timer) != ESP_OK)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    mode = WIFI_MODE_STA;
+    inited = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_deinit(void)
+{
+    if (!inited)
+    {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    if (started)
+    {
+        return ESP_ERR_WIFI_NOT_STOPPED;
+    }
+    esp_timer_delete(connect_timer);
+    esp_timer_delete(beacon_timer);
+    esp_timer_delete(scan_timer);
+    connect_timer = NULL;
+    beacon_timer = NULL;
+    scan_timer = NULL;
+    free(scan_records);
+    scan_records = NULL;
+    scan_count = 0;
+    inited = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_mode(wifi_mode_t new_mode)
+{
+    if (!inited)
+    {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    if (new_mode >= WIFI_MODE_MAX)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    mode = new_mode;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_mode(wifi_mode_t *out_mode)
+{
+    if (!inited)
+    {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    *out_mode = mode;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_start(void)
+{
+    if (!inited)
+    {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    if (started)
+    {
+        return ESP_OK;
+    }
+    started = true;
+    esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_START, NULL, 0, portMAX_DELAY);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_stop(void)
+{
+    if (!inited)
+    {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    if (!started)
+    {
+        return ESP_OK;
+    }
+    if (link_state != LINK_IDLE)
+    {
+        link_drop(WIFI_REASON_ASSOC_LEAVE);
+    }
+    scanning = false;
+    esp_timer_stop(scan_timer);
+    started = false;
+    esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_STOP, NULL, 0, portMAX_DELAY);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_restore(void)
+{
+    memset(&sta_config, 0, sizeof(sta_config));
+    ps_type = WIFI_PS_MIN_MODEM;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_connect(void)
+{
+    if (!inited)
+    {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    if (!started)
+    {
+        return ESP_ERR_WIFI_NOT_STARTED;
+    }
+    if (mode != WIFI_MODE_STA && mode != WIFI_MODE_APSTA)
+    {
+        return ESP_ERR_WIFI_MODE;
+    }
+    if (link_state != LINK_IDLE)
+    {
+        return ESP_OK;
+    }
+    stats.connects++;
+    uint32_t channels;
+    int ap = connect_pick_ap(&channels);
+    uint32_t wait_ms = channels * sim_timing.scan_channel_ms;
+    if (ap < 0)
+    {
+        attempt_reason = WIFI_REASON_NO_AP_FOUND;
+    }
+    else
+    {
+        stats.ap_attempts[ap]++;
+        attempt_reason = 0;
+        if (fail_count > 0)
+        {
+            fail_count--;
+            attempt_reason = fail_reason;
+        }
+        else if (strncmp(aps[ap].password, (const char *)sta_config.password, sizeof(sta_config.password)) != 0)
+        {
+            attempt_reason = WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT;
+        }
+        wait_ms += (attempt_reason != 0) ? sim_timing.auth_fail_ms : sim_timing.assoc_ms;
+    }
+    link_state = LINK_CONNECTING;
+    link_ap = ap;
+    esp_timer_start_once(connect_timer, wait_ms * 1000ULL);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_disconnect(void)
+{
+    if (!inited)
+    {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    if (!started)
+    {
+        return ESP_ERR_WIFI_NOT_STARTED;
+    }
+    if (link_state != LINK_IDLE)
+    {
+        link_drop(WIFI_REASON_ASSOC_LEAVE);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_start(const wifi_scan_config_t *config, bool block)
+{
+    if (!inited)
+    {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    if (!started)
+    {
+        return ESP_ERR_WIFI_NOT_STARTED;
+    }
+    if (block)
+    {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (scanning || link_state == LINK_CONNECTING)
+    {
+        return ESP_ERR_WIFI_STATE;
+    }
+    memset(&scan_config, 0, sizeof(scan_config));
+    if (config != NULL)
+    {
+        scan_config = *config;
+    }
+    uint32_t dwell_ms;
+    if (scan_config.scan_type == WIFI_SCAN_TYPE_PASSIVE)
+    {
+        dwell_ms = scan_config.scan_time.passive ? scan_config.scan_time.passive : SCAN_PASSIVE_DEFAULT_MS;
+    }
+    else
+    {
+        dwell_ms = scan_config.scan_time.active.max ? scan_config.scan_time.active.max : SCAN_ACTIVE_DEFAULT_MS;
+    }
+    uint32_t channels = (scan_config.channel != 0) ? 1 : country.nchan;
+    stats.scans++;
+    scanning = true;
+    esp_timer_start_once(scan_timer, (uint64_t)channels * dwell_ms * 1000);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_stop(void)
+{
+    if (!inited)
+    {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    scanning = false;
+    esp_timer_stop(scan_timer);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_get_ap_num(uint16_t *number)
+{
+    if (number == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *number = scan_count;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_get_ap_records(uint16_t *number, wifi_ap_record_t *ap_records)
+{
+    if (!inited)
+    {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    if (number == NULL || ap_records == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (*number > scan_count)
+    {
+        *number = scan_count;
+    }
+    if (*number > 0)
+    {
+        memcpy(ap_records, scan_records, *number * sizeof(wifi_ap_record_t));
+    }
+    // Read once, as the driver frees them
+    free(scan_records);
+    scan_records = NULL;
+    scan_count = 0;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *ap_info)
+{
+    if (ap_info == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (link_state != LINK_CONNECTED)
+    {
+        return ESP_ERR_WIFI_NOT_CONNECT;
+    }
+    const sim_ap_t *ap = &aps[link_ap];
+    memset(ap_info, 0, sizeof(wifi_ap_record_t));
+    memcpy(ap_info->bssid, ap->bssid, 6);
+    memcpy(ap_info->ssid, ap->ssid, strlen(ap->ssid));
+    ap_info->primary = ap->channel;
+    ap_info->rssi = ap->rssi;
+    ap_info->authmode = (ap->password[0] != '\0') ? WIFI_AUTH_WPA2_PSK : WIFI_AUTH_OPEN;
+    ap_info->country = country;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_ps(wifi_ps_type_t type)
+{
+    ps_type = type;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_ps(wifi_ps_type_t *type)
+{
+    *type = ps_type;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_country(const wifi_country_t *new_country)
+{
+    if (!inited)
+    {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    if (new_country == NULL || new_country->schan == 0 || new_country->nchan == 0 ||
+        new_country->schan + new_country->nchan > 15)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    country = *new_country;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_country(wifi_country_t *out_country)
+{
+    if (!inited)
+    {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    *out_country = country;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t *conf)
+{
+    if (!inited)
+    {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    if (interface != WIFI_IF_STA)
+    {
+        return ESP_ERR_WIFI_IF;
+    }
+    if (conf == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sta_config = conf->sta;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_config(wifi_interface_t interface, wifi_config_t *conf)
+{
+    if (!inited)
+    {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    if (interface != WIFI_IF_STA)
+    {
+        return ESP_ERR_WIFI_IF;
+    }
+    if (conf == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(conf, 0, sizeof(wifi_config_t));
+    conf->sta = sta_config;
+    return ESP_OK;
+}
+
+/* esp_wifi_default */
+
+esp_netif_t *esp_netif_create_default_wifi_sta(void)
+{
+    esp_netif_config_t cfg = ESP_NETIF_DEFAULT_WIFI_STA();
+    esp_netif_t *netif = esp_netif_new(&cfg);
+    if (netif == NULL)
+    {
+        return NULL;
+    }
+    esp_netif_attach(netif, &sta_config);
+    esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_START, esp_netif_action_start, netif);
+    esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_STOP, esp_netif_action_stop, netif);
+    esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, esp_netif_action_connected, netif);
+    esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, esp_netif_action_disconnected, netif);
+    return netif;
+}
+
+esp_err_t esp_wifi_clear_default_wifi_driver_and_handlers(void *esp_netif)
+{
+    esp_event_handler_unregister(WIFI_EVENT, WIFI_EVENT_STA_START, esp_netif_action_start);
+    esp_event_handler_unregister(WIFI_EVENT, WIFI_EVENT_STA_STOP, esp_netif_action_stop);
+    esp_event_handler_unregister(WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, esp_netif_action_connected);
+    esp_event_handler_unregister(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, esp_netif_action_disconnected);
+    return ESP_OK;
+}
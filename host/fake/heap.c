@@ -0,0 +1,166 @@
+/*
+    Host build: the heap figures
+
+    Every malloc of the process, the component's, mbedTLS's and the fakes', is counted
+    against a heap of SIM_HEAP_SIZE bytes, about what an ESP32 application has free when
+    it starts. The low water mark is kept the way heap_caps keeps it. The allocations
+    themselves are glibc's. The simulation's own bookkeeping is left out.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include "esp_heap_caps.h"
+#include "esp_system.h"
+#include "sim_priv.h"
+
+#define SIM_HEAP_SIZE (320 * 1024)
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+static size_t heap_used = 0;
+static size_t heap_peak = 0;
+
+static void heap_add(void *ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+    size_t used = __atomic_add_fetch(&heap_used, malloc_usable_size(ptr), __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&heap_peak, __ATOMIC_RELAXED);
+    while (used > peak && !__atomic_compare_exchange_n(&heap_peak, &peak, used, true, __ATOMIC_RELAXED,
+        __ATOMIC_RELAXED))
+    {
+    }
+}
+
+static void heap_remove(void *ptr)
+{
+    if (ptr != NULL)
+    {
+        __atomic_sub_fetch(&heap_used, malloc_usable_size(ptr), __ATOMIC_RELAXED);
+    }
+}
+
+void *malloc(size_t size)
+{
+    void *ptr = __libc_malloc(size);
+    heap_add(ptr);
+    return ptr;
+}
+
+void *calloc(size_t count, size_t size)
+{
+    void *ptr = __libc_calloc(count, size);
+    heap_add(ptr);
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    size_t old_size = (ptr != NULL) ? malloc_usable_size(ptr) : 0;
+    void *new_ptr = __libc_realloc(ptr, size);
+    if (new_ptr == NULL && size != 0)
+    {
+        return NULL;
+    }
+    __atomic_sub_fetch(&heap_used, old_size, __ATOMIC_RELAXED);
+    heap_add(new_ptr);
+    return new_ptr;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    void *ptr = __libc_memalign(alignment, size);
+    heap_add(ptr);
+    return ptr;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void **out_ptr, size_t alignment, size_t size)
+{
+    void *ptr = memalign(alignment, size);
+    if (ptr == NULL)
+    {
+        return 12;  // ENOMEM
+    }
+    *out_ptr = ptr;
+    return 0;
+}
+
+void free(void *ptr)
+{
+    heap_remove(ptr);
+    __libc_free(ptr);
+}
+
+void *sim_internal_calloc(size_t count, size_t size)
+{
+    void *ptr = __libc_calloc(count, size);
+    if (ptr == NULL)
+    {
+        abort();
+    }
+    return ptr;
+}
+
+void sim_internal_free(void *ptr)
+{
+    __libc_free(ptr);
+}
+
+void sim_heap_reset_minimum(void)
+{
+    __atomic_store_n(&heap_peak, __atomic_load_n(&heap_used, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+}
+
+static size_t heap_free(size_t used)
+{
+    return (used < SIM_HEAP_SIZE) ? SIM_HEAP_SIZE - used : 0;
+}
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    return heap_free(__atomic_load_n(&heap_used, __ATOMIC_RELAXED));
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+    return heap_free(__atomic_load_n(&heap_peak, __ATOMIC_RELAXED));
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+    return heap_caps_get_free_size(caps);
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+    return malloc(size);
+}
+
+void heap_caps_free(void *ptr)
+{
+    free(ptr);
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+    return (uint32_t)heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+}
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+    return (uint32_t)heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+}
@@ -0,0 +1,333 @@
+/*
+    Host build: NVS in memory
+
+    Namespaces and keys follow the NVS rules the component can run into: names of at most
+    15 characters, a read only open of a namespace that was never written fails, and a
+    get with the wrong type fails. A set that stores what is already there is not a write.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "sim.h"
+
+#define NVS_NAME_MAX 15
+#define NVS_MAX_HANDLES 16
+
+typedef enum {
+    NVS_TYPE_U8,
+    NVS_TYPE_U32,
+    NVS_TYPE_BLOB
+} nvs_type_t;
+
+typedef struct nvs_entry {
+    char name_space[NVS_NAME_MAX + 1];
+    char key[NVS_NAME_MAX + 1];
+    nvs_type_t type;
+    size_t length;
+    uint8_t *data;
+    struct nvs_entry *next;
+} nvs_entry_t;
+
+typedef struct {
+    bool used;
+    nvs_open_mode_t mode;
+    char name_space[NVS_NAME_MAX + 1];
+} nvs_open_t;
+
+static bool initialised = false;
+static nvs_entry_t *entries = NULL;
+static nvs_open_t handles[NVS_MAX_HANDLES];
+static uint32_t writes = 0;
+
+uint32_t sim_nvs_writes(void)
+{
+    return writes;
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    initialised = true;
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    while (entries != NULL)
+    {
+        nvs_entry_t *entry = entries;
+        entries = entry->next;
+        free(entry->data);
+        free(entry);
+    }
+    writes++;
+    return ESP_OK;
+}
+
+static bool nvs_namespace_exists(const char *name)
+{
+    for (nvs_entry_t *entry = entries; entry != NULL; entry = entry->next)
+    {
+        if (strcmp(entry->name_space, name) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    if (!initialised)
+    {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    if (name == NULL || strlen(name) == 0 || strlen(name) > NVS_NAME_MAX)
+    {
+        return ESP_ERR_NVS_INVALID_NAME;
+    }
+    if (open_mode == NVS_READONLY && !nvs_namespace_exists(name))
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    for (int i = 0; i < NVS_MAX_HANDLES; i++)
+    {
+        if (!handles[i].used)
+        {
+            handles[i].used = true;
+            handles[i].mode = open_mode;
+            strcpy(handles[i].name_space, name);
+            *out_handle = (nvs_handle_t)(i + 1);
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+}
+
+static nvs_open_t *nvs_get_open(nvs_handle_t handle)
+{
+    if (handle == 0 || handle > NVS_MAX_HANDLES || !handles[handle - 1].used)
+    {
+        return NULL;
+    }
+    return &handles[handle - 1];
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    nvs_open_t *open = nvs_get_open(handle);
+    if (open != NULL)
+    {
+        open->used = false;
+    }
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    return (nvs_get_open(handle) != NULL) ? ESP_OK : ESP_ERR_NVS_INVALID_HANDLE;
+}
+
+static nvs_entry_t **nvs_find(const char *name_space, const char *key)
+{
+    for (nvs_entry_t **link = &entries; *link != NULL; link = &(*link)->next)
+    {
+        if (strcmp((*link)->name_space, name_space) == 0 && strcmp((*link)->key, key) == 0)
+        {
+            return link;
+        }
+    }
+    return NULL;
+}
+
+static esp_err_t nvs_set(nvs_handle_t handle, const char *key, nvs_type_t type, const void *value, size_t length)
+{
+    nvs_open_t *open = nvs_get_open(handle);
+    if (open == NULL)
+    {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (open->mode == NVS_READONLY)
+    {
+        return ESP_ERR_NVS_READ_ONLY;
+    }
+    if (key == NULL || strlen(key) == 0)
+    {
+        return ESP_ERR_NVS_INVALID_NAME;
+    }
+    if (strlen(key) > NVS_NAME_MAX)
+    {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+    nvs_entry_t **link = nvs_find(open->name_space, key);
+    nvs_entry_t *entry = (link != NULL) ? *link : NULL;
+    if (entry != NULL && entry->type == type && entry->length == length && memcmp(entry->data, value, length) == 0)
+    {
+        return ESP_OK;
+    }
+    uint8_t *data = malloc(length ? length : 1);
+    if (data == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(data, value, length);
+    if (entry == NULL)
+    {
+        entry = calloc(1, sizeof(nvs_entry_t));
+        if (entry == NULL)
+        {
+            free(data);
+            return ESP_ERR_NO_MEM;
+        }
+        strcpy(entry->name_space, open->name_space);
+        strcpy(entry->key, key);
+        entry->next = entries;
+        entries = entry;
+    }
+    free(entry->data);
+    entry->data = data;
+    entry->length = length;
+    entry->type = type;
+    writes++;
+    return ESP_OK;
+}
+
+static esp_err_t nvs_get(nvs_handle_t handle, const char *key, nvs_type_t type, nvs_entry_t **out_entry)
+{
+    nvs_open_t *open = nvs_get_open(handle);
+    if (open == NULL)
+    {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (key == NULL)
+    {
+        return ESP_ERR_NVS_INVALID_NAME;
+    }
+    nvs_entry_t **link = nvs_find(open->name_space, key);
+    if (link == NULL)
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if ((*link)->type != type)
+    {
+        return ESP_ERR_NVS_TYPE_MISMATCH;
+    }
+    *out_entry = *link;
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    nvs_open_t *open = nvs_get_open(handle);
+    if (open == NULL)
+    {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (open->mode == NVS_READONLY)
+    {
+        return ESP_ERR_NVS_READ_ONLY;
+    }
+    nvs_entry_t **link = nvs_find(open->name_space, key);
+    if (link == NULL)
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    nvs_entry_t *entry = *link;
+    *link = entry->next;
+    free(entry->data);
+    free(entry);
+    writes++;
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle)
+{
+    nvs_open_t *open = nvs_get_open(handle);
+    if (open == NULL)
+    {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (open->mode == NVS_READONLY)
+    {
+        return ESP_ERR_NVS_READ_ONLY;
+    }
+    nvs_entry_t **link = &entries;
+    while (*link != NULL)
+    {
+        nvs_entry_t *entry = *link;
+        if (strcmp(entry->name_space, open->name_space) == 0)
+        {
+            *link = entry->next;
+            free(entry->data);
+            free(entry);
+        }
+        else
+        {
+            link = &entry->next;
+        }
+    }
+    writes++;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    nvs_entry_t *entry;
+    esp_err_t err = nvs_get(handle, key, NVS_TYPE_BLOB, &entry);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    if (out_value == NULL)
+    {
+        *length = entry->length;
+        return ESP_OK;
+    }
+    if (*length < entry->length)
+    {
+        *length = entry->length;
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    memcpy(out_value, entry->data, entry->length);
+    *length = entry->length;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    return nvs_set(handle, key, NVS_TYPE_BLOB, value, length);
+}
+
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char *key, uint8_t *out_value)
+{
+    nvs_entry_t *entry;
+    esp_err_t err = nvs_get(handle, key, NVS_TYPE_U8, &entry);
+    if (err == ESP_OK)
+    {
+        memcpy(out_value, entry->data, sizeof(uint8_t));
+    }
+    return err;
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char *key, uint8_t value)
+{
+    return nvs_set(handle, key, NVS_TYPE_U8, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out_value)
+{
+    nvs_entry_t *entry;
+    esp_err_t err = nvs_get(handle, key, NVS_TYPE_U32, &entry);
+    if (err == ESP_OK)
+    {
+        memcpy(out_value, entry->data, sizeof(uint32_t));
+    }
+    return err;
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value)
+{
+    return nvs_set(handle, key, NVS_TYPE_U32, &value, sizeof(value));
+}
@@ -0,0 +1,836 @@
+/*
+    Host simulation: clock, scheduler and FreeRTOS
+
+    Every task is a thread, and the task that holds the CPU is the only one that runs. It
+    gives the CPU up when it blocks, and when it wakes a task of a higher priority, which
+    is what a single core FreeRTOS does. When every task is blocked the clock jumps to the
+    earliest deadline any of them waits for, so time only passes while nothing can run.
+    If nothing waits with a deadline the simulation has deadlocked and ends.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "esp_timer.h"
+#include "sim.h"
+#include "sim_priv.h"
+
+/* Host code needs more stack than the same code on the target */
+#define SIM_THREAD_STACK_SIZE (256 * 1024)
+#define SIM_NAME_LEN 16
+#define SIM_DEFAULT_TIME_LIMIT_MS (48ULL * 3600 * 1000)
+
+typedef enum {
+    SIM_TASK_READY,
+    SIM_TASK_RUNNING,
+    SIM_TASK_BLOCKED,
+    SIM_TASK_DELETED
+} sim_task_state_t;
+
+struct sim_task {
+    char name[SIM_NAME_LEN];
+    TaskFunction_t code;
+    void *parameters;
+    UBaseType_t priority;
+    uint32_t stack_depth;
+    void *stack;                // Allocated so the heap figures include it, as on the target
+    sim_task_state_t state;
+    pthread_t thread;
+    pthread_cond_t cond;        // Signalled when the task is given the CPU
+    const void *wait_object;
+    int64_t wait_until_us;
+    bool timed_out;
+    uint64_t ready_seq;         // First come, first served within a priority
+    uint32_t notify_value;
+    bool notified;
+    struct sim_task *next;
+};
+
+struct sim_queue {
+    uint8_t *storage;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t count;
+    UBaseType_t head;
+    bool is_static;
+};
+
+_Static_assert(sizeof(struct sim_queue) <= sizeof(StaticQueue_t), "StaticQueue_t is too small");
+
+struct sim_event_group {
+    EventBits_t bits;
+};
+
+static pthread_mutex_t scheduler_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sim_task *tasks = NULL;
+static struct sim_task *running = NULL;
+static int64_t now_us = 0;
+static uint64_t ready_counter = 0;
+static uint64_t time_limit_us = 0;
+static uint32_t critical_nesting = 0;
+static bool yield_pending = false;
+
+sim_timing_t sim_timing = {
+    .scan_channel_ms = 120,
+    .assoc_ms = 150,
+    .auth_fail_ms = 1000,
+    .beacon_timeout_ms = 6000,
+    .autoip_ms = 6000,
+    .dhcp_retry_ms = 60000,
+    .eth_link_up_ms = 1500,
+    .eth_link_down_ms = 1000,
+    .ping_rtt_ms = 3,
+};
+
+void sim_lock(void)
+{
+    pthread_mutex_lock(&scheduler_lock);
+}
+
+void sim_unlock(void)
+{
+    pthread_mutex_unlock(&scheduler_lock);
+}
+
+int64_t sim_now_us(void)
+{
+    return now_us;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return now_us;
+}
+
+uint32_t sim_elapsed_ms(void)
+{
+    return (uint32_t)((now_us - SIM_BOOT_US) / 1000);
+}
+
+void sim_set_time_limit(uint64_t limit_ms)
+{
+    time_limit_us = SIM_BOOT_US + limit_ms * 1000;
+}
+
+void sim_get_timing(sim_timing_t *timing)
+{
+    *timing = sim_timing;
+}
+
+void sim_set_timing(const sim_timing_t *timing)
+{
+    sim_timing = *timing;
+}
+
+void sim_exit(int code)
+{
+    fflush(stdout);
+    fflush(stderr);
+    _exit(code);
+}
+
+static const char *sim_state_name(sim_task_state_t state)
+{
+    switch (state)
+    {
+        case SIM_TASK_READY:
+            return "ready";
+        case SIM_TASK_RUNNING:
+            return "running";
+        case SIM_TASK_BLOCKED:
+            return "blocked";
+        default:
+            return "deleted";
+    }
+}
+
+static void sim_dump_tasks(void)
+{
+    for (struct sim_task *task = tasks; task != NULL; task = task->next)
+    {
+        if (task->state == SIM_TASK_DELETED)
+        {
+            continue;
+        }
+        fprintf(stderr, "  %-16s prio %2u %-8s", task->name, task->priority, sim_state_name(task->state));
+        if (task->state == SIM_TASK_BLOCKED && task->wait_until_us != INT64_MAX)
+        {
+            fprintf(stderr, " until %lld ms", (long long)((task->wait_until_us - SIM_BOOT_US) / 1000));
+        }
+        fprintf(stderr, "\n");
+    }
+}
+
+void sim_fatal(const char *format, ...)
+{
+    va_list args;
+    fflush(stdout);
+    fprintf(stderr, "SIM (%lld) ", (long long)((now_us - SIM_BOOT_US) / 1000));
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fprintf(stderr, "\n");
+    sim_dump_tasks();
+    sim_exit(2);
+}
+
+static void sim_make_ready(struct sim_task *task)
+{
+    task->state = SIM_TASK_READY;
+    task->wait_object = NULL;
+    task->ready_seq = ready_counter++;
+}
+
+static struct sim_task *sim_next_ready(void)
+{
+    struct sim_task *best = NULL;
+    for (struct sim_task *task = tasks; task != NULL; task = task->next)
+    {
+        if (task->state == SIM_TASK_READY &&
+            (best == NULL || task->priority > best->priority ||
+            (task->priority == best->priority && task->ready_seq < best->ready_seq)))
+        {
+            best = task;
+        }
+    }
+    return best;
+}
+
+/* Nothing can run: move the clock to the next deadline and wake whoever waits for it */
+static void sim_advance_clock(void)
+{
+    int64_t next_us = INT64_MAX;
+    for (struct sim_task *task = tasks; task != NULL; task = task->next)
+    {
+        if (task->state == SIM_TASK_BLOCKED && task->wait_until_us < next_us)
+        {
+            next_us = task->wait_until_us;
+        }
+    }
+    if (next_us == INT64_MAX)
+    {
+        sim_fatal("simulation deadlock, every task waits forever");
+    }
+    if ((uint64_t)next_us > time_limit_us)
+    {
+        now_us = time_limit_us;
+        sim_fatal("simulation time limit reached");
+    }
+    if (next_us > now_us)
+    {
+        now_us = next_us;
+    }
+    for (struct sim_task *task = tasks; task != NULL; task = task->next)
+    {
+        if (task->state == SIM_TASK_BLOCKED && task->wait_until_us <= now_us)
+        {
+            task->timed_out = true;
+            sim_make_ready(task);
+        }
+    }
+}
+
+/* Hands the CPU to the next task. The caller has set its own state first. Returns when it runs again. */
+static void sim_schedule(void)
+{
+    struct sim_task *self = running;
+    struct sim_task *next = sim_next_ready();
+    while (next == NULL)
+    {
+        sim_advance_clock();
+        next = sim_next_ready();
+    }
+    next->state = SIM_TASK_RUNNING;
+    if (next == self)
+    {
+        return;
+    }
+    running = next;
+    pthread_cond_signal(&next->cond);
+    if (self->state == SIM_TASK_DELETED)
+    {
+        return;
+    }
+    while (running != self)
+    {
+        pthread_cond_wait(&self->cond, &scheduler_lock);
+    }
+}
+
+static void sim_preempt(void)
+{
+    if (critical_nesting > 0)
+    {
+        yield_pending = true;
+        return;
+    }
+    sim_make_ready(running);
+    sim_schedule();
+}
+
+bool sim_block_until(const void *object, int64_t deadline_us)
+{
+    struct sim_task *self = running;
+    if (deadline_us <= now_us)
+    {
+        return false;
+    }
+    if (critical_nesting > 0)
+    {
+        sim_fatal("task %s blocks in a critical section", self->name);
+    }
+    self->state = SIM_TASK_BLOCKED;
+    self->wait_object = object;
+    self->wait_until_us = deadline_us;
+    self->timed_out = false;
+    sim_schedule();
+    return !self->timed_out;
+}
+
+void sim_wake(const void *object)
+{
+    bool preempt = false;
+    for (struct sim_task *task = tasks; task != NULL; task = task->next)
+    {
+        if (task->state == SIM_TASK_BLOCKED && task->wait_object == object && object != NULL)
+        {
+            sim_make_ready(task);
+            preempt |= task->priority > running->priority;
+        }
+    }
+    if (preempt)
+    {
+        sim_preempt();
+    }
+}
+
+static int64_t sim_deadline(TickType_t ticks)
+{
+    return (ticks == portMAX_DELAY) ? INT64_MAX : now_us + (int64_t)ticks * 1000 * portTICK_PERIOD_MS;
+}
+
+void sim_critical_enter(portMUX_TYPE *mux)
+{
+    mux->count++;
+    critical_nesting++;
+}
+
+void sim_critical_exit(portMUX_TYPE *mux)
+{
+    if (mux->count == 0 || critical_nesting == 0)
+    {
+        sim_fatal("critical section exited more often than entered");
+    }
+    mux->count--;
+    if (--critical_nesting == 0 && yield_pending)
+    {
+        yield_pending = false;
+        sim_lock();
+        sim_make_ready(running);
+        sim_schedule();
+        sim_unlock();
+    }
+}
+
+/* Tasks */
+
+static void *sim_task_main(void *arg)
+{
+    struct sim_task *self = arg;
+    sim_lock();
+    while (running != self)
+    {
+        pthread_cond_wait(&self->cond, &scheduler_lock);
+    }
+    sim_unlock();
+    self->code(self->parameters);
+    sim_fatal("task %s returned, FreeRTOS tasks must delete themselves", self->name);
+}
+
+static struct sim_task *sim_task_new(const char *name, UBaseType_t priority, uint32_t stack_depth)
+{
+    struct sim_task *task = sim_internal_calloc(1, sizeof(struct sim_task));
+    snprintf(task->name, sizeof(task->name), "%s", name ? name : "");
+    task->priority = priority;
+    task->stack_depth = stack_depth;
+    pthread_cond_init(&task->cond, NULL);
+    // Newest last, so tasks that become ready together run in the order they were created
+    struct sim_task **tail = &tasks;
+    while (*tail != NULL)
+    {
+        tail = &(*tail)->next;
+    }
+    *tail = task;
+    return task;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task_code, const char *name, uint32_t stack_depth,
+    void *parameters, UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id)
+{
+    void *stack = malloc(stack_depth);
+    if (stack == NULL)
+    {
+        return pdFAIL;
+    }
+    if (priority >= configMAX_PRIORITIES)
+    {
+        priority = configMAX_PRIORITIES - 1;
+    }
+    sim_lock();
+    struct sim_task *task = sim_task_new(name, priority, stack_depth);
+    task->code = task_code;
+    task->parameters = parameters;
+    task->stack = stack;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, SIM_THREAD_STACK_SIZE);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&task->thread, &attr, sim_task_main, task) != 0)
+    {
+        sim_fatal("unable to create a thread for task %s", task->name);
+    }
+    pthread_attr_destroy(&attr);
+    if (created_task != NULL)
+    {
+        *created_task = task;
+    }
+    sim_make_ready(task);
+    if (priority > running->priority)
+    {
+        sim_preempt();
+    }
+    sim_unlock();
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task_code, const char *name, uint32_t stack_depth, void *parameters,
+    UBaseType_t priority, TaskHandle_t *created_task)
+{
+    return xTaskCreatePinnedToCore(task_code, name, stack_depth, parameters, priority, created_task, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    sim_lock();
+    struct sim_task *target = (task != NULL) ? task : running;
+    if (target->state == SIM_TASK_DELETED)
+    {
+        sim_fatal("task %s deleted twice", target->name);
+    }
+    free(target->stack);
+    target->stack = NULL;
+    target->state = SIM_TASK_DELETED;
+    if (target == running)
+    {
+        if (critical_nesting > 0)
+        {
+            sim_fatal("task %s deletes itself in a critical section", target->name);
+        }
+        sim_schedule();
+        sim_unlock();
+        pthread_exit(NULL);
+    }
+    // The thread of another task stays parked, it is never given the CPU again
+    sim_unlock();
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    sim_lock();
+    if (ticks == 0)
+    {
+        sim_make_ready(running);
+        sim_schedule();
+    }
+    else
+    {
+        sim_block_until(NULL, sim_deadline(ticks));
+    }
+    sim_unlock();
+}
+
+void taskYIELD(void)
+{
+    vTaskDelay(0);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(now_us / 1000 / portTICK_PERIOD_MS);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return running;
+}
+
+char *pcTaskGetTaskName(TaskHandle_t task)
+{
+    return (task != NULL) ? task->name : running->name;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    // Host stack use says nothing about the target's, report the stack as unused
+    struct sim_task *target = (task != NULL) ? task : running;
+    return target->stack_depth;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action)
+{
+    BaseType_t ret = pdPASS;
+    sim_lock();
+    switch (action)
+    {
+        case eSetBits:
+            task->notify_value |= value;
+            break;
+        case eIncrement:
+            task->notify_value++;
+            break;
+        case eSetValueWithOverwrite:
+            task->notify_value = value;
+            break;
+        case eSetValueWithoutOverwrite:
+            if (task->notified)
+            {
+                ret = pdFAIL;
+            }
+            else
+            {
+                task->notify_value = value;
+            }
+            break;
+        case eNoAction:
+            break;
+    }
+    task->notified = true;
+    sim_wake(&task->notify_value);
+    sim_unlock();
+    return ret;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    return xTaskNotify(task, 0, eIncrement);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+    sim_lock();
+    struct sim_task *self = running;
+    if (self->notify_value == 0)
+    {
+        sim_block_until(&self->notify_value, sim_deadline(ticks));
+    }
+    uint32_t value = self->notify_value;
+    if (value != 0)
+    {
+        self->notify_value = clear_on_exit ? 0 : value - 1;
+    }
+    self->notified = false;
+    sim_unlock();
+    return value;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t *value, TickType_t ticks)
+{
+    sim_lock();
+    struct sim_task *self = running;
+    if (!self->notified)
+    {
+        self->notify_value &= ~clear_on_entry;
+        sim_block_until(&self->notify_value, sim_deadline(ticks));
+    }
+    if (value != NULL)
+    {
+        *value = self->notify_value;
+    }
+    BaseType_t ret = self->notified ? pdTRUE : pdFALSE;
+    if (self->notified)
+    {
+        self->notify_value &= ~clear_on_exit;
+    }
+    self->notified = false;
+    sim_unlock();
+    return ret;
+}
+
+/* Queues */
+
+static void sim_queue_init(struct sim_queue *queue, UBaseType_t length, UBaseType_t item_size, uint8_t *storage)
+{
+    memset(queue, 0, sizeof(struct sim_queue));
+    queue->length = length;
+    queue->item_size = item_size;
+    queue->storage = storage;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    if (length == 0)
+    {
+        return NULL;
+    }
+    struct sim_queue *queue = malloc(sizeof(struct sim_queue) + length * item_size);
+    if (queue != NULL)
+    {
+        sim_queue_init(queue, length, item_size, (uint8_t *)(queue + 1));
+    }
+    return queue;
+}
+
+QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t item_size, uint8_t *storage,
+    StaticQueue_t *static_queue)
+{
+    if (length == 0 || static_queue == NULL || (item_size > 0 && storage == NULL))
+    {
+        return NULL;
+    }
+    struct sim_queue *queue = (struct sim_queue *)static_queue;
+    sim_queue_init(queue, length, item_size, storage);
+    queue->is_static = true;
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    sim_lock();
+    for (struct sim_task *task = tasks; task != NULL; task = task->next)
+    {
+        if (task->state == SIM_TASK_BLOCKED && (task->wait_object == queue || task->wait_object == &queue->length))
+        {
+            sim_fatal("queue deleted while task %s waits on it", task->name);
+        }
+    }
+    sim_unlock();
+    if (!queue->is_static)
+    {
+        free(queue);
+    }
+}
+
+static BaseType_t sim_queue_send(QueueHandle_t queue, const void *item, TickType_t ticks, bool front)
+{
+    sim_lock();
+    int64_t deadline_us = sim_deadline(ticks);
+    while (queue->count == queue->length)
+    {
+        if (!sim_block_until(&queue->length, deadline_us) && queue->count == queue->length)
+        {
+            sim_unlock();
+            return errQUEUE_FULL;
+        }
+    }
+    UBaseType_t slot;
+    if (front)
+    {
+        queue->head = (queue->head + queue->length - 1) % queue->length;
+        slot = queue->head;
+    }
+    else
+    {
+        slot = (queue->head + queue->count) % queue->length;
+    }
+    if (queue->item_size > 0)
+    {
+        memcpy(queue->storage + slot * queue->item_size, item, queue->item_size);
+    }
+    queue->count++;
+    sim_wake(queue);
+    sim_unlock();
+    return pdPASS;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    return sim_queue_send(queue, item, ticks, false);
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    return sim_queue_send(queue, item, ticks, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    return sim_queue_send(queue, item, ticks, true);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    sim_lock();
+    int64_t deadline_us = sim_deadline(ticks);
+    while (queue->count == 0)
+    {
+        if (!sim_block_until(queue, deadline_us) && queue->count == 0)
+        {
+            sim_unlock();
+            return errQUEUE_EMPTY;
+        }
+    }
+    if (queue->item_size > 0)
+    {
+        memcpy(item, queue->storage + queue->head * queue->item_size, queue->item_size);
+    }
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    sim_wake(&queue->length);
+    sim_unlock();
+    return pdPASS;
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue)
+{
+    sim_lock();
+    queue->count = 0;
+    queue->head = 0;
+    sim_wake(&queue->length);
+    sim_unlock();
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    return queue->count;
+}
+
+/* Semaphores are queues of empty items */
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count)
+{
+    QueueHandle_t queue = xQueueCreate(max_count, 0);
+    if (queue != NULL)
+    {
+        queue->count = initial_count;
+    }
+    return queue;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return xSemaphoreCreateCounting(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return xSemaphoreCreateCounting(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer)
+{
+    QueueHandle_t queue = xQueueCreateStatic(1, 0, NULL, buffer);
+    if (queue != NULL)
+    {
+        queue->count = 1;
+    }
+    return queue;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks)
+{
+    return xQueueReceive(semaphore, NULL, ticks);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    return xQueueSend(semaphore, NULL, 0);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore)
+{
+    vQueueDelete(semaphore);
+}
+
+/* Event groups */
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+    return calloc(1, sizeof(struct sim_event_group));
+}
+
+void vEventGroupDelete(EventGroupHandle_t group)
+{
+    free(group);
+}
+
+static bool sim_event_group_match(EventBits_t current, EventBits_t bits, BaseType_t wait_for_all)
+{
+    return wait_for_all ? ((current & bits) == bits) : ((current & bits) != 0);
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, const EventBits_t bits, const BaseType_t clear_on_exit,
+    const BaseType_t wait_for_all, TickType_t ticks)
+{
+    sim_lock();
+    int64_t deadline_us = sim_deadline(ticks);
+    while (!sim_event_group_match(group->bits, bits, wait_for_all))
+    {
+        if (!sim_block_until(group, deadline_us))
+        {
+            break;
+        }
+    }
+    EventBits_t current = group->bits;
+    if (clear_on_exit && sim_event_group_match(current, bits, wait_for_all))
+    {
+        group->bits &= ~bits;
+    }
+    sim_unlock();
+    return current;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, const EventBits_t bits)
+{
+    sim_lock();
+    group->bits |= bits;
+    EventBits_t current = group->bits;
+    sim_wake(group);
+    sim_unlock();
+    return current;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, const EventBits_t bits)
+{
+    sim_lock();
+    EventBits_t previous = group->bits;
+    group->bits &= ~bits;
+    sim_unlock();
+    return previous;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+    return group->bits;
+}
+
+/* Start up */
+
+void sim_init(uint32_t seed)
+{
+    if (running != NULL)
+    {
+        sim_fatal("sim_init called twice");
+    }
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    now_us = SIM_BOOT_US;
+    time_limit_us = SIM_BOOT_US + SIM_DEFAULT_TIME_LIMIT_MS * 1000;
+    sim_random_seed(seed);
+    sim_lock();
+    struct sim_task *main_task = sim_task_new("main", 1, 3584);
+    main_task->thread = pthread_self();
+    main_task->state = SIM_TASK_RUNNING;
+    running = main_task;
+    sim_unlock();
+    sim_timer_init();
+}
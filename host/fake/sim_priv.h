@@ -0,0 +1,55 @@
+/*
+    Host simulation internals, shared by the fakes
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "sim.h"
+
+/**
+ * The scheduler lock. Held by the running task while it changes anything a blocked task waits on.
+ */
+void sim_lock(void);
+void sim_unlock(void);
+
+/**
+ * Blocks the running task until another task calls sim_wake with object, or the clock reaches
+ * deadline_us. Called with the lock held. Returns false on the deadline, straight away if it
+ * has passed. Waking is not a promise, the caller checks its condition again.
+ */
+bool sim_block_until(const void *object, int64_t deadline_us);
+
+/**
+ * Makes every task blocked on object ready. One with a higher priority than the caller runs
+ * before this returns, unless the caller is in a critical section. Called with the lock held.
+ */
+void sim_wake(const void *object);
+
+/**
+ * Reports an error in the simulation and ends it.
+ */
+void sim_fatal(const char *format, ...) __attribute__((noreturn, format(printf, 1, 2)));
+
+int64_t sim_now_us(void);
+
+/* How long the simulated hardware and servers take, see sim_set_timing */
+extern sim_timing_t sim_timing;
+
+void sim_timer_init(void);
+void sim_random_seed(uint64_t seed);
+
+/* Memory for the simulation itself, which the heap figures leave out */
+void *sim_internal_calloc(size_t count, size_t size);
+void sim_internal_free(void *ptr);
+
+/* Whether each interface can carry a packet now: the station is on an AP that is up, the Ethernet link is up */
+bool sim_wifi_carrier(void);
+bool sim_eth_carrier(void);
+
+/* Finds the netif with the lwIP name impl_name that is up with an address, and its interface */
+bool sim_netif_route(const char *impl_name, sim_if_t *iface);
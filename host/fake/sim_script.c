@@ -0,0 +1,64 @@
+/*
+    Host simulation: scripts of timed changes to the world
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sim_priv.h"
+
+void sim_step(const sim_step_t *step)
+{
+    switch (step->type)
+    {
+        case SIM_STEP_NONE:
+            break;
+        case SIM_STEP_AP_UP:
+            sim_ap_set_up(step->target, true);
+            break;
+        case SIM_STEP_AP_DOWN:
+            sim_ap_set_up(step->target, false);
+            break;
+        case SIM_STEP_AP_RSSI:
+            sim_ap_set_rssi(step->target, (int8_t)step->arg);
+            break;
+        case SIM_STEP_AP_CHANNEL:
+            sim_ap_set_channel(step->target, (uint8_t)step->arg);
+            break;
+        case SIM_STEP_WIFI_KICK:
+            sim_wifi_kick((uint8_t)step->arg);
+            break;
+        case SIM_STEP_WIFI_FAIL:
+            sim_wifi_fail_next((uint32_t)step->target, (uint8_t)step->arg);
+            break;
+        case SIM_STEP_DHCP_DELAY:
+            sim_dhcp_set_delay((sim_if_t)step->target, (uint32_t)step->arg);
+            break;
+        case SIM_STEP_DHCP_SERVER:
+            sim_dhcp_set_server((sim_if_t)step->target, step->arg != 0);
+            break;
+        case SIM_STEP_ETH_CABLE:
+            sim_eth_set_cable(step->arg != 0);
+            break;
+        case SIM_STEP_LINK_TRAFFIC:
+            sim_link_set_traffic((sim_if_t)step->target, step->arg != 0);
+            break;
+        default:
+            sim_fatal("unknown script step %d", step->type);
+    }
+}
+
+void sim_run_script(const sim_step_t *steps, size_t count)
+{
+    int64_t start_us = sim_now_us();
+    for (size_t i = 0; i < count; i++)
+    {
+        int64_t at_us = start_us + steps[i].at_ms * 1000LL;
+        if (at_us > sim_now_us())
+        {
+            vTaskDelay(pdMS_TO_TICKS((at_us - sim_now_us()) / 1000));
+        }
+        sim_step(&steps[i]);
+    }
+}
@@ -0,0 +1,183 @@
+/*
+    Host simulation: lwIP sockets on the simulated network
+
+    Only what the health probe needs: raw ICMP sockets bound to a netif with
+    SO_BINDTODEVICE. An echo request sent through an interface that is up, has a carrier
+    and passes traffic is answered after ping_rtt_ms. recvfrom waits on the simulated clock
+    for the reply, or for the SO_RCVTIMEO timeout. Descriptors that are not simulated
+    sockets are closed by the host.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include <string.h>
+#include "lwip/sockets.h"
+#include "lwip/prot/icmp.h"
+#include "lwip/prot/ip4.h"
+#include "sim_priv.h"
+
+#undef close
+
+#define SIM_SOCKETS 8
+/* Well above the host descriptors a test has open */
+#define SIM_SOCKET_FD_BASE 1000
+
+typedef struct {
+    bool used;
+    char ifname[IFNAMSIZ];
+    int64_t timeout_us;         // 0 waits forever
+    bool reply_pending;
+    int64_t reply_at_us;
+    uint32_t reply_from;
+    struct icmp_echo_hdr reply;
+} sim_socket_t;
+
+static sim_socket_t sockets[SIM_SOCKETS];
+static bool traffic_passing[SIM_IF_MAX] = { true, true };
+static uint32_t pings[SIM_IF_MAX];
+
+static sim_socket_t *sim_socket_get(int s)
+{
+    if (s < SIM_SOCKET_FD_BASE || s >= SIM_SOCKET_FD_BASE + SIM_SOCKETS || !sockets[s - SIM_SOCKET_FD_BASE].used)
+    {
+        return NULL;
+    }
+    return &sockets[s - SIM_SOCKET_FD_BASE];
+}
+
+void sim_link_set_traffic(sim_if_t iface, bool passing)
+{
+    traffic_passing[iface] = passing;
+}
+
+uint32_t sim_pings(sim_if_t iface)
+{
+    return pings[iface];
+}
+
+int lwip_socket(int domain, int type, int protocol)
+{
+    if (domain != AF_INET || type != SOCK_RAW || protocol != IPPROTO_ICMP)
+    {
+        errno = EPROTONOSUPPORT;
+        return -1;
+    }
+    for (int i = 0; i < SIM_SOCKETS; i++)
+    {
+        if (!sockets[i].used)
+        {
+            memset(&sockets[i], 0, sizeof(sim_socket_t));
+            sockets[i].used = true;
+            return SIM_SOCKET_FD_BASE + i;
+        }
+    }
+    errno = ENFILE;
+    return -1;
+}
+
+int lwip_setsockopt(int s, int level, int optname, const void *optval, socklen_t optlen)
+{
+    sim_socket_t *sock = sim_socket_get(s);
+    if (sock == NULL)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    if (level == SOL_SOCKET && optname == SO_BINDTODEVICE && optlen >= sizeof(struct ifreq))
+    {
+        strncpy(sock->ifname, ((const struct ifreq *)optval)->ifr_name, IFNAMSIZ - 1);
+    }
+    else if (level == SOL_SOCKET && optname == SO_RCVTIMEO && optlen >= sizeof(struct timeval))
+    {
+        const struct timeval *timeout = optval;
+        sock->timeout_us = timeout->tv_sec * 1000000LL + timeout->tv_usec;
+    }
+    return 0;
+}
+
+ssize_t lwip_sendto(int s, const void *data, size_t size, int flags, const struct sockaddr *to, socklen_t tolen)
+{
+    sim_socket_t *sock = sim_socket_get(s);
+    if (sock == NULL || size < sizeof(struct icmp_echo_hdr) || to == NULL || tolen < sizeof(struct sockaddr_in))
+    {
+        errno = (sock == NULL) ? EBADF : EINVAL;
+        return -1;
+    }
+    sim_if_t iface;
+    if (!sim_netif_route(sock->ifname, &iface))
+    {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+    pings[iface]++;
+    const struct icmp_echo_hdr *echo = data;
+    bool carrier = (iface == SIM_IF_WIFI) ? sim_wifi_carrier() : sim_eth_carrier();
+    if (echo->type != ICMP_ECHO || !carrier || !traffic_passing[iface])
+    {
+        // Lost on the way
+        return (ssize_t)size;
+    }
+    sock->reply = *echo;
+    sock->reply.type = ICMP_ER;
+    sock->reply_from = ((const struct sockaddr_in *)to)->sin_addr.s_addr;
+    sock->reply_at_us = sim_now_us() + sim_timing.ping_rtt_ms * 1000LL;
+    sock->reply_pending = true;
+    return (ssize_t)size;
+}
+
+ssize_t lwip_recvfrom(int s, void *mem, size_t len, int flags, struct sockaddr *from, socklen_t *fromlen)
+{
+    sim_socket_t *sock = sim_socket_get(s);
+    if (sock == NULL)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    sim_lock();
+    int64_t deadline_us = (sock->timeout_us == 0) ? INT64_MAX : sim_now_us() + sock->timeout_us;
+    int64_t until_us = (sock->reply_pending && sock->reply_at_us < deadline_us) ? sock->reply_at_us : deadline_us;
+    while (sim_now_us() < until_us)
+    {
+        sim_block_until(sock, until_us);
+    }
+    sim_unlock();
+    if (!sock->reply_pending || sock->reply_at_us > sim_now_us())
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    sock->reply_pending = false;
+
+    // The raw socket hands over the IP header too
+    uint8_t packet[IP_HLEN + sizeof(struct icmp_echo_hdr)];
+    struct ip_hdr *iphdr = (struct ip_hdr *)packet;
+    memset(packet, 0, sizeof(packet));
+    iphdr->_v_hl = 0x45;
+    iphdr->_len = htons(sizeof(packet));
+    iphdr->_ttl = 64;
+    iphdr->_proto = IPPROTO_ICMP;
+    iphdr->src = sock->reply_from;
+    memcpy(packet + IP_HLEN, &sock->reply, sizeof(struct icmp_echo_hdr));
+    size_t copied = (len < sizeof(packet)) ? len : sizeof(packet);
+    memcpy(mem, packet, copied);
+    if (from != NULL && fromlen != NULL && *fromlen >= sizeof(struct sockaddr_in))
+    {
+        struct sockaddr_in *from_in = (struct sockaddr_in *)from;
+        memset(from_in, 0, sizeof(*from_in));
+        from_in->sin_family = AF_INET;
+        from_in->sin_addr.s_addr = sock->reply_from;
+        *fromlen = sizeof(struct sockaddr_in);
+    }
+    return (ssize_t)copied;
+}
+
+int lwip_close(int s)
+{
+    sim_socket_t *sock = sim_socket_get(s);
+    if (sock == NULL)
+    {
+        return close(s);
+    }
+    sock->used = false;
+    return 0;
+}
@@ -0,0 +1,7 @@
+/*
+    Host build: GPIO driver, nothing the host build uses
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
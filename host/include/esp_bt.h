@@ -0,0 +1,12 @@
+/*
+    Host build: esp_bt.h
+
+    There is no Bluetooth controller on the host. The BluFi security code includes this
+    header but calls nothing in it.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include "esp_err.h"
@@ -0,0 +1,23 @@
+/*
+    Host build: esp_crc.h
+
+    The ROM CRC routines, with the same initial value and bit order conventions.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint16_t esp_crc16_le(uint16_t crc, uint8_t const *buf, uint32_t len);
+uint16_t esp_crc16_be(uint16_t crc, uint8_t const *buf, uint32_t len);
+uint32_t esp_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len);
+
+#ifdef __cplusplus
+}
+#endif
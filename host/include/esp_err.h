@@ -0,0 +1,96 @@
+/*
+    Host build: esp_err.h
+
+    The error codes the component uses, with the values ESP-IDF 4.x gives them, and
+    ESP_ERROR_CHECK aborting the way it does on the target.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int esp_err_t;
+
+#define ESP_OK                      0
+#define ESP_FAIL                    -1
+
+#define ESP_ERR_NO_MEM              0x101
+#define ESP_ERR_INVALID_ARG         0x102
+#define ESP_ERR_INVALID_STATE       0x103
+#define ESP_ERR_INVALID_SIZE        0x104
+#define ESP_ERR_NOT_FOUND           0x105
+#define ESP_ERR_NOT_SUPPORTED       0x106
+#define ESP_ERR_TIMEOUT             0x107
+#define ESP_ERR_INVALID_RESPONSE    0x108
+#define ESP_ERR_INVALID_CRC         0x109
+#define ESP_ERR_INVALID_VERSION     0x10A
+#define ESP_ERR_INVALID_MAC         0x10B
+
+#define ESP_ERR_NVS_BASE                0x1100
+#define ESP_ERR_NVS_NOT_INITIALIZED     (ESP_ERR_NVS_BASE + 0x01)
+#define ESP_ERR_NVS_NOT_FOUND           (ESP_ERR_NVS_BASE + 0x02)
+#define ESP_ERR_NVS_TYPE_MISMATCH       (ESP_ERR_NVS_BASE + 0x03)
+#define ESP_ERR_NVS_READ_ONLY           (ESP_ERR_NVS_BASE + 0x04)
+#define ESP_ERR_NVS_NOT_ENOUGH_SPACE    (ESP_ERR_NVS_BASE + 0x05)
+#define ESP_ERR_NVS_INVALID_NAME        (ESP_ERR_NVS_BASE + 0x06)
+#define ESP_ERR_NVS_INVALID_HANDLE      (ESP_ERR_NVS_BASE + 0x07)
+#define ESP_ERR_NVS_KEY_TOO_LONG        (ESP_ERR_NVS_BASE + 0x09)
+#define ESP_ERR_NVS_INVALID_LENGTH      (ESP_ERR_NVS_BASE + 0x0c)
+#define ESP_ERR_NVS_NO_FREE_PAGES       (ESP_ERR_NVS_BASE + 0x0d)
+#define ESP_ERR_NVS_NEW_VERSION_FOUND   (ESP_ERR_NVS_BASE + 0x10)
+
+#define ESP_ERR_WIFI_BASE               0x3000
+#define ESP_ERR_WIFI_NOT_INIT           (ESP_ERR_WIFI_BASE + 1)
+#define ESP_ERR_WIFI_NOT_STARTED        (ESP_ERR_WIFI_BASE + 2)
+#define ESP_ERR_WIFI_NOT_STOPPED        (ESP_ERR_WIFI_BASE + 3)
+#define ESP_ERR_WIFI_IF                 (ESP_ERR_WIFI_BASE + 4)
+#define ESP_ERR_WIFI_MODE               (ESP_ERR_WIFI_BASE + 5)
+#define ESP_ERR_WIFI_STATE              (ESP_ERR_WIFI_BASE + 6)
+#define ESP_ERR_WIFI_CONN               (ESP_ERR_WIFI_BASE + 7)
+#define ESP_ERR_WIFI_SSID               (ESP_ERR_WIFI_BASE + 10)
+#define ESP_ERR_WIFI_PASSWORD           (ESP_ERR_WIFI_BASE + 11)
+#define ESP_ERR_WIFI_TIMEOUT            (ESP_ERR_WIFI_BASE + 12)
+#define ESP_ERR_WIFI_NOT_CONNECT        (ESP_ERR_WIFI_BASE + 15)
+
+#define ESP_ERR_ESP_NETIF_BASE                  0x5000
+#define ESP_ERR_ESP_NETIF_INVALID_PARAMS        (ESP_ERR_ESP_NETIF_BASE + 0x01)
+#define ESP_ERR_ESP_NETIF_IF_NOT_READY          (ESP_ERR_ESP_NETIF_BASE + 0x02)
+#define ESP_ERR_ESP_NETIF_DHCPC_START_FAILED    (ESP_ERR_ESP_NETIF_BASE + 0x03)
+#define ESP_ERR_ESP_NETIF_DHCP_ALREADY_STARTED  (ESP_ERR_ESP_NETIF_BASE + 0x04)
+#define ESP_ERR_ESP_NETIF_DHCP_ALREADY_STOPPED  (ESP_ERR_ESP_NETIF_BASE + 0x05)
+#define ESP_ERR_ESP_NETIF_NO_MEM                (ESP_ERR_ESP_NETIF_BASE + 0x06)
+#define ESP_ERR_ESP_NETIF_DHCP_NOT_STOPPED      (ESP_ERR_ESP_NETIF_BASE + 0x07)
+
+const char *esp_err_to_name(esp_err_t code);
+
+void _esp_error_check_failed(esp_err_t rc, const char *file, int line, const char *function,
+    const char *expression) __attribute__((noreturn));
+void _esp_error_check_failed_without_abort(esp_err_t rc, const char *file, int line, const char *function,
+    const char *expression);
+
+#define ESP_ERROR_CHECK(x) do {                                                 \
+        esp_err_t err_rc_ = (x);                                                \
+        if (err_rc_ != ESP_OK) {                                                \
+            _esp_error_check_failed(err_rc_, __FILE__, __LINE__, __func__, #x); \
+        }                                                                       \
+    } while (0)
+
+#define ESP_ERROR_CHECK_WITHOUT_ABORT(x) ({                                                 \
+        esp_err_t err_rc_ = (x);                                                            \
+        if (err_rc_ != ESP_OK) {                                                            \
+            _esp_error_check_failed_without_abort(err_rc_, __FILE__, __LINE__, __func__, #x); \
+        }                                                                                   \
+        err_rc_;                                                                            \
+    })
+
+#ifdef __cplusplus
+}
+#endif
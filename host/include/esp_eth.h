@@ -0,0 +1,92 @@
+/*
+    Host build: esp_eth.h
+
+    An Ethernet driver whose cable is plugged and unplugged with sim.h. As in ESP-IDF 4.x,
+    esp_eth_stop stops the driver without reporting the link down.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+ESP_EVENT_DECLARE_BASE(ETH_EVENT);
+
+typedef enum {
+    ETHERNET_EVENT_START,
+    ETHERNET_EVENT_STOP,
+    ETHERNET_EVENT_CONNECTED,
+    ETHERNET_EVENT_DISCONNECTED,
+} eth_event_t;
+
+typedef enum {
+    ETH_CMD_G_MAC_ADDR,
+    ETH_CMD_S_MAC_ADDR,
+    ETH_CMD_G_PHY_ADDR,
+    ETH_CMD_S_PHY_ADDR,
+    ETH_CMD_G_SPEED,
+    ETH_CMD_S_PROMISCUOUS,
+    ETH_CMD_S_FLOW_CTRL,
+    ETH_CMD_G_DUPLEX_MODE,
+} esp_eth_io_cmd_t;
+
+typedef void *esp_eth_handle_t;
+typedef struct esp_eth_mac_s esp_eth_mac_t;
+typedef struct esp_eth_phy_s esp_eth_phy_t;
+
+typedef struct {
+    uint32_t sw_reset_timeout_ms;
+    uint32_t rx_task_stack_size;
+    uint32_t rx_task_prio;
+    int smi_mdc_gpio_num;
+    int smi_mdio_gpio_num;
+    uint32_t flags;
+} eth_mac_config_t;
+
+typedef struct {
+    int32_t phy_addr;
+    uint32_t reset_timeout_ms;
+    uint32_t autonego_timeout_ms;
+    int reset_gpio_num;
+} eth_phy_config_t;
+
+typedef struct {
+    esp_eth_mac_t *mac;
+    esp_eth_phy_t *phy;
+    uint32_t check_link_period_ms;
+} esp_eth_config_t;
+
+#define ETH_MAC_DEFAULT_CONFIG() { .sw_reset_timeout_ms = 100, .rx_task_stack_size = 4096, .rx_task_prio = 15, \
+    .smi_mdc_gpio_num = 23, .smi_mdio_gpio_num = 18, .flags = 0 }
+#define ETH_PHY_DEFAULT_CONFIG() { .phy_addr = -1, .reset_timeout_ms = 100, .autonego_timeout_ms = 4000, \
+    .reset_gpio_num = 5 }
+#define ETH_DEFAULT_CONFIG(emac, ephy) { .mac = emac, .phy = ephy, .check_link_period_ms = 2000 }
+
+esp_eth_mac_t *esp_eth_mac_new_esp32(const eth_mac_config_t *config);
+esp_eth_phy_t *esp_eth_phy_new_ip101(const eth_phy_config_t *config);
+esp_eth_phy_t *esp_eth_phy_new_rtl8201(const eth_phy_config_t *config);
+esp_eth_phy_t *esp_eth_phy_new_lan8720(const eth_phy_config_t *config);
+esp_eth_phy_t *esp_eth_phy_new_dp83848(const eth_phy_config_t *config);
+
+esp_err_t esp_eth_driver_install(const esp_eth_config_t *config, esp_eth_handle_t *out_hdl);
+esp_err_t esp_eth_driver_uninstall(esp_eth_handle_t hdl);
+esp_err_t esp_eth_start(esp_eth_handle_t hdl);
+esp_err_t esp_eth_stop(esp_eth_handle_t hdl);
+esp_err_t esp_eth_ioctl(esp_eth_handle_t hdl, esp_eth_io_cmd_t cmd, void *data);
+
+void *esp_eth_new_netif_glue(esp_eth_handle_t eth_hdl);
+esp_err_t esp_eth_set_default_handlers(void *esp_netif);
+esp_err_t esp_eth_clear_default_handlers(void *esp_netif);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,172 @@
+/*
+    Host build: esp_netif.h
+
+    Behaves like the ESP-IDF 4.x esp_netif on lwIP where the component depends on it:
+    - esp_netif_dhcpc_start clears the address and the DNS server before DHCP runs, and
+      esp_netif_dhcpc_stop clears the address
+    - the default handlers start DHCP on a connect if the client is in the INIT state, run
+      it again if it was already started, and report the static address if it was stopped
+    - on a disconnect the default handlers clear the address and put the client back to INIT
+    - esp_netif_set_ip_info fails while DHCP runs, and reports GOT_IP for an address
+    Where the address comes from is set up with sim.h.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_event.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+ESP_EVENT_DECLARE_BASE(IP_EVENT);
+
+typedef struct esp_ip4_addr {
+    uint32_t addr;
+} esp_ip4_addr_t;
+
+typedef struct esp_ip6_addr {
+    uint32_t addr[4];
+    uint8_t zone;
+} esp_ip6_addr_t;
+
+typedef struct _ip_addr {
+    union {
+        esp_ip6_addr_t ip6;
+        esp_ip4_addr_t ip4;
+    } u_addr;
+    uint8_t type;
+} esp_ip_addr_t;
+
+#define ESP_IPADDR_TYPE_V4  0
+#define ESP_IPADDR_TYPE_V6  6
+
+/* The host is little endian, as the ESP32 is */
+#define ESP_IP4TOADDR(a, b, c, d) \
+    ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+#define esp_ip4_addr_get_byte(ipaddr, idx) (((const uint8_t *)(&(ipaddr)->addr))[idx])
+#define esp_ip4_addr1(ipaddr) esp_ip4_addr_get_byte(ipaddr, 0)
+#define esp_ip4_addr2(ipaddr) esp_ip4_addr_get_byte(ipaddr, 1)
+#define esp_ip4_addr3(ipaddr) esp_ip4_addr_get_byte(ipaddr, 2)
+#define esp_ip4_addr4(ipaddr) esp_ip4_addr_get_byte(ipaddr, 3)
+#define esp_ip4_addr1_16(ipaddr) ((uint16_t)esp_ip4_addr1(ipaddr))
+#define esp_ip4_addr2_16(ipaddr) ((uint16_t)esp_ip4_addr2(ipaddr))
+#define esp_ip4_addr3_16(ipaddr) ((uint16_t)esp_ip4_addr3(ipaddr))
+#define esp_ip4_addr4_16(ipaddr) ((uint16_t)esp_ip4_addr4(ipaddr))
+
+#define IPSTR "%d.%d.%d.%d"
+#define IP2STR(ipaddr) esp_ip4_addr1_16(ipaddr), esp_ip4_addr2_16(ipaddr), esp_ip4_addr3_16(ipaddr), \
+    esp_ip4_addr4_16(ipaddr)
+
+typedef struct {
+    esp_ip4_addr_t ip;
+    esp_ip4_addr_t netmask;
+    esp_ip4_addr_t gw;
+} esp_netif_ip_info_t;
+
+typedef struct {
+    esp_ip_addr_t ip;
+} esp_netif_dns_info_t;
+
+typedef enum {
+    ESP_NETIF_DNS_MAIN = 0,
+    ESP_NETIF_DNS_BACKUP,
+    ESP_NETIF_DNS_FALLBACK,
+    ESP_NETIF_DNS_MAX
+} esp_netif_dns_type_t;
+
+typedef enum {
+    ESP_NETIF_DHCP_INIT = 0,
+    ESP_NETIF_DHCP_STARTED,
+    ESP_NETIF_DHCP_STOPPED,
+    ESP_NETIF_DHCP_STATUS_MAX
+} esp_netif_dhcp_status_t;
+
+typedef enum {
+    ESP_NETIF_IP_EVENT_GOT_IP = 1,
+    ESP_NETIF_IP_EVENT_LOST_IP = 2,
+} esp_netif_ip_event_type_t;
+
+typedef enum {
+    IP_EVENT_STA_GOT_IP,
+    IP_EVENT_STA_LOST_IP,
+    IP_EVENT_AP_STAIPASSIGNED,
+    IP_EVENT_GOT_IP6,
+    IP_EVENT_ETH_GOT_IP,
+    IP_EVENT_PPP_GOT_IP,
+    IP_EVENT_PPP_LOST_IP,
+} ip_event_t;
+
+typedef struct esp_netif_obj esp_netif_t;
+
+typedef struct {
+    int if_index;
+    esp_netif_t *esp_netif;
+    esp_netif_ip_info_t ip_info;
+    bool ip_changed;
+} ip_event_got_ip_t;
+
+typedef enum {
+    ESP_NETIF_DHCP_CLIENT = 1 << 0,
+} esp_netif_flags_t;
+
+typedef struct {
+    esp_netif_flags_t flags;
+    const char *if_key;
+    const char *if_desc;
+    int route_prio;
+    ip_event_t get_ip_event;
+    ip_event_t lost_ip_event;
+} esp_netif_inherent_config_t;
+
+typedef struct {
+    const esp_netif_inherent_config_t *base;
+    const void *driver;
+    const void *stack;
+} esp_netif_config_t;
+
+extern const esp_netif_inherent_config_t _g_esp_netif_inherent_sta_config;
+extern const esp_netif_inherent_config_t _g_esp_netif_inherent_eth_config;
+
+#define ESP_NETIF_DEFAULT_WIFI_STA() { .base = &_g_esp_netif_inherent_sta_config }
+#define ESP_NETIF_DEFAULT_ETH() { .base = &_g_esp_netif_inherent_eth_config }
+
+uint32_t esp_ip4addr_aton(const char *addr);
+
+esp_err_t esp_netif_init(void);
+esp_netif_t *esp_netif_new(const esp_netif_config_t *esp_netif_config);
+void esp_netif_destroy(esp_netif_t *esp_netif);
+esp_err_t esp_netif_attach(esp_netif_t *esp_netif, void *driver_handle);
+
+esp_err_t esp_netif_set_default_netif(esp_netif_t *esp_netif);
+esp_netif_t *esp_netif_get_default_netif(void);
+esp_netif_t *esp_netif_get_handle_from_ifkey(const char *if_key);
+bool esp_netif_is_netif_up(esp_netif_t *esp_netif);
+
+esp_err_t esp_netif_get_ip_info(esp_netif_t *esp_netif, esp_netif_ip_info_t *ip_info);
+esp_err_t esp_netif_set_ip_info(esp_netif_t *esp_netif, const esp_netif_ip_info_t *ip_info);
+esp_err_t esp_netif_set_dns_info(esp_netif_t *esp_netif, esp_netif_dns_type_t type, esp_netif_dns_info_t *dns);
+esp_err_t esp_netif_get_dns_info(esp_netif_t *esp_netif, esp_netif_dns_type_t type, esp_netif_dns_info_t *dns);
+
+esp_err_t esp_netif_dhcpc_start(esp_netif_t *esp_netif);
+esp_err_t esp_netif_dhcpc_stop(esp_netif_t *esp_netif);
+esp_err_t esp_netif_dhcpc_get_status(esp_netif_t *esp_netif, esp_netif_dhcp_status_t *status);
+
+void *esp_netif_get_netif_impl(esp_netif_t *esp_netif);
+esp_err_t esp_netif_get_netif_impl_name(esp_netif_t *esp_netif, char *name);
+int32_t esp_netif_get_event_id(esp_netif_t *esp_netif, esp_netif_ip_event_type_t event_type);
+
+void esp_netif_action_start(void *esp_netif, esp_event_base_t base, int32_t event_id, void *data);
+void esp_netif_action_stop(void *esp_netif, esp_event_base_t base, int32_t event_id, void *data);
+void esp_netif_action_connected(void *esp_netif, esp_event_base_t base, int32_t event_id, void *data);
+void esp_netif_action_disconnected(void *esp_netif, esp_event_base_t base, int32_t event_id, void *data);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,33 @@
+/*
+    Host build: esp_system.h
+
+    esp_restart ends the process, as nothing on the host can boot again. The random numbers
+    come from a generator seeded with sim_init, so a run can be repeated. The heap figures are
+    those of the allocator the host build counts, see esp_heap_caps.h.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_bit_defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MACSTR "%02x:%02x:%02x:%02x:%02x:%02x"
+#define MAC2STR(a) (a)[0], (a)[1], (a)[2], (a)[3], (a)[4], (a)[5]
+
+void esp_restart(void) __attribute__((noreturn));
+uint32_t esp_random(void);
+void esp_fill_random(void *buf, size_t len);
+uint32_t esp_get_free_heap_size(void);
+uint32_t esp_get_minimum_free_heap_size(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,65 @@
+/*
+    Host build: FreeRTOS
+
+    Every task is a thread, but only one runs at a time, as on a single core: a task runs
+    until it blocks, and a higher priority task it wakes runs straight away. The tick is one
+    millisecond of simulated time, which only moves on when every task is blocked, so a
+    run takes as long as the work in it and gives the same result every time.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <assert.h>
+#include "esp_err.h"
+#include "esp_bit_defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint8_t StackType_t;
+
+#define portMAX_DELAY           ((TickType_t)0xffffffffUL)
+#define configTICK_RATE_HZ      1000
+#define portTICK_PERIOD_MS      ((TickType_t)1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(xTimeInMs) ((TickType_t)(((TickType_t)(xTimeInMs) * (TickType_t)configTICK_RATE_HZ) / (TickType_t)1000U))
+#define configMINIMAL_STACK_SIZE 768
+#define configMAX_PRIORITIES    25
+#define tskNO_AFFINITY          0x7FFFFFFF
+#define portNUM_PROCESSORS      1
+
+#define pdFALSE                 ((BaseType_t)0)
+#define pdTRUE                  ((BaseType_t)1)
+#define pdPASS                  (pdTRUE)
+#define pdFAIL                  (pdFALSE)
+#define errQUEUE_EMPTY          ((BaseType_t)0)
+#define errQUEUE_FULL           ((BaseType_t)0)
+
+/* Nothing else runs inside a critical section. Blocking in one is an error, as on the target. */
+typedef struct {
+    uint32_t owner;
+    uint32_t count;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED { 0, 0 }
+
+void sim_critical_enter(portMUX_TYPE *mux);
+void sim_critical_exit(portMUX_TYPE *mux);
+
+#define portENTER_CRITICAL(mux)     sim_critical_enter(mux)
+#define portEXIT_CRITICAL(mux)      sim_critical_exit(mux)
+#define portENTER_CRITICAL_ISR(mux) sim_critical_enter(mux)
+#define portEXIT_CRITICAL_ISR(mux)  sim_critical_exit(mux)
+
+#ifdef __cplusplus
+}
+#endif
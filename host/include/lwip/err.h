@@ -0,0 +1,18 @@
+/*
+    Host build: lwIP error codes
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+typedef int8_t err_t;
+
+#define ERR_OK      0
+#define ERR_MEM     -1
+#define ERR_BUF     -2
+#define ERR_TIMEOUT -3
+#define ERR_VAL     -6
+#define ERR_ARG     -16
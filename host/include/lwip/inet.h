@@ -0,0 +1,9 @@
+/*
+    Host build: lwIP address conversion
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include <arpa/inet.h>
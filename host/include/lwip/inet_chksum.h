@@ -0,0 +1,11 @@
+/*
+    Host build: lwIP checksums
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+uint16_t inet_chksum(const void *dataptr, uint16_t len);
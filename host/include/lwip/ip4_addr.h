@@ -0,0 +1,13 @@
+/*
+    Host build: lwIP IPv4 addresses
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+typedef struct ip4_addr {
+    uint32_t addr;
+} ip4_addr_t;
@@ -0,0 +1,36 @@
+/*
+    Host build: lwIP network interfaces
+
+    The address of an esp_netif lives in its lwIP netif, as on the target, so an address
+    set with netif_set_addr is what esp_netif_get_ip_info returns.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "lwip/ip4_addr.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NETIF_FLAG_UP           0x01U
+#define NETIF_FLAG_LINK_UP      0x04U
+
+struct netif {
+    ip4_addr_t ip_addr;
+    ip4_addr_t netmask;
+    ip4_addr_t gw;
+    uint8_t flags;
+    char name[2];
+    void *state;
+};
+
+/* Must be called on the tcpip task */
+void netif_set_addr(struct netif *netif, const ip4_addr_t *ipaddr, const ip4_addr_t *netmask, const ip4_addr_t *gw);
+
+#ifdef __cplusplus
+}
+#endif
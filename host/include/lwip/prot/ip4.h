@@ -0,0 +1,26 @@
+/*
+    Host build: lwIP IPv4 header
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#define IP_HLEN 20
+
+struct ip_hdr {
+    uint8_t _v_hl;
+    uint8_t _tos;
+    uint16_t _len;
+    uint16_t _id;
+    uint16_t _offset;
+    uint8_t _ttl;
+    uint8_t _proto;
+    uint16_t _chksum;
+    uint32_t src;
+    uint32_t dest;
+} __attribute__((packed));
+
+#define IPH_HL_BYTES(hdr) ((uint8_t)(((hdr)->_v_hl & 0x0f) * 4))
@@ -0,0 +1,33 @@
+/*
+    Host build: lwIP sockets
+
+    The types and constants are the host's. The calls go to the simulated network, as
+    lwIP's compatibility macros send them to lwip_socket and friends: raw ICMP sockets
+    bound to a netif, which get an echo reply while the interface is passing traffic.
+    Other sockets are not simulated and fail to open.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+int lwip_socket(int domain, int type, int protocol);
+int lwip_setsockopt(int s, int level, int optname, const void *optval, socklen_t optlen);
+ssize_t lwip_sendto(int s, const void *data, size_t size, int flags, const struct sockaddr *to, socklen_t tolen);
+ssize_t lwip_recvfrom(int s, void *mem, size_t len, int flags, struct sockaddr *from, socklen_t *fromlen);
+int lwip_close(int s);
+
+#define socket(domain, type, protocol) lwip_socket(domain, type, protocol)
+#define setsockopt(s, level, optname, opval, optlen) lwip_setsockopt(s, level, optname, opval, optlen)
+#define sendto(s, dataptr, size, flags, to, tolen) lwip_sendto(s, dataptr, size, flags, to, tolen)
+#define recvfrom(s, mem, len, flags, from, fromlen) lwip_recvfrom(s, mem, len, flags, from, fromlen)
+#define close(s) lwip_close(s)
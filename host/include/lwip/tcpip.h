@@ -0,0 +1,23 @@
+/*
+    Host build: lwIP tcpip thread
+
+    Callbacks run on the tcpip task in the order they were posted.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include "lwip/err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*tcpip_callback_fn)(void *ctx);
+
+err_t tcpip_callback(tcpip_callback_fn function, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,41 @@
+/*
+    Host build: mbedTLS 2.28 bignum.h
+
+    The BluFi code is built against the host's libmbedcrypto 2.28, the major version of
+    mbedTLS in ESP-IDF 4.x. The host has the library but not its headers, so these declare
+    the calls the component makes, with the 2.28 layouts of the structures for a 64 bit host.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int64_t mbedtls_mpi_sint;
+typedef uint64_t mbedtls_mpi_uint;
+
+typedef struct mbedtls_mpi {
+    int s;
+    size_t n;
+    mbedtls_mpi_uint *p;
+} mbedtls_mpi;
+
+void mbedtls_mpi_init(mbedtls_mpi *X);
+void mbedtls_mpi_free(mbedtls_mpi *X);
+int mbedtls_mpi_lset(mbedtls_mpi *X, mbedtls_mpi_sint z);
+size_t mbedtls_mpi_size(const mbedtls_mpi *X);
+int mbedtls_mpi_read_string(mbedtls_mpi *X, int radix, const char *s);
+int mbedtls_mpi_read_binary(mbedtls_mpi *X, const unsigned char *buf, size_t buflen);
+int mbedtls_mpi_read_binary_le(mbedtls_mpi *X, const unsigned char *buf, size_t buflen);
+int mbedtls_mpi_write_binary(const mbedtls_mpi *X, unsigned char *buf, size_t buflen);
+int mbedtls_mpi_write_binary_le(const mbedtls_mpi *X, unsigned char *buf, size_t buflen);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,43 @@
+/*
+    Host build: mbedTLS 2.28 dhm.h, see bignum.h
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include "mbedtls/bignum.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct mbedtls_dhm_context {
+    size_t len;
+    mbedtls_mpi P;
+    mbedtls_mpi G;
+    mbedtls_mpi X;
+    mbedtls_mpi GX;
+    mbedtls_mpi GY;
+    mbedtls_mpi K;
+    mbedtls_mpi RP;
+    mbedtls_mpi Vi;
+    mbedtls_mpi Vf;
+    mbedtls_mpi pX;
+} mbedtls_dhm_context;
+
+void mbedtls_dhm_init(mbedtls_dhm_context *ctx);
+void mbedtls_dhm_free(mbedtls_dhm_context *ctx);
+int mbedtls_dhm_set_group(mbedtls_dhm_context *ctx, const mbedtls_mpi *P, const mbedtls_mpi *G);
+int mbedtls_dhm_read_params(mbedtls_dhm_context *ctx, unsigned char **p, const unsigned char *end);
+int mbedtls_dhm_make_params(mbedtls_dhm_context *ctx, int x_size, unsigned char *output, size_t *olen,
+    int (*f_rng)(void *, unsigned char *, size_t), void *p_rng);
+int mbedtls_dhm_make_public(mbedtls_dhm_context *ctx, int x_size, unsigned char *output, size_t olen,
+    int (*f_rng)(void *, unsigned char *, size_t), void *p_rng);
+int mbedtls_dhm_read_public(mbedtls_dhm_context *ctx, const unsigned char *input, size_t ilen);
+int mbedtls_dhm_calc_secret(mbedtls_dhm_context *ctx, unsigned char *output, size_t output_size, size_t *olen,
+    int (*f_rng)(void *, unsigned char *, size_t), void *p_rng);
+
+#ifdef __cplusplus
+}
+#endif
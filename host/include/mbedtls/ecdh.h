@@ -0,0 +1,22 @@
+/*
+    Host build: mbedTLS 2.28 ecdh.h, see bignum.h
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include "mbedtls/ecp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int mbedtls_ecdh_gen_public(mbedtls_ecp_group *grp, mbedtls_mpi *d, mbedtls_ecp_point *Q,
+    int (*f_rng)(void *, unsigned char *, size_t), void *p_rng);
+int mbedtls_ecdh_compute_shared(mbedtls_ecp_group *grp, mbedtls_mpi *z, const mbedtls_ecp_point *Q,
+    const mbedtls_mpi *d, int (*f_rng)(void *, unsigned char *, size_t), void *p_rng);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,75 @@
+/*
+    Host build: mbedTLS 2.28 ecp.h, see bignum.h
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include "mbedtls/bignum.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The curves of the host library that the component uses */
+#define MBEDTLS_ECP_DP_SECP256R1_ENABLED
+#define MBEDTLS_ECP_DP_CURVE25519_ENABLED
+
+#define MBEDTLS_ECP_PF_UNCOMPRESSED 0
+#define MBEDTLS_ECP_PF_COMPRESSED 1
+
+typedef enum {
+    MBEDTLS_ECP_DP_NONE = 0,
+    MBEDTLS_ECP_DP_SECP192R1,
+    MBEDTLS_ECP_DP_SECP224R1,
+    MBEDTLS_ECP_DP_SECP256R1,
+    MBEDTLS_ECP_DP_SECP384R1,
+    MBEDTLS_ECP_DP_SECP521R1,
+    MBEDTLS_ECP_DP_BP256R1,
+    MBEDTLS_ECP_DP_BP384R1,
+    MBEDTLS_ECP_DP_BP512R1,
+    MBEDTLS_ECP_DP_CURVE25519,
+    MBEDTLS_ECP_DP_SECP192K1,
+    MBEDTLS_ECP_DP_SECP224K1,
+    MBEDTLS_ECP_DP_SECP256K1,
+    MBEDTLS_ECP_DP_CURVE448,
+} mbedtls_ecp_group_id;
+
+typedef struct mbedtls_ecp_point {
+    mbedtls_mpi X;
+    mbedtls_mpi Y;
+    mbedtls_mpi Z;
+} mbedtls_ecp_point;
+
+typedef struct mbedtls_ecp_group {
+    mbedtls_ecp_group_id id;
+    mbedtls_mpi P;
+    mbedtls_mpi A;
+    mbedtls_mpi B;
+    mbedtls_ecp_point G;
+    mbedtls_mpi N;
+    size_t pbits;
+    size_t nbits;
+    unsigned int h;
+    int (*modp)(mbedtls_mpi *);
+    int (*t_pre)(mbedtls_ecp_point *, void *);
+    int (*t_post)(mbedtls_ecp_point *, void *);
+    void *t_data;
+    mbedtls_ecp_point *T;
+    size_t T_size;
+} mbedtls_ecp_group;
+
+void mbedtls_ecp_group_init(mbedtls_ecp_group *grp);
+void mbedtls_ecp_group_free(mbedtls_ecp_group *grp);
+int mbedtls_ecp_group_load(mbedtls_ecp_group *grp, mbedtls_ecp_group_id id);
+void mbedtls_ecp_point_init(mbedtls_ecp_point *pt);
+void mbedtls_ecp_point_free(mbedtls_ecp_point *pt);
+int mbedtls_ecp_point_read_binary(const mbedtls_ecp_group *grp, mbedtls_ecp_point *P, const unsigned char *buf,
+    size_t ilen);
+int mbedtls_ecp_point_write_binary(const mbedtls_ecp_group *grp, const mbedtls_ecp_point *P, int format,
+    size_t *olen, unsigned char *buf, size_t buflen);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,20 @@
+/*
+    Host build: mbedTLS 2.28 md5.h, see bignum.h
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int mbedtls_md5_ret(const unsigned char *input, size_t ilen, unsigned char output[16]);
+void mbedtls_md5(const unsigned char *input, size_t ilen, unsigned char output[16]);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,19 @@
+/*
+    Host build: mbedTLS 2.28 sha256.h, see bignum.h
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int mbedtls_sha256_ret(const unsigned char *input, size_t ilen, unsigned char output[32], int is224);
+
+#ifdef __cplusplus
+}
+#endif
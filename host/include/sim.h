@@ -0,0 +1,213 @@
+/*
+    Host simulation
+
+    Runs the component on Linux against fakes of the ESP-IDF 4.x APIs it uses. The fakes
+    share a simulated clock and a single core scheduler (see freertos/FreeRTOS.h), and a
+    world of access points, DHCP servers and an Ethernet cable that a test changes while
+    the component runs, directly or with a script of timed steps.
+
+    A test calls sim_init first, from main, which becomes the "main" task at priority 1 like
+    app_main. Each process holds one device: the component keeps its state in statics, so a
+    test or benchmark that needs a fresh device runs it in a new process.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SIM_MAX_APS 8
+
+/** The clock starts here, about when app_main runs on the target */
+#define SIM_BOOT_US 1000000LL
+
+/**
+ * @brief Interfaces that have a DHCP server
+ */
+typedef enum {
+    SIM_IF_WIFI = 0,
+    SIM_IF_ETH,
+    SIM_IF_MAX
+} sim_if_t;
+
+/**
+ * @brief An access point
+ */
+typedef struct {
+    const char *ssid;
+    const char *password;       /**< Empty or NULL for an open network */
+    uint8_t bssid[6];
+    uint8_t channel;
+    int8_t rssi;
+} sim_ap_config_t;
+
+/**
+ * @brief How long the radio, DHCP and the PHY take. sim_init sets values typical of an ESP32.
+ */
+typedef struct {
+    uint32_t scan_channel_ms;       /**< Dwell per channel of the scan before a connect */
+    uint32_t assoc_ms;              /**< Authentication, association and the 4-way handshake */
+    uint32_t auth_fail_ms;          /**< Until a failing authentication is given up */
+    uint32_t beacon_timeout_ms;     /**< Until a station notices its AP has gone */
+    uint32_t autoip_ms;             /**< DHCP without an answer until the link-local fallback */
+    uint32_t dhcp_retry_ms;         /**< Longest wait between DHCP retries, which double from 2 s */
+    uint32_t eth_link_up_ms;        /**< Autonegotiation after the cable is plugged in */
+    uint32_t eth_link_down_ms;      /**< Until the PHY link check notices the cable is out */
+    uint32_t ping_rtt_ms;           /**< Round trip of an ICMP echo through an interface passing traffic */
+} sim_timing_t;
+
+/**
+ * @brief Counters of the fake WIFI driver
+ */
+typedef struct {
+    uint32_t connects;                  /**< Connection attempts started */
+    uint32_t associations;              /**< Attempts that associated */
+    uint32_t scans;                     /**< Scans requested with esp_wifi_scan_start */
+    uint32_t ap_attempts[SIM_MAX_APS];  /**< Authentication attempts each AP saw */
+} sim_wifi_stats_t;
+
+/**
+ * @brief Steps of a script
+ */
+typedef enum {
+    SIM_STEP_NONE = 0,      /**< Only waits */
+    SIM_STEP_AP_UP,         /**< target: AP */
+    SIM_STEP_AP_DOWN,       /**< target: AP. A station on it notices after the beacon timeout. */
+    SIM_STEP_AP_RSSI,       /**< target: AP, arg: dBm */
+    SIM_STEP_AP_CHANNEL,    /**< target: AP, arg: channel. A station on it loses it straight away. */
+    SIM_STEP_WIFI_KICK,     /**< arg: reason. The AP deauthenticates the station. */
+    SIM_STEP_WIFI_FAIL,     /**< target: count, arg: reason. The next count attempts fail. */
+    SIM_STEP_DHCP_DELAY,    /**< target: sim_if_t, arg: ms the server takes to answer */
+    SIM_STEP_DHCP_SERVER,   /**< target: sim_if_t, arg: 1 for up, 0 for down */
+    SIM_STEP_ETH_CABLE,     /**< arg: 1 for plugged in, 0 for out */
+    SIM_STEP_LINK_TRAFFIC,  /**< target: sim_if_t, arg: 1 for passing traffic, 0 for dropping it */
+} sim_step_type_t;
+
+/**
+ * @brief One step of a script, at_ms after the script started
+ */
+typedef struct {
+    uint32_t at_ms;
+    sim_step_type_t type;
+    int32_t target;
+    int32_t arg;
+} sim_step_t;
+
+/**
+ * @brief Starts the simulation: the clock, the scheduler with the calling thread as the main task, and
+ * the esp_timer task. seed makes esp_random repeatable.
+ */
+void sim_init(uint32_t seed);
+
+/**
+ * @brief Ends the process straight away with code, without running the other tasks any further.
+ */
+void sim_exit(int code) __attribute__((noreturn));
+
+/**
+ * @brief The simulation ends with an error if the clock passes limit_ms. A task waiting forever on
+ * a timer that keeps firing would otherwise never end.
+ */
+void sim_set_time_limit(uint64_t limit_ms);
+
+/**
+ * @brief Milliseconds since sim_init
+ */
+uint32_t sim_elapsed_ms(void);
+
+void sim_get_timing(sim_timing_t *timing);
+void sim_set_timing(const sim_timing_t *timing);
+
+/**
+ * @brief Adds an access point, up.
+ * @return its index
+ */
+int sim_ap_add(const sim_ap_config_t *config);
+void sim_ap_set_up(int ap, bool up);
+void sim_ap_set_rssi(int ap, int8_t rssi);
+void sim_ap_set_channel(int ap, uint8_t channel);
+
+/**
+ * @brief The AP the station is associated with, or -1
+ */
+int sim_wifi_current_ap(void);
+
+/**
+ * @brief The AP deauthenticates the station with reason. An attempt in progress fails with it.
+ */
+void sim_wifi_kick(uint8_t reason);
+
+/**
+ * @brief The next count authentication attempts fail with reason.
+ */
+void sim_wifi_fail_next(uint32_t count, uint8_t reason);
+
+void sim_wifi_get_stats(sim_wifi_stats_t *stats);
+
+/**
+ * @brief Sets how long the DHCP server of iface takes to answer. 200 ms by default.
+ */
+void sim_dhcp_set_delay(sim_if_t iface, uint32_t delay_ms);
+
+/**
+ * @brief Without a server, DHCP falls back to a link-local address after autoip_ms.
+ */
+void sim_dhcp_set_server(sim_if_t iface, bool up);
+
+/**
+ * @brief Sets the address the DHCP server of iface hands out, as dotted strings.
+ */
+void sim_dhcp_set_lease(sim_if_t iface, const char *ip, const char *gw);
+
+/**
+ * @brief DHCP exchanges started on iface
+ */
+uint32_t sim_dhcp_requests(sim_if_t iface);
+
+/**
+ * @brief Plugs the Ethernet cable in or pulls it out. It is out at the start.
+ */
+void sim_eth_set_cable(bool plugged);
+
+/**
+ * @brief Makes the network behind iface drop every packet, or pass them again. The AP or the cable stays
+ * up, so only the health probe notices. Traffic passes at the start.
+ */
+void sim_link_set_traffic(sim_if_t iface, bool passing);
+
+/**
+ * @brief ICMP echo requests sent through iface, answered or not
+ */
+uint32_t sim_pings(sim_if_t iface);
+
+/**
+ * @brief Starts the heap low-water mark again from the heap in use now, so a benchmark can take the peak of one
+ * step from esp_get_minimum_free_heap_size. Works without sim_init.
+ */
+void sim_heap_reset_minimum(void);
+
+/**
+ * @brief Writes to the NVS flash: sets that changed a value, and erases
+ */
+uint32_t sim_nvs_writes(void);
+
+/**
+ * @brief Applies one step now.
+ */
+void sim_step(const sim_step_t *step);
+
+/**
+ * @brief Runs a script on the calling task, each step at_ms after the call. Returns after the last step.
+ */
+void sim_run_script(const sim_step_t *steps, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,27 @@
+/*
+    Host build: soc/cpu.h
+
+    The cycle count is the time stamp counter on x86, and nanoseconds elsewhere.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+static inline uint32_t esp_cpu_get_ccount(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return (uint32_t)__rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)(now.tv_sec * 1000000000ULL + now.tv_nsec);
+#endif
+}
@@ -0,0 +1,87 @@
+/*
+    Host tests: checks, waiting and the test table
+
+    Each test runs in its own process, named on the command line, because the component
+    keeps its state in statics. A failed check prints where it failed and ends the process.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sim.h"
+
+typedef struct {
+    const char *name;
+    void (*run)(void);
+} test_case_t;
+
+#define TEST_CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fflush(stdout); \
+            fprintf(stderr, "%s:%d: check failed at %u ms: %s\n", __FILE__, __LINE__, sim_elapsed_ms(), #cond); \
+            sim_exit(1); \
+        } \
+    } while (0)
+
+#define TEST_CHECK_EQ(expected, actual) \
+    do { \
+        long long _e = (long long)(expected), _a = (long long)(actual); \
+        if (_e != _a) { \
+            fflush(stdout); \
+            fprintf(stderr, "%s:%d: check failed at %u ms: %s == %s, expected %lld, got %lld\n", \
+                __FILE__, __LINE__, sim_elapsed_ms(), #expected, #actual, _e, _a); \
+            sim_exit(1); \
+        } \
+    } while (0)
+
+/**
+ * @brief Polls until check returns true, for at most timeout_ms of simulated time.
+ */
+static inline bool wait_for(bool (*check)(void), uint32_t timeout_ms)
+{
+    uint32_t end_ms = sim_elapsed_ms() + timeout_ms;
+    while (!check())
+    {
+        if (sim_elapsed_ms() >= end_ms)
+        {
+            return false;
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    return true;
+}
+
+/**
+ * @brief Runs the test named by argv[1] from tests, or lists the names without an argument.
+ */
+static inline int test_main(int argc, char **argv, const test_case_t *tests, size_t count)
+{
+    if (argc < 2)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            printf("%s\n", tests[i].name);
+        }
+        return 0;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        if (strcmp(tests[i].name, argv[1]) == 0)
+        {
+            sim_init(1);
+            tests[i].run();
+            printf("%s: passed at %u ms\n", tests[i].name, sim_elapsed_ms());
+            sim_exit(0);
+        }
+    }
+    fprintf(stderr, "no test named %s\n", argv[1]);
+    return 2;
+}
@@ -0,0 +1,146 @@
+/*
+    Host tests of the health probe and the failover latency it measures
+
+    Built with SIM_NETWORK_HEALTH: the gateway of each interface is pinged every 5 s, up to
+    3 probes of 1 s a round, and 2 failed rounds declare a link dead.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "nvs_flash.h"
+#include "network.h"
+#include "network_priv.h"
+#include "test.h"
+
+/* A round that gets no reply */
+#define FAILED_ROUND_MS (CONFIG_ESP_NETWORK_HEALTH_PROBE_COUNT * CONFIG_ESP_NETWORK_HEALTH_TIMEOUT_MS)
+
+static const sim_ap_config_t ap_home = {
+    .ssid = "sim-net",
+    .password = "sim-pass",
+    .bssid = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 },
+    .channel = 6,
+    .rssi = -50
+};
+
+static bool eth_up(void)
+{
+    return (network_connected_interfaces() & NETWORK_IF_ETHERNET) != 0;
+}
+
+static bool wifi_active(void)
+{
+    return network_active_interface() == NETWORK_IF_WIFI;
+}
+
+static bool eth_active(void)
+{
+    return network_active_interface() == NETWORK_IF_ETHERNET;
+}
+
+static bool switched(void)
+{
+    network_failover_stats_t stats;
+    network_get_failover_stats(&stats);
+    return stats.switchovers > 0;
+}
+
+/* WIFI and Ethernet connected, Ethernet carrying the default route and both answering the probe */
+static void connect_both(void)
+{
+    sim_ap_add(&ap_home);
+    sim_eth_set_cable(true);
+    TEST_CHECK_EQ(ESP_OK, nvs_flash_init());
+    network_setup();
+    network_waitforconnect();
+    TEST_CHECK(wait_for(eth_up, 5000));
+    TEST_CHECK(wait_for(eth_active, 100));
+    // One round through both
+    vTaskDelay(pdMS_TO_TICKS(CONFIG_ESP_NETWORK_HEALTH_INTERVAL * 1000));
+    network_health_t health;
+    TEST_CHECK_EQ(ESP_OK, network_get_health(NETWORK_IF_ETHERNET, &health));
+    TEST_CHECK(health.probes > 0);
+    TEST_CHECK_EQ(0, health.lost);
+}
+
+/* The Ethernet link goes down: the switchover ends with the first reply through WIFI, a round trip later */
+static void test_eth_failover(void)
+{
+    connect_both();
+    uint32_t pings = sim_pings(SIM_IF_WIFI);
+    sim_eth_set_cable(false);
+    TEST_CHECK(wait_for(wifi_active, 5000));
+    TEST_CHECK(wait_for(switched, 100));
+    TEST_CHECK_EQ(pings + 1, sim_pings(SIM_IF_WIFI));
+
+    network_failover_stats_t stats;
+    network_get_failover_stats(&stats);
+    sim_timing_t timing;
+    sim_get_timing(&timing);
+    TEST_CHECK_EQ(1, stats.switchovers);
+    TEST_CHECK(stats.last_us >= timing.ping_rtt_ms * 1000);
+    TEST_CHECK(stats.last_us < 50000);
+}
+
+/* Ethernet stays up but stops passing traffic: the latency covers finding out, from the first failed round */
+static void test_dead_link(void)
+{
+    connect_both();
+    sim_link_set_traffic(SIM_IF_ETH, false);
+    TEST_CHECK(wait_for(wifi_active, 3 * (CONFIG_ESP_NETWORK_HEALTH_INTERVAL * 1000 + FAILED_ROUND_MS)));
+    TEST_CHECK(wait_for(switched, 100));
+
+    network_failover_stats_t stats;
+    network_get_failover_stats(&stats);
+    TEST_CHECK_EQ(1, stats.switchovers);
+    // The first round, the interval and the round that declares it dead
+    uint32_t detect_ms = (CONFIG_ESP_NETWORK_HEALTH_FAIL_COUNT - 1) * (FAILED_ROUND_MS +
+        CONFIG_ESP_NETWORK_HEALTH_INTERVAL * 1000) + FAILED_ROUND_MS;
+    TEST_CHECK(stats.last_us >= detect_ms * 1000);
+    TEST_CHECK(stats.last_us < (detect_ms + 100) * 1000);
+    network_health_t health;
+    network_get_health(NETWORK_IF_ETHERNET, &health);
+    TEST_CHECK_EQ(1, health.dead_count);
+
+    // Back on Ethernet once it answers, which is not a switchover
+    sim_link_set_traffic(SIM_IF_ETH, true);
+    TEST_CHECK(wait_for(eth_active, CONFIG_ESP_NETWORK_HEALTH_INTERVAL * 1000 + 100));
+    network_get_failover_stats(&stats);
+    TEST_CHECK_EQ(1, stats.switchovers);
+}
+
+/* A round lost on the active interface that answers again is not a failover, and does not count towards the next */
+static void test_probe_blip(void)
+{
+    connect_both();
+    sim_link_set_traffic(SIM_IF_ETH, false);
+    vTaskDelay(pdMS_TO_TICKS(CONFIG_ESP_NETWORK_HEALTH_INTERVAL * 1000 + FAILED_ROUND_MS));
+    sim_link_set_traffic(SIM_IF_ETH, true);
+    network_health_t health;
+    network_get_health(NETWORK_IF_ETHERNET, &health);
+    TEST_CHECK(health.lost > 0);
+    vTaskDelay(pdMS_TO_TICKS(2 * CONFIG_ESP_NETWORK_HEALTH_INTERVAL * 1000));
+    TEST_CHECK(eth_active());
+    TEST_CHECK(!switched());
+
+    sim_eth_set_cable(false);
+    TEST_CHECK(wait_for(wifi_active, 5000));
+    TEST_CHECK(wait_for(switched, 100));
+    network_failover_stats_t stats;
+    network_get_failover_stats(&stats);
+    TEST_CHECK(stats.last_us < 50000);
+}
+
+static const test_case_t tests[] = {
+    { "eth_failover", test_eth_failover },
+    { "dead_link", test_dead_link },
+    { "probe_blip", test_probe_blip },
+};
+
+int main(int argc, char **argv)
+{
+    return test_main(argc, argv, tests, sizeof(tests) / sizeof(tests[0]));
+}
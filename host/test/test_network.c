@@ -0,0 +1,370 @@
+/*
+    Host tests of the network component: connects, reconnects, DHCP and failover
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_wifi.h"
+#include "nvs_flash.h"
+#include "network.h"
+#include "network_priv.h"
+#include "test.h"
+
+static const sim_ap_config_t ap_home = {
+    .ssid = "sim-net",
+    .password = "sim-pass",
+    .bssid = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 },
+    .channel = 6,
+    .rssi = -50
+};
+
+static const sim_ap_config_t ap_home_2 = {
+    .ssid = "sim-net",
+    .password = "sim-pass",
+    .bssid = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 },
+    .channel = 1,
+    .rssi = -65
+};
+
+static void boot(void)
+{
+    TEST_CHECK_EQ(ESP_OK, nvs_flash_init());
+    network_setup();
+}
+
+static bool wifi_down(void)
+{
+    return (network_connected_interfaces() & NETWORK_IF_WIFI) == 0;
+}
+
+static bool wifi_up(void)
+{
+    return (network_connected_interfaces() & NETWORK_IF_WIFI) != 0;
+}
+
+static bool eth_up(void)
+{
+    return (network_connected_interfaces() & NETWORK_IF_ETHERNET) != 0;
+}
+
+static bool wifi_link_local(void)
+{
+    return network_get_link_state(NETWORK_IF_WIFI) == NETWORK_LINK_LOCAL_ONLY;
+}
+
+static bool wifi_link_up(void)
+{
+    return network_get_link_state(NETWORK_IF_WIFI) == NETWORK_LINK_UP;
+}
+
+static bool wifi_active(void)
+{
+    return network_active_interface() == NETWORK_IF_WIFI;
+}
+
+static bool eth_active(void)
+{
+    return network_active_interface() == NETWORK_IF_ETHERNET;
+}
+
+static void connect_wifi(void)
+{
+    boot();
+    network_waitforconnect();
+    TEST_CHECK(wifi_up());
+}
+
+static void test_boot_connect(void)
+{
+    sim_ap_add(&ap_home);
+    connect_wifi();
+    TEST_CHECK_EQ(NETWORK_IF_WIFI, network_connected_interfaces());
+    TEST_CHECK_EQ(WIFI_STATE_CONNECTED, wifi_get_state());
+    TEST_CHECK_EQ(NETWORK_LINK_UP, network_get_link_state(NETWORK_IF_WIFI));
+    TEST_CHECK_EQ(NETWORK_IF_WIFI, network_active_interface());
+    TEST_CHECK_EQ(0, sim_wifi_current_ap());
+}
+
+/* network_setup starts WIFI with Ethernet, so network_wait gets an IP number with the Ethernet cable out */
+static void test_setup_wait(void)
+{
+    sim_ap_add(&ap_home);
+    boot();
+    TEST_CHECK_EQ(ESP_ERR_TIMEOUT, network_wait(NETWORK_IF_ETHERNET, pdMS_TO_TICKS(100)));
+    TEST_CHECK_EQ(ESP_OK, network_wait(NETWORK_IF_ANY, pdMS_TO_TICKS(10000)));
+    TEST_CHECK_EQ(NETWORK_IF_WIFI, network_connected_interfaces());
+}
+
+/* A deauthentication is answered by going straight back to the same AP, without a scan of every channel */
+static void test_fast_reconnect(void)
+{
+    sim_ap_add(&ap_home);
+    connect_wifi();
+    sim_wifi_kick(7);
+    TEST_CHECK(wait_for(wifi_down, 100));
+    TEST_CHECK(wait_for(wifi_up, 2000));
+
+    wifi_reconnect_stats_t fast, full;
+    wifi_get_reconnect_stats(WIFI_RECONNECT_PATH_FAST, &fast);
+    wifi_get_reconnect_stats(WIFI_RECONNECT_PATH_FULL_SCAN, &full);
+    TEST_CHECK_EQ(1, fast.count);
+    TEST_CHECK_EQ(0, fast.failures);
+    TEST_CHECK_EQ(0, full.count);
+    // One channel, association and DHCP
+    TEST_CHECK(fast.last_ms < 600);
+}
+
+/* When the last AP has gone, the fast reconnect fails and the full scan finds the other AP of the network */
+static void test_full_scan_fallback(void)
+{
+    int first = sim_ap_add(&ap_home);
+    int second = sim_ap_add(&ap_home_2);
+    connect_wifi();
+    TEST_CHECK_EQ(first, sim_wifi_current_ap());
+    sim_ap_set_up(first, false);
+    TEST_CHECK(wait_for(wifi_down, 10000));
+    TEST_CHECK(wait_for(wifi_up, 30000));
+    TEST_CHECK_EQ(second, sim_wifi_current_ap());
+
+    wifi_reconnect_stats_t fast, full;
+    wifi_get_reconnect_stats(WIFI_RECONNECT_PATH_FAST, &fast);
+    wifi_get_reconnect_stats(WIFI_RECONNECT_PATH_FULL_SCAN, &full);
+    TEST_CHECK_EQ(0, fast.count);
+    TEST_CHECK_EQ(1, fast.failures);
+    TEST_CHECK_EQ(1, full.count);
+}
+
+/* While the AP is down the attempts back off, and the device is back soon after the AP */
+static void test_backoff(void)
+{
+    int ap = sim_ap_add(&ap_home);
+    connect_wifi();
+    sim_wifi_stats_t before, after;
+    sim_wifi_get_stats(&before);
+    sim_ap_set_up(ap, false);
+    sim_wifi_kick(7);
+    TEST_CHECK(wait_for(wifi_down, 100));
+    vTaskDelay(pdMS_TO_TICKS(120000));
+    sim_wifi_get_stats(&after);
+    // Immediate, then 0.5, 1, 2, 4 ... 60 s at most, with full jitter: far fewer than one attempt a second
+    uint32_t attempts = after.connects - before.connects;
+    TEST_CHECK(attempts >= 4);
+    TEST_CHECK(attempts <= 20);
+    TEST_CHECK(wifi_down());
+
+    uint32_t up_ms = sim_elapsed_ms();
+    sim_ap_set_up(ap, true);
+    TEST_CHECK(wait_for(wifi_up, 65000));
+    TEST_CHECK(sim_elapsed_ms() - up_ms <= 62000);
+}
+
+/* A held DHCP answer delays the reconnect by the hold */
+static void test_dhcp_delay(void)
+{
+    sim_ap_add(&ap_home);
+    connect_wifi();
+    TEST_CHECK_EQ(ESP_OK, network_inject_fault(NETWORK_FAULT_DHCP_DELAY, 3000));
+    uint32_t kick_ms = sim_elapsed_ms();
+    sim_wifi_kick(7);
+    TEST_CHECK(wait_for(wifi_down, 100));
+    TEST_CHECK(wait_for(wifi_up, 10000));
+    TEST_CHECK(sim_elapsed_ms() - kick_ms >= 3000);
+    TEST_CHECK_EQ(ESP_OK, network_inject_fault(NETWORK_FAULT_DHCP_DELAY, 0));
+}
+
+/* Without a DHCP server the link-local address is reported, and DHCP keeps trying until the server answers */
+static void test_link_local(void)
+{
+    sim_ap_add(&ap_home);
+    sim_dhcp_set_server(SIM_IF_WIFI, false);
+    // network_waitforconnect would wait for a routable address
+    boot();
+    TEST_CHECK(wait_for(wifi_link_local, 10000));
+    esp_netif_ip_info_t ip_info;
+    TEST_CHECK_EQ(ESP_OK, esp_netif_get_ip_info(esp_netif_get_handle_from_ifkey("WIFI_STA_DEF"), &ip_info));
+    TEST_CHECK_EQ(169, esp_ip4_addr1_16(&ip_info.ip));
+    TEST_CHECK_EQ(254, esp_ip4_addr2_16(&ip_info.ip));
+
+    sim_dhcp_set_server(SIM_IF_WIFI, true);
+    TEST_CHECK(wait_for(wifi_link_up, 70000));
+    network_link_local_stats_t stats;
+    network_get_link_local_stats(NETWORK_IF_WIFI, &stats);
+    TEST_CHECK_EQ(1, stats.entries);
+    TEST_CHECK(stats.dhcp_retries >= 1);
+}
+
+/* The default route moves to Ethernet when its cable goes in, and back to WIFI when it comes out */
+static void test_eth_failover(void)
+{
+    sim_ap_add(&ap_home);
+    connect_wifi();
+    TEST_CHECK_EQ(NETWORK_IF_WIFI, network_active_interface());
+    sim_eth_set_cable(true);
+    TEST_CHECK(wait_for(eth_up, 5000));
+    TEST_CHECK(wait_for(eth_active, 100));
+    TEST_CHECK(esp_netif_get_default_netif() == esp_netif_get_handle_from_ifkey("ETH_DEF"));
+
+    sim_eth_set_cable(false);
+    TEST_CHECK(wait_for(wifi_active, 5000));
+    TEST_CHECK(!eth_up());
+    TEST_CHECK(esp_netif_get_default_netif() == esp_netif_get_handle_from_ifkey("WIFI_STA_DEF"));
+    network_failover_stats_t stats;
+    network_get_failover_stats(&stats);
+    TEST_CHECK_EQ(1, stats.switchovers);
+}
+
+/* wifi_stop turns the radio off without reconnects, wifi_start goes straight back to the last AP */
+static void test_wifi_stop_start(void)
+{
+    sim_ap_add(&ap_home);
+    connect_wifi();
+    for (int i = 0; i < 3; i++)
+    {
+        TEST_CHECK_EQ(ESP_OK, wifi_stop());
+        TEST_CHECK(wait_for(wifi_down, 100));
+        sim_wifi_stats_t before, after;
+        sim_wifi_get_stats(&before);
+        vTaskDelay(pdMS_TO_TICKS(10000));
+        sim_wifi_get_stats(&after);
+        TEST_CHECK_EQ(before.connects, after.connects);
+        TEST_CHECK_EQ(ESP_OK, wifi_start());
+        TEST_CHECK(wait_for(wifi_up, 2000));
+    }
+    wifi_reconnect_stats_t fast;
+    wifi_get_reconnect_stats(WIFI_RECONNECT_PATH_FAST, &fast);
+    TEST_CHECK_EQ(3, fast.count);
+    wifi_lifecycle_stats_t lifecycle;
+    wifi_get_lifecycle_stats(&lifecycle);
+    TEST_CHECK_EQ(3, lifecycle.stops);
+    TEST_CHECK_EQ(0, lifecycle.heap_drift);
+}
+
+/* Everything wifi_start made is freed, and made again by the next wifi_start */
+static void test_wifi_deinit(void)
+{
+    sim_ap_add(&ap_home);
+    connect_wifi();
+    TEST_CHECK_EQ(ESP_OK, wifi_deinit());
+    TEST_CHECK(wait_for(wifi_down, 100));
+    TEST_CHECK(esp_netif_get_handle_from_ifkey("WIFI_STA_DEF") == NULL);
+    TEST_CHECK_EQ(ESP_OK, wifi_start());
+    TEST_CHECK(wait_for(wifi_up, 5000));
+    TEST_CHECK_EQ(ESP_OK, wifi_deinit());
+    TEST_CHECK_EQ(ESP_OK, wifi_start());
+    TEST_CHECK(wait_for(wifi_up, 5000));
+}
+
+/* The AP only takes a new listen interval at association: a profile that changes it reassociates, one that does not
+   leaves the connection and the driver config alone */
+static void test_power_profile(void)
+{
+    sim_ap_add(&ap_home);
+    connect_wifi();
+    sim_wifi_stats_t before, after;
+    wifi_config_t config;
+    sim_wifi_get_stats(&before);
+    TEST_CHECK_EQ(ESP_OK, wifi_set_power_profile(WIFI_POWER_LOW_POWER));
+    TEST_CHECK(wait_for(wifi_down, 1000));
+    TEST_CHECK(wait_for(wifi_up, 5000));
+    sim_wifi_get_stats(&after);
+    TEST_CHECK_EQ(before.associations + 1, after.associations);
+    TEST_CHECK_EQ(ESP_OK, esp_wifi_get_config(WIFI_IF_STA, &config));
+    TEST_CHECK_EQ(CONFIG_ESP_WIFI_LISTEN_INTERVAL, config.sta.listen_interval);
+
+    TEST_CHECK_EQ(ESP_OK, wifi_set_power_profile(WIFI_POWER_LOW_LATENCY));
+    TEST_CHECK(wait_for(wifi_down, 1000));
+    TEST_CHECK(wait_for(wifi_up, 5000));
+    TEST_CHECK_EQ(ESP_OK, esp_wifi_get_config(WIFI_IF_STA, &config));
+    TEST_CHECK_EQ(0, config.sta.listen_interval);
+
+    // Balanced has the same listen interval as low latency
+    sim_wifi_get_stats(&before);
+    wifi_config_t pinned = config;
+    TEST_CHECK_EQ(ESP_OK, wifi_set_power_profile(WIFI_POWER_BALANCED));
+    vTaskDelay(pdMS_TO_TICKS(5000));
+    sim_wifi_get_stats(&after);
+    TEST_CHECK_EQ(before.connects, after.connects);
+    TEST_CHECK(wifi_up());
+    TEST_CHECK_EQ(ESP_OK, esp_wifi_get_config(WIFI_IF_STA, &config));
+    TEST_CHECK(memcmp(&pinned.sta, &config.sta, sizeof(config.sta)) == 0);
+}
+
+/* Attempts that keep failing climb the ladder to a new netif, and the connection comes back on it */
+static void test_recovery_ladder(void)
+{
+    int ap = sim_ap_add(&ap_home);
+    connect_wifi();
+    esp_netif_t *old_netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+    sim_ap_set_up(ap, false);
+    sim_wifi_kick(7);
+
+    wifi_recovery_stats_t stats;
+    for (int i = 0; i < 60; i++)
+    {
+        wifi_get_recovery_stats(WIFI_RECOVERY_NETIF_RECREATE, &stats);
+        if (stats.attempts > 0)
+        {
+            break;
+        }
+        vTaskDelay(pdMS_TO_TICKS(60000));
+    }
+    TEST_CHECK_EQ(1, stats.attempts);
+    wifi_get_recovery_stats(WIFI_RECOVERY_DRIVER_RESTART, &stats);
+    TEST_CHECK_EQ(1, stats.attempts);
+    wifi_get_recovery_stats(WIFI_RECOVERY_RADIO_REINIT, &stats);
+    TEST_CHECK_EQ(1, stats.attempts);
+    TEST_CHECK(esp_netif_get_handle_from_ifkey("WIFI_STA_DEF") != old_netif);
+
+    sim_ap_set_up(ap, true);
+    TEST_CHECK(wait_for(wifi_up, 65000));
+    wifi_get_recovery_stats(WIFI_RECOVERY_NETIF_RECREATE, &stats);
+    TEST_CHECK_EQ(1, stats.successes);
+    TEST_CHECK(wifi_get_netif() == esp_netif_get_handle_from_ifkey("WIFI_STA_DEF"));
+}
+
+/* The on-device fault script drives the same paths as the simulated world */
+static void test_fault_script(void)
+{
+    sim_ap_add(&ap_home);
+    sim_eth_set_cable(true);
+    connect_wifi();
+    TEST_CHECK(wait_for(eth_up, 5000));
+    static const network_fault_step_t steps[] = {
+        { NETWORK_FAULT_WIFI_DISCONNECT, 7, 2000 },
+        { NETWORK_FAULT_ETH_LINK_DOWN, 0, 2000 },
+        { NETWORK_FAULT_ETH_LINK_UP, 0, 5000 },
+    };
+    TEST_CHECK_EQ(ESP_OK, network_run_fault_script(steps, 3));
+    TEST_CHECK_EQ(NETWORK_IF_ANY, network_connected_interfaces());
+    TEST_CHECK_EQ(NETWORK_IF_ETHERNET, network_active_interface());
+    wifi_reconnect_stats_t fast;
+    wifi_get_reconnect_stats(WIFI_RECONNECT_PATH_FAST, &fast);
+    TEST_CHECK_EQ(1, fast.count);
+    network_failover_stats_t failover;
+    network_get_failover_stats(&failover);
+    TEST_CHECK_EQ(1, failover.switchovers);
+}
+
+static const test_case_t tests[] = {
+    { "boot_connect", test_boot_connect },
+    { "setup_wait", test_setup_wait },
+    { "fast_reconnect", test_fast_reconnect },
+    { "full_scan_fallback", test_full_scan_fallback },
+    { "backoff", test_backoff },
+    { "dhcp_delay", test_dhcp_delay },
+    { "link_local", test_link_local },
+    { "eth_failover", test_eth_failover },
+    { "wifi_stop_start", test_wifi_stop_start },
+    { "wifi_deinit", test_wifi_deinit },
+    { "power_profile", test_power_profile },
+    { "recovery_ladder", test_recovery_ladder },
+    { "fault_script", test_fault_script },
+};
+
+int main(int argc, char **argv)
+{
+    return test_main(argc, argv, tests, sizeof(tests) / sizeof(tests[0]));
+}
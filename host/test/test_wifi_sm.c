@@ -0,0 +1,186 @@
+/*
+    Host tests of the WIFI state machine table: every state, event and guard condition
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include "sdkconfig.h"
+#include "wifi_sm.h"
+#include "test.h"
+
+typedef struct {
+    bool handled;
+    wifi_state_t next;
+    wifi_sm_action_t action;
+} expected_t;
+
+static expected_t handled(wifi_state_t next, wifi_sm_action_t action)
+{
+    expected_t expected = { true, next, action };
+    return expected;
+}
+
+static const expected_t ignored = { false, WIFI_STATE_IDLE, WIFI_SM_ACTION_NONE };
+
+static bool linking(wifi_state_t state)
+{
+    return state == WIFI_STATE_ASSOCIATING || state == WIFI_STATE_DHCP || state == WIFI_STATE_CONNECTED;
+}
+
+/* What the state machine is meant to do, written out case by case */
+static expected_t expected_transition(wifi_state_t state, wifi_sm_event_t event, const wifi_sm_conditions_t *c)
+{
+    switch (event)
+    {
+        case WIFI_SM_EVENT_START:
+            if (state != WIFI_STATE_IDLE)
+            {
+                return ignored;
+            }
+            return handled(WIFI_STATE_ASSOCIATING,
+                c->fast_reconnect_ready ? WIFI_SM_ACTION_RESUME_FAST : WIFI_SM_ACTION_CONNECT_CURRENT);
+        case WIFI_SM_EVENT_ASSOCIATED:
+            if (state == WIFI_STATE_ASSOCIATING)
+            {
+                return handled(WIFI_STATE_DHCP, WIFI_SM_ACTION_NONE);
+            }
+            if (state == WIFI_STATE_IDLE || state == WIFI_STATE_BACKOFF || state == WIFI_STATE_SCANNING)
+            {
+                return handled(WIFI_STATE_DHCP, WIFI_SM_ACTION_CANCEL_RETRY);
+            }
+            return ignored;
+        case WIFI_SM_EVENT_GOT_IP:
+            if (state == WIFI_STATE_ASSOCIATING || state == WIFI_STATE_DHCP)
+            {
+                return handled(WIFI_STATE_CONNECTED, WIFI_SM_ACTION_CONNECTED);
+            }
+            if (state == WIFI_STATE_CONNECTED)
+            {
+                return handled(WIFI_STATE_CONNECTED, WIFI_SM_ACTION_NONE);
+            }
+            return ignored;
+        case WIFI_SM_EVENT_DISCONNECTED:
+            if (!linking(state))
+            {
+                return ignored;
+            }
+            if (c->roam_pending)
+            {
+                return handled(WIFI_STATE_ASSOCIATING, WIFI_SM_ACTION_CONNECT_ROAM);
+            }
+            if (c->fast_reconnect_ready)
+            {
+                return handled(WIFI_STATE_ASSOCIATING, WIFI_SM_ACTION_CONNECT_FAST);
+            }
+            return handled(WIFI_STATE_BACKOFF, WIFI_SM_ACTION_START_BACKOFF);
+        case WIFI_SM_EVENT_BACKOFF_DONE:
+            return (state == WIFI_STATE_BACKOFF) ? handled(WIFI_STATE_SCANNING, WIFI_SM_ACTION_START_SCAN) : ignored;
+        case WIFI_SM_EVENT_SCAN_DONE:
+            return (state == WIFI_STATE_SCANNING) ?
+                handled(WIFI_STATE_ASSOCIATING, WIFI_SM_ACTION_CONNECT_SELECTED) : ignored;
+        case WIFI_SM_EVENT_DISABLE:
+            return (state != WIFI_STATE_DISABLED) ? handled(WIFI_STATE_DISABLED, WIFI_SM_ACTION_DISABLE) : ignored;
+        case WIFI_SM_EVENT_ENABLE:
+            return (state == WIFI_STATE_DISABLED) ? handled(WIFI_STATE_IDLE, WIFI_SM_ACTION_ENABLE) : ignored;
+        default:
+            return ignored;
+    }
+}
+
+static void check_transition(wifi_state_t state, wifi_sm_event_t event, const wifi_sm_conditions_t *conditions)
+{
+    expected_t expected = expected_transition(state, event, conditions);
+    const wifi_sm_transition_t *row = wifi_sm_find(state, event, conditions);
+    if (expected.handled != (row != NULL) ||
+        (row != NULL && (row->next != expected.next || row->action != expected.action)))
+    {
+        fprintf(stderr, "%s, event %d, roam_pending %d, fast_reconnect_ready %d: expected %s %d, got %s %d\n",
+            wifi_sm_state_name(state), event, conditions->roam_pending, conditions->fast_reconnect_ready,
+            expected.handled ? wifi_sm_state_name(expected.next) : "ignored", expected.action,
+            row ? wifi_sm_state_name(row->next) : "ignored", row ? row->action : 0);
+        sim_exit(1);
+    }
+}
+
+static void test_every_transition(void)
+{
+    int checked = 0;
+    for (int state = 0; state < WIFI_STATE_MAX; state++)
+    {
+        for (int event = 0; event < WIFI_SM_EVENT_MAX; event++)
+        {
+            for (int bits = 0; bits < 4; bits++)
+            {
+                wifi_sm_conditions_t conditions = {
+                    .roam_pending = (bits & 1) != 0,
+                    .fast_reconnect_ready = (bits & 2) != 0
+                };
+                check_transition((wifi_state_t)state, (wifi_sm_event_t)event, &conditions);
+                checked++;
+            }
+        }
+    }
+    TEST_CHECK_EQ(WIFI_STATE_MAX * WIFI_SM_EVENT_MAX * 4, checked);
+}
+
+/* Every row is reachable: none is hidden by a row before it */
+static void test_no_dead_rows(void)
+{
+    bool used[32] = { false };
+    TEST_CHECK(wifi_sm_table_size <= 32);
+    for (int state = 0; state < WIFI_STATE_MAX; state++)
+    {
+        for (int event = 0; event < WIFI_SM_EVENT_MAX; event++)
+        {
+            for (int bits = 0; bits < 4; bits++)
+            {
+                wifi_sm_conditions_t conditions = {
+                    .roam_pending = (bits & 1) != 0,
+                    .fast_reconnect_ready = (bits & 2) != 0
+                };
+                const wifi_sm_transition_t *row = wifi_sm_find((wifi_state_t)state, (wifi_sm_event_t)event,
+                    &conditions);
+                if (row != NULL)
+                {
+                    used[row - wifi_sm_table] = true;
+                }
+            }
+        }
+    }
+    for (size_t i = 0; i < wifi_sm_table_size; i++)
+    {
+        if (!used[i])
+        {
+            fprintf(stderr, "row %zu of the table is never taken\n", i);
+            sim_exit(1);
+        }
+    }
+}
+
+/* A roam wins over the fast reconnect, which wins over the backoff */
+static void test_disconnect_priority(void)
+{
+    const wifi_sm_conditions_t both = { .roam_pending = true, .fast_reconnect_ready = true };
+    const wifi_sm_conditions_t fast = { .roam_pending = false, .fast_reconnect_ready = true };
+    const wifi_sm_conditions_t none = { .roam_pending = false, .fast_reconnect_ready = false };
+    TEST_CHECK_EQ(WIFI_SM_ACTION_CONNECT_ROAM,
+        wifi_sm_find(WIFI_STATE_CONNECTED, WIFI_SM_EVENT_DISCONNECTED, &both)->action);
+    TEST_CHECK_EQ(WIFI_SM_ACTION_CONNECT_FAST,
+        wifi_sm_find(WIFI_STATE_CONNECTED, WIFI_SM_EVENT_DISCONNECTED, &fast)->action);
+    TEST_CHECK_EQ(WIFI_SM_ACTION_START_BACKOFF,
+        wifi_sm_find(WIFI_STATE_CONNECTED, WIFI_SM_EVENT_DISCONNECTED, &none)->action);
+    // A disconnect while backing off or scanning is the attempt that was already given up
+    TEST_CHECK(wifi_sm_find(WIFI_STATE_BACKOFF, WIFI_SM_EVENT_DISCONNECTED, &both) == NULL);
+    TEST_CHECK(wifi_sm_find(WIFI_STATE_SCANNING, WIFI_SM_EVENT_DISCONNECTED, &both) == NULL);
+}
+
+static const test_case_t tests[] = {
+    { "every_transition", test_every_transition },
+    { "no_dead_rows", test_no_dead_rows },
+    { "disconnect_priority", test_disconnect_priority },
+};
+
+int main(int argc, char **argv)
+{
+    return test_main(argc, argv, tests, sizeof(tests) / sizeof(tests[0]));
+}
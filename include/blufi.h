@@ -2,6 +2,41 @@
 
 #ifdef CONFIG_ESP_BLUFI_ENABLED
 
+#include "blufi_xfer.h"
+
+/** @brief Key negotiation methods measured by blufi_security_benchmark */
+typedef enum {
+    BLUFI_SEC_DH = 0,               /**< 1024 bit DH, the method of the stock BluFi apps */
+    BLUFI_SEC_ECDH_X25519,          /**< ECDH on Curve25519 */
+    BLUFI_SEC_ECDH_P256,            /**< ECDH on NIST P-256 */
+    BLUFI_SEC_MODE_MAX
+} blufi_sec_mode_t;
+
+/** @brief Cost of the device side of one key negotiation */
+typedef struct {
+    esp_err_t err;                  /**< ESP_OK, or ESP_FAIL if the method is not enabled in mbedtls */
+    uint32_t cpu_us;                /**< Time to make our key pair and compute the shared secret */
+    size_t heap_peak;               /**< Largest drop below the free heap at the start, see blufi_security_benchmark */
+} blufi_sec_bench_t;
+
+/** @brief Frame sizes measured by blufi_transport_benchmark: 16, 64, 128 and 255 bytes */
+#define BLUFI_TRANSPORT_BENCH_SIZES 4
+
+/** @brief Cost of one frame operation */
+typedef struct {
+    uint32_t bytes_per_sec;
+    uint32_t cycles_per_frame;
+} blufi_op_bench_t;
+
+/** @brief Cost of the operations every BluFi frame goes through, at one frame size */
+typedef struct {
+    uint16_t frame_len;
+    blufi_op_bench_t encrypt;       /**< blufi_aes_encrypt */
+    blufi_op_bench_t decrypt;       /**< blufi_aes_decrypt */
+    blufi_op_bench_t crc;           /**< blufi_crc_checksum */
+    blufi_op_bench_t crc_rom;       /**< esp_crc16_be in ROM, to compare with CONFIG_ESP_BLUFI_CRC_SLICE_BY_4 */
+} blufi_transport_bench_t;
+
 void blufi_dh_negotiate_data_handler(uint8_t *data, int len, uint8_t **output_data, int *output_len, bool *need_free);
 int blufi_aes_encrypt(uint8_t iv8, uint8_t *crypt_data, int crypt_len);
 int blufi_aes_decrypt(uint8_t iv8, uint8_t *crypt_data, int crypt_len);
@@ -9,8 +44,100 @@ uint16_t blufi_crc_checksum(uint8_t iv8, uint8_t *data, int len);
 
 int blufi_security_init(void);
 void blufi_security_deinit(void);
+/**
+ * @brief Runs the device side of each key negotiation method once and measures it. Takes a few seconds.
+ *
+ * The heap peak is sampled between the steps of each negotiation, and also taken from the heap low-water
+ * mark when a negotiation sets a new low. Other tasks allocating at the same time show up in it.
+ *
+ * @param results One entry per blufi_sec_mode_t
+ * @return ESP_OK, or ESP_ERR_NOT_SUPPORTED if CONFIG_ESP_BLUFI_SECURITY_BENCHMARK is not set
+ */
+esp_err_t blufi_security_benchmark(blufi_sec_bench_t results[BLUFI_SEC_MODE_MAX]);
+
+/**
+ * @brief Measures encryption, decryption and the checksum of BluFi frames at each of the benchmark frame sizes
+ *
+ * Uses the negotiated key during a BluFi session, or a random key outside one.
+ *
+ * @param results One entry per frame size
+ * @return ESP_OK, ESP_FAIL if blufi_crc_checksum does not match the ROM CRC, or ESP_ERR_NOT_SUPPORTED if
+ *         CONFIG_ESP_BLUFI_SECURITY_BENCHMARK is not set
+ */
+esp_err_t blufi_transport_benchmark(blufi_transport_bench_t results[BLUFI_TRANSPORT_BENCH_SIZES]);
 int esp_blufi_gap_register_callback(void);
+
+/**
+ * @brief Starts the command worker task. Called when BluFi is set up.
+ */
+void blufi_cmd_init(void);
+
+/**
+ * @brief Queues custom data from the phone as a command. Called on the Bluetooth stack task, only copies the data.
+ */
+void blufi_cmd_post(const uint8_t *data, uint32_t len);
+
+#ifdef CONFIG_ESP_BLUFI_XFER_ENABLED
+/**
+ * @brief Starts the bulk transfer task. Called when BluFi is set up.
+ */
+void blufi_xfer_init(void);
+
+/**
+ * @brief Returns true if custom data is a bulk transfer frame rather than a command.
+ */
+bool blufi_xfer_is_frame(const uint8_t *data, uint32_t len);
+
+/**
+ * @brief Queues a bulk transfer frame. Called on the Bluetooth stack task, only copies the frame.
+ */
+void blufi_xfer_post(const uint8_t *data, uint32_t len);
+
+/**
+ * @brief Queues a certificate or key (a blufi_cert_t) from the phone to be saved to NVS. The data is copied.
+ */
+void blufi_xfer_save_cert(blufi_cert_t type, const uint8_t *data, int len);
+
+/**
+ * @brief Records the phone's address, used to change the connection interval during a transfer.
+ */
+void blufi_xfer_connected(const uint8_t *bda);
+
+/**
+ * @brief Ends a transfer in progress when the phone disconnects.
+ */
+void blufi_xfer_disconnected(void);
+#else
+#define blufi_xfer_init()
+#define blufi_xfer_is_frame(data, len) false
+#define blufi_xfer_post(data, len)
+#define blufi_xfer_save_cert(type, data, len)
+#define blufi_xfer_connected(bda)
+#define blufi_xfer_disconnected()
+#endif
 esp_err_t esp_blufi_host_init(void);
 esp_err_t esp_blufi_host_and_cb_init(esp_blufi_callbacks_t *callbacks);
+esp_err_t esp_blufi_host_deinit(void);
+
+/**
+ * @brief Returns true while a phone is connected to BluFi.
+ */
+bool wifi_blufi_connected(void);
+
+#ifdef CONFIG_ESP_BLUFI_TEARDOWN_ENABLED
+/**
+ * @brief Reads the re-provision flag and starts watching the WIFI connection. Called when BluFi is set up.
+ */
+void blufi_teardown_init(void);
+
+/**
+ * @brief Called when the phone asks to connect to the network it sent, so a re-provisioning boot can tear
+ * BluFi down once that network is connected.
+ */
+void blufi_teardown_provisioned(void);
+#else
+#define blufi_teardown_init()
+#define blufi_teardown_provisioned()
+#endif
 
 #endif
@@ -0,0 +1,126 @@
+/*
+    BluFi bulk transfer
+
+    Streams blobs such as config bundles and certificates over BluFi custom data, into a data
+    partition. Every frame starts with an 8 byte header, all fields little endian:
+
+        0  magic (BLUFI_XFER_MAGIC)
+        1  type (BLUFI_XFER_xxx)
+        2  sequence number
+        4  payload length
+        6  CRC16 of the payload, as the BluFi checksum
+        8  payload
+
+    The phone sends START (seq 0, payload: uint32 length then the name), DATA with the next
+    sequence numbers, and END (payload: uint32 CRC32 of the blob, as esp_crc32_le). Up to
+    window frames may be unacknowledged. Every frame that is written is acknowledged with
+    ACK, and the ACK of START carries the window and the largest chunk as two uint16s. A
+    frame with a bad CRC or out of order is answered with NAK and the expected sequence
+    number, and the phone sends again from there. ERROR carries an esp_err_t and ends the
+    transfer.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef CONFIG_ESP_BLUFI_ENABLED
+
+#define BLUFI_XFER_MAGIC        0xB7
+#define BLUFI_XFER_HEADER_LEN   8
+#define BLUFI_XFER_NAME_LEN     16
+
+/* Frames from the phone */
+#define BLUFI_XFER_START        0x01
+#define BLUFI_XFER_DATA         0x02
+#define BLUFI_XFER_END          0x03
+#define BLUFI_XFER_ABORT        0x04
+/* Frames to the phone */
+#define BLUFI_XFER_ACK          0x81
+#define BLUFI_XFER_NAK          0x82
+#define BLUFI_XFER_ERROR        0x83
+
+/**
+ * @brief Certificates and keys sent with the standard BluFi certificate messages
+ */
+typedef enum {
+    BLUFI_CERT_CA = 0,
+    BLUFI_CERT_CLIENT,
+    BLUFI_CERT_SERVER,
+    BLUFI_KEY_CLIENT,
+    BLUFI_KEY_SERVER,
+    BLUFI_CERT_MAX
+} blufi_cert_t;
+
+/**
+ * @brief Bulk transfer statistics
+ */
+typedef struct {
+    uint32_t started;
+    uint32_t completed;
+    uint32_t failed;            /**< Aborted, disconnected, stalled or a bad blob CRC */
+    uint32_t bytes;             /**< Written to flash */
+    uint32_t crc_errors;        /**< Chunks with a bad CRC */
+    uint32_t seq_errors;        /**< Chunks out of order */
+    uint32_t dropped;           /**< Frames that arrived with the queue full */
+} blufi_xfer_stats_t;
+
+/**
+ * @brief Result of the loopback benchmark
+ */
+typedef struct {
+    uint32_t bytes;
+    uint32_t elapsed_ms;
+    uint32_t kbytes_per_sec;
+    uint32_t heap_peak;         /**< Largest drop below the free heap at the start, sampled after every frame */
+    uint32_t ram_bytes;         /**< Static RAM held by the transfer: the window queue, frame buffers and task stack */
+} blufi_xfer_bench_t;
+
+/**
+ * @brief Sets the callback called on the transfer task when a blob has been received and checked.
+ */
+void blufi_xfer_set_callback(void (*callback)(const char *name, size_t len));
+
+/**
+ * @brief Gets the name and length of the blob in the partition.
+ * @return ESP_OK, or ESP_ERR_NOT_FOUND if there is no complete blob
+ */
+esp_err_t blufi_xfer_get(char name[BLUFI_XFER_NAME_LEN], size_t *len);
+
+/**
+ * @brief Reads part of the blob in the partition.
+ */
+esp_err_t blufi_xfer_read(size_t offset, void *buf, size_t len);
+
+/**
+ * @brief Reads a certificate or key received over BluFi. As nvs_get_blob, buf may be NULL to get the length.
+ */
+esp_err_t blufi_get_cert(blufi_cert_t type, void *buf, size_t *len);
+
+/**
+ * @brief Copies the bulk transfer statistics into stats.
+ */
+void blufi_xfer_get_stats(blufi_xfer_stats_t *stats);
+
+/**
+ * @brief Sends a blob of total_len bytes through the receive path, with the replies looped back instead of
+ * sent to the phone. The blob is written to the partition, replacing the one there. Frames from a phone
+ * are dropped while it runs.
+ * @return ESP_OK, ESP_ERR_INVALID_STATE during a transfer or while a phone is connected, or
+ *         ESP_ERR_NOT_SUPPORTED if CONFIG_ESP_BLUFI_XFER_BENCHMARK is not set
+ */
+esp_err_t blufi_xfer_benchmark(size_t total_len, blufi_xfer_bench_t *result);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -8,6 +8,9 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+
 #if CONFIG_ESP_ETHERNET_ENABLED
 
 // Ethernet Monitor Thread
@@ -32,6 +35,11 @@ void ethernet_setup(void);
  */
 void ethernet_waitforconnect(void);
 
+/**
+ * @brief Same as ethernet_waitforconnect, but gives up after timeout ticks. Returns true if connected.
+ */
+bool ethernet_waitforconnect_timeout(TickType_t timeout);
+
 /**
  * Sets the callback when the Ethernet connection is made and an IP number is assigned. It is intended to change
  * the status of LED's,  but can be used for anything. The callback should do processing quickly and return.
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_netif.h"
+#include "freertos/FreeRTOS.h"
 #include "wifi.h"
 #include "ethernet.h"
 
@@ -7,19 +11,222 @@
 extern "C" {
 #endif
 
+/* Interface flags for network_wait */
+#define NETWORK_IF_WIFI         (1 << 0)
+#define NETWORK_IF_ETHERNET     (1 << 1)
+#define NETWORK_IF_ANY          (NETWORK_IF_WIFI | NETWORK_IF_ETHERNET)
+/* Wait for all of the given interfaces instead of any one of them */
+#define NETWORK_WAIT_ALL        (1 << 7)
+
+/**
+ * @brief Events delivered to subscribers. Used as a mask for network_subscribe.
+ */
+typedef enum {
+    NETWORK_EVENT_CONNECTED         = (1 << 0),     // Interface has an IP number
+    NETWORK_EVENT_DISCONNECTED      = (1 << 1),     // Interface lost its connection
+    NETWORK_EVENT_LINK_LOCAL        = (1 << 2),     // DHCP failed, only a link local address was assigned
+    NETWORK_EVENT_ACTIVE_CHANGED    = (1 << 3),     // The default route moved to iface (0 if none)
+    NETWORK_EVENT_LINK_DEAD         = (1 << 4),     // The health probe found the interface is not passing traffic
+} network_event_t;
+
+#define NETWORK_EVENT_ALL           0xFF
+
+/**
+ * @brief Payload of a network event. Fields that do not apply to the event are 0.
+ */
+typedef struct {
+    network_event_t event;
+    uint32_t iface;                 // NETWORK_IF_xxx
+    esp_netif_ip_info_t ip_info;    // CONNECTED and LINK_LOCAL
+    uint8_t reason;                 // DISCONNECTED: the WIFI disconnect reason
+    int8_t rssi;                    // WIFI CONNECTED: the RSSI of the AP
+    int64_t timestamp_us;           // esp_timer_get_time when the event happened
+    int64_t connected_us;           // DISCONNECTED: esp_timer_get_time when the interface connected
+} network_event_data_t;
+
+/**
+ * @brief Subscriber callback. Called on a task of the network component, so it should return quickly. The
+ * event is only valid during the call.
+ */
+typedef void (*network_event_cb_t)(const network_event_data_t *event, void *ctx);
+
+/**
+ * @brief Connection phases timed by the phase tracer
+ */
+typedef enum {
+    NETWORK_PHASE_WIFI_SCAN = 0,    // Scan start to scan done
+    NETWORK_PHASE_WIFI_ASSOCIATE,   // WIFI connect started to associated with the AP
+    NETWORK_PHASE_WIFI_DHCP,        // Associated with the AP to IP number assigned
+    NETWORK_PHASE_WIFI_TOTAL,       // WIFI connect started to IP number assigned
+    NETWORK_PHASE_ETH_DHCP,         // Ethernet link up to IP number assigned
+    NETWORK_PHASE_BLUFI_CALLBACK,   // Time spent in the BluFi event callback, on the Bluetooth stack task
+    NETWORK_PHASE_MAX
+} network_phase_t;
+
+/**
+ * @brief Timing histogram for one phase. The percentiles are calculated over the most recent samples
+ * kept in the ring buffer (CONFIG_ESP_NETWORK_TRACE_SAMPLES). All times are in microseconds.
+ */
+typedef struct {
+    uint32_t count;         // Number of times the phase was recorded since boot or the last reset
+    uint32_t samples;       // Number of samples the histogram was calculated from
+    uint32_t min_us;
+    uint32_t p50_us;
+    uint32_t p99_us;
+    uint32_t max_us;
+} network_phase_stats_t;
+
+/**
+ * @brief Address state of an interface
+ */
+typedef enum {
+    NETWORK_LINK_DOWN = 0,          // Not connected
+    NETWORK_LINK_LOCAL_ONLY,        // Connected, but DHCP failed and only a 169.254.x.x address is assigned
+    NETWORK_LINK_UP                 // Connected with a routable address
+} network_link_state_t;
+
+/**
+ * @brief Time spent with only a link local address. total_ms includes the current stay.
+ */
+typedef struct {
+    uint32_t entries;               // Number of times the interface ended up link local only
+    uint32_t dhcp_retries;          // Number of times DHCP was restarted to get out of it
+    uint64_t total_ms;
+} network_link_local_stats_t;
+
+/**
+ * @brief Result of the connectivity health probe for one interface. Times are in microseconds.
+ */
+typedef struct {
+    bool alive;                     // false while the interface is connected but not passing traffic
+    uint32_t probes;                // Probes sent
+    uint32_t lost;                  // Probes without a reply
+    uint8_t loss_percent;           // Loss over the last 32 probes
+    uint32_t rtt_last_us;
+    uint32_t rtt_avg_us;            // Moving average
+    uint32_t rtt_max_us;
+    uint32_t failures;              // Consecutive probe rounds without a reply
+    uint32_t dead_count;            // Number of times the link was declared dead
+} network_health_t;
+
+/**
+ * @brief Event dispatcher statistics. Latency is from the event on the default event loop to the start of the
+ * handler on the dispatcher task.
+ */
+typedef struct {
+    uint32_t dispatched;            // Events handled
+    uint32_t dropped;               // Events lost because the queue was full
+    uint32_t max_depth;             // Most events waiting at once
+    uint32_t max_latency_us;
+    uint32_t max_handler_us;        // Longest time spent in a handler
+} network_dispatch_stats_t;
+
+/**
+ * @brief Failover state. A switchover is counted when the interface carrying the default route is lost and
+ * the default route is moved to another interface. The latency is from the loss, when the link goes down or
+ * the first health probe round fails, until traffic flows on the other interface: the first health probe
+ * reply through it. Without the health probe it ends when the other interface becomes the default.
+ */
+typedef struct {
+    uint32_t active;        // NETWORK_IF_xxx carrying the default route, 0 if none
+    uint32_t switchovers;
+    uint32_t last_us;
+    uint32_t max_us;
+} network_failover_stats_t;
+
 /**
- * @brief Sets up the wifi API and must be called once and only once per application. Typically called
- * in the app_main function and must be called before calling wifi_connect.
+ * @brief Faults that can be injected for testing reconnect behaviour on a device
+ */
+typedef enum {
+    NETWORK_FAULT_WIFI_DISCONNECT = 0,  // Drop the WIFI connection. arg is the disconnect reason to report.
+    NETWORK_FAULT_ETH_LINK_DOWN,        // Stop the Ethernet driver as if the cable was pulled
+    NETWORK_FAULT_ETH_LINK_UP,          // Start the Ethernet driver again
+    NETWORK_FAULT_DHCP_DELAY,           // Hold DHCP for arg milliseconds on every connect. 0 turns it off.
+} network_fault_t;
+
+/**
+ * @brief One step of a fault script. The fault is injected and then the script waits delay_ms.
+ */
+typedef struct {
+    network_fault_t fault;
+    uint32_t arg;
+    uint32_t delay_ms;
+} network_fault_step_t;
+
+/**
+ * @brief Sets up and starts WIFI and Ethernet, which then connect at the same time. Must be called once and only
+ * once per application, typically in the app_main function. Use network_wait to wait for an IP number.
  */
 void network_setup(void);
 
 /**
- * @brief Monitors the WIFI and Ethernet queues and waits for an IP number to be assigned to one or both. If already connected,
- * the call just exits. This function can be used to ensure a connection is setup and an IP number has been
- * assigned.
+ * @brief Waits for an IP number to be assigned to either WIFI or Ethernet, whichever is first. If already connected, the call just exits. This function can be used to ensure a connection
+ * is setup and an IP number has been assigned.
  */
 void network_waitforconnect(void);
 
+/**
+ * @brief Waits until the interfaces in flags have an IP number. flags is NETWORK_IF_WIFI, NETWORK_IF_ETHERNET or
+ * NETWORK_IF_ANY. By default any one of the interfaces is enough, add NETWORK_WAIT_ALL to wait for all of them.
+ * Returns ESP_OK when connected or ESP_ERR_TIMEOUT if timeout ticks passed first. Use portMAX_DELAY to wait forever.
+ */
+esp_err_t network_wait(uint32_t flags, TickType_t timeout);
+
+/**
+ * @brief Returns the NETWORK_IF_xxx flags of the interfaces that currently have an IP number.
+ */
+uint32_t network_connected_interfaces(void);
+
+/**
+ * @brief Returns the address state of one interface (NETWORK_IF_WIFI or NETWORK_IF_ETHERNET). When DHCP fails and
+ * only a link local address is assigned, the state is NETWORK_LINK_LOCAL_ONLY and DHCP is retried in the background.
+ */
+network_link_state_t network_get_link_state(uint32_t iface);
+
+/**
+ * @brief Copies the link local statistics for one interface into stats.
+ */
+void network_get_link_local_stats(uint32_t iface, network_link_local_stats_t *stats);
+
+/**
+ * @brief Returns the NETWORK_IF_xxx flag of the interface carrying the default route, or 0 if none.
+ * The preferred interface is set in menuconfig.
+ */
+uint32_t network_active_interface(void);
+
+/**
+ * @brief Copies the failover state and switchover latency into stats.
+ */
+void network_get_failover_stats(network_failover_stats_t *stats);
+
+/**
+ * @brief Copies the event dispatcher statistics into stats. Returns ESP_ERR_NOT_SUPPORTED if the dispatcher is
+ * disabled in menuconfig.
+ */
+esp_err_t network_get_dispatch_stats(network_dispatch_stats_t *stats);
+
+/**
+ * @brief Copies the health probe results for one interface (NETWORK_IF_WIFI or NETWORK_IF_ETHERNET) into health.
+ * Returns ESP_ERR_NOT_SUPPORTED if the health probe is disabled in menuconfig.
+ */
+esp_err_t network_get_health(uint32_t iface, network_health_t *health);
+
+/**
+ * @brief Changes the time between health probes. 0 pauses probing, for example while in a low power mode.
+ */
+esp_err_t network_set_health_interval(uint32_t interval_s);
+
+/**
+ * @brief Subscribes to the network events in mask (NETWORK_EVENT_xxx or NETWORK_EVENT_ALL). ctx is passed to
+ * the callback. The subscriber table is fixed in size (menuconfig), ESP_ERR_NO_MEM is returned when it is full.
+ */
+esp_err_t network_subscribe(network_event_cb_t callback, void *ctx, uint32_t mask);
+
+/**
+ * @brief Removes a subscription made with the same callback and ctx.
+ */
+esp_err_t network_unsubscribe(network_event_cb_t callback, void *ctx);
+
 /**
  * Sets the callback when the WIFI and/or Ethernet connection is made and an IP number is assigned. It is intended to change
  * the status of LED's,  but can be used for anything. The callback should do processing quickly and return.
@@ -34,6 +241,29 @@ void set_network_led_disconnected_callback(void (*callback)());
  */
 void set_network_led_connected_callback(void (*callback)());
 
+/**
+ * @brief Copies the timing histogram for a connection phase into stats. Returns ESP_ERR_NOT_SUPPORTED if the
+ * phase tracer is disabled in menuconfig.
+ */
+esp_err_t network_get_phase_stats(network_phase_t phase, network_phase_stats_t *stats);
+
+/**
+ * @brief Clears the timing samples for all phases.
+ */
+void network_reset_phase_stats(void);
+
+/**
+ * @brief Injects a fault. Only available when CONFIG_ESP_NETWORK_FAULT_INJECTION is enabled, otherwise
+ * ESP_ERR_NOT_SUPPORTED is returned. Intended for testing only.
+ */
+esp_err_t network_inject_fault(network_fault_t fault, uint32_t arg);
+
+/**
+ * @brief Runs a script of faults in the calling task. Combined with network_get_phase_stats and
+ * wifi_get_reconnect_stats, this measures connect and reconnect times for flaky network scenarios.
+ */
+esp_err_t network_run_fault_script(const network_fault_step_t *steps, int count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,190 @@
+/*
+    Internal interfaces shared by the network component. Not for application use.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_netif.h"
+#include "esp_event.h"
+#include "network.h"
+
+/**
+ * @brief Registers an event handler for the component. With the dispatcher enabled, the handler runs on the
+ * dispatcher task instead of the default event loop, and gets a copy of the event data. Only the event data
+ * types listed in net_dispatch.c are copied, other events get NULL.
+ */
+esp_err_t net_dispatch_register(esp_event_base_t base, int32_t id, esp_event_handler_t handler, void *arg);
+
+/**
+ * @brief Removes a handler registered with net_dispatch_register. Events already queued for it are dropped.
+ */
+esp_err_t net_dispatch_unregister(esp_event_base_t base, int32_t id, esp_event_handler_t handler);
+
+/**
+ * @brief Runs fn on the task that runs the component's event handlers, after the events already queued, and
+ * waits for it to return. Nothing else the handlers use changes under them while fn runs. Must not be called
+ * from an event handler.
+ */
+esp_err_t net_dispatch_call(void (*fn)(void *arg), void *arg);
+
+/**
+ * @brief Sets or clears the connected bit for an interface (NETWORK_IF_xxx) in the network event group.
+ */
+void network_set_connected(uint32_t iface, bool connected);
+
+/**
+ * @brief Delivers an event to the subscribers. ip_info may be NULL.
+ */
+void net_event_publish(network_event_t event, uint32_t iface, const esp_netif_ip_info_t *ip_info, uint8_t reason,
+    int8_t rssi);
+
+/**
+ * @brief Picks the interface for the default route from the NETWORK_IF_xxx flags of the connected interfaces.
+ * Has no side effects so the policy can be checked on its own.
+ */
+uint32_t net_failover_select(uint32_t connected, uint32_t preferred);
+
+/**
+ * @brief Moves the default netif to the best connected interface. Called when an interface connects or
+ * disconnects.
+ */
+void net_failover_update(uint32_t connected);
+
+/**
+ * @brief Starts the switchover clock at lost_us if iface carries the default route: its link went down or a
+ * health probe round through it failed. Ignored for a standby interface.
+ */
+void net_failover_lost(uint32_t iface, int64_t lost_us);
+
+/**
+ * @brief A health probe got a reply through iface. Stops the switchover clock if iface is the new default, or
+ * clears it if iface was never switched away from.
+ */
+void net_failover_traffic(uint32_t iface);
+
+/**
+ * @brief Applies a static or cached address to an interface. Called when the interface connects (associated
+ * or link up), after the default handler has started DHCP.
+ */
+void net_ip_apply(uint32_t iface, esp_netif_t *netif);
+
+/**
+ * @brief Saves the lease when DHCP assigns an address. Returns true if this was DHCP confirming the cached
+ * address that is already in use, in which case the connection has already been reported.
+ */
+bool net_ip_got_ip(uint32_t iface, esp_netif_t *netif, const esp_netif_ip_info_t *ip_info);
+
+/**
+ * @brief Updates the link state of an interface. Entering NETWORK_LINK_LOCAL_ONLY starts restarting DHCP on a
+ * backoff schedule until a routable address is assigned or the link goes down.
+ */
+void net_ip_set_link_state(uint32_t iface, esp_netif_t *netif, network_link_state_t state);
+
+/**
+ * @brief Returns true if a link local address should be reported as connected (menuconfig option).
+ */
+bool net_ip_link_local_allowed(void);
+
+/**
+ * @brief Replaces the netif kept for an interface, when it has been destroyed and created again. The link is
+ * down until the new netif connects.
+ */
+void net_ip_set_netif(uint32_t iface, esp_netif_t *netif);
+
+#if CONFIG_ESP_WIFI_ENABLED
+esp_netif_t *wifi_get_netif(void);
+
+/**
+ * @brief Drops the WIFI connection so the reconnect task connects again.
+ */
+void wifi_force_reconnect(void);
+
+/**
+ * @brief Sets the listen interval in the station config. 0 is the driver default. Takes effect on the next
+ * association. Returns true if the interval changed.
+ */
+bool wifi_set_listen_interval(uint16_t interval);
+
+/**
+ * @brief Applies the current power profile. Called when the driver starts. Falls back to the balanced profile
+ * if the profile can not be used with Bluetooth enabled.
+ */
+void wifi_power_apply(void);
+
+#ifdef CONFIG_ESP_WIFI_ROAM_ENABLED
+/**
+ * @brief Starts the roaming monitor. Called when WIFI starts.
+ */
+void wifi_roam_init(void);
+
+/**
+ * @brief Moves the connection to another AP of the same network. The reconnect task connects to it.
+ */
+void wifi_roam_to(const uint8_t *bssid, uint8_t channel);
+#else
+#define wifi_roam_init()
+#endif
+#endif
+
+#if CONFIG_ESP_ETHERNET_ENABLED
+esp_netif_t *ethernet_get_netif(void);
+#endif
+
+#ifdef CONFIG_ESP_NETWORK_TRACE_ENABLED
+/**
+ * @brief Records the time from start_us (esp_timer_get_time) until now for a phase. Does nothing if
+ * start_us is 0. Safe to call from the event loop, no locks or heap are used.
+ */
+void net_trace_record(network_phase_t phase, int64_t start_us);
+#else
+#define net_trace_record(phase, start_us)
+#endif
+
+#ifdef CONFIG_ESP_NETWORK_HEALTH_ENABLED
+/**
+ * @brief Starts the health probe task.
+ */
+void net_health_start(void);
+
+/**
+ * @brief Runs a probe round now instead of at the end of the interval. Used to confirm a new default interface.
+ */
+void net_health_probe_now(void);
+#else
+#define net_health_start()
+#define net_health_probe_now()
+#endif
+
+#ifdef CONFIG_ESP_NETWORK_FAULT_INJECTION
+/**
+ * @brief Called when an interface connects. If a DHCP delay is being injected, stops the DHCP client and
+ * starts it again after the delay.
+ */
+void net_fault_dhcp_hold(esp_netif_t *netif);
+
+/**
+ * @brief Moves a DHCP hold from a netif that is being destroyed to the one that replaces it.
+ */
+void net_fault_netif_replaced(esp_netif_t *old_netif, esp_netif_t *new_netif);
+
+#if CONFIG_ESP_WIFI_ENABLED
+/**
+ * @brief Drops the WIFI connection and reports reason in the disconnect event.
+ */
+void wifi_inject_disconnect(uint8_t reason);
+#endif
+
+#if CONFIG_ESP_ETHERNET_ENABLED
+/**
+ * @brief Stops or starts the Ethernet driver, as if the cable was pulled or plugged in.
+ */
+void ethernet_inject_link(bool up);
+#endif
+#else
+#define net_fault_dhcp_hold(netif)
+#define net_fault_netif_replaced(old_netif, new_netif)
+#endif
@@ -0,0 +1,78 @@
+/*
+    Retry policy for network reconnects
+
+    (C) 2020 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief How the delay between retries grows
+ */
+typedef enum {
+    RETRY_POLICY_FIXED = 0,         // Always wait base_ms
+    RETRY_POLICY_EXPONENTIAL,       // Double the delay each retry, starting at base_ms, up to max_ms
+    RETRY_POLICY_CUSTOM             // The custom callback returns the delay
+} retry_policy_type_t;
+
+/**
+ * @brief Random jitter applied to the delay so a fleet of devices does not retry in lockstep
+ */
+typedef enum {
+    RETRY_JITTER_NONE = 0,          // Use the delay as is
+    RETRY_JITTER_FULL,              // Random delay between 0 and the computed delay
+    RETRY_JITTER_DECORRELATED       // Random delay between base_ms and 3 times the previous delay, capped at max_ms
+} retry_jitter_t;
+
+/**
+ * @brief Callback for RETRY_POLICY_CUSTOM. attempt starts at 0 and prev_delay_ms is the last delay returned.
+ */
+typedef uint32_t (*retry_policy_fn_t)(uint32_t attempt, uint32_t prev_delay_ms, void *ctx);
+
+typedef struct {
+    retry_policy_type_t type;
+    retry_jitter_t jitter;
+    bool immediate_first;           // The first retry after a reset has no delay
+    uint32_t base_ms;
+    uint32_t max_ms;                // 0 means no cap
+    retry_policy_fn_t custom;       // Only used for RETRY_POLICY_CUSTOM
+    void *custom_ctx;
+} retry_policy_config_t;
+
+/**
+ * @brief Retry policy state. The policy has no clock and no platform dependencies, it only
+ * computes delays, so it can be run on a host with a simulated clock.
+ */
+typedef struct {
+    retry_policy_config_t config;
+    uint32_t attempt;
+    uint32_t prev_ms;
+    uint32_t rng;
+} retry_policy_t;
+
+/**
+ * @brief Initialises the policy with a config. seed is used for jitter and should come from
+ * esp_fill_random on the device. A zero seed is replaced with a fixed non-zero one.
+ */
+void retry_policy_init(retry_policy_t *policy, const retry_policy_config_t *config, uint32_t seed);
+
+/**
+ * @brief Returns the delay in milliseconds to wait before the next retry and advances the attempt count.
+ */
+uint32_t retry_policy_next_ms(retry_policy_t *policy);
+
+/**
+ * @brief Resets the attempt count. Call after a successful connection.
+ */
+void retry_policy_reset(retry_policy_t *policy);
+
+#ifdef __cplusplus
+}
+#endif
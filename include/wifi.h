@@ -9,8 +9,15 @@
 
 #pragma once
 
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
 #if CONFIG_ESP_WIFI_ENABLED
 
+#include "retry_policy.h"
+
 // WIFI Monitor Thread
 #define THREAD_WIFI_NAME "wifi_connected"
 #define THREAD_WIFI_STACKSIZE configMINIMAL_STACK_SIZE * 4
@@ -24,15 +31,181 @@ extern "C" {
 
 /**
  * @brief BluFi offers custom text, and we use it for commands
- * Struct holds the command text and the callback to call for the command
+ * Struct holds the command text and the callback to call for the command. The text is split into arguments
+ * at spaces, and the first is the command. Commands run on the BluFi command task, and the result is sent
+ * back to the phone as custom data: "<command>: OK", "<command>: <reply>" or "<command>: <error name>".
  */
 typedef struct bluficmd {
     const char* command;
-    void (*cmd_callback)();
+    void (*cmd_callback)();                         /**< Called with no arguments if handler is NULL */
+    esp_err_t (*handler)(int argc, char **argv, char *reply, size_t reply_len); /**< argv[0] is the command */
+    uint32_t timeout_ms;                            /**< 0 for CONFIG_ESP_BLUFI_CMD_TIMEOUT_MS */
 } bluficmd_t;
 
+/**
+ * @brief BluFi command statistics
+ */
+typedef struct {
+    uint32_t received;          /**< Custom data messages from the phone */
+    uint32_t executed;          /**< Commands run, including the custom command callback */
+    uint32_t unknown;           /**< Commands not in the command set, with no custom command callback */
+    uint32_t dropped;           /**< Too long, or the queue was full */
+    uint32_t timeouts;          /**< Commands that ran past their timeout */
+    uint32_t max_wait_ms;       /**< Longest time a command waited in the queue */
+    uint32_t max_run_ms;        /**< Longest time a command ran */
+} blufi_cmd_stats_t;
+
+/**
+ * @brief Result of releasing Bluetooth after provisioning
+ */
+typedef struct {
+    bool torn_down;             /**< BluFi, Bluedroid and the controller have been shut down */
+    uint32_t heap_reclaimed;    /**< Free heap gained, in bytes */
+    uint32_t teardown_ms;       /**< Time the shutdown took */
+} blufi_teardown_stats_t;
+
 #endif
 
+/**
+ * @brief How a reconnect was made after the WIFI connection dropped
+ */
+typedef enum {
+    WIFI_RECONNECT_PATH_FAST = 0,   // Reconnect to the last AP's BSSID on its channel, no scan
+    WIFI_RECONNECT_PATH_FULL_SCAN,  // Reconnect after a scan of all channels
+    WIFI_RECONNECT_PATH_ROAM,       // Move to a stronger AP of the same network, started by the roaming monitor
+    WIFI_RECONNECT_PATH_MAX
+} wifi_reconnect_path_t;
+
+/**
+ * @brief Reconnect latency for one reconnect path. Latency is measured from the time the disconnect
+ * is handled until an IP number is assigned again.
+ */
+typedef struct {
+    uint32_t count;         // Number of successful reconnects using this path
+    uint32_t failures;      // Number of attempts using this path that did not connect
+    uint32_t last_ms;
+    uint32_t min_ms;
+    uint32_t max_ms;
+    uint64_t total_ms;      // Divide by count for the mean
+} wifi_reconnect_stats_t;
+
+/**
+ * @brief Roaming statistics. The roam latency is in the WIFI_RECONNECT_PATH_ROAM reconnect stats.
+ */
+typedef struct {
+    uint32_t roams;                 // Moves to another AP started by the roaming monitor
+    uint32_t sweeps;                // Background scans for a better AP
+    uint32_t btm_queries;           // 802.11v BSS transition queries sent to the AP
+    uint64_t below_threshold_ms;    // Time connected with the RSSI below the roaming threshold
+} wifi_roam_stats_t;
+
+/**
+ * @brief States of the WIFI connection state machine
+ */
+typedef enum {
+    WIFI_STATE_IDLE = 0,        // wifi_connect not called yet, or the driver has not started
+    WIFI_STATE_SCANNING,        // Scanning to pick the best stored network
+    WIFI_STATE_ASSOCIATING,     // Connecting to an AP
+    WIFI_STATE_DHCP,            // Associated, waiting for an IP number
+    WIFI_STATE_CONNECTED,       // Associated with an IP number
+    WIFI_STATE_BACKOFF,         // Waiting for the retry delay before reconnecting
+    WIFI_STATE_DISABLED,        // wifi_disable was called, no reconnects are made
+    WIFI_STATE_MAX
+} wifi_state_t;
+
+/**
+ * @brief Time spent in one state of the connection state machine
+ */
+typedef struct {
+    uint32_t entries;       // Number of times the state was entered
+    uint32_t last_ms;       // Time spent in the state the last time it was left
+    uint64_t total_ms;      // Total time in the state, including the current period
+} wifi_state_stats_t;
+
+/**
+ * @brief Resource use over wifi_start/wifi_stop cycles. Updated by wifi_stop.
+ */
+typedef struct {
+    uint32_t starts;
+    uint32_t stops;
+    int32_t heap_delta_last;        // Free heap after the last wifi_stop minus before its wifi_start
+    int32_t heap_drift;             // Free heap after the last wifi_stop minus after the first one. Negative is a leak.
+    uint32_t min_free_heap;         // Lowest free heap since boot
+    uint32_t stack_high_water;      // Least unused stack of the WIFI task
+} wifi_lifecycle_stats_t;
+
+/**
+ * @brief Called from the duty cycle task once WIFI is connected in a window. remaining_ms is what is left of
+ * the window's budget. WIFI is stopped when the callback returns.
+ */
+typedef void (*wifi_duty_cb_t)(uint32_t remaining_ms, void *ctx);
+
+/**
+ * @brief Duty cycle schedule
+ */
+typedef struct {
+    uint32_t period_s;          // Time between windows, 0 for windows on wifi_duty_trigger only
+    uint32_t budget_ms;         // Radio on time allowed per window, 0 for the menuconfig default
+    wifi_duty_cb_t callback;
+    void *ctx;
+} wifi_duty_config_t;
+
+/**
+ * @brief Radio on time of the duty cycle windows
+ */
+typedef struct {
+    uint32_t windows;
+    uint32_t failures;          // Windows that did not connect within the budget
+    uint32_t overruns;          // Windows where the radio was on longer than the budget
+    uint32_t last_connect_ms;   // Time from turning the radio on to connected, in the last window that connected
+    uint32_t last_on_ms;
+    uint32_t max_on_ms;
+    uint64_t total_on_ms;       // Total radio on time. Multiply by the radio current for the charge used.
+} wifi_duty_stats_t;
+
+/**
+ * @brief Power save profiles
+ */
+typedef enum {
+    WIFI_POWER_LOW_LATENCY = 0,     // No power save. Not available while Bluetooth is enabled.
+    WIFI_POWER_BALANCED,            // Minimum modem power save, wakes for every DTIM
+    WIFI_POWER_LOW_POWER,           // Maximum modem power save with the listen interval set in menuconfig
+    WIFI_POWER_PROFILE_MAX
+} wifi_power_profile_t;
+
+/**
+ * @brief Results of the power profile benchmark for one profile
+ */
+typedef struct {
+    wifi_power_profile_t profile;
+    esp_err_t err;                  // ESP_OK if the profile was measured
+    uint32_t ping_sent;
+    uint32_t ping_received;
+    uint32_t rtt_avg_ms;
+    uint32_t rtt_max_ms;
+    uint32_t tcp_kbps;              // TCP upload throughput
+} wifi_power_bench_t;
+
+/**
+ * @brief Stages of the recovery ladder, used when WIFI keeps failing to connect
+ */
+typedef enum {
+    WIFI_RECOVERY_RECONNECT = 0,    // Normal reconnect attempts
+    WIFI_RECOVERY_DRIVER_RESTART,   // esp_wifi_stop and esp_wifi_start
+    WIFI_RECOVERY_RADIO_REINIT,     // Driver deinit and init, which powers the PHY down and calibrates it again
+    WIFI_RECOVERY_NETIF_RECREATE,   // The netif is destroyed and created again as well
+    WIFI_RECOVERY_REBOOT,           // Restart the device (if enabled in menuconfig)
+    WIFI_RECOVERY_STAGE_MAX
+} wifi_recovery_stage_t;
+
+/**
+ * @brief Outcomes of one recovery stage
+ */
+typedef struct {
+    uint32_t attempts;      // Times the stage was run
+    uint32_t successes;     // Times the connection came back with this as the highest stage run
+} wifi_recovery_stats_t;
+
 /**
  * @brief Sets up the wifi API and must be called once and only once per application. Typically called
  * in the app_main function and must be called before calling wifi_connect.
@@ -40,12 +213,35 @@ typedef struct bluficmd {
 void wifi_setup(void);
 
 /**
- * @brief Setup up the WIFI api to connect to a station and starts the wifi monitoring thread. This must
- * not be called more than once in an applicaton unless wifi_disable is called. No checks are made to 
- * ensure proper call order.
+ * @brief Setup up the WIFI api to connect to a station and starts the wifi monitoring thread. Same as
+ * wifi_start.
  */
 void wifi_connect(void);
 
+/**
+ * @brief Starts the WIFI driver and connects. The netif, driver, handlers and task are created on the first
+ * call and reused after that, so WIFI can be started and stopped any number of times. Also turns reconnects
+ * back on after wifi_disable.
+ */
+esp_err_t wifi_start(void);
+
+/**
+ * @brief Disconnects and stops the WIFI driver, which turns the radio off. No reconnects are made until
+ * wifi_start is called.
+ */
+esp_err_t wifi_stop(void);
+
+/**
+ * @brief Stops WIFI if needed and frees everything created by wifi_start: the state machine task, the event
+ * handlers, the driver and the netif. wifi_start can be called again afterwards.
+ */
+esp_err_t wifi_deinit(void);
+
+/**
+ * @brief Copies the heap and stack use over the wifi_start/wifi_stop cycles into stats.
+ */
+void wifi_get_lifecycle_stats(wifi_lifecycle_stats_t *stats);
+
 /**
  * @brief Monitors the wifi queue and waits for the connection to an AP to be created. If already connected,
  * the call just exits. This function can be used to ensure a connection to an AP and an IP number has been
@@ -54,9 +250,15 @@ void wifi_connect(void);
 void wifi_waitforconnect(void);
 
 /**
- * @brief Disables the wifi reconnect thread and causes if to exit when the wifi connnection drops.
- * The function is intended to be called when the device is shutdown or wifi_discconnect is called
- * when reconnection is not desired. wifi_connect must be called again to setup the wifi connection.
+ * @brief Same as wifi_waitforconnect, but gives up after timeout ticks. Returns true if connected.
+ */
+bool wifi_waitforconnect_timeout(TickType_t timeout);
+
+/**
+ * @brief Stops the wifi reconnects. Any pending retry or scan is cancelled before the function returns, so
+ * a wifi_disconnect that follows is not reconnected. The function is intended to be called when the
+ * device is shutdown or wifi_discconnect is called when reconnection is not desired. wifi_connect must be
+ * called again to setup the wifi connection.
  */
 void wifi_disable();
 
@@ -83,12 +285,118 @@ void set_wifi_led_connected_callback(void (*callback)());
 void set_wifi_led_disconnected_callback(void (*callback)());
 
 /**
- * @brief Register a blufi command set
+ * @brief Replaces the retry policy used between reconnect attempts. Passing NULL restores the policy
+ * configured in menuconfig. The jitter is seeded from esp_fill_random.
+ */
+void wifi_set_retry_policy(const retry_policy_config_t *config);
+
+/**
+ * @brief Copies the reconnect latency statistics for the given reconnect path into stats.
+ */
+void wifi_get_reconnect_stats(wifi_reconnect_path_t path, wifi_reconnect_stats_t *stats);
+
+/**
+ * @brief Stops WIFI and starts the duty cycle task, which turns WIFI on for one window every period_s. NULL
+ * uses the schedule set in menuconfig with no callback. Do not use wifi_connect or network_waitforconnect
+ * while it runs.
+ */
+esp_err_t wifi_duty_start(const wifi_duty_config_t *config);
+
+/**
+ * @brief Opens a window now. The next scheduled window is a full period after it.
+ */
+esp_err_t wifi_duty_trigger(void);
+
+/**
+ * @brief Stops the duty cycle task after any window in progress. WIFI is left stopped.
+ */
+esp_err_t wifi_duty_stop(void);
+
+/**
+ * @brief Copies the duty cycle window statistics into stats.
+ */
+void wifi_duty_get_stats(wifi_duty_stats_t *stats);
+
+/**
+ * @brief Switches the power save profile at run time, e.g. to low latency for an OTA update. Returns
+ * ESP_ERR_NOT_SUPPORTED for the low latency profile while Bluetooth is enabled. Called before WIFI starts,
+ * the profile is applied when it does. The AP only takes a new listen interval when the station associates, so
+ * switching to or from the low power profile while connected drops the connection and reconnects to the same AP.
+ */
+esp_err_t wifi_set_power_profile(wifi_power_profile_t profile);
+
+/**
+ * @brief Returns the current power save profile.
+ */
+wifi_power_profile_t wifi_get_power_profile(void);
+
+/**
+ * @brief Measures ping round trip time and TCP upload throughput to a server on the local network under each
+ * power profile, one entry per profile in results. host is an IPv4 address and port a TCP port that accepts
+ * and discards data. WIFI must be connected. Each profile is measured after the reassociation its listen
+ * interval needs. The current profile is restored afterwards. Only available with the benchmark enabled in
+ * menuconfig.
  */
+esp_err_t wifi_power_benchmark(const char *host, uint16_t port, wifi_power_bench_t results[WIFI_POWER_PROFILE_MAX]);
+
+/**
+ * @brief Copies the statistics of one recovery stage into stats. The reboot stage is not counted, as the
+ * counts do not survive it.
+ */
+void wifi_get_recovery_stats(wifi_recovery_stage_t stage, wifi_recovery_stats_t *stats);
+
+/**
+ * @brief Returns the state of the WIFI connection state machine.
+ */
+wifi_state_t wifi_get_state(void);
+
+/**
+ * @brief Copies the time spent in the given state into stats.
+ */
+void wifi_get_state_stats(wifi_state_t state, wifi_state_stats_t *stats);
+
+/**
+ * @brief Copies the roaming statistics into stats. below_threshold_ms includes the current period.
+ */
+void wifi_get_roam_stats(wifi_roam_stats_t *stats);
+
 #ifdef CONFIG_ESP_BLUFI_ENABLED
+/**
+ * @brief Register a blufi command set. The table is copied and sorted by command name, the commands must
+ * stay valid. Replaces the previous set.
+ */
+void register_command_set(bluficmd_t *commands[], int count);
+
+/**
+ * @brief Copies the BluFi command statistics into stats.
+ */
+void blufi_get_command_stats(blufi_cmd_stats_t *stats);
+
+/**
+ * @brief Shuts down BluFi, Bluedroid and the BLE controller now and releases their memory. This is done
+ * automatically after the grace period once WIFI connects. BluFi can not be started again without a restart.
+ * If a step fails its error is returned, and the next call carries on from that step.
+ * @return ESP_OK, ESP_ERR_INVALID_STATE if already done, or ESP_ERR_NOT_SUPPORTED if
+ *         CONFIG_ESP_BLUFI_TEARDOWN_ENABLED is not set
+ */
+esp_err_t blufi_teardown(void);
+
+/**
+ * @brief Sets a flag in NVS so that after the next boot BluFi stays up until the phone has sent a network and
+ * the device has connected to it. The flag is cleared by that boot. Call esp_restart() afterwards to
+ * provision again now.
+ */
+esp_err_t blufi_reprovision_on_boot(bool enable);
+
+/**
+ * @brief Copies the teardown result into stats.
+ */
+void blufi_get_teardown_stats(blufi_teardown_stats_t *stats);
+
 /**
  * @brief Registers a custom data/command handler for blufi custom data. The intend is to process
- * commands from the custom data received from blufi for reboot, etc.
+ * commands from the custom data received from blufi for reboot, etc. It gets the whole text of commands
+ * that are not in the command set, on the command task.
  */
 void set_custom_command_callback(void (*callback)(const char*));
 #endif
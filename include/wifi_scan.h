@@ -0,0 +1,115 @@
+/*
+    WIFI scan results for ESP32
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_wifi_types.h"
+#include "freertos/FreeRTOS.h"
+
+#if CONFIG_ESP_WIFI_ENABLED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief An AP seen in a scan. The cached results hold the strongest AP for each SSID.
+ */
+typedef struct {
+    uint8_t ssid[33];
+    uint8_t bssid[6];
+    uint8_t channel;
+    int8_t rssi;
+    wifi_auth_mode_t authmode;
+} wifi_scan_result_t;
+
+/**
+ * @brief Called from the scan task when a scan request completes. err is ESP_OK if the results are fresh,
+ * otherwise the cached results may be old or empty.
+ */
+typedef void (*wifi_scan_done_cb_t)(esp_err_t err, void *ctx);
+
+/**
+ * @brief Scan scheduler statistics.
+ */
+typedef struct {
+    uint32_t requests;              // Scan requests received
+    uint32_t scans;                 // Scans run
+    uint32_t cached;                // Requests answered from the cache without scanning
+    uint32_t coalesced;             // Requests answered by a scan started for another request
+    uint32_t failures;              // Scans that failed to start or timed out
+    uint32_t last_scan_ms;          // Duration of the last scan
+} wifi_scan_stats_t;
+
+/**
+ * @brief Creates the lock for the scan results and starts the scan task. Called by wifi_setup. Scan results
+ * are read into a static pool, keeping the strongest AP for each SSID, so no heap is used.
+ */
+void wifi_scan_init(void);
+
+/**
+ * @brief Queues a scan request and returns straight away. done is called from the scan task once results
+ * are available. Requests queued while a scan is running share its results, and requests within the scan
+ * cache time are answered from the cache.
+ */
+esp_err_t wifi_scan_request(wifi_scan_done_cb_t done, void *ctx);
+
+/**
+ * @brief Queues a scan of one channel, which keeps the radio off the current channel for one dwell time.
+ * The results are kept apart from the cached results of a full scan, read them with wifi_scan_foreach_channel.
+ */
+esp_err_t wifi_scan_request_channel(uint8_t channel, wifi_scan_done_cb_t done, void *ctx);
+
+/**
+ * @brief Tells the scan task the driver finished a scan. Called from the WIFI_EVENT_SCAN_DONE handler.
+ */
+void wifi_scan_done(void);
+
+/**
+ * @brief Copies the scan scheduler statistics into stats.
+ */
+void wifi_scan_get_stats(wifi_scan_stats_t *stats);
+
+/**
+ * @brief Returns the age of the cached scan results in ms, or UINT32_MAX if there are none.
+ */
+uint32_t wifi_scan_age_ms(void);
+
+/**
+ * @brief Returns true if there are cached results younger than the scan cache time set in menuconfig.
+ */
+bool wifi_scan_is_fresh(void);
+
+/**
+ * @brief Copies up to max cached results into results, strongest first. Returns the number copied.
+ */
+int wifi_scan_get_results(wifi_scan_result_t *results, int max);
+
+/**
+ * @brief Calls callback for each cached result, strongest first, while holding the results lock. The callback
+ * must not block.
+ */
+void wifi_scan_foreach(void (*callback)(const wifi_scan_result_t *result, int index, void *ctx), void *ctx);
+
+/**
+ * @brief Calls callback for each AP found by the last single channel scan, strongest first, while holding the
+ * results lock. Unlike the cached results, every BSSID is listed. The callback must not block.
+ */
+void wifi_scan_foreach_channel(void (*callback)(const wifi_scan_result_t *result, int index, void *ctx), void *ctx);
+
+/**
+ * @brief Discards the cached results, so the next request scans again.
+ */
+void wifi_scan_invalidate(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
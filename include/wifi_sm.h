@@ -0,0 +1,101 @@
+/*
+    WIFI connection state machine table. Internal to the network component, not for application use.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "wifi.h"
+
+#if CONFIG_ESP_WIFI_ENABLED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Events queued to the state machine task
+ */
+typedef enum {
+    WIFI_SM_EVENT_START = 0,        // The driver started
+    WIFI_SM_EVENT_ASSOCIATED,       // Associated with an AP
+    WIFI_SM_EVENT_GOT_IP,           // An IP number that is not link local was assigned
+    WIFI_SM_EVENT_DISCONNECTED,     // The connection dropped or an attempt failed
+    WIFI_SM_EVENT_BACKOFF_DONE,     // The retry delay is over
+    WIFI_SM_EVENT_SCAN_DONE,        // The network selection scan finished
+    WIFI_SM_EVENT_DISABLE,          // wifi_disable was called
+    WIFI_SM_EVENT_ENABLE,           // wifi_start was called after wifi_disable or wifi_stop
+    WIFI_SM_EVENT_MAX
+} wifi_sm_event_t;
+
+/**
+ * @brief Actions run by wifi.c after a transition
+ */
+typedef enum {
+    WIFI_SM_ACTION_NONE = 0,
+    WIFI_SM_ACTION_RESUME_FAST,         // Back from wifi_stop, straight to the last AP
+    WIFI_SM_ACTION_CONNECT_CURRENT,     // Connect with the current config
+    WIFI_SM_ACTION_CANCEL_RETRY,        // Something else connected while a retry was pending
+    WIFI_SM_ACTION_CONNECTED,           // Record the success and reset the retries
+    WIFI_SM_ACTION_CONNECT_ROAM,        // Move to the AP the roaming monitor picked
+    WIFI_SM_ACTION_CONNECT_FAST,        // Retry the last AP without a delay
+    WIFI_SM_ACTION_START_BACKOFF,       // Wait for the retry delay
+    WIFI_SM_ACTION_START_SCAN,          // Scan to pick the best stored network
+    WIFI_SM_ACTION_CONNECT_SELECTED,    // Connect to the network the scan picked
+    WIFI_SM_ACTION_DISABLE,
+    WIFI_SM_ACTION_ENABLE,
+    WIFI_SM_ACTION_MAX
+} wifi_sm_action_t;
+
+/**
+ * @brief What the guards look at, filled in by wifi.c before each lookup
+ */
+typedef struct {
+    bool roam_pending;              // The roaming monitor disconnected to move to another AP
+    bool fast_reconnect_ready;      // The last AP is known and has not been retried since the last connect
+} wifi_sm_conditions_t;
+
+/**
+ * @brief One row of the table
+ */
+typedef struct {
+    uint32_t states;                // WIFI_SM_STATE mask of the states the row applies to
+    wifi_sm_event_t event;
+    bool (*guard)(const wifi_sm_conditions_t *conditions);  // The row is skipped if this returns false. NULL always matches.
+    wifi_state_t next;
+    wifi_sm_action_t action;        // Run after entering next
+} wifi_sm_transition_t;
+
+#define WIFI_SM_STATE(state) (1 << (state))
+#define WIFI_SM_LINKING (WIFI_SM_STATE(WIFI_STATE_ASSOCIATING) | WIFI_SM_STATE(WIFI_STATE_DHCP) | \
+    WIFI_SM_STATE(WIFI_STATE_CONNECTED))
+#define WIFI_SM_ENABLED (((1 << WIFI_STATE_MAX) - 1) & ~WIFI_SM_STATE(WIFI_STATE_DISABLED))
+
+/**
+ * @brief The transitions, searched in order. The first row that matches the state, the event and the guard
+ * is taken.
+ */
+extern const wifi_sm_transition_t wifi_sm_table[];
+extern const size_t wifi_sm_table_size;
+
+/**
+ * @brief Returns the transition for event in state under conditions, or NULL if the event is ignored in
+ * that state.
+ */
+const wifi_sm_transition_t *wifi_sm_find(wifi_state_t state, wifi_sm_event_t event,
+    const wifi_sm_conditions_t *conditions);
+
+/**
+ * @brief Returns the name of a state for the log
+ */
+const char *wifi_sm_state_name(wifi_state_t state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
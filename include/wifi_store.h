@@ -0,0 +1,108 @@
+/*
+    WIFI credential store for ESP32
+
+    (C) 2020 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#if CONFIG_ESP_WIFI_ENABLED
+
+#define WIFI_STORE_SSID_LEN     32
+#define WIFI_STORE_PASSWORD_LEN 64
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Connection statistics for a stored network. These are saved in NVS with the credentials
+ * so the network ranking improves over time.
+ */
+typedef struct {
+    uint32_t attempts;              // Number of connection attempts
+    uint32_t successes;             // Number of attempts that got an IP number
+    uint64_t total_time_to_ip_ms;   // Divide by successes for the mean time to IP
+} wifi_store_stats_t;
+
+typedef struct {
+    char ssid[WIFI_STORE_SSID_LEN + 1];
+    char password[WIFI_STORE_PASSWORD_LEN + 1];
+    bool from_config;               // Added by wifi_store_set_config, and removed once it is no longer configured
+    wifi_store_stats_t stats;
+} wifi_store_entry_t;
+
+/**
+ * @brief A network seen in a scan, used to rank the stored networks.
+ */
+typedef struct {
+    const uint8_t *ssid;
+    int8_t rssi;
+} wifi_store_scan_t;
+
+/**
+ * @brief Loads the stored networks from NVS. NVS must be initialised first. Called by wifi_setup.
+ */
+esp_err_t wifi_store_init(void);
+
+/**
+ * @brief Adds a network to the store, or updates the password if the SSID is already stored. When the
+ * store is full, the network with the worst success rate is replaced. Returns the index of the network
+ * or -1 on error.
+ */
+int wifi_store_add(const char *ssid, const char *password);
+
+/**
+ * @brief Removes a network from the store.
+ */
+esp_err_t wifi_store_remove(const char *ssid);
+
+/**
+ * @brief Adds the networks from the project config, and removes the networks an earlier config added that
+ * are no longer in it. Networks added with wifi_store_add are kept.
+ */
+void wifi_store_set_config(const char *const ssids[], const char *const passwords[], int count);
+
+/**
+ * @brief Returns the number of stored networks.
+ */
+int wifi_store_count(void);
+
+/**
+ * @brief Copies the stored network at index into entry. Returns false if there is no such network.
+ */
+bool wifi_store_get(int index, wifi_store_entry_t *entry);
+
+/**
+ * @brief Ranks the stored networks against the results of one scan, using the strongest RSSI for each
+ * SSID and the historical success rate. Returns the index of the best network or -1 if none of the stored
+ * networks were seen.
+ */
+int wifi_store_select(const wifi_store_scan_t *scan, int count);
+
+/**
+ * @brief Records a connection attempt to the network at index. Saved to NVS within
+ * CONFIG_ESP_WIFI_STORE_SAVE_INTERVAL seconds.
+ */
+void wifi_store_record_attempt(int index);
+
+/**
+ * @brief Records a successful connection to the network at index, and the time it took to get an IP number.
+ * Saved to NVS within CONFIG_ESP_WIFI_STORE_SAVE_INTERVAL seconds.
+ */
+void wifi_store_record_success(int index, uint32_t time_to_ip_ms);
+
+/**
+ * @brief Saves connection statistics that have not been saved yet. Called by wifi_stop.
+ */
+void wifi_store_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
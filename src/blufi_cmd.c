@@ -0,0 +1,338 @@
+/*
+    BluFi command engine
+
+    Custom data from the phone is a text command, such as "reboot" or "led on". The Bluetooth
+    stack task only copies it into a queue. A worker task splits it into arguments, looks the
+    command up in the registered set (kept sorted, so the lookup is a binary search) and runs
+    it. The result goes back to the phone as custom data.
+
+    A command that runs past its timeout is answered with a timeout reply when the timeout
+    expires, so the phone is not left waiting. The command itself can not be stopped, its result
+    is dropped when it finishes and the commands queued behind it wait for it.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+#ifdef CONFIG_ESP_BLUFI_ENABLED
+
+#include "esp_blufi_api.h"
+#include "blufi.h"
+#include "wifi.h"
+
+static const char *TAG = "BLUFICMD";
+
+#define THREAD_CMD_NAME "blufi_cmd"
+#define THREAD_CMD_PRIORITY 3
+
+#define BLUFI_CMD_MAX_COMMANDS 32
+#define BLUFI_CMD_MAX_LEN 128
+#define BLUFI_CMD_MAX_ARGS 8
+#define BLUFI_CMD_REPLY_LEN 128
+
+typedef struct {
+    int64_t received_us;
+    char text[BLUFI_CMD_MAX_LEN + 1];
+} blufi_cmd_msg_t;
+
+static StaticQueue_t cmd_queue_buffer;
+static uint8_t cmd_queue_storage[CONFIG_ESP_BLUFI_CMD_QUEUE_LEN * sizeof(blufi_cmd_msg_t)];
+static QueueHandle_t cmd_queue = NULL;
+static TaskHandle_t cmd_task = NULL;
+static esp_timer_handle_t cmd_timer = NULL;
+
+/* The registered commands, sorted by name */
+static const bluficmd_t *commands[BLUFI_CMD_MAX_COMMANDS];
+static int command_count = 0;
+static StaticSemaphore_t commands_lock_buffer;
+static SemaphoreHandle_t commands_lock = NULL;
+static void (*custom_command_callback)(const char*) = NULL;
+
+/*
+ * The command being run, all set under cmd_lock. Whichever of the worker and the timeout gets the reply
+ * flag first answers the phone. esp_timer_stop does not wait for a callback that is already running, so a
+ * timeout that fires before the deadline of the current command belongs to an earlier one and is ignored.
+ */
+static portMUX_TYPE cmd_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t cmd_seq = 0;
+static int64_t cmd_deadline_us = 0;
+static bool cmd_replied = true;
+static char cmd_running[BLUFI_CMD_MAX_LEN + 1];
+static char cmd_reply[BLUFI_CMD_REPLY_LEN];
+
+/* Updated from the Bluetooth task, the worker and the timer task */
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static blufi_cmd_stats_t cmd_stats;
+
+#define BLUFI_CMD_STAT_INC(field) do { \
+        portENTER_CRITICAL(&stats_lock); \
+        cmd_stats.field++; \
+        portEXIT_CRITICAL(&stats_lock); \
+    } while (0)
+
+#define BLUFI_CMD_STAT_MAX(field, value) do { \
+        portENTER_CRITICAL(&stats_lock); \
+        if ((value) > cmd_stats.field) cmd_stats.field = (value); \
+        portEXIT_CRITICAL(&stats_lock); \
+    } while (0)
+
+static int blufi_cmd_compare(const void *a, const void *b)
+{
+    return strcmp((*(const bluficmd_t **)a)->command, (*(const bluficmd_t **)b)->command);
+}
+
+static int blufi_cmd_compare_key(const void *key, const void *entry)
+{
+    return strcmp((const char *)key, (*(const bluficmd_t **)entry)->command);
+}
+
+static const bluficmd_t *blufi_cmd_find(const char *name)
+{
+    xSemaphoreTake(commands_lock, portMAX_DELAY);
+    const bluficmd_t **entry = bsearch(name, commands, command_count, sizeof(commands[0]), blufi_cmd_compare_key);
+    const bluficmd_t *command = (entry != NULL) ? *entry : NULL;
+    xSemaphoreGive(commands_lock);
+    return command;
+}
+
+/* Returns false if the reply to command seq was already sent */
+static bool blufi_cmd_take_reply(uint32_t seq)
+{
+    bool take;
+    portENTER_CRITICAL(&cmd_lock);
+    take = !cmd_replied && seq == cmd_seq;
+    if (take)
+    {
+        cmd_replied = true;
+    }
+    portEXIT_CRITICAL(&cmd_lock);
+    return take;
+}
+
+static void blufi_cmd_send(const char *text)
+{
+    esp_err_t err = esp_blufi_send_custom_data((uint8_t *)text, strlen(text));
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Unable to send the reply: %s", esp_err_to_name(err));
+    }
+}
+
+static void blufi_cmd_timeout(void *arg)
+{
+    char name[BLUFI_CMD_MAX_LEN + 1];
+    uint32_t seq = 0;
+    bool take = false;
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&cmd_lock);
+    if (!cmd_replied && now >= cmd_deadline_us)
+    {
+        cmd_replied = true;
+        seq = cmd_seq;
+        strcpy(name, cmd_running);
+        take = true;
+    }
+    portEXIT_CRITICAL(&cmd_lock);
+    if (take)
+    {
+        char reply[BLUFI_CMD_MAX_LEN + 16];
+        BLUFI_CMD_STAT_INC(timeouts);
+        ESP_LOGW(TAG, "Command %u (%s) timed out", seq, name);
+        snprintf(reply, sizeof(reply), "%s: %s", name, esp_err_to_name(ESP_ERR_TIMEOUT));
+        blufi_cmd_send(reply);
+    }
+}
+
+/* Splits the text into arguments at spaces, in place. Returns the number of arguments. */
+static int blufi_cmd_parse(char *text, char **argv)
+{
+    int argc = 0;
+    char *save = NULL;
+    for (char *arg = strtok_r(text, " \t\r\n", &save); arg != NULL && argc < BLUFI_CMD_MAX_ARGS;
+        arg = strtok_r(NULL, " \t\r\n", &save))
+    {
+        argv[argc++] = arg;
+    }
+    return argc;
+}
+
+static void blufi_cmd_run(blufi_cmd_msg_t *msg)
+{
+    char *argv[BLUFI_CMD_MAX_ARGS];
+    char reply[BLUFI_CMD_MAX_LEN + BLUFI_CMD_REPLY_LEN + 4];
+    char text[BLUFI_CMD_MAX_LEN + 1];
+    esp_err_t err = ESP_OK;
+
+    uint32_t wait_ms = (uint32_t)((esp_timer_get_time() - msg->received_us) / 1000);
+    BLUFI_CMD_STAT_MAX(max_wait_ms, wait_ms);
+    // The legacy callback gets the whole text, so keep a copy before it is split
+    strcpy(text, msg->text);
+    int argc = blufi_cmd_parse(msg->text, argv);
+    if (argc == 0)
+    {
+        return;
+    }
+    const bluficmd_t *command = blufi_cmd_find(argv[0]);
+    if (command == NULL && custom_command_callback == NULL)
+    {
+        ESP_LOGI(TAG, "Unknown command: %s", argv[0]);
+        BLUFI_CMD_STAT_INC(unknown);
+        snprintf(reply, sizeof(reply), "%s: %s", argv[0], esp_err_to_name(ESP_ERR_NOT_FOUND));
+        blufi_cmd_send(reply);
+        return;
+    }
+
+    ESP_LOGI(TAG, "Processing cmd: %s", text);
+    uint32_t timeout_ms = (command != NULL && command->timeout_ms != 0) ? command->timeout_ms : CONFIG_ESP_BLUFI_CMD_TIMEOUT_MS;
+    cmd_reply[0] = '\0';
+    int64_t start_us = esp_timer_get_time();
+    portENTER_CRITICAL(&cmd_lock);
+    uint32_t seq = ++cmd_seq;
+    strcpy(cmd_running, text);
+    cmd_deadline_us = start_us + timeout_ms * 1000LL;
+    cmd_replied = false;
+    portEXIT_CRITICAL(&cmd_lock);
+    esp_timer_start_once(cmd_timer, timeout_ms * 1000ULL);
+    if (command == NULL)
+    {
+        custom_command_callback(text);
+    }
+    else if (command->handler != NULL)
+    {
+        err = command->handler(argc, argv, cmd_reply, sizeof(cmd_reply));
+    }
+    else
+    {
+        command->cmd_callback();
+    }
+    esp_timer_stop(cmd_timer);
+    uint32_t run_ms = (uint32_t)((esp_timer_get_time() - start_us) / 1000);
+    BLUFI_CMD_STAT_MAX(max_run_ms, run_ms);
+    BLUFI_CMD_STAT_INC(executed);
+    if (!blufi_cmd_take_reply(seq))
+    {
+        ESP_LOGW(TAG, "Command %s finished after %u ms, the result is dropped", argv[0], run_ms);
+        return;
+    }
+    if (err != ESP_OK)
+    {
+        snprintf(reply, sizeof(reply), "%s: %s", argv[0], esp_err_to_name(err));
+    }
+    else
+    {
+        snprintf(reply, sizeof(reply), "%s: %s", argv[0], (cmd_reply[0] != '\0') ? cmd_reply : "OK");
+    }
+    blufi_cmd_send(reply);
+}
+
+static void blufi_cmd_task(void *arg)
+{
+    blufi_cmd_msg_t msg;
+    while (true)
+    {
+        if (xQueueReceive(cmd_queue, &msg, portMAX_DELAY) == pdTRUE)
+        {
+            blufi_cmd_run(&msg);
+        }
+    }
+}
+
+void blufi_cmd_init(void)
+{
+    if (cmd_queue != NULL)
+    {
+        return;
+    }
+    if (commands_lock == NULL)
+    {
+        commands_lock = xSemaphoreCreateMutexStatic(&commands_lock_buffer);
+    }
+    const esp_timer_create_args_t args = {
+        .callback = blufi_cmd_timeout,
+        .name = "blufi_cmd"
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&args, &cmd_timer));
+    cmd_queue = xQueueCreateStatic(CONFIG_ESP_BLUFI_CMD_QUEUE_LEN, sizeof(blufi_cmd_msg_t), cmd_queue_storage,
+        &cmd_queue_buffer);
+    xTaskCreate(blufi_cmd_task, THREAD_CMD_NAME, CONFIG_ESP_BLUFI_CMD_STACKSIZE, NULL, THREAD_CMD_PRIORITY, &cmd_task);
+}
+
+void blufi_cmd_post(const uint8_t *data, uint32_t len)
+{
+    blufi_cmd_msg_t msg;
+    BLUFI_CMD_STAT_INC(received);
+    if (cmd_queue == NULL)
+    {
+        BLUFI_CMD_STAT_INC(dropped);
+        return;
+    }
+    if (len > BLUFI_CMD_MAX_LEN)
+    {
+        ESP_LOGW(TAG, "Command of %u bytes is too long", len);
+        BLUFI_CMD_STAT_INC(dropped);
+        return;
+    }
+    memcpy(msg.text, data, len);
+    msg.text[len] = '\0';
+    msg.received_us = esp_timer_get_time();
+    if (xQueueSend(cmd_queue, &msg, 0) != pdTRUE)
+    {
+        ESP_LOGW(TAG, "Command queue is full");
+        BLUFI_CMD_STAT_INC(dropped);
+    }
+}
+
+void register_command_set(bluficmd_t *command_set[], int count)
+{
+    if (count > BLUFI_CMD_MAX_COMMANDS)
+    {
+        ESP_LOGE(TAG, "Only the first %d of %d commands are registered", BLUFI_CMD_MAX_COMMANDS, count);
+        count = BLUFI_CMD_MAX_COMMANDS;
+    }
+    if (commands_lock == NULL)
+    {
+        commands_lock = xSemaphoreCreateMutexStatic(&commands_lock_buffer);
+    }
+    xSemaphoreTake(commands_lock, portMAX_DELAY);
+    for (int i = 0; i < count; i++)
+    {
+        commands[i] = command_set[i];
+    }
+    command_count = count;
+    qsort(commands, count, sizeof(commands[0]), blufi_cmd_compare);
+    xSemaphoreGive(commands_lock);
+    for (int i = 0; i < count; i++)
+    {
+        ESP_LOGI(TAG, "Registered CMD: %s", commands[i]->command);
+    }
+}
+
+void set_custom_command_callback(void (*callback)(const char*))
+{
+    if (callback!=NULL)
+    {
+        custom_command_callback = callback;
+    }
+}
+
+void blufi_get_command_stats(blufi_cmd_stats_t *stats)
+{
+    if (stats != NULL)
+    {
+        portENTER_CRITICAL(&stats_lock);
+        *stats = cmd_stats;
+        portEXIT_CRITICAL(&stats_lock);
+    }
+}
+
+#endif
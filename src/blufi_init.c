@@ -17,6 +17,9 @@
 #include "esp_bt.h"
 #include "esp_bt_main.h"
 #include "esp_bt_device.h"
+#ifdef CONFIG_ESP_BLUFI_XFER_ENABLED
+#include "esp_gatt_common_api.h"
+#endif
 
 static const char *BLUFI_INIT_TAG = "BLUFIINIT";
 
@@ -35,11 +38,41 @@ esp_err_t esp_blufi_host_init(void)
         return ESP_FAIL;
     }
     ESP_LOGI(BLUFI_INIT_TAG,"BD ADDR: "ESP_BD_ADDR_STR"\n", ESP_BD_ADDR_HEX(esp_bt_dev_get_address()));
+#ifdef CONFIG_ESP_BLUFI_XFER_ENABLED
+    // A larger MTU lets a transfer chunk go in fewer BluFi fragments
+    ret = esp_ble_gatt_set_local_mtu(517);
+    if (ret) {
+        ESP_LOGW(BLUFI_INIT_TAG,"%s set local MTU failed: %s\n", __func__, esp_err_to_name(ret));
+    }
+#endif
 
     return ESP_OK;
 
 }
 
+esp_err_t esp_blufi_host_deinit(void)
+{
+    int ret;
+    ret = esp_blufi_profile_deinit();
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    ret = esp_bluedroid_disable();
+    if (ret) {
+        ESP_LOGE(BLUFI_INIT_TAG,"%s disable bluedroid failed: %s\n", __func__, esp_err_to_name(ret));
+        return ESP_FAIL;
+    }
+
+    ret = esp_bluedroid_deinit();
+    if (ret) {
+        ESP_LOGE(BLUFI_INIT_TAG,"%s deinit bluedroid failed: %s\n", __func__, esp_err_to_name(ret));
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
 esp_err_t esp_blufi_gap_register_callback(void)
 {
    int rc;
@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "sdkconfig.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
@@ -28,7 +29,14 @@
 #include "mbedtls/aes.h"
 #include "mbedtls/dhm.h"
 #include "mbedtls/md5.h"
+#include "mbedtls/ecdh.h"
+#include "mbedtls/sha256.h"
 #include "esp_crc.h"
+#ifdef CONFIG_ESP_BLUFI_SECURITY_BENCHMARK
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "soc/cpu.h"
+#endif
 
 /*
    The SEC_TYPE_xxx is for self-defined packet data type in the procedure of "BLUFI negotiate key"
@@ -39,9 +47,29 @@
 #define SEC_TYPE_DH_P           0x02
 #define SEC_TYPE_DH_G           0x03
 #define SEC_TYPE_DH_PUBLIC      0x04
+/*
+   ECDH negotiation, an alternative to the 1024 bit DH above that needs much less CPU time. The phone sends
+   SEC_TYPE_ECDH_PUBLIC, the curve (BLUFI_ECDH_CURVE_xxx) and its public key, and gets our public key on the
+   same curve back. X25519 keys are the 32 byte little endian u-coordinate, P-256 keys are uncompressed points.
+   The AES key is the first 16 bytes of the SHA-256 of the shared secret.
+ */
+#define SEC_TYPE_ECDH_PUBLIC    0x05
+
+#define BLUFI_ECDH_CURVE_X25519 0x00
+#define BLUFI_ECDH_CURVE_P256   0x01
 
 static const char *BLUFI_SEC_TAG = "BLUFISEC";
 
+#define ECDH_SECRET_LEN         32
+
+typedef struct {
+    mbedtls_ecp_group grp;
+    mbedtls_mpi d;                      // Our private key
+    mbedtls_ecp_point q;                // Our public key
+    mbedtls_ecp_point peer;             // The phone's public key
+    mbedtls_mpi z;                      // The shared secret
+} blufi_ecdh_t;
+
 struct blufi_security {
 #define DH_SELF_PUB_KEY_LEN     128
 #define DH_SELF_PUB_KEY_BIT_LEN (DH_SELF_PUB_KEY_LEN * 8)
@@ -57,6 +85,9 @@ struct blufi_security {
     uint8_t  iv[16];
     mbedtls_dhm_context dhm;
     mbedtls_aes_context aes;
+#define ECDH_PUB_KEY_MAX_LEN    65
+    uint8_t  ecdh_public_key[ECDH_PUB_KEY_MAX_LEN];
+    blufi_ecdh_t ecdh;
 };
 static struct blufi_security *blufi_sec;
 
@@ -66,6 +97,84 @@ static int myrand( void *rng_state, unsigned char *output, size_t len )
     return( 0 );
 }
 
+static void blufi_ecdh_init(blufi_ecdh_t *ecdh)
+{
+    mbedtls_ecp_group_init(&ecdh->grp);
+    mbedtls_mpi_init(&ecdh->d);
+    mbedtls_ecp_point_init(&ecdh->q);
+    mbedtls_ecp_point_init(&ecdh->peer);
+    mbedtls_mpi_init(&ecdh->z);
+}
+
+static void blufi_ecdh_free(blufi_ecdh_t *ecdh)
+{
+    mbedtls_ecp_group_free(&ecdh->grp);
+    mbedtls_mpi_free(&ecdh->d);
+    mbedtls_ecp_point_free(&ecdh->q);
+    mbedtls_ecp_point_free(&ecdh->peer);
+    mbedtls_mpi_free(&ecdh->z);
+}
+
+/* Generates our key pair on the curve and writes the public key in the wire format */
+static int blufi_ecdh_make_public(blufi_ecdh_t *ecdh, uint8_t curve, uint8_t *public_key, size_t *public_len)
+{
+    mbedtls_ecp_group_id id;
+    switch (curve) {
+#ifdef MBEDTLS_ECP_DP_CURVE25519_ENABLED
+    case BLUFI_ECDH_CURVE_X25519:
+        id = MBEDTLS_ECP_DP_CURVE25519;
+        break;
+#endif
+#ifdef MBEDTLS_ECP_DP_SECP256R1_ENABLED
+    case BLUFI_ECDH_CURVE_P256:
+        id = MBEDTLS_ECP_DP_SECP256R1;
+        break;
+#endif
+    default:
+        ESP_LOGE(BLUFI_SEC_TAG, "Unsupported curve %d", curve);
+        return -1;
+    }
+    int ret = mbedtls_ecp_group_load(&ecdh->grp, id);
+    if (ret == 0) {
+        ret = mbedtls_ecdh_gen_public(&ecdh->grp, &ecdh->d, &ecdh->q, myrand, NULL);
+    }
+    if (ret) {
+        return ret;
+    }
+    if (curve == BLUFI_ECDH_CURVE_X25519) {
+        *public_len = ECDH_SECRET_LEN;
+        return mbedtls_mpi_write_binary_le(&ecdh->q.X, public_key, ECDH_SECRET_LEN);
+    }
+    return mbedtls_ecp_point_write_binary(&ecdh->grp, &ecdh->q, MBEDTLS_ECP_PF_UNCOMPRESSED, public_len,
+        public_key, ECDH_PUB_KEY_MAX_LEN);
+}
+
+/* Computes the ECDH_SECRET_LEN byte shared secret from the peer's public key. Call blufi_ecdh_make_public first. */
+static int blufi_ecdh_calc_secret(blufi_ecdh_t *ecdh, uint8_t curve, const uint8_t *peer_key, size_t peer_len,
+    uint8_t *secret)
+{
+    int ret;
+    if (curve == BLUFI_ECDH_CURVE_X25519) {
+        if (peer_len != ECDH_SECRET_LEN) {
+            return -1;
+        }
+        ret = mbedtls_mpi_read_binary_le(&ecdh->peer.X, peer_key, peer_len);
+        if (ret == 0) {
+            ret = mbedtls_mpi_lset(&ecdh->peer.Z, 1);
+        }
+    } else {
+        ret = mbedtls_ecp_point_read_binary(&ecdh->grp, &ecdh->peer, peer_key, peer_len);
+    }
+    if (ret == 0) {
+        ret = mbedtls_ecdh_compute_shared(&ecdh->grp, &ecdh->z, &ecdh->peer, &ecdh->d, myrand, NULL);
+    }
+    if (ret == 0) {
+        ret = (curve == BLUFI_ECDH_CURVE_X25519) ? mbedtls_mpi_write_binary_le(&ecdh->z, secret, ECDH_SECRET_LEN) :
+            mbedtls_mpi_write_binary(&ecdh->z, secret, ECDH_SECRET_LEN);
+    }
+    return ret;
+}
+
 extern void btc_blufi_report_error(esp_blufi_error_state_t state);
 
 void blufi_dh_negotiate_data_handler(uint8_t *data, int len, uint8_t **output_data, int *output_len, bool *need_free)
@@ -139,47 +248,143 @@ void blufi_dh_negotiate_data_handler(uint8_t *data, int len, uint8_t **output_da
         break;
     case SEC_TYPE_DH_PUBLIC:
         break;
+    case SEC_TYPE_ECDH_PUBLIC: {
+        uint8_t digest[32];
+        size_t public_len = 0;
+        if (len < 3) {
+            btc_blufi_report_error(ESP_BLUFI_DATA_FORMAT_ERROR);
+            return;
+        }
+        ret = blufi_ecdh_make_public(&blufi_sec->ecdh, data[1], blufi_sec->ecdh_public_key, &public_len);
+        if (ret == 0) {
+            ret = blufi_ecdh_calc_secret(&blufi_sec->ecdh, data[1], &data[2], len - 2, blufi_sec->share_key);
+        }
+        if (ret) {
+            ESP_LOGE(BLUFI_SEC_TAG,"%s ECDH failed %d\n", __func__, ret);
+            btc_blufi_report_error(ESP_BLUFI_MAKE_PUBLIC_ERROR);
+            return;
+        }
+        blufi_sec->share_len = ECDH_SECRET_LEN;
+        mbedtls_sha256_ret(blufi_sec->share_key, blufi_sec->share_len, digest, 0);
+        memcpy(blufi_sec->psk, digest, PSK_LEN);
+
+        mbedtls_aes_setkey_enc(&blufi_sec->aes, blufi_sec->psk, 128);
+
+        *output_data = &blufi_sec->ecdh_public_key[0];
+        *output_len = public_len;
+        *need_free = false;
+        break;
+    }
     }
 }
 
-int blufi_aes_encrypt(uint8_t iv8, uint8_t *crypt_data, int crypt_len)
+/*
+   AES-128-CFB with the key schedule set up once by the negotiation. With CONFIG_MBEDTLS_HARDWARE_AES mbedtls
+   runs the whole frame on the AES accelerator in one go. The software mbedtls_aes_crypt_cfb128 works a byte at
+   a time, so without the accelerator each 16 byte block is one AES block and one XOR here instead.
+ */
+static int blufi_aes_cfb(int mode, uint8_t iv8, uint8_t *crypt_data, int crypt_len)
 {
-    int ret;
-    size_t iv_offset = 0;
     uint8_t iv0[16];
 
+    if (blufi_sec == NULL) {
+        return -1;
+    }
     memcpy(iv0, blufi_sec->iv, sizeof(blufi_sec->iv));
     iv0[0] = iv8;   /* set iv8 as the iv0[0] */
 
-    ret = mbedtls_aes_crypt_cfb128(&blufi_sec->aes, MBEDTLS_AES_ENCRYPT, crypt_len, &iv_offset, iv0, crypt_data, crypt_data);
-    if (ret) {
+#ifdef CONFIG_MBEDTLS_HARDWARE_AES
+    size_t iv_offset = 0;
+    if (mbedtls_aes_crypt_cfb128(&blufi_sec->aes, mode, crypt_len, &iv_offset, iv0, crypt_data, crypt_data)) {
         return -1;
     }
+#else
+    uint8_t stream[16];
+    for (int pos = 0; pos < crypt_len; pos += sizeof(stream)) {
+        if (mbedtls_aes_crypt_ecb(&blufi_sec->aes, MBEDTLS_AES_ENCRYPT, iv0, stream)) {
+            return -1;
+        }
+        if (crypt_len - pos < (int)sizeof(stream)) {
+            for (int i = 0; i < crypt_len - pos; i++) {
+                crypt_data[pos + i] ^= stream[i];
+            }
+            break;
+        }
+        uint64_t in[2], key[2], out[2];
+        memcpy(in, &crypt_data[pos], sizeof(in));
+        memcpy(key, stream, sizeof(key));
+        out[0] = in[0] ^ key[0];
+        out[1] = in[1] ^ key[1];
+        memcpy(&crypt_data[pos], out, sizeof(out));
+        /* the cipher text is the iv of the next block */
+        memcpy(iv0, (mode == MBEDTLS_AES_ENCRYPT) ? out : in, sizeof(iv0));
+    }
+#endif
 
     return crypt_len;
 }
 
+int blufi_aes_encrypt(uint8_t iv8, uint8_t *crypt_data, int crypt_len)
+{
+    return blufi_aes_cfb(MBEDTLS_AES_ENCRYPT, iv8, crypt_data, crypt_len);
+}
+
 int blufi_aes_decrypt(uint8_t iv8, uint8_t *crypt_data, int crypt_len)
 {
-    int ret;
-    size_t iv_offset = 0;
-    uint8_t iv0[16];
+    return blufi_aes_cfb(MBEDTLS_AES_DECRYPT, iv8, crypt_data, crypt_len);
+}
 
-    memcpy(iv0, blufi_sec->iv, sizeof(blufi_sec->iv));
-    iv0[0] = iv8;   /* set iv8 as the iv0[0] */
+#ifdef CONFIG_ESP_BLUFI_CRC_SLICE_BY_4
+/*
+   CRC-16/CCITT, big endian and inverted on entry and exit like esp_crc16_be. crc_tables[k][b] is the CRC of byte
+   b followed by k zero bytes, so four bytes take four lookups and no shifts between them.
+ */
+static uint16_t crc_tables[4][256];
+static bool crc_tables_ready;
 
-    ret = mbedtls_aes_crypt_cfb128(&blufi_sec->aes, MBEDTLS_AES_DECRYPT, crypt_len, &iv_offset, iv0, crypt_data, crypt_data);
-    if (ret) {
-        return -1;
+static void blufi_crc_tables_init(void)
+{
+    for (int i = 0; i < 256; i++) {
+        uint16_t crc = (uint16_t)(i << 8);
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+        crc_tables[0][i] = crc;
+    }
+    for (int k = 1; k < 4; k++) {
+        for (int i = 0; i < 256; i++) {
+            uint16_t crc = crc_tables[k - 1][i];
+            crc_tables[k][i] = (uint16_t)((crc << 8) ^ crc_tables[0][crc >> 8]);
+        }
     }
+    crc_tables_ready = true;
+}
 
-    return crypt_len;
+static uint16_t blufi_crc16_slice_by_4(uint16_t crc, const uint8_t *data, int len)
+{
+    crc = ~crc;
+    for (; len >= 4; len -= 4, data += 4) {
+        crc = crc_tables[3][data[0] ^ (crc >> 8)] ^ crc_tables[2][data[1] ^ (crc & 0xff)] ^
+            crc_tables[1][data[2]] ^ crc_tables[0][data[3]];
+    }
+    while (len-- > 0) {
+        crc = (uint16_t)((crc << 8) ^ crc_tables[0][((crc >> 8) ^ *data++) & 0xff]);
+    }
+    return ~crc;
 }
+#endif
 
 uint16_t blufi_crc_checksum(uint8_t iv8, uint8_t *data, int len)
 {
     /* This iv8 ignore, not used */
+#ifdef CONFIG_ESP_BLUFI_CRC_SLICE_BY_4
+    if (!crc_tables_ready) {
+        blufi_crc_tables_init();
+    }
+    return blufi_crc16_slice_by_4(0, data, len);
+#else
     return esp_crc16_be(0, data, len);
+#endif
 }
 
 esp_err_t blufi_security_init(void)
@@ -193,6 +398,7 @@ esp_err_t blufi_security_init(void)
 
     mbedtls_dhm_init(&blufi_sec->dhm);
     mbedtls_aes_init(&blufi_sec->aes);
+    blufi_ecdh_init(&blufi_sec->ecdh);
 
     memset(blufi_sec->iv, 0x0, 16);
     return 0;
@@ -209,10 +415,261 @@ void blufi_security_deinit(void)
     }
     mbedtls_dhm_free(&blufi_sec->dhm);
     mbedtls_aes_free(&blufi_sec->aes);
+    blufi_ecdh_free(&blufi_sec->ecdh);
 
     memset(blufi_sec, 0x0, sizeof(struct blufi_security));
 
     free(blufi_sec);
     blufi_sec =  NULL;
 }
+
+#ifdef CONFIG_ESP_BLUFI_SECURITY_BENCHMARK
+
+/* RFC 2409 group 2, the 1024 bit group the BluFi apps send for DH */
+static const char bench_dh_p[] =
+    "FFFFFFFFFFFFFFFFC90FDAA22168C234C4C6628B80DC1CD129024E088A67CC74020BBEA63B139B22514A08798E3404DD"
+    "EF9519B3CD3A431B302B0A6DF25F14374FE1356D6D51C245E485B576625E7EC6F44C42E9A637ED6B0BFF5CB6F406B7ED"
+    "EE386BFB5A899FA5AE9F24117C4B1FE649286651ECE65381FFFFFFFFFFFFFFFF";
+
+/*
+   Heap used by the device side. The free heap is sampled between the steps, which shows what the contexts
+   hold. mbedtls frees its temporaries before each step returns, so those only show in the heap low-water mark,
+   and only if they set a new low.
+ */
+static uint32_t bench_free_before;
+static uint32_t bench_min_free_before;
+static uint32_t bench_free_low;
+
+static void blufi_bench_heap_begin(void)
+{
+    bench_free_before = esp_get_free_heap_size();
+    bench_min_free_before = heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+    bench_free_low = bench_free_before;
+}
+
+static void blufi_bench_heap_sample(void)
+{
+    uint32_t free_now = esp_get_free_heap_size();
+    if (free_now < bench_free_low) {
+        bench_free_low = free_now;
+    }
+}
+
+static size_t blufi_bench_heap_peak(void)
+{
+    uint32_t peak = bench_free_before - bench_free_low;
+    uint32_t min_free_after = heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+    if (min_free_after < bench_min_free_before && bench_free_before - min_free_after > peak) {
+        peak = bench_free_before - min_free_after;
+    }
+    return peak;
+}
+
+/* The device side of a DH negotiation: our public key and the secret from the phone's public key */
+static int blufi_bench_dh(blufi_sec_bench_t *result)
+{
+    mbedtls_mpi p, g;
+    mbedtls_dhm_context phone, device;
+    uint8_t phone_public[DH_SELF_PUB_KEY_LEN];
+    uint8_t device_public[DH_SELF_PUB_KEY_LEN];
+    uint8_t secret[SHARE_KEY_LEN];
+    size_t secret_len;
+
+    mbedtls_mpi_init(&p);
+    mbedtls_mpi_init(&g);
+    mbedtls_dhm_init(&phone);
+    int ret = mbedtls_mpi_read_string(&p, 16, bench_dh_p);
+    if (ret == 0) {
+        ret = mbedtls_mpi_lset(&g, 2);
+    }
+    if (ret == 0) {
+        ret = mbedtls_dhm_set_group(&phone, &p, &g);
+    }
+    if (ret == 0) {
+        ret = mbedtls_dhm_make_public(&phone, (int)mbedtls_mpi_size(&phone.P), phone_public, phone.len, myrand, NULL);
+    }
+    if (ret == 0) {
+        blufi_bench_heap_begin();
+        int64_t start_us = esp_timer_get_time();
+        mbedtls_dhm_init(&device);
+        ret = mbedtls_dhm_set_group(&device, &p, &g);
+        if (ret == 0) {
+            blufi_bench_heap_sample();
+            ret = mbedtls_dhm_make_public(&device, (int)mbedtls_mpi_size(&device.P), device_public, device.len, myrand, NULL);
+        }
+        if (ret == 0) {
+            blufi_bench_heap_sample();
+            ret = mbedtls_dhm_read_public(&device, phone_public, phone.len);
+        }
+        if (ret == 0) {
+            blufi_bench_heap_sample();
+            ret = mbedtls_dhm_calc_secret(&device, secret, sizeof(secret), &secret_len, NULL, NULL);
+        }
+        blufi_bench_heap_sample();
+        mbedtls_dhm_free(&device);
+        result->cpu_us = (uint32_t)(esp_timer_get_time() - start_us);
+        result->heap_peak = blufi_bench_heap_peak();
+    }
+    mbedtls_dhm_free(&phone);
+    mbedtls_mpi_free(&p);
+    mbedtls_mpi_free(&g);
+    return ret;
+}
+
+static int blufi_bench_ecdh(uint8_t curve, blufi_sec_bench_t *result)
+{
+    blufi_ecdh_t phone, device;
+    uint8_t phone_public[ECDH_PUB_KEY_MAX_LEN];
+    uint8_t device_public[ECDH_PUB_KEY_MAX_LEN];
+    uint8_t secret[ECDH_SECRET_LEN];
+    size_t phone_len = 0;
+    size_t device_len = 0;
+
+    blufi_ecdh_init(&phone);
+    int ret = blufi_ecdh_make_public(&phone, curve, phone_public, &phone_len);
+    if (ret == 0) {
+        blufi_bench_heap_begin();
+        int64_t start_us = esp_timer_get_time();
+        blufi_ecdh_init(&device);
+        ret = blufi_ecdh_make_public(&device, curve, device_public, &device_len);
+        if (ret == 0) {
+            blufi_bench_heap_sample();
+            ret = blufi_ecdh_calc_secret(&device, curve, phone_public, phone_len, secret);
+        }
+        blufi_bench_heap_sample();
+        blufi_ecdh_free(&device);
+        result->cpu_us = (uint32_t)(esp_timer_get_time() - start_us);
+        result->heap_peak = blufi_bench_heap_peak();
+    }
+    blufi_ecdh_free(&phone);
+    return ret;
+}
+
+esp_err_t blufi_security_benchmark(blufi_sec_bench_t results[BLUFI_SEC_MODE_MAX])
+{
+    if (results == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (int mode = 0; mode < BLUFI_SEC_MODE_MAX; mode++) {
+        blufi_sec_bench_t *result = &results[mode];
+        int ret;
+        memset(result, 0, sizeof(blufi_sec_bench_t));
+        switch (mode) {
+        case BLUFI_SEC_DH:
+            ret = blufi_bench_dh(result);
+            break;
+        case BLUFI_SEC_ECDH_X25519:
+            ret = blufi_bench_ecdh(BLUFI_ECDH_CURVE_X25519, result);
+            break;
+        default:
+            ret = blufi_bench_ecdh(BLUFI_ECDH_CURVE_P256, result);
+            break;
+        }
+        result->err = (ret == 0) ? ESP_OK : ESP_FAIL;
+        ESP_LOGI(BLUFI_SEC_TAG, "Negotiation %d: %s, %u us, %u bytes heap peak", mode, esp_err_to_name(result->err),
+            result->cpu_us, (unsigned)result->heap_peak);
+    }
+    return ESP_OK;
+}
+
+/*
+   Frame costs, with the negotiated key schedule and the AES accelerator when mbedtls uses it. The CRC is
+   blufi_crc_checksum, and esp_crc16_be in ROM is measured next to it to compare it with the slice-by-4 CRC.
+ */
+#define BENCH_FRAMES 1000
+
+static const uint16_t bench_frame_lens[BLUFI_TRANSPORT_BENCH_SIZES] = { 16, 64, 128, 255 };
+static uint8_t bench_frame[255];
+
+static void blufi_bench_op_end(blufi_op_bench_t *op, int frame_len, int64_t start_us, uint32_t start_cycles)
+{
+    uint32_t cycles = esp_cpu_get_ccount() - start_cycles;
+    int64_t elapsed_us = esp_timer_get_time() - start_us;
+    op->cycles_per_frame = cycles / BENCH_FRAMES;
+    int64_t bytes_per_sec = (elapsed_us > 0) ? (int64_t)BENCH_FRAMES * frame_len * 1000000LL / elapsed_us : 0;
+    op->bytes_per_sec = (bytes_per_sec > UINT32_MAX) ? UINT32_MAX : (uint32_t)bytes_per_sec;
+}
+
+esp_err_t blufi_transport_benchmark(blufi_transport_bench_t results[BLUFI_TRANSPORT_BENCH_SIZES])
+{
+    if (results == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // Outside a BluFi session, measure with a random key
+    bool own_session = (blufi_sec == NULL);
+    if (own_session) {
+        if (blufi_security_init() != ESP_OK) {
+            return ESP_ERR_NO_MEM;
+        }
+        esp_fill_random(blufi_sec->psk, PSK_LEN);
+        mbedtls_aes_setkey_enc(&blufi_sec->aes, blufi_sec->psk, 128);
+    }
+    esp_fill_random(bench_frame, sizeof(bench_frame));
+
+    esp_err_t err = ESP_OK;
+    for (int i = 0; i < BLUFI_TRANSPORT_BENCH_SIZES; i++) {
+        blufi_transport_bench_t *result = &results[i];
+        int len = bench_frame_lens[i];
+        volatile uint16_t crc = 0;
+        memset(result, 0, sizeof(blufi_transport_bench_t));
+        result->frame_len = len;
+
+        int64_t start_us = esp_timer_get_time();
+        uint32_t start_cycles = esp_cpu_get_ccount();
+        for (int frame = 0; frame < BENCH_FRAMES; frame++) {
+            blufi_aes_encrypt((uint8_t)frame, bench_frame, len);
+        }
+        blufi_bench_op_end(&result->encrypt, len, start_us, start_cycles);
+
+        start_us = esp_timer_get_time();
+        start_cycles = esp_cpu_get_ccount();
+        for (int frame = 0; frame < BENCH_FRAMES; frame++) {
+            blufi_aes_decrypt((uint8_t)frame, bench_frame, len);
+        }
+        blufi_bench_op_end(&result->decrypt, len, start_us, start_cycles);
+
+        start_us = esp_timer_get_time();
+        start_cycles = esp_cpu_get_ccount();
+        for (int frame = 0; frame < BENCH_FRAMES; frame++) {
+            crc = blufi_crc_checksum(0, bench_frame, len);
+        }
+        blufi_bench_op_end(&result->crc, len, start_us, start_cycles);
+
+        start_us = esp_timer_get_time();
+        start_cycles = esp_cpu_get_ccount();
+        for (int frame = 0; frame < BENCH_FRAMES; frame++) {
+            crc = esp_crc16_be(0, bench_frame, len);
+        }
+        blufi_bench_op_end(&result->crc_rom, len, start_us, start_cycles);
+
+        if (crc != blufi_crc_checksum(0, bench_frame, len)) {
+            ESP_LOGE(BLUFI_SEC_TAG, "blufi_crc_checksum does not match the ROM CRC");
+            err = ESP_FAIL;
+        }
+        ESP_LOGI(BLUFI_SEC_TAG, "%d byte frames: encrypt %u B/s %u cycles, decrypt %u B/s %u cycles, "
+            "CRC %u B/s %u cycles, ROM CRC %u B/s %u cycles", len,
+            result->encrypt.bytes_per_sec, result->encrypt.cycles_per_frame,
+            result->decrypt.bytes_per_sec, result->decrypt.cycles_per_frame,
+            result->crc.bytes_per_sec, result->crc.cycles_per_frame,
+            result->crc_rom.bytes_per_sec, result->crc_rom.cycles_per_frame);
+    }
+    if (own_session) {
+        blufi_security_deinit();
+    }
+    return err;
+}
+
+#else
+
+esp_err_t blufi_security_benchmark(blufi_sec_bench_t results[BLUFI_SEC_MODE_MAX])
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t blufi_transport_benchmark(blufi_transport_bench_t results[BLUFI_TRANSPORT_BENCH_SIZES])
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif
 #endif /* CONFIG_ESP_BLUFI_ENABLED */
\ No newline at end of file
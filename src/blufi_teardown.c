@@ -0,0 +1,270 @@
+/*
+    BluFi teardown after provisioning
+
+    Bluedroid and the BLE controller hold a large part of the heap, and once the device has
+    connected to WIFI they are only needed to provision it again. When the WIFI connection has
+    stayed up for the grace period and no phone is connected, BluFi, Bluedroid and the
+    controller are shut down and their memory is released. The controller memory can not be
+    taken back without a restart, so provisioning again needs a reboot: the flag set by
+    blufi_reprovision_on_boot keeps BluFi up after the next boot until the phone has sent a
+    network and the device has connected to it.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+
+#ifdef CONFIG_ESP_BLUFI_ENABLED
+
+#include "esp_bt.h"
+#include "esp_blufi_api.h"
+#include "esp_blufi.h"
+#include "blufi.h"
+#include "network.h"
+#include "wifi.h"
+
+#ifdef CONFIG_ESP_BLUFI_TEARDOWN_ENABLED
+
+static const char *TAG = "BLUFITEAR";
+
+#define THREAD_TEARDOWN_NAME "blufi_teardown"
+#define THREAD_TEARDOWN_STACKSIZE configMINIMAL_STACK_SIZE * 4
+#define THREAD_TEARDOWN_PRIORITY 3
+
+#define TEARDOWN_NAMESPACE "blufi"
+#define TEARDOWN_REPROVISION_KEY "reprovision"
+
+/* The shutdown in order. A failed step is tried again by the next blufi_teardown, the ones before it are not. */
+typedef enum {
+    TEARDOWN_STEP_HOST = 0,             // BluFi and Bluedroid
+    TEARDOWN_STEP_CONTROLLER_DISABLE,
+    TEARDOWN_STEP_CONTROLLER_DEINIT,
+    TEARDOWN_STEP_MEM_RELEASE,
+    TEARDOWN_STEP_DONE
+} teardown_step_t;
+
+static esp_timer_handle_t teardown_timer = NULL;
+static blufi_teardown_stats_t teardown_stats;
+static volatile bool teardown_started = false;
+static teardown_step_t teardown_step = TEARDOWN_STEP_HOST;
+/* Free heap before the first step, so the heap reclaimed covers every try */
+static uint32_t teardown_free_before = 0;
+/* Set on a boot after blufi_reprovision_on_boot, until the phone sends a network */
+static volatile bool awaiting_provisioning = false;
+/* The flag is still in NVS. It is only cleared once the new network has connected. */
+static bool reprovision_stored = false;
+
+static void blufi_teardown_task(void *arg)
+{
+    blufi_teardown();
+    vTaskDelete(NULL);
+}
+
+static void blufi_teardown_expired(void *arg)
+{
+    if (wifi_blufi_connected())
+    {
+        // A phone is using BluFi, wait another grace period
+        esp_timer_start_once(teardown_timer, CONFIG_ESP_BLUFI_TEARDOWN_DELAY * 1000000ULL);
+        return;
+    }
+    // The shutdown waits on the Bluetooth tasks, so it does not run on the timer task
+    xTaskCreate(blufi_teardown_task, THREAD_TEARDOWN_NAME, THREAD_TEARDOWN_STACKSIZE, NULL, THREAD_TEARDOWN_PRIORITY, NULL);
+}
+
+static void blufi_teardown_clear_flag(void)
+{
+    nvs_handle_t handle;
+    if (nvs_open(TEARDOWN_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK)
+    {
+        if (nvs_erase_key(handle, TEARDOWN_REPROVISION_KEY) == ESP_OK)
+        {
+            nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    reprovision_stored = false;
+}
+
+static void blufi_teardown_event(const network_event_data_t *event, void *ctx)
+{
+    if (event->iface != NETWORK_IF_WIFI || teardown_started)
+    {
+        return;
+    }
+    if (event->event == NETWORK_EVENT_CONNECTED && !awaiting_provisioning)
+    {
+        if (reprovision_stored)
+        {
+            // Connected to the network the phone sent, a reset from here on keeps it
+            blufi_teardown_clear_flag();
+        }
+        esp_timer_stop(teardown_timer);
+        esp_timer_start_once(teardown_timer, CONFIG_ESP_BLUFI_TEARDOWN_DELAY * 1000000ULL);
+    }
+    else if (event->event == NETWORK_EVENT_DISCONNECTED)
+    {
+        esp_timer_stop(teardown_timer);
+    }
+}
+
+void blufi_teardown_init(void)
+{
+    nvs_handle_t handle;
+    uint8_t reprovision = 0;
+    if (teardown_timer != NULL)
+    {
+        return;
+    }
+    // The flag stays in NVS until the new network connects, so a reset while provisioning keeps BluFi up
+    if (nvs_open(TEARDOWN_NAMESPACE, NVS_READONLY, &handle) == ESP_OK)
+    {
+        if (nvs_get_u8(handle, TEARDOWN_REPROVISION_KEY, &reprovision) == ESP_OK && reprovision)
+        {
+            ESP_LOGI(TAG, "Re-provisioning requested, BluFi stays up until a new network is connected");
+            awaiting_provisioning = true;
+            reprovision_stored = true;
+        }
+        nvs_close(handle);
+    }
+    const esp_timer_create_args_t args = {
+        .callback = blufi_teardown_expired,
+        .name = "blufi_teardown"
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&args, &teardown_timer));
+    network_subscribe(blufi_teardown_event, NULL, NETWORK_EVENT_CONNECTED | NETWORK_EVENT_DISCONNECTED);
+}
+
+void blufi_teardown_provisioned(void)
+{
+    awaiting_provisioning = false;
+}
+
+static esp_err_t blufi_teardown_run_step(teardown_step_t step)
+{
+    switch (step)
+    {
+    case TEARDOWN_STEP_HOST:
+        esp_blufi_adv_stop();
+        return esp_blufi_host_deinit();
+    case TEARDOWN_STEP_CONTROLLER_DISABLE:
+        return esp_bt_controller_disable();
+    case TEARDOWN_STEP_CONTROLLER_DEINIT:
+        return esp_bt_controller_deinit();
+    case TEARDOWN_STEP_MEM_RELEASE:
+        return esp_bt_mem_release(ESP_BT_MODE_BTDM);
+    default:
+        return ESP_OK;
+    }
+}
+
+esp_err_t blufi_teardown(void)
+{
+    if (teardown_started)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    teardown_started = true;
+    if (teardown_timer != NULL)
+    {
+        esp_timer_stop(teardown_timer);
+    }
+    network_unsubscribe(blufi_teardown_event, NULL);
+
+    if (teardown_step == TEARDOWN_STEP_HOST)
+    {
+        teardown_free_before = esp_get_free_heap_size();
+    }
+    int64_t start_us = esp_timer_get_time();
+    esp_err_t err = ESP_OK;
+    while (teardown_step < TEARDOWN_STEP_DONE)
+    {
+        err = blufi_teardown_run_step(teardown_step);
+        if (err != ESP_OK)
+        {
+            break;
+        }
+        teardown_step++;
+    }
+    teardown_stats.teardown_ms += (uint32_t)((esp_timer_get_time() - start_us) / 1000);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Bluetooth shutdown failed at step %d: %s", teardown_step, esp_err_to_name(err));
+        // Let a later call carry on from the step that failed
+        teardown_started = false;
+        return err;
+    }
+    uint32_t free_after = esp_get_free_heap_size();
+    teardown_stats.torn_down = true;
+    teardown_stats.heap_reclaimed = (free_after > teardown_free_before) ? free_after - teardown_free_before : 0;
+    ESP_LOGI(TAG, "Bluetooth released, %u bytes of heap reclaimed in %u ms", teardown_stats.heap_reclaimed,
+        teardown_stats.teardown_ms);
+    return ESP_OK;
+}
+
+esp_err_t blufi_reprovision_on_boot(bool enable)
+{
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(TEARDOWN_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    if (enable)
+    {
+        err = nvs_set_u8(handle, TEARDOWN_REPROVISION_KEY, 1);
+    }
+    else
+    {
+        err = nvs_erase_key(handle, TEARDOWN_REPROVISION_KEY);
+        if (err == ESP_ERR_NVS_NOT_FOUND)
+        {
+            err = ESP_OK;
+        }
+    }
+    if (err == ESP_OK)
+    {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return err;
+}
+
+void blufi_get_teardown_stats(blufi_teardown_stats_t *stats)
+{
+    if (stats != NULL)
+    {
+        *stats = teardown_stats;
+    }
+}
+
+#else
+
+esp_err_t blufi_teardown(void)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t blufi_reprovision_on_boot(bool enable)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void blufi_get_teardown_stats(blufi_teardown_stats_t *stats)
+{
+    if (stats != NULL)
+    {
+        memset(stats, 0, sizeof(blufi_teardown_stats_t));
+    }
+}
+
+#endif
+
+#endif
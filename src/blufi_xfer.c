@@ -0,0 +1,781 @@
+/*
+    BluFi bulk transfer
+
+    The Bluetooth stack task only checks the frame header and copies the frame into a queue
+    that holds a window of frames. The transfer task checks each chunk and writes it to the
+    data partition at once, so a blob of any size needs no more RAM than the window. Flash
+    sectors are erased as the writes reach them. The blob header is written to the first
+    sector last, once the CRC32 of the whole blob has been checked, so a partial transfer never
+    looks complete.
+
+    While a transfer runs the BLE connection interval is shortened, and set back when it ends.
+    Certificates and keys from the standard BluFi messages are saved to NVS by the same task.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_crc.h"
+#include "esp_partition.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+
+#ifdef CONFIG_ESP_BLUFI_ENABLED
+
+#include "esp_blufi_api.h"
+#include "esp_gap_ble_api.h"
+#include "blufi.h"
+#include "blufi_xfer.h"
+
+#ifdef CONFIG_ESP_BLUFI_XFER_ENABLED
+
+static const char *TAG = "BLUFIXFER";
+
+#define THREAD_XFER_NAME "blufi_xfer"
+#define THREAD_XFER_PRIORITY 3
+
+/* The window, plus END and a certificate */
+#define XFER_QUEUE_LEN (CONFIG_ESP_BLUFI_XFER_WINDOW + 2)
+#define XFER_FRAME_MAX (BLUFI_XFER_HEADER_LEN + CONFIG_ESP_BLUFI_XFER_CHUNK_SIZE)
+/* A transfer with no frames for this long is abandoned */
+#define XFER_IDLE_TIMEOUT_MS 10000
+
+#define XFER_SECTOR_SIZE 4096
+#define XFER_DATA_OFFSET XFER_SECTOR_SIZE
+#define XFER_BLOB_MAGIC 0x42465852
+
+#define CERT_NAMESPACE "blufi_cert"
+
+/* Connection interval in 1.25 ms units, supervision timeout in 10 ms units */
+#define CONN_FAST_MIN_INT 0x06
+#define CONN_FAST_MAX_INT 0x0C
+#define CONN_IDLE_MIN_INT 0x18
+#define CONN_IDLE_MAX_INT 0x28
+#define CONN_TIMEOUT 400
+
+typedef struct {
+    uint32_t magic;
+    uint32_t len;
+    uint32_t crc32;
+    char name[BLUFI_XFER_NAME_LEN];
+} xfer_blob_header_t;
+
+typedef enum {
+    XFER_MSG_FRAME,
+    XFER_MSG_CERT,
+    XFER_MSG_DISCONNECT
+} xfer_msg_kind_t;
+
+typedef struct {
+    xfer_msg_kind_t kind;
+    uint16_t len;
+    union {
+        uint8_t frame[XFER_FRAME_MAX];
+        struct {
+            blufi_cert_t type;
+            uint8_t *data;
+        } cert;
+    };
+} xfer_msg_t;
+
+static const char *cert_keys[BLUFI_CERT_MAX] = {
+    "ca", "client_cert", "server_cert", "client_key", "server_key"
+};
+
+static StaticQueue_t xfer_queue_buffer;
+static uint8_t xfer_queue_storage[XFER_QUEUE_LEN * sizeof(xfer_msg_t)];
+static QueueHandle_t xfer_queue = NULL;
+static xfer_msg_t xfer_msg;
+
+static blufi_xfer_stats_t xfer_stats;
+static void (*xfer_callback)(const char *name, size_t len) = NULL;
+
+static esp_bd_addr_t peer_bda;
+static bool peer_connected = false;
+
+/* The transfer in progress. Only touched by the transfer task. */
+static const esp_partition_t *xfer_partition = NULL;
+static bool xfer_active = false;
+static bool xfer_nak_sent = false;
+static uint16_t xfer_expected_seq = 0;
+/* Sequence number of the END of the last completed transfer, so a resent END is acknowledged again */
+static int32_t xfer_done_seq = -1;
+static uint32_t xfer_len = 0;
+static uint32_t xfer_offset = 0;
+static uint32_t xfer_erased_to = 0;
+static uint32_t xfer_crc32 = 0;
+static char xfer_name[BLUFI_XFER_NAME_LEN];
+
+#ifdef CONFIG_ESP_BLUFI_XFER_BENCHMARK
+/* Set while the loopback benchmark runs. Replies wake the benchmark instead of going to the phone. */
+static TaskHandle_t bench_task = NULL;
+static volatile int32_t bench_acked = -1;
+static volatile uint8_t bench_reply = 0;
+/* Lowest free heap seen by the transfer task while the benchmark runs */
+static volatile uint32_t bench_free_low = 0;
+#endif
+
+static uint16_t xfer_get16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t xfer_get32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void xfer_put16(uint8_t *p, uint16_t value)
+{
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+}
+
+static void xfer_put32(uint8_t *p, uint32_t value)
+{
+    xfer_put16(p, (uint16_t)value);
+    xfer_put16(&p[2], (uint16_t)(value >> 16));
+}
+
+/* Builds a frame in buffer, which must have room for the header. Returns the frame length. */
+static uint16_t blufi_xfer_build(uint8_t *buffer, uint8_t type, uint16_t seq, const uint8_t *payload, uint16_t len)
+{
+    buffer[0] = BLUFI_XFER_MAGIC;
+    buffer[1] = type;
+    xfer_put16(&buffer[2], seq);
+    xfer_put16(&buffer[4], len);
+    xfer_put16(&buffer[6], esp_crc16_be(0, payload, len));
+    if (payload != &buffer[BLUFI_XFER_HEADER_LEN] && len > 0)
+    {
+        memcpy(&buffer[BLUFI_XFER_HEADER_LEN], payload, len);
+    }
+    return BLUFI_XFER_HEADER_LEN + len;
+}
+
+static void blufi_xfer_reply(uint8_t type, uint16_t seq, const uint8_t *payload, uint16_t len)
+{
+    uint8_t frame[BLUFI_XFER_HEADER_LEN + 4];
+#ifdef CONFIG_ESP_BLUFI_XFER_BENCHMARK
+    if (bench_task != NULL)
+    {
+        bench_acked = (type == BLUFI_XFER_ACK) ? seq : bench_acked;
+        bench_reply = type;
+        xTaskNotifyGive(bench_task);
+        return;
+    }
+#endif
+    uint16_t frame_len = blufi_xfer_build(frame, type, seq, payload, len);
+    esp_err_t err = esp_blufi_send_custom_data(frame, frame_len);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Unable to send the reply: %s", esp_err_to_name(err));
+    }
+}
+
+static void blufi_xfer_reply_error(uint16_t seq, esp_err_t error)
+{
+    uint8_t payload[4];
+    xfer_put32(payload, (uint32_t)error);
+    blufi_xfer_reply(BLUFI_XFER_ERROR, seq, payload, sizeof(payload));
+}
+
+static void blufi_xfer_conn_params(bool fast)
+{
+    if (!peer_connected)
+    {
+        return;
+    }
+    esp_ble_conn_update_params_t params = {
+        .min_int = fast ? CONN_FAST_MIN_INT : CONN_IDLE_MIN_INT,
+        .max_int = fast ? CONN_FAST_MAX_INT : CONN_IDLE_MAX_INT,
+        .latency = 0,
+        .timeout = CONN_TIMEOUT
+    };
+    memcpy(params.bda, peer_bda, sizeof(esp_bd_addr_t));
+    esp_ble_gap_update_conn_params(&params);
+}
+
+static void blufi_xfer_end(bool completed)
+{
+    if (!xfer_active)
+    {
+        return;
+    }
+    xfer_active = false;
+    if (completed)
+    {
+        xfer_stats.completed++;
+    }
+    else
+    {
+        xfer_stats.failed++;
+    }
+    blufi_xfer_conn_params(false);
+}
+
+static esp_err_t blufi_xfer_start(const uint8_t *payload, uint16_t len)
+{
+    if (len < 5)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (xfer_partition == NULL)
+    {
+        xfer_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+            CONFIG_ESP_BLUFI_XFER_PARTITION);
+        if (xfer_partition == NULL)
+        {
+            ESP_LOGE(TAG, "No %s partition", CONFIG_ESP_BLUFI_XFER_PARTITION);
+            return ESP_ERR_NOT_FOUND;
+        }
+    }
+    uint32_t total_len = xfer_get32(payload);
+    if (total_len > xfer_partition->size - XFER_DATA_OFFSET)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    // A new START replaces a transfer that did not finish
+    blufi_xfer_end(false);
+    // Invalidate the blob that is there before any of it is overwritten
+    esp_err_t err = esp_partition_erase_range(xfer_partition, 0, XFER_SECTOR_SIZE);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    uint16_t name_len = len - 4;
+    if (name_len >= BLUFI_XFER_NAME_LEN)
+    {
+        name_len = BLUFI_XFER_NAME_LEN - 1;
+    }
+    memcpy(xfer_name, &payload[4], name_len);
+    xfer_name[name_len] = '\0';
+    xfer_len = total_len;
+    xfer_offset = 0;
+    xfer_erased_to = XFER_DATA_OFFSET;
+    xfer_crc32 = 0;
+    xfer_expected_seq = 1;
+    xfer_done_seq = -1;
+    xfer_nak_sent = false;
+    xfer_active = true;
+    xfer_stats.started++;
+    blufi_xfer_conn_params(true);
+    ESP_LOGI(TAG, "Receiving %s, %u bytes", xfer_name, total_len);
+    return ESP_OK;
+}
+
+static esp_err_t blufi_xfer_write(const uint8_t *data, uint16_t len)
+{
+    if (xfer_offset + len > xfer_len)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    uint32_t address = XFER_DATA_OFFSET + xfer_offset;
+    while (xfer_erased_to < address + len)
+    {
+        esp_err_t err = esp_partition_erase_range(xfer_partition, xfer_erased_to, XFER_SECTOR_SIZE);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        xfer_erased_to += XFER_SECTOR_SIZE;
+    }
+    esp_err_t err = esp_partition_write(xfer_partition, address, data, len);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    xfer_crc32 = esp_crc32_le(xfer_crc32, data, len);
+    xfer_offset += len;
+    xfer_stats.bytes += len;
+    return ESP_OK;
+}
+
+static esp_err_t blufi_xfer_finish(const uint8_t *payload, uint16_t len)
+{
+    if (len < 4 || xfer_offset != xfer_len)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (xfer_get32(payload) != xfer_crc32)
+    {
+        return ESP_ERR_INVALID_CRC;
+    }
+    xfer_blob_header_t header = {
+        .magic = XFER_BLOB_MAGIC,
+        .len = xfer_len,
+        .crc32 = xfer_crc32
+    };
+    memcpy(header.name, xfer_name, sizeof(header.name));
+    return esp_partition_write(xfer_partition, 0, &header, sizeof(header));
+}
+
+static void blufi_xfer_frame(const uint8_t *frame, uint16_t frame_len)
+{
+    uint8_t type = frame[1];
+    uint16_t seq = xfer_get16(&frame[2]);
+    uint16_t len = xfer_get16(&frame[4]);
+    const uint8_t *payload = &frame[BLUFI_XFER_HEADER_LEN];
+    esp_err_t err = ESP_OK;
+
+    if (type == BLUFI_XFER_ABORT)
+    {
+        ESP_LOGI(TAG, "Transfer aborted by the phone");
+        blufi_xfer_end(false);
+        return;
+    }
+    bool crc_ok = (len == frame_len - BLUFI_XFER_HEADER_LEN && esp_crc16_be(0, payload, len) == xfer_get16(&frame[6]));
+    if (type == BLUFI_XFER_START)
+    {
+        err = crc_ok ? blufi_xfer_start(payload, len) : ESP_ERR_INVALID_CRC;
+        if (err != ESP_OK)
+        {
+            blufi_xfer_reply_error(seq, err);
+            return;
+        }
+        uint8_t reply[4];
+        xfer_put16(reply, CONFIG_ESP_BLUFI_XFER_WINDOW);
+        xfer_put16(&reply[2], CONFIG_ESP_BLUFI_XFER_CHUNK_SIZE);
+        blufi_xfer_reply(BLUFI_XFER_ACK, seq, reply, sizeof(reply));
+        return;
+    }
+    if (!xfer_active)
+    {
+        if (type == BLUFI_XFER_END && seq == xfer_done_seq)
+        {
+            // The ACK of END was lost and the phone sent it again. The blob is already committed.
+            blufi_xfer_reply(BLUFI_XFER_ACK, seq, NULL, 0);
+            return;
+        }
+        blufi_xfer_reply_error(seq, ESP_ERR_INVALID_STATE);
+        return;
+    }
+    if (!crc_ok || seq != xfer_expected_seq)
+    {
+        // Go back N: everything after the bad frame is dropped until it is sent again
+        if (!crc_ok)
+        {
+            xfer_stats.crc_errors++;
+        }
+        else
+        {
+            xfer_stats.seq_errors++;
+        }
+        if (!xfer_nak_sent)
+        {
+            xfer_nak_sent = true;
+            blufi_xfer_reply(BLUFI_XFER_NAK, xfer_expected_seq, NULL, 0);
+        }
+        return;
+    }
+    xfer_nak_sent = false;
+    if (type == BLUFI_XFER_DATA)
+    {
+        err = blufi_xfer_write(payload, len);
+    }
+    else if (type == BLUFI_XFER_END)
+    {
+        err = blufi_xfer_finish(payload, len);
+    }
+    else
+    {
+        err = ESP_ERR_NOT_SUPPORTED;
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Transfer of %s failed at %u bytes: %s", xfer_name, xfer_offset, esp_err_to_name(err));
+        blufi_xfer_reply_error(seq, err);
+        blufi_xfer_end(false);
+        return;
+    }
+    xfer_expected_seq++;
+    blufi_xfer_reply(BLUFI_XFER_ACK, seq, NULL, 0);
+    if (type == BLUFI_XFER_END)
+    {
+        ESP_LOGI(TAG, "Received %s, %u bytes", xfer_name, xfer_len);
+        xfer_done_seq = seq;
+        blufi_xfer_end(true);
+        if (xfer_callback != NULL)
+        {
+            xfer_callback(xfer_name, xfer_len);
+        }
+    }
+}
+
+static void blufi_xfer_save_cert_nvs(blufi_cert_t type, const uint8_t *data, uint16_t len)
+{
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(CERT_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK)
+    {
+        err = nvs_set_blob(handle, cert_keys[type], data, len);
+        if (err == ESP_OK)
+        {
+            err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Unable to save %s: %s", cert_keys[type], esp_err_to_name(err));
+    }
+    else
+    {
+        ESP_LOGI(TAG, "Saved %s, %u bytes", cert_keys[type], len);
+    }
+}
+
+static void blufi_xfer_task(void *arg)
+{
+    while (true)
+    {
+        TickType_t timeout = xfer_active ? pdMS_TO_TICKS(XFER_IDLE_TIMEOUT_MS) : portMAX_DELAY;
+        if (xQueueReceive(xfer_queue, &xfer_msg, timeout) != pdTRUE)
+        {
+            ESP_LOGW(TAG, "Transfer of %s stalled at %u bytes", xfer_name, xfer_offset);
+            blufi_xfer_end(false);
+            continue;
+        }
+        switch (xfer_msg.kind)
+        {
+            case XFER_MSG_FRAME:
+                blufi_xfer_frame(xfer_msg.frame, xfer_msg.len);
+#ifdef CONFIG_ESP_BLUFI_XFER_BENCHMARK
+                if (bench_task != NULL)
+                {
+                    uint32_t free_now = esp_get_free_heap_size();
+                    if (free_now < bench_free_low)
+                    {
+                        bench_free_low = free_now;
+                    }
+                }
+#endif
+                break;
+            case XFER_MSG_CERT:
+                blufi_xfer_save_cert_nvs(xfer_msg.cert.type, xfer_msg.cert.data, xfer_msg.len);
+                free(xfer_msg.cert.data);
+                break;
+            case XFER_MSG_DISCONNECT:
+                blufi_xfer_end(false);
+                break;
+        }
+    }
+}
+
+void blufi_xfer_init(void)
+{
+    if (xfer_queue != NULL)
+    {
+        return;
+    }
+    xfer_queue = xQueueCreateStatic(XFER_QUEUE_LEN, sizeof(xfer_msg_t), xfer_queue_storage, &xfer_queue_buffer);
+    xTaskCreate(blufi_xfer_task, THREAD_XFER_NAME, CONFIG_ESP_BLUFI_XFER_STACKSIZE, NULL, THREAD_XFER_PRIORITY, NULL);
+}
+
+bool blufi_xfer_is_frame(const uint8_t *data, uint32_t len)
+{
+    return len >= BLUFI_XFER_HEADER_LEN && data[0] == BLUFI_XFER_MAGIC;
+}
+
+/* msg is too big for the caller's stack, so each caller passes its own static one */
+static void blufi_xfer_queue_frame(xfer_msg_t *msg, const uint8_t *data, uint32_t len)
+{
+    if (xfer_queue == NULL || len > XFER_FRAME_MAX)
+    {
+        xfer_stats.dropped++;
+        return;
+    }
+    msg->kind = XFER_MSG_FRAME;
+    msg->len = (uint16_t)len;
+    memcpy(msg->frame, data, len);
+    if (xQueueSend(xfer_queue, msg, 0) != pdTRUE)
+    {
+        // The phone sent more than the window. The next frame that gets through is out of order and NAKed.
+        xfer_stats.dropped++;
+    }
+}
+
+void blufi_xfer_post(const uint8_t *data, uint32_t len)
+{
+    static xfer_msg_t msg;      // Only the Bluetooth stack task posts frames from the phone
+#ifdef CONFIG_ESP_BLUFI_XFER_BENCHMARK
+    if (bench_task != NULL)
+    {
+        // Would be mixed into the benchmark's transfer
+        xfer_stats.dropped++;
+        return;
+    }
+#endif
+    blufi_xfer_queue_frame(&msg, data, len);
+}
+
+void blufi_xfer_save_cert(blufi_cert_t type, const uint8_t *data, int len)
+{
+    static xfer_msg_t msg;      // Only the Bluetooth stack task saves certificates
+    if (xfer_queue == NULL || data == NULL || len <= 0 || len > UINT16_MAX)
+    {
+        return;
+    }
+    msg.kind = XFER_MSG_CERT;
+    msg.len = (uint16_t)len;
+    msg.cert.type = type;
+    msg.cert.data = malloc(len);
+    if (msg.cert.data == NULL)
+    {
+        ESP_LOGE(TAG, "No memory for %s", cert_keys[type]);
+        return;
+    }
+    memcpy(msg.cert.data, data, len);
+    if (xQueueSend(xfer_queue, &msg, 0) != pdTRUE)
+    {
+        ESP_LOGE(TAG, "Queue full, %s not saved", cert_keys[type]);
+        free(msg.cert.data);
+    }
+}
+
+void blufi_xfer_connected(const uint8_t *bda)
+{
+    memcpy(peer_bda, bda, sizeof(esp_bd_addr_t));
+    peer_connected = true;
+}
+
+void blufi_xfer_disconnected(void)
+{
+    static const xfer_msg_t msg = { .kind = XFER_MSG_DISCONNECT };
+    peer_connected = false;
+    if (xfer_queue != NULL)
+    {
+        xQueueSend(xfer_queue, &msg, 0);
+    }
+}
+
+void blufi_xfer_set_callback(void (*callback)(const char *name, size_t len))
+{
+    xfer_callback = callback;
+}
+
+esp_err_t blufi_xfer_get(char name[BLUFI_XFER_NAME_LEN], size_t *len)
+{
+    xfer_blob_header_t header;
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+        CONFIG_ESP_BLUFI_XFER_PARTITION);
+    if (partition == NULL)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t err = esp_partition_read(partition, 0, &header, sizeof(header));
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    if (header.magic != XFER_BLOB_MAGIC)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (name != NULL)
+    {
+        memcpy(name, header.name, BLUFI_XFER_NAME_LEN);
+        name[BLUFI_XFER_NAME_LEN - 1] = '\0';
+    }
+    if (len != NULL)
+    {
+        *len = header.len;
+    }
+    return ESP_OK;
+}
+
+esp_err_t blufi_xfer_read(size_t offset, void *buf, size_t len)
+{
+    size_t blob_len;
+    esp_err_t err = blufi_xfer_get(NULL, &blob_len);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    if (offset + len > blob_len)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+        CONFIG_ESP_BLUFI_XFER_PARTITION);
+    return esp_partition_read(partition, XFER_DATA_OFFSET + offset, buf, len);
+}
+
+esp_err_t blufi_get_cert(blufi_cert_t type, void *buf, size_t *len)
+{
+    nvs_handle_t handle;
+    if (type >= BLUFI_CERT_MAX || len == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = nvs_open(CERT_NAMESPACE, NVS_READONLY, &handle);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    err = nvs_get_blob(handle, cert_keys[type], buf, len);
+    nvs_close(handle);
+    return err;
+}
+
+void blufi_xfer_get_stats(blufi_xfer_stats_t *stats)
+{
+    if (stats != NULL)
+    {
+        *stats = xfer_stats;
+    }
+}
+
+#ifdef CONFIG_ESP_BLUFI_XFER_BENCHMARK
+
+#define BENCH_REPLY_TIMEOUT_MS 5000
+
+static uint8_t bench_frame[XFER_FRAME_MAX];
+static xfer_msg_t bench_msg;
+
+static void blufi_xfer_bench_post(uint16_t len)
+{
+    blufi_xfer_queue_frame(&bench_msg, bench_frame, len);
+}
+
+/* Waits until seq is acknowledged. Returns false on a timeout or a reply other than an ACK. */
+static bool blufi_xfer_bench_wait(uint16_t seq)
+{
+    while (bench_acked < seq)
+    {
+        if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(BENCH_REPLY_TIMEOUT_MS)) == 0 || bench_reply != BLUFI_XFER_ACK)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+esp_err_t blufi_xfer_benchmark(size_t total_len, blufi_xfer_bench_t *result)
+{
+    uint8_t chunk[CONFIG_ESP_BLUFI_XFER_CHUNK_SIZE];
+    uint8_t payload[4 + sizeof("bench")];
+    uint32_t crc32 = 0;
+
+    if (result == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // A phone could be sending frames of its own, or start to once it has seen the window
+    if (xfer_queue == NULL || xfer_active || bench_task != NULL || peer_connected)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    memset(result, 0, sizeof(blufi_xfer_bench_t));
+    esp_fill_random(chunk, sizeof(chunk));
+    bench_acked = -1;
+    bench_reply = 0;
+    uint32_t free_before = esp_get_free_heap_size();
+    uint32_t min_free_before = heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+    bench_free_low = free_before;
+    bench_task = xTaskGetCurrentTaskHandle();
+    ulTaskNotifyTake(pdTRUE, 0);
+    int64_t start_us = esp_timer_get_time();
+
+    xfer_put32(payload, total_len);
+    memcpy(&payload[4], "bench", sizeof("bench") - 1);
+    blufi_xfer_bench_post(blufi_xfer_build(bench_frame, BLUFI_XFER_START, 0, payload, sizeof(payload) - 1));
+    esp_err_t err = blufi_xfer_bench_wait(0) ? ESP_OK : ESP_FAIL;
+
+    // Keep the window full: send until window frames are unacknowledged, then wait for the oldest
+    uint16_t seq = 1;
+    size_t sent = 0;
+    while (err == ESP_OK && sent < total_len)
+    {
+        uint16_t len = (total_len - sent < sizeof(chunk)) ? (uint16_t)(total_len - sent) : sizeof(chunk);
+        if (seq > CONFIG_ESP_BLUFI_XFER_WINDOW && !blufi_xfer_bench_wait(seq - CONFIG_ESP_BLUFI_XFER_WINDOW))
+        {
+            err = ESP_FAIL;
+            break;
+        }
+        blufi_xfer_bench_post(blufi_xfer_build(bench_frame, BLUFI_XFER_DATA, seq, chunk, len));
+        crc32 = esp_crc32_le(crc32, chunk, len);
+        sent += len;
+        seq++;
+    }
+    if (err == ESP_OK)
+    {
+        xfer_put32(payload, crc32);
+        blufi_xfer_bench_post(blufi_xfer_build(bench_frame, BLUFI_XFER_END, seq, payload, 4));
+        err = blufi_xfer_bench_wait(seq) ? ESP_OK : ESP_FAIL;
+    }
+    int64_t elapsed_us = esp_timer_get_time() - start_us;
+    bench_task = NULL;
+
+    // The per frame samples can miss a short allocation. The low-water mark catches it if it set a new low.
+    uint32_t heap_peak = free_before - bench_free_low;
+    uint32_t min_free_after = heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+    if (min_free_after < min_free_before && free_before - min_free_after > heap_peak)
+    {
+        heap_peak = free_before - min_free_after;
+    }
+
+    result->bytes = sent;
+    result->elapsed_ms = (uint32_t)(elapsed_us / 1000);
+    result->kbytes_per_sec = (elapsed_us > 0) ? (uint32_t)((int64_t)sent * 1000000LL / 1024 / elapsed_us) : 0;
+    result->heap_peak = heap_peak;
+    result->ram_bytes = sizeof(xfer_queue_storage) + sizeof(xfer_msg) + sizeof(bench_msg) + sizeof(bench_frame) +
+        CONFIG_ESP_BLUFI_XFER_STACKSIZE;
+    ESP_LOGI(TAG, "Loopback %u bytes in %u ms, %u KB/s, heap peak %u bytes, static RAM %u bytes: %s", result->bytes,
+        result->elapsed_ms, result->kbytes_per_sec, result->heap_peak, result->ram_bytes, esp_err_to_name(err));
+    return err;
+}
+
+#else
+
+esp_err_t blufi_xfer_benchmark(size_t total_len, blufi_xfer_bench_t *result)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif
+
+#else
+
+void blufi_xfer_set_callback(void (*callback)(const char *name, size_t len))
+{
+}
+
+esp_err_t blufi_xfer_get(char name[BLUFI_XFER_NAME_LEN], size_t *len)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t blufi_xfer_read(size_t offset, void *buf, size_t len)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t blufi_get_cert(blufi_cert_t type, void *buf, size_t *len)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void blufi_xfer_get_stats(blufi_xfer_stats_t *stats)
+{
+    if (stats != NULL)
+    {
+        memset(stats, 0, sizeof(blufi_xfer_stats_t));
+    }
+}
+
+esp_err_t blufi_xfer_benchmark(size_t total_len, blufi_xfer_bench_t *result)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif
+
+#endif
@@ -16,8 +16,10 @@
 #include "esp_eth.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "driver/gpio.h"
 #include "sdkconfig.h"
+#include "network_priv.h"
 
 #if CONFIG_ESP_ETHERNET_ENABLED
 
@@ -35,23 +37,31 @@ static EventGroupHandle_t s_ethernet_event_group;
 static void (*led_ethernet_connected_callback)() = NULL;
 static void (*led_ethernet_disconnected_callback)() = NULL;
 
+static esp_netif_t *eth_netif = NULL;
+static esp_eth_handle_t eth_handle = NULL;
+
+/* Time the link came up, used to time DHCP */
+static int64_t link_up_us = 0;
+
 void ethernet_waitforconnect(void)
 {
-    while (1)
+    while (!ethernet_waitforconnect_timeout(portMAX_DELAY))
     {
-        // Sit and wait until something happens
-        EventBits_t bits = xEventGroupWaitBits(s_ethernet_event_group,
-                ETHERNET_CONNECTED_BIT,
-                pdFALSE,
-                pdFALSE,
-                portMAX_DELAY);
-
-        if (bits & ETHERNET_CONNECTED_BIT) {
-            return;
-        }
     }
 }
 
+bool ethernet_waitforconnect_timeout(TickType_t timeout)
+{
+    // Sit and wait until something happens
+    EventBits_t bits = xEventGroupWaitBits(s_ethernet_event_group,
+            ETHERNET_CONNECTED_BIT,
+            pdFALSE,
+            pdFALSE,
+            timeout);
+
+    return (bits & ETHERNET_CONNECTED_BIT) != 0;
+}
+
 void set_ethernet_led_connected_callback(void (*callback)())
 {
     if (callback!=NULL)
@@ -84,17 +94,46 @@ static void led_disconnected()
     }
 }
 
+esp_netif_t *ethernet_get_netif(void)
+{
+    return eth_netif;
+}
+
+#ifdef CONFIG_ESP_NETWORK_FAULT_INJECTION
+void ethernet_inject_link(bool up)
+{
+    if (eth_handle == NULL)
+    {
+        return;
+    }
+    if (up)
+    {
+        // The PHY reports the link when it comes back
+        esp_eth_start(eth_handle);
+    }
+    else
+    {
+        // Stopping the driver does not report a link down, so post one like the PHY would
+        esp_eth_stop(eth_handle);
+        esp_event_post(ETH_EVENT, ETHERNET_EVENT_DISCONNECTED, &eth_handle, sizeof(eth_handle), portMAX_DELAY);
+    }
+}
+#endif
+
 /** Event handler for Ethernet events */
 static void eth_event_handler(void *arg, esp_event_base_t event_base,
                               int32_t event_id, void *event_data)
 {
     uint8_t mac_addr[6] = {0};
     /* we can get the ethernet driver handle from event data */
-    esp_eth_handle_t eth_handle = *(esp_eth_handle_t *)event_data;
+    esp_eth_handle_t handle = *(esp_eth_handle_t *)event_data;
 
     switch (event_id) {
     case ETHERNET_EVENT_CONNECTED:
-        esp_eth_ioctl(eth_handle, ETH_CMD_G_MAC_ADDR, mac_addr);
+        esp_eth_ioctl(handle, ETH_CMD_G_MAC_ADDR, mac_addr);
+        link_up_us = esp_timer_get_time();
+        net_ip_apply(NETWORK_IF_ETHERNET, eth_netif);
+        net_fault_dhcp_hold(eth_netif);
         ESP_LOGI(TAG, "Ethernet Link Up");
         ESP_LOGI(TAG, "Ethernet HW Addr %02x:%02x:%02x:%02x:%02x:%02x",
                  mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
@@ -103,6 +142,10 @@ static void eth_event_handler(void *arg, esp_event_base_t event_base,
         ESP_LOGI(TAG, "Ethernet Link Down");
         xEventGroupClearBits(s_ethernet_event_group, ETHERNET_CONNECTED_BIT);
         xEventGroupSetBits(s_ethernet_event_group, ETHERNET_DISCONNECTED_BIT);
+        net_failover_lost(NETWORK_IF_ETHERNET, esp_timer_get_time());
+        network_set_connected(NETWORK_IF_ETHERNET, false);
+        net_ip_set_link_state(NETWORK_IF_ETHERNET, eth_netif, NETWORK_LINK_DOWN);
+        net_event_publish(NETWORK_EVENT_DISCONNECTED, NETWORK_IF_ETHERNET, NULL, 0, 0);
         led_disconnected();
         break;
     case ETHERNET_EVENT_START:
@@ -129,15 +172,33 @@ static void got_ip_event_handler(void *arg, esp_event_base_t event_base,
     ESP_LOGI(TAG, "ETHMASK:" IPSTR, IP2STR(&ip_info->netmask));
     ESP_LOGI(TAG, "ETHGW:" IPSTR, IP2STR(&ip_info->gw));
     ESP_LOGI(TAG, "~~~~~~~~~~~");
-    if (esp_ip4_addr1_16(&event->ip_info.ip)==169)
+    if (net_ip_got_ip(NETWORK_IF_ETHERNET, event->esp_netif, ip_info))
+    {
+        // DHCP confirmed the cached address we are already using
+        return;
+    }
+    bool link_local = (esp_ip4_addr1_16(&event->ip_info.ip)==169);
+    if (link_local)
+    {
+        net_ip_set_link_state(NETWORK_IF_ETHERNET, event->esp_netif, NETWORK_LINK_LOCAL_ONLY);
+        net_event_publish(NETWORK_EVENT_LINK_LOCAL, NETWORK_IF_ETHERNET, ip_info, 0, 0);
+    }
+    else
+    {
+        net_ip_set_link_state(NETWORK_IF_ETHERNET, event->esp_netif, NETWORK_LINK_UP);
+        net_trace_record(NETWORK_PHASE_ETH_DHCP, link_up_us);
+    }
+    if (link_local && !net_ip_link_local_allowed())
     {
-        ESP_LOGW(TAG, "Got IP, but local one - not firing events");
+        ESP_LOGW(TAG, "Got IP, but local one - not firing events until DHCP succeeds");
     }
     else
     {
         led_connected();
         xEventGroupClearBits(s_ethernet_event_group, ETHERNET_DISCONNECTED_BIT);
         xEventGroupSetBits(s_ethernet_event_group, ETHERNET_CONNECTED_BIT);
+        network_set_connected(NETWORK_IF_ETHERNET, true);
+        net_event_publish(NETWORK_EVENT_CONNECTED, NETWORK_IF_ETHERNET, ip_info, 0, 0);
     }
 
 }
@@ -147,12 +208,12 @@ void ethernet_setup(void)
     s_ethernet_event_group = xEventGroupCreate();
 
     esp_netif_config_t cfg = ESP_NETIF_DEFAULT_ETH();
-    esp_netif_t *eth_netif = esp_netif_new(&cfg);
+    eth_netif = esp_netif_new(&cfg);
     // Set default handlers to process TCP/IP stuffs
     ESP_ERROR_CHECK(esp_eth_set_default_handlers(eth_netif));
     // Register user defined event handers
-    ESP_ERROR_CHECK(esp_event_handler_register(ETH_EVENT, ESP_EVENT_ANY_ID, &eth_event_handler, NULL));
-    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_ETH_GOT_IP, &got_ip_event_handler, NULL));
+    ESP_ERROR_CHECK(net_dispatch_register(ETH_EVENT, ESP_EVENT_ANY_ID, &eth_event_handler, NULL));
+    ESP_ERROR_CHECK(net_dispatch_register(IP_EVENT, IP_EVENT_ETH_GOT_IP, &got_ip_event_handler, NULL));
 
     eth_mac_config_t mac_config = ETH_MAC_DEFAULT_CONFIG();
     eth_phy_config_t phy_config = ETH_PHY_DEFAULT_CONFIG();
@@ -200,7 +261,6 @@ void ethernet_setup(void)
     esp_eth_phy_t *phy = esp_eth_phy_new_dm9051(&phy_config);
 #endif
     esp_eth_config_t config = ETH_DEFAULT_CONFIG(mac, phy);
-    esp_eth_handle_t eth_handle = NULL;
     ESP_LOGI(TAG, "Installing Ethernet Driver...");
     ESP_ERROR_CHECK(esp_eth_driver_install(&config, &eth_handle));
     /* attach Ethernet driver to TCP/IP stack */
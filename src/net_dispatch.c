@@ -0,0 +1,315 @@
+/*
+    Network event dispatcher
+
+    The component's event handlers used to run on the default event loop task, along with the
+    LED callbacks, BluFi reports and logging they do. Instead, a small forwarder is registered
+    on the default loop. It copies the event into a fixed size message in a single producer,
+    single consumer ring and wakes the dispatcher task, which calls the real handler. The
+    default loop is the only producer and the dispatcher task the only consumer, so the ring
+    needs no lock. net_dispatch_call queues a function the same way, for changes that must not
+    happen while a handler runs.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "sdkconfig.h"
+#include "network_priv.h"
+
+#if CONFIG_ESP_WIFI_ENABLED
+#include "esp_wifi.h"
+#endif
+#if CONFIG_ESP_ETHERNET_ENABLED
+#include "esp_eth.h"
+#endif
+
+/* A function run by net_dispatch_call, sent as an event so it is queued behind the events before it */
+ESP_EVENT_DEFINE_BASE(NET_DISPATCH_EVENT);
+#define NET_DISPATCH_EVENT_CALL 0
+
+typedef struct {
+    void (*fn)(void *arg);
+    void *arg;
+    TaskHandle_t waiter;
+} net_dispatch_call_t;
+
+static bool call_registered = false;
+
+static void net_dispatch_run_call(void *arg, esp_event_base_t base, int32_t id, void *event_data)
+{
+    const net_dispatch_call_t *call = (const net_dispatch_call_t *)event_data;
+    call->fn(call->arg);
+    xTaskNotifyGive(call->waiter);
+}
+
+#ifdef CONFIG_ESP_NETWORK_DISPATCH_ENABLED
+
+static const char *TAG = "NETDISPATCH";
+
+#define THREAD_DISPATCH_NAME "net_dispatch"
+#define DISPATCH_MAX_HANDLERS 8
+
+/* Every event data type the component handles fits in the payload */
+typedef union {
+#if CONFIG_ESP_WIFI_ENABLED
+    wifi_event_sta_connected_t sta_connected;
+    wifi_event_sta_disconnected_t sta_disconnected;
+    wifi_event_sta_scan_done_t scan_done;
+#endif
+#if CONFIG_ESP_ETHERNET_ENABLED
+    esp_eth_handle_t eth_handle;
+#endif
+    ip_event_got_ip_t got_ip;
+    net_dispatch_call_t call;
+} net_dispatch_payload_t;
+
+typedef struct {
+    esp_event_handler_t handler;        // NULL if the entry is free
+    void *arg;
+    esp_event_base_t base;
+    int32_t id;
+    esp_event_handler_instance_t instance;
+    uint32_t generation;                // Bumped when the entry is freed, so a reused entry drops old events
+} net_dispatch_handler_t;
+
+typedef struct {
+    const net_dispatch_handler_t *handler;
+    uint32_t generation;
+    esp_event_base_t base;
+    int32_t id;
+    bool has_data;
+    int64_t posted_us;
+    net_dispatch_payload_t payload;
+} net_dispatch_msg_t;
+
+static net_dispatch_handler_t dispatch_handlers[DISPATCH_MAX_HANDLERS];
+
+/* One slot is always left empty so a full ring can be told apart from an empty one */
+static net_dispatch_msg_t dispatch_ring[CONFIG_ESP_NETWORK_DISPATCH_QUEUE_LEN];
+static uint32_t dispatch_head = 0;     // Written by the default event loop only
+static uint32_t dispatch_tail = 0;     // Written by the dispatcher task only
+
+static TaskHandle_t dispatch_task = NULL;
+static network_dispatch_stats_t dispatch_stats;
+
+/* Size of the event data for the events the component handles. Events with no data used by the handlers are 0. */
+static size_t net_dispatch_event_size(esp_event_base_t base, int32_t id)
+{
+#if CONFIG_ESP_WIFI_ENABLED
+    if (base == WIFI_EVENT)
+    {
+        switch (id)
+        {
+            case WIFI_EVENT_STA_CONNECTED:
+                return sizeof(wifi_event_sta_connected_t);
+            case WIFI_EVENT_STA_DISCONNECTED:
+                return sizeof(wifi_event_sta_disconnected_t);
+            case WIFI_EVENT_SCAN_DONE:
+                return sizeof(wifi_event_sta_scan_done_t);
+            default:
+                return 0;
+        }
+    }
+#endif
+#if CONFIG_ESP_ETHERNET_ENABLED
+    if (base == ETH_EVENT)
+    {
+        return sizeof(esp_eth_handle_t);
+    }
+#endif
+    if (base == IP_EVENT && (id == IP_EVENT_STA_GOT_IP || id == IP_EVENT_ETH_GOT_IP))
+    {
+        return sizeof(ip_event_got_ip_t);
+    }
+    if (base == NET_DISPATCH_EVENT)
+    {
+        return sizeof(net_dispatch_call_t);
+    }
+    return 0;
+}
+
+/* Runs on the default event loop. Only copies the event. */
+static void net_dispatch_forward(void *arg, esp_event_base_t base, int32_t id, void *event_data)
+{
+    uint32_t head = __atomic_load_n(&dispatch_head, __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n(&dispatch_tail, __ATOMIC_ACQUIRE);
+    uint32_t next = (head + 1) % CONFIG_ESP_NETWORK_DISPATCH_QUEUE_LEN;
+    if (next == tail)
+    {
+        dispatch_stats.dropped++;
+        ESP_LOGE(TAG, "Queue full, dropped event %s:%d", base, id);
+        return;
+    }
+    net_dispatch_msg_t *msg = &dispatch_ring[head];
+    size_t size = net_dispatch_event_size(base, id);
+    msg->handler = (const net_dispatch_handler_t *)arg;
+    msg->generation = __atomic_load_n(&msg->handler->generation, __ATOMIC_ACQUIRE);
+    msg->base = base;
+    msg->id = id;
+    msg->has_data = (size > 0 && event_data != NULL);
+    msg->posted_us = esp_timer_get_time();
+    if (msg->has_data)
+    {
+        memcpy(&msg->payload, event_data, size);
+    }
+    __atomic_store_n(&dispatch_head, next, __ATOMIC_RELEASE);
+
+    uint32_t depth = (next + CONFIG_ESP_NETWORK_DISPATCH_QUEUE_LEN - tail) % CONFIG_ESP_NETWORK_DISPATCH_QUEUE_LEN;
+    if (depth > dispatch_stats.max_depth)
+    {
+        dispatch_stats.max_depth = depth;
+    }
+    xTaskNotifyGive(dispatch_task);
+}
+
+static void net_dispatch_task(void *arg)
+{
+    while (true)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        uint32_t tail = __atomic_load_n(&dispatch_tail, __ATOMIC_RELAXED);
+        while (tail != __atomic_load_n(&dispatch_head, __ATOMIC_ACQUIRE))
+        {
+            net_dispatch_msg_t *msg = &dispatch_ring[tail];
+            int64_t start_us = esp_timer_get_time();
+            uint32_t latency_us = (uint32_t)(start_us - msg->posted_us);
+            if (latency_us > dispatch_stats.max_latency_us)
+            {
+                dispatch_stats.max_latency_us = latency_us;
+            }
+            // The handler may have been unregistered after the event was queued, and its entry reused since
+            esp_event_handler_t handler = msg->handler->handler;
+            if (handler != NULL && msg->generation == __atomic_load_n(&msg->handler->generation, __ATOMIC_ACQUIRE))
+            {
+                handler(msg->handler->arg, msg->base, msg->id, msg->has_data ? &msg->payload : NULL);
+            }
+            uint32_t handler_us = (uint32_t)(esp_timer_get_time() - start_us);
+            if (handler_us > dispatch_stats.max_handler_us)
+            {
+                dispatch_stats.max_handler_us = handler_us;
+            }
+            dispatch_stats.dispatched++;
+            tail = (tail + 1) % CONFIG_ESP_NETWORK_DISPATCH_QUEUE_LEN;
+            __atomic_store_n(&dispatch_tail, tail, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+esp_err_t net_dispatch_register(esp_event_base_t base, int32_t id, esp_event_handler_t handler, void *arg)
+{
+    // Handlers are registered from the setup functions, before any events arrive
+    if (dispatch_task == NULL)
+    {
+        BaseType_t core = (CONFIG_ESP_NETWORK_DISPATCH_CORE < 0) ? tskNO_AFFINITY : CONFIG_ESP_NETWORK_DISPATCH_CORE;
+        if (xTaskCreatePinnedToCore(net_dispatch_task, THREAD_DISPATCH_NAME, CONFIG_ESP_NETWORK_DISPATCH_STACKSIZE,
+                NULL, CONFIG_ESP_NETWORK_DISPATCH_PRIORITY, &dispatch_task, core) != pdPASS)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    net_dispatch_handler_t *entry = NULL;
+    for (int i = 0; i < DISPATCH_MAX_HANDLERS && entry == NULL; i++)
+    {
+        if (dispatch_handlers[i].handler == NULL)
+        {
+            entry = &dispatch_handlers[i];
+        }
+    }
+    if (entry == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    entry->arg = arg;
+    entry->base = base;
+    entry->id = id;
+    esp_err_t err = esp_event_handler_instance_register(base, id, net_dispatch_forward, entry, &entry->instance);
+    if (err == ESP_OK)
+    {
+        entry->handler = handler;
+    }
+    return err;
+}
+
+esp_err_t net_dispatch_unregister(esp_event_base_t base, int32_t id, esp_event_handler_t handler)
+{
+    for (int i = 0; i < DISPATCH_MAX_HANDLERS; i++)
+    {
+        net_dispatch_handler_t *entry = &dispatch_handlers[i];
+        if (entry->handler == handler && entry->base == base && entry->id == id)
+        {
+            esp_err_t err = esp_event_handler_instance_unregister(base, id, entry->instance);
+            __atomic_add_fetch(&entry->generation, 1, __ATOMIC_RELEASE);
+            entry->handler = NULL;
+            return err;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t network_get_dispatch_stats(network_dispatch_stats_t *stats)
+{
+    if (stats == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *stats = dispatch_stats;
+    return ESP_OK;
+}
+
+#else
+
+#define dispatch_task NULL
+
+esp_err_t net_dispatch_register(esp_event_base_t base, int32_t id, esp_event_handler_t handler, void *arg)
+{
+    return esp_event_handler_register(base, id, handler, arg);
+}
+
+esp_err_t net_dispatch_unregister(esp_event_base_t base, int32_t id, esp_event_handler_t handler)
+{
+    return esp_event_handler_unregister(base, id, handler);
+}
+
+esp_err_t network_get_dispatch_stats(network_dispatch_stats_t *stats)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif
+
+esp_err_t net_dispatch_call(void (*fn)(void *arg), void *arg)
+{
+    if (dispatch_task != NULL && xTaskGetCurrentTaskHandle() == dispatch_task)
+    {
+        fn(arg);
+        return ESP_OK;
+    }
+    if (!call_registered)
+    {
+        esp_err_t err = net_dispatch_register(NET_DISPATCH_EVENT, NET_DISPATCH_EVENT_CALL, net_dispatch_run_call, NULL);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        call_registered = true;
+    }
+    net_dispatch_call_t call = {
+        .fn = fn,
+        .arg = arg,
+        .waiter = xTaskGetCurrentTaskHandle()
+    };
+    ulTaskNotifyTake(pdTRUE, 0);
+    esp_err_t err = esp_event_post(NET_DISPATCH_EVENT, NET_DISPATCH_EVENT_CALL, &call, sizeof(call), portMAX_DELAY);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    return ESP_OK;
+}
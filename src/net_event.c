@@ -0,0 +1,118 @@
+/*
+    Network event subscriptions
+
+    Subscribers are kept in a fixed table, so subscribing and delivering an event never use the
+    heap. The table is copied under a critical section and the callbacks are called from the
+    copy, so a callback may subscribe or unsubscribe.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "network_priv.h"
+
+typedef struct {
+    network_event_cb_t callback;
+    void *ctx;
+    uint32_t mask;
+} net_event_subscriber_t;
+
+static net_event_subscriber_t subscribers[CONFIG_ESP_NETWORK_MAX_SUBSCRIBERS];
+static portMUX_TYPE subscribers_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* When each interface connected, reported with the disconnect */
+static int64_t connected_us[2];
+
+esp_err_t network_subscribe(network_event_cb_t callback, void *ctx, uint32_t mask)
+{
+    esp_err_t err = ESP_ERR_NO_MEM;
+    if (callback == NULL || mask == 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    portENTER_CRITICAL(&subscribers_lock);
+    for (int i = 0; i < CONFIG_ESP_NETWORK_MAX_SUBSCRIBERS; i++)
+    {
+        if (subscribers[i].callback == NULL)
+        {
+            subscribers[i].callback = callback;
+            subscribers[i].ctx = ctx;
+            subscribers[i].mask = mask;
+            err = ESP_OK;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&subscribers_lock);
+    return err;
+}
+
+esp_err_t network_unsubscribe(network_event_cb_t callback, void *ctx)
+{
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    portENTER_CRITICAL(&subscribers_lock);
+    for (int i = 0; i < CONFIG_ESP_NETWORK_MAX_SUBSCRIBERS; i++)
+    {
+        if (subscribers[i].callback == callback && subscribers[i].ctx == ctx)
+        {
+            subscribers[i].callback = NULL;
+            err = ESP_OK;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&subscribers_lock);
+    return err;
+}
+
+void net_event_publish(network_event_t event, uint32_t iface, const esp_netif_ip_info_t *ip_info, uint8_t reason,
+    int8_t rssi)
+{
+    net_event_subscriber_t targets[CONFIG_ESP_NETWORK_MAX_SUBSCRIBERS];
+    network_event_data_t data;
+    int count = 0;
+
+    memset(&data, 0, sizeof(data));
+    data.event = event;
+    data.iface = iface;
+    data.reason = reason;
+    data.rssi = rssi;
+    data.timestamp_us = esp_timer_get_time();
+    if (ip_info != NULL)
+    {
+        data.ip_info = *ip_info;
+    }
+    int slot = (iface == NETWORK_IF_ETHERNET) ? 1 : 0;
+    if (event == NETWORK_EVENT_CONNECTED)
+    {
+        connected_us[slot] = data.timestamp_us;
+    }
+    else if (event == NETWORK_EVENT_DISCONNECTED)
+    {
+        if (connected_us[slot] == 0)
+        {
+            // A failed connection attempt, the interface was never reported as connected
+            return;
+        }
+        data.connected_us = connected_us[slot];
+        connected_us[slot] = 0;
+    }
+
+    portENTER_CRITICAL(&subscribers_lock);
+    for (int i = 0; i < CONFIG_ESP_NETWORK_MAX_SUBSCRIBERS; i++)
+    {
+        if (subscribers[i].callback != NULL && (subscribers[i].mask & event) != 0)
+        {
+            targets[count++] = subscribers[i];
+        }
+    }
+    portEXIT_CRITICAL(&subscribers_lock);
+
+    for (int i = 0; i < count; i++)
+    {
+        targets[i].callback(&data, targets[i].ctx);
+    }
+}
@@ -0,0 +1,172 @@
+/*
+    Ethernet/WIFI failover
+
+    Keeps the default netif (and so the default route) on the highest priority interface
+    that has an IP number. Both interfaces stay connected, so the standby interface is
+    ready the moment the active one drops.
+
+    The switchover latency runs from the moment the active interface is known to be lost,
+    when its link goes down or the first health probe round fails, until traffic flows on
+    the new default: the first health probe reply through it, or the switch itself when the
+    health probe is disabled.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_netif.h"
+#include "sdkconfig.h"
+#include "network_priv.h"
+
+static const char *TAG = "NETFAIL";
+
+#ifdef CONFIG_ESP_NETWORK_PREFER_WIFI
+#define PREFERRED_INTERFACE NETWORK_IF_WIFI
+#else
+#define PREFERRED_INTERFACE NETWORK_IF_ETHERNET
+#endif
+
+static network_failover_stats_t failover_stats;
+/* Time the active interface was lost, 0 if it has not been lost or traffic flows again */
+static int64_t active_lost_us = 0;
+static uint32_t lost_interface = 0;
+
+static const char *net_failover_name(uint32_t iface)
+{
+    return (iface == NETWORK_IF_WIFI) ? "WIFI" : "Ethernet";
+}
+
+uint32_t net_failover_select(uint32_t connected, uint32_t preferred)
+{
+    if (connected & preferred)
+    {
+        return preferred;
+    }
+    if (connected & NETWORK_IF_ETHERNET)
+    {
+        return NETWORK_IF_ETHERNET;
+    }
+    if (connected & NETWORK_IF_WIFI)
+    {
+        return NETWORK_IF_WIFI;
+    }
+    return 0;
+}
+
+static esp_netif_t *net_failover_netif(uint32_t iface)
+{
+    switch (iface)
+    {
+#if CONFIG_ESP_WIFI_ENABLED
+        case NETWORK_IF_WIFI:
+            return wifi_get_netif();
+#endif
+#if CONFIG_ESP_ETHERNET_ENABLED
+        case NETWORK_IF_ETHERNET:
+            return ethernet_get_netif();
+#endif
+        default:
+            return NULL;
+    }
+}
+
+/* Traffic flows on active, the new default, so the switchover is over */
+static void net_failover_record(uint32_t active)
+{
+    uint32_t elapsed_us = (uint32_t)(esp_timer_get_time() - active_lost_us);
+    failover_stats.switchovers++;
+    failover_stats.last_us = elapsed_us;
+    if (elapsed_us > failover_stats.max_us)
+    {
+        failover_stats.max_us = elapsed_us;
+    }
+    active_lost_us = 0;
+    ESP_LOGW(TAG, "Switched from %s to %s in %u us", net_failover_name(lost_interface), net_failover_name(active),
+        elapsed_us);
+}
+
+void net_failover_lost(uint32_t iface, int64_t lost_us)
+{
+    // Keeps the earliest sign, the health probe usually fails before the link goes down
+    if (iface == failover_stats.active && active_lost_us == 0)
+    {
+        active_lost_us = lost_us;
+        lost_interface = iface;
+    }
+}
+
+void net_failover_traffic(uint32_t iface)
+{
+    if (active_lost_us == 0 || iface != failover_stats.active)
+    {
+        return;
+    }
+    if (iface == lost_interface)
+    {
+        // A few lost probes, the interface was never switched away from
+        active_lost_us = 0;
+        return;
+    }
+    net_failover_record(iface);
+}
+
+void net_failover_update(uint32_t connected)
+{
+    uint32_t active = net_failover_select(connected, PREFERRED_INTERFACE);
+    if (active == failover_stats.active)
+    {
+        return;
+    }
+    if (failover_stats.active != 0 && (connected & failover_stats.active) == 0 && active_lost_us == 0)
+    {
+        // The active interface went away without a sign of it first
+        active_lost_us = esp_timer_get_time();
+        lost_interface = failover_stats.active;
+    }
+    if (active == 0)
+    {
+        // The clock keeps running until another interface carries traffic
+        ESP_LOGW(TAG, "No interface is connected");
+        failover_stats.active = 0;
+        net_event_publish(NETWORK_EVENT_ACTIVE_CHANGED, 0, NULL, 0, 0);
+        return;
+    }
+    esp_netif_t *netif = net_failover_netif(active);
+    if (netif == NULL)
+    {
+        return;
+    }
+    esp_netif_set_default_netif(netif);
+    failover_stats.active = active;
+    if (active_lost_us != 0 && active != lost_interface)
+    {
+#ifdef CONFIG_ESP_NETWORK_HEALTH_ENABLED
+        // Stopped by the first reply through the new default, which is probed straight away
+        ESP_LOGW(TAG, "Default interface is %s, waiting for traffic", net_failover_name(active));
+        net_health_probe_now();
+#else
+        net_failover_record(active);
+#endif
+    }
+    else
+    {
+        // First connection, a move back to the preferred interface or the lost interface came back
+        active_lost_us = 0;
+        ESP_LOGI(TAG, "Default interface is %s", net_failover_name(active));
+    }
+    net_event_publish(NETWORK_EVENT_ACTIVE_CHANGED, active, NULL, 0, 0);
+}
+
+uint32_t network_active_interface(void)
+{
+    return failover_stats.active;
+}
+
+void network_get_failover_stats(network_failover_stats_t *stats)
+{
+    if (stats != NULL)
+    {
+        *stats = failover_stats;
+    }
+}
@@ -0,0 +1,142 @@
+/*
+    Fault injection for testing reconnect behaviour on a device
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_netif.h"
+#include "sdkconfig.h"
+#include "network_priv.h"
+
+#ifdef CONFIG_ESP_NETWORK_FAULT_INJECTION
+
+static const char *TAG = "NETFAULT";
+
+/* One held DHCP client per interface */
+#define DHCP_HOLDS 2
+
+typedef struct {
+    esp_netif_t *netif;
+    esp_timer_handle_t timer;
+} dhcp_hold_t;
+
+static uint32_t dhcp_delay_ms = 0;
+static dhcp_hold_t dhcp_holds[DHCP_HOLDS];
+
+static void dhcp_release(void *arg)
+{
+    dhcp_hold_t *hold = (dhcp_hold_t *)arg;
+    ESP_LOGI(TAG, "Releasing DHCP");
+    esp_netif_dhcpc_start(hold->netif);
+}
+
+void net_fault_dhcp_hold(esp_netif_t *netif)
+{
+    if (dhcp_delay_ms == 0 || netif == NULL)
+    {
+        return;
+    }
+    dhcp_hold_t *hold = NULL;
+    for (int i = 0; i < DHCP_HOLDS && hold == NULL; i++)
+    {
+        if (dhcp_holds[i].netif == netif || dhcp_holds[i].netif == NULL)
+        {
+            hold = &dhcp_holds[i];
+        }
+    }
+    if (hold == NULL)
+    {
+        return;
+    }
+    if (hold->timer == NULL)
+    {
+        const esp_timer_create_args_t args = {
+            .callback = dhcp_release,
+            .arg = hold,
+            .name = "dhcp_hold"
+        };
+        if (esp_timer_create(&args, &hold->timer) != ESP_OK)
+        {
+            return;
+        }
+        hold->netif = netif;
+    }
+    ESP_LOGW(TAG, "Holding DHCP for %u ms", dhcp_delay_ms);
+    esp_netif_dhcpc_stop(netif);
+    esp_timer_stop(hold->timer);
+    esp_timer_start_once(hold->timer, (uint64_t)dhcp_delay_ms * 1000);
+}
+
+void net_fault_netif_replaced(esp_netif_t *old_netif, esp_netif_t *new_netif)
+{
+    for (int i = 0; i < DHCP_HOLDS; i++)
+    {
+        if (dhcp_holds[i].netif == old_netif)
+        {
+            // The new netif starts its own DHCP client when it connects
+            esp_timer_stop(dhcp_holds[i].timer);
+            dhcp_holds[i].netif = new_netif;
+        }
+    }
+}
+
+esp_err_t network_inject_fault(network_fault_t fault, uint32_t arg)
+{
+    ESP_LOGW(TAG, "Injecting fault %d (%u)", fault, arg);
+    switch (fault)
+    {
+#if CONFIG_ESP_WIFI_ENABLED
+        case NETWORK_FAULT_WIFI_DISCONNECT:
+            wifi_inject_disconnect((uint8_t)arg);
+            return ESP_OK;
+#endif
+#if CONFIG_ESP_ETHERNET_ENABLED
+        case NETWORK_FAULT_ETH_LINK_DOWN:
+            ethernet_inject_link(false);
+            return ESP_OK;
+        case NETWORK_FAULT_ETH_LINK_UP:
+            ethernet_inject_link(true);
+            return ESP_OK;
+#endif
+        case NETWORK_FAULT_DHCP_DELAY:
+            dhcp_delay_ms = arg;
+            return ESP_OK;
+        default:
+            return ESP_ERR_NOT_SUPPORTED;
+    }
+}
+
+esp_err_t network_run_fault_script(const network_fault_step_t *steps, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        esp_err_t err = network_inject_fault(steps[i].fault, steps[i].arg);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        if (steps[i].delay_ms > 0)
+        {
+            vTaskDelay(pdMS_TO_TICKS(steps[i].delay_ms));
+        }
+    }
+    return ESP_OK;
+}
+
+#else
+
+esp_err_t network_inject_fault(network_fault_t fault, uint32_t arg)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t network_run_fault_script(const network_fault_step_t *steps, int count)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif
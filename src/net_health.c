@@ -0,0 +1,402 @@
+/*
+    Connectivity health probe. An interface with an IP number is only known to be connected to the AP or switch.
+    This task periodically sends a probe through each interface, measures the round trip time and loss, and
+    handles a link that stops answering the same way as a disconnect.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+#include "lwip/inet.h"
+#include "lwip/inet_chksum.h"
+#include "lwip/prot/icmp.h"
+#include "lwip/prot/ip4.h"
+#include "sdkconfig.h"
+#include "network_priv.h"
+
+#ifdef CONFIG_ESP_NETWORK_HEALTH_ENABLED
+
+static const char *TAG = "NETHEALTH";
+
+#define THREAD_HEALTH_NAME "net_health"
+#define THREAD_HEALTH_STACKSIZE configMINIMAL_STACK_SIZE * 4
+#define THREAD_HEALTH_PRIORITY 3
+
+#define HEALTH_ICMP_ID 0x4e48
+#define HEALTH_HISTORY_LEN 32
+
+/* Task notification bits */
+#define HEALTH_NOTIFY_INTERVAL BIT0     // The interval changed, start it again from now
+#define HEALTH_NOTIFY_PROBE BIT1        // Probe now
+
+typedef struct {
+    uint32_t iface;
+    const char *name;
+    network_health_t health;
+    uint32_t history;           // One bit per probe, set if it was lost. Newest in bit 0.
+    uint32_t history_len;
+} net_health_iface_t;
+
+static net_health_iface_t health_ifaces[] = {
+    { .iface = NETWORK_IF_WIFI, .name = "WIFI" },
+    { .iface = NETWORK_IF_ETHERNET, .name = "Ethernet" },
+};
+
+static TaskHandle_t health_task = NULL;
+static volatile uint32_t health_interval_s = CONFIG_ESP_NETWORK_HEALTH_INTERVAL;
+static uint16_t health_seq = 0;
+
+static net_health_iface_t *net_health_find(uint32_t iface)
+{
+    for (int i = 0; i < sizeof(health_ifaces) / sizeof(health_ifaces[0]); i++)
+    {
+        if (health_ifaces[i].iface == iface)
+        {
+            return &health_ifaces[i];
+        }
+    }
+    return NULL;
+}
+
+static esp_netif_t *net_health_netif(uint32_t iface)
+{
+#if CONFIG_ESP_WIFI_ENABLED
+    if (iface == NETWORK_IF_WIFI)
+    {
+        return wifi_get_netif();
+    }
+#endif
+#if CONFIG_ESP_ETHERNET_ENABLED
+    if (iface == NETWORK_IF_ETHERNET)
+    {
+        return ethernet_get_netif();
+    }
+#endif
+    return NULL;
+}
+
+static uint32_t net_health_target(esp_netif_t *netif)
+{
+#ifdef CONFIG_ESP_NETWORK_HEALTH_TARGET_GATEWAY
+    esp_netif_ip_info_t ip_info;
+    if (esp_netif_get_ip_info(netif, &ip_info) != ESP_OK)
+    {
+        return 0;
+    }
+    return ip_info.gw.addr;
+#else
+    return inet_addr(CONFIG_ESP_NETWORK_HEALTH_HOST);
+#endif
+}
+
+/* Opens a socket bound to the interface, so the probe does not follow the default route */
+static int net_health_socket(esp_netif_t *netif, int type, int protocol)
+{
+    struct ifreq ifr;
+    struct timeval timeout = {
+        .tv_sec = CONFIG_ESP_NETWORK_HEALTH_TIMEOUT_MS / 1000,
+        .tv_usec = (CONFIG_ESP_NETWORK_HEALTH_TIMEOUT_MS % 1000) * 1000
+    };
+    int sock = socket(AF_INET, type, protocol);
+    if (sock < 0)
+    {
+        ESP_LOGE(TAG, "Unable to create the probe socket: %d", errno);
+        return -1;
+    }
+    memset(&ifr, 0, sizeof(ifr));
+    if (esp_netif_get_netif_impl_name(netif, ifr.ifr_name) != ESP_OK ||
+        setsockopt(sock, SOL_SOCKET, SO_BINDTODEVICE, &ifr, sizeof(ifr)) < 0 ||
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0)
+    {
+        ESP_LOGE(TAG, "Unable to bind the probe socket: %d", errno);
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+#ifdef CONFIG_ESP_NETWORK_HEALTH_PROBE_TCP
+/* Returns the time to connect in microseconds, or -1. A refused connection still proves the host is reachable. */
+static int64_t net_health_probe_once(esp_netif_t *netif, uint32_t target)
+{
+    struct sockaddr_in to = {
+        .sin_family = AF_INET,
+        .sin_port = htons(CONFIG_ESP_NETWORK_HEALTH_PORT),
+        .sin_addr.s_addr = target
+    };
+    struct timeval timeout = {
+        .tv_sec = CONFIG_ESP_NETWORK_HEALTH_TIMEOUT_MS / 1000,
+        .tv_usec = (CONFIG_ESP_NETWORK_HEALTH_TIMEOUT_MS % 1000) * 1000
+    };
+    fd_set wfds;
+    int err = 0;
+    socklen_t err_len = sizeof(err);
+    int64_t rtt = -1;
+
+    int sock = net_health_socket(netif, SOCK_STREAM, IPPROTO_TCP);
+    if (sock < 0)
+    {
+        return -1;
+    }
+    fcntl(sock, F_SETFL, O_NONBLOCK);
+    int64_t start = esp_timer_get_time();
+    if (connect(sock, (struct sockaddr *)&to, sizeof(to)) == 0)
+    {
+        rtt = esp_timer_get_time() - start;
+    }
+    else if (errno == EINPROGRESS)
+    {
+        FD_ZERO(&wfds);
+        FD_SET(sock, &wfds);
+        if (select(sock + 1, NULL, &wfds, NULL, &timeout) > 0 &&
+            getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &err_len) == 0 &&
+            (err == 0 || err == ECONNREFUSED))
+        {
+            rtt = esp_timer_get_time() - start;
+        }
+    }
+    close(sock);
+    return rtt;
+}
+#else
+/* Sends one ICMP echo request. Returns the round trip time in microseconds, or -1 if there was no reply. */
+static int64_t net_health_probe_once(esp_netif_t *netif, uint32_t target)
+{
+    struct sockaddr_in to = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = target
+    };
+    struct icmp_echo_hdr echo;
+    uint8_t reply[64];
+    int64_t rtt = -1;
+
+    int sock = net_health_socket(netif, SOCK_RAW, IPPROTO_ICMP);
+    if (sock < 0)
+    {
+        return -1;
+    }
+    memset(&echo, 0, sizeof(echo));
+    ICMPH_TYPE_SET(&echo, ICMP_ECHO);
+    ICMPH_CODE_SET(&echo, 0);
+    echo.id = htons(HEALTH_ICMP_ID);
+    echo.seqno = htons(++health_seq);
+    echo.chksum = inet_chksum(&echo, sizeof(echo));
+
+    int64_t start = esp_timer_get_time();
+    if (sendto(sock, &echo, sizeof(echo), 0, (struct sockaddr *)&to, sizeof(to)) < 0)
+    {
+        close(sock);
+        return -1;
+    }
+    // The raw socket sees every ICMP packet, skip anything that is not our reply
+    while (esp_timer_get_time() - start < CONFIG_ESP_NETWORK_HEALTH_TIMEOUT_MS * 1000LL)
+    {
+        int len = recvfrom(sock, reply, sizeof(reply), 0, NULL, NULL);
+        if (len < 0)
+        {
+            break;
+        }
+        struct ip_hdr *iphdr = (struct ip_hdr *)reply;
+        int hlen = IPH_HL_BYTES(iphdr);
+        if (len < hlen + (int)sizeof(struct icmp_echo_hdr))
+        {
+            continue;
+        }
+        struct icmp_echo_hdr *echo_reply = (struct icmp_echo_hdr *)(reply + hlen);
+        if (ICMPH_TYPE(echo_reply) == ICMP_ER && echo_reply->id == echo.id && echo_reply->seqno == echo.seqno)
+        {
+            rtt = esp_timer_get_time() - start;
+            break;
+        }
+    }
+    close(sock);
+    return rtt;
+}
+#endif
+
+static void net_health_sample(net_health_iface_t *h, int64_t rtt_us)
+{
+    network_health_t *health = &h->health;
+    health->probes++;
+    h->history <<= 1;
+    if (h->history_len < HEALTH_HISTORY_LEN)
+    {
+        h->history_len++;
+    }
+    if (rtt_us < 0)
+    {
+        health->lost++;
+        h->history |= 1;
+        return;
+    }
+    health->rtt_last_us = (uint32_t)rtt_us;
+    if (health->rtt_last_us > health->rtt_max_us)
+    {
+        health->rtt_max_us = health->rtt_last_us;
+    }
+    // Moving average with a weight of 1/8 for the new sample
+    if (health->rtt_avg_us == 0)
+    {
+        health->rtt_avg_us = health->rtt_last_us;
+    }
+    else
+    {
+        health->rtt_avg_us = health->rtt_avg_us - (health->rtt_avg_us >> 3) + (health->rtt_last_us >> 3);
+    }
+}
+
+static void net_health_declare_dead(net_health_iface_t *h)
+{
+    h->health.alive = false;
+    h->health.dead_count++;
+    ESP_LOGW(TAG, "%s has an IP number but is not passing traffic, disconnecting", h->name);
+    // Moves the default route to the other interface, if there is one
+    network_set_connected(h->iface, false);
+    net_event_publish(NETWORK_EVENT_LINK_DEAD, h->iface, NULL, 0, 0);
+#if CONFIG_ESP_WIFI_ENABLED
+    if (h->iface == NETWORK_IF_WIFI)
+    {
+        wifi_force_reconnect();
+    }
+#endif
+}
+
+/* Runs one probe round. Stops at the first reply, so a healthy link costs one packet per interval. */
+static void net_health_probe(net_health_iface_t *h)
+{
+    esp_netif_t *netif = net_health_netif(h->iface);
+    if (netif == NULL || network_get_link_state(h->iface) != NETWORK_LINK_UP)
+    {
+        // Down or still getting an address. The next connection starts with a clean slate.
+        h->health.alive = true;
+        h->health.failures = 0;
+        return;
+    }
+    uint32_t target = net_health_target(netif);
+    if (target == 0)
+    {
+        return;
+    }
+    int64_t start = esp_timer_get_time();
+    bool replied = false;
+    for (int i = 0; i < CONFIG_ESP_NETWORK_HEALTH_PROBE_COUNT && !replied; i++)
+    {
+        int64_t rtt = net_health_probe_once(netif, target);
+        net_health_sample(h, rtt);
+        replied = (rtt >= 0);
+    }
+    if (replied)
+    {
+        h->health.failures = 0;
+        net_failover_traffic(h->iface);
+        if (!h->health.alive)
+        {
+            // Only Ethernet gets here, WIFI reconnects when the link is declared dead
+            ESP_LOGI(TAG, "%s is passing traffic again", h->name);
+            h->health.alive = true;
+            network_set_connected(h->iface, true);
+            esp_netif_ip_info_t ip_info;
+            esp_netif_get_ip_info(netif, &ip_info);
+            net_event_publish(NETWORK_EVENT_CONNECTED, h->iface, &ip_info, 0, 0);
+        }
+    }
+    else
+    {
+        if (h->health.alive && h->health.failures == 0)
+        {
+            // The link stopped passing traffic some time since the last reply, count the failover from here
+            net_failover_lost(h->iface, start);
+        }
+        if (++h->health.failures >= CONFIG_ESP_NETWORK_HEALTH_FAIL_COUNT && h->health.alive)
+        {
+            net_health_declare_dead(h);
+        }
+    }
+}
+
+static void net_health_task(void *arg)
+{
+    while (true)
+    {
+        uint32_t interval = health_interval_s;
+        TickType_t wait = (interval == 0) ? portMAX_DELAY : pdMS_TO_TICKS(interval * 1000);
+        uint32_t notified = 0;
+        // Woken early when the interval changes, so the new interval starts from now, or for a probe now
+        if (xTaskNotifyWait(0, UINT32_MAX, &notified, wait) == pdTRUE && (notified & HEALTH_NOTIFY_PROBE) == 0)
+        {
+            continue;
+        }
+        for (int i = 0; i < sizeof(health_ifaces) / sizeof(health_ifaces[0]); i++)
+        {
+            net_health_probe(&health_ifaces[i]);
+        }
+    }
+}
+
+void net_health_start(void)
+{
+    if (health_task != NULL)
+    {
+        return;
+    }
+    for (int i = 0; i < sizeof(health_ifaces) / sizeof(health_ifaces[0]); i++)
+    {
+        health_ifaces[i].health.alive = true;
+    }
+    xTaskCreate(net_health_task, THREAD_HEALTH_NAME, THREAD_HEALTH_STACKSIZE, NULL, THREAD_HEALTH_PRIORITY,
+        &health_task);
+}
+
+esp_err_t network_get_health(uint32_t iface, network_health_t *health)
+{
+    net_health_iface_t *h = net_health_find(iface);
+    if (h == NULL || health == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *health = h->health;
+    health->loss_percent = 0;
+    if (h->history_len > 0)
+    {
+        uint32_t mask = (h->history_len < HEALTH_HISTORY_LEN) ? ((1U << h->history_len) - 1) : 0xFFFFFFFF;
+        health->loss_percent = (uint8_t)(__builtin_popcount(h->history & mask) * 100 / h->history_len);
+    }
+    return ESP_OK;
+}
+
+esp_err_t network_set_health_interval(uint32_t interval_s)
+{
+    health_interval_s = interval_s;
+    if (health_task != NULL)
+    {
+        xTaskNotify(health_task, HEALTH_NOTIFY_INTERVAL, eSetBits);
+    }
+    return ESP_OK;
+}
+
+void net_health_probe_now(void)
+{
+    if (health_task != NULL)
+    {
+        xTaskNotify(health_task, HEALTH_NOTIFY_PROBE, eSetBits);
+    }
+}
+
+#else
+
+esp_err_t network_get_health(uint32_t iface, network_health_t *health)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t network_set_health_interval(uint32_t interval_s)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif
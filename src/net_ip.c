@@ -0,0 +1,413 @@
+/*
+    Static IP and cached DHCP lease support
+
+    In cached mode the last DHCP lease is saved in NVS. When the interface connects, the DHCP
+    client is started as usual, and the cached address is put on the lwIP interface straight
+    away, so there is no wait for DHCP. lwIP is configured to request the last address directly
+    (INIT-REBOOT), and when DHCP binds the same address nothing changes on the interface. The
+    address is set on the lwIP interface rather than with esp_netif_set_ip_info, which needs
+    the DHCP client stopped, and restarting the client would clear the address again.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include <string.h>
+#include <time.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_netif.h"
+#include "esp_event.h"
+#include "lwip/err.h"
+#include "lwip/tcpip.h"
+#include "lwip/netif.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+#include "network_priv.h"
+
+static const char *TAG = "NETIP";
+
+#define NET_IP_NAMESPACE "netip"
+
+// Wall clock times before this are not set by SNTP
+#define NET_IP_VALID_TIME 1577836800
+
+typedef enum {
+    NET_IP_MODE_DHCP = 0,
+    NET_IP_MODE_DHCP_CACHED,
+    NET_IP_MODE_STATIC
+} net_ip_mode_t;
+
+/* Saved lease. expires is 0 if the wall clock was not set when it was saved. */
+typedef struct {
+    esp_netif_ip_info_t ip_info;
+    esp_ip4_addr_t dns;
+    int64_t expires;
+} net_ip_lease_t;
+
+typedef struct {
+    uint32_t iface;
+    const char *key;
+    net_ip_mode_t mode;
+    const char *ip;
+    const char *netmask;
+    const char *gw;
+    const char *dns;
+    esp_netif_t *netif;
+    bool confirming;                // The cached address is in use and DHCP has not answered yet
+    bool cached_posted;             // The GOT_IP for the cached address is queued
+    net_ip_lease_t lease;
+    network_link_state_t link_state;
+    int64_t link_local_since_us;
+    uint32_t link_local_delay_ms;
+    esp_timer_handle_t link_local_timer;
+    network_link_local_stats_t link_local_stats;
+} net_ip_iface_t;
+
+static net_ip_iface_t net_ip_ifaces[] = {
+#if CONFIG_ESP_WIFI_ENABLED
+    {
+        .iface = NETWORK_IF_WIFI,
+        .key = "wifi",
+#if CONFIG_ESP_WIFI_IP_STATIC
+        .mode = NET_IP_MODE_STATIC,
+        .ip = CONFIG_ESP_WIFI_STATIC_IP,
+        .netmask = CONFIG_ESP_WIFI_STATIC_NETMASK,
+        .gw = CONFIG_ESP_WIFI_STATIC_GW,
+        .dns = CONFIG_ESP_WIFI_STATIC_DNS,
+#elif CONFIG_ESP_WIFI_IP_DHCP_CACHED
+        .mode = NET_IP_MODE_DHCP_CACHED,
+#else
+        .mode = NET_IP_MODE_DHCP,
+#endif
+    },
+#endif
+#if CONFIG_ESP_ETHERNET_ENABLED
+    {
+        .iface = NETWORK_IF_ETHERNET,
+        .key = "eth",
+#if CONFIG_ESP_ETH_IP_STATIC
+        .mode = NET_IP_MODE_STATIC,
+        .ip = CONFIG_ESP_ETH_STATIC_IP,
+        .netmask = CONFIG_ESP_ETH_STATIC_NETMASK,
+        .gw = CONFIG_ESP_ETH_STATIC_GW,
+        .dns = CONFIG_ESP_ETH_STATIC_DNS,
+#elif CONFIG_ESP_ETH_IP_DHCP_CACHED
+        .mode = NET_IP_MODE_DHCP_CACHED,
+#else
+        .mode = NET_IP_MODE_DHCP,
+#endif
+    },
+#endif
+};
+
+#define NET_IP_IFACE_COUNT (sizeof(net_ip_ifaces) / sizeof(net_ip_ifaces[0]))
+
+static net_ip_iface_t *net_ip_find(uint32_t iface)
+{
+    for (int i = 0; i < NET_IP_IFACE_COUNT; i++)
+    {
+        if (net_ip_ifaces[i].iface == iface)
+        {
+            return &net_ip_ifaces[i];
+        }
+    }
+    return NULL;
+}
+
+static void net_ip_set_static(esp_netif_t *netif, const esp_netif_ip_info_t *ip_info, esp_ip4_addr_t dns)
+{
+    esp_err_t err = esp_netif_dhcpc_stop(netif);
+    if (err != ESP_OK && err != ESP_ERR_ESP_NETIF_DHCP_ALREADY_STOPPED)
+    {
+        ESP_LOGE(TAG, "Unable to stop DHCP: %s", esp_err_to_name(err));
+        return;
+    }
+    // Posts the GOT_IP event, just as DHCP would
+    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_netif_set_ip_info(netif, ip_info));
+    if (dns.addr != 0)
+    {
+        esp_netif_dns_info_t dns_info = {0};
+        dns_info.ip.u_addr.ip4 = dns;
+        dns_info.ip.type = ESP_IPADDR_TYPE_V4;
+        esp_netif_set_dns_info(netif, ESP_NETIF_DNS_MAIN, &dns_info);
+    }
+}
+
+static bool net_ip_load_lease(net_ip_iface_t *ip)
+{
+    nvs_handle_t handle;
+    if (nvs_open(NET_IP_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+    {
+        return false;
+    }
+    size_t size = sizeof(net_ip_lease_t);
+    esp_err_t err = nvs_get_blob(handle, ip->key, &ip->lease, &size);
+    nvs_close(handle);
+    if (err != ESP_OK || size != sizeof(net_ip_lease_t) || ip->lease.ip_info.ip.addr == 0)
+    {
+        return false;
+    }
+    time_t now = time(NULL);
+    if (ip->lease.expires != 0 && now > NET_IP_VALID_TIME && now > ip->lease.expires)
+    {
+        ESP_LOGI(TAG, "Cached %s lease has expired", ip->key);
+        return false;
+    }
+    return true;
+}
+
+static void net_ip_save_lease(net_ip_iface_t *ip)
+{
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(NET_IP_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Unable to open NVS: %s", esp_err_to_name(err));
+        return;
+    }
+    err = nvs_set_blob(handle, ip->key, &ip->lease, sizeof(net_ip_lease_t));
+    if (err == ESP_OK)
+    {
+        err = nvs_commit(handle);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Unable to save the %s lease: %s", ip->key, esp_err_to_name(err));
+    }
+    nvs_close(handle);
+}
+
+/* Runs on the lwIP thread, so the address is set before the GOT_IP that reports it */
+static void net_ip_use_cached(void *arg)
+{
+    net_ip_iface_t *ip = (net_ip_iface_t *)arg;
+    struct netif *lwip_netif = (struct netif *)esp_netif_get_netif_impl(ip->netif);
+    if (lwip_netif == NULL)
+    {
+        return;
+    }
+    ip4_addr_t addr = { .addr = ip->lease.ip_info.ip.addr };
+    ip4_addr_t netmask = { .addr = ip->lease.ip_info.netmask.addr };
+    ip4_addr_t gw = { .addr = ip->lease.ip_info.gw.addr };
+    netif_set_addr(lwip_netif, &addr, &netmask, &gw);
+    ip_event_got_ip_t event = {
+        .esp_netif = ip->netif,
+        .ip_info = ip->lease.ip_info,
+        .ip_changed = true
+    };
+    ip->cached_posted = true;
+    if (esp_event_post(IP_EVENT, esp_netif_get_event_id(ip->netif, ESP_NETIF_IP_EVENT_GOT_IP), &event, sizeof(event), 0) != ESP_OK)
+    {
+        ip->cached_posted = false;
+        ESP_LOGW(TAG, "Unable to report the cached %s address, waiting for DHCP", ip->key);
+    }
+}
+
+void net_ip_apply(uint32_t iface, esp_netif_t *netif)
+{
+    net_ip_iface_t *ip = net_ip_find(iface);
+    if (ip == NULL || netif == NULL)
+    {
+        return;
+    }
+    ip->netif = netif;
+    switch (ip->mode)
+    {
+        case NET_IP_MODE_STATIC: {
+            esp_netif_ip_info_t ip_info = {
+                .ip.addr = esp_ip4addr_aton(ip->ip),
+                .netmask.addr = esp_ip4addr_aton(ip->netmask),
+                .gw.addr = esp_ip4addr_aton(ip->gw),
+            };
+            esp_ip4_addr_t dns = { .addr = esp_ip4addr_aton(ip->dns) };
+            ESP_LOGI(TAG, "Using static %s address %s", ip->key, ip->ip);
+            net_ip_set_static(netif, &ip_info, dns);
+            break;
+        }
+        case NET_IP_MODE_DHCP_CACHED: {
+            // The default handlers only start DHCP on the first connect. The client clears the address when
+            // it starts, so it is started before the cached address is set.
+            esp_netif_dhcp_status_t status;
+            if (esp_netif_dhcpc_get_status(netif, &status) == ESP_OK && status != ESP_NETIF_DHCP_STARTED)
+            {
+                ESP_ERROR_CHECK_WITHOUT_ABORT(esp_netif_dhcpc_start(netif));
+            }
+            ip->confirming = false;
+            if (!net_ip_load_lease(ip))
+            {
+                break;
+            }
+            ESP_LOGI(TAG, "Using cached %s lease " IPSTR ", DHCP confirms it", ip->key, IP2STR(&ip->lease.ip_info.ip));
+            ip->confirming = true;
+            if (tcpip_callback(net_ip_use_cached, ip) != ERR_OK)
+            {
+                ip->confirming = false;
+                break;
+            }
+            if (ip->lease.dns.addr != 0)
+            {
+                esp_netif_dns_info_t dns_info = {0};
+                dns_info.ip.u_addr.ip4 = ip->lease.dns;
+                dns_info.ip.type = ESP_IPADDR_TYPE_V4;
+                esp_netif_set_dns_info(netif, ESP_NETIF_DNS_MAIN, &dns_info);
+            }
+            break;
+        }
+        case NET_IP_MODE_DHCP:
+        default:
+            break;
+    }
+}
+
+bool net_ip_got_ip(uint32_t iface, esp_netif_t *netif, const esp_netif_ip_info_t *ip_info)
+{
+    net_ip_iface_t *ip = net_ip_find(iface);
+    if (ip == NULL || ip->mode != NET_IP_MODE_DHCP_CACHED || esp_ip4_addr1_16(&ip_info->ip) == 169)
+    {
+        return false;
+    }
+    if (ip->cached_posted && ip->confirming && ip->lease.ip_info.ip.addr == ip_info->ip.addr)
+    {
+        // The address was set from the cache, not by DHCP
+        ip->cached_posted = false;
+        return false;
+    }
+    bool confirmed = ip->confirming && ip->lease.ip_info.ip.addr == ip_info->ip.addr;
+    ip->confirming = false;
+    if (confirmed)
+    {
+        ESP_LOGI(TAG, "Cached %s lease confirmed", ip->key);
+    }
+    esp_netif_dns_info_t dns_info;
+    esp_ip4_addr_t dns = {
+        .addr = (esp_netif_get_dns_info(netif, ESP_NETIF_DNS_MAIN, &dns_info) == ESP_OK) ? dns_info.ip.u_addr.ip4.addr : 0
+    };
+    // Only write the flash when the lease changed, or its saved expiry is half way through
+    time_t now = time(NULL);
+    bool clock_set = (now > NET_IP_VALID_TIME);
+    bool changed = ip->lease.ip_info.ip.addr != ip_info->ip.addr || ip->lease.ip_info.netmask.addr != ip_info->netmask.addr ||
+        ip->lease.ip_info.gw.addr != ip_info->gw.addr || ip->lease.dns.addr != dns.addr;
+    bool stale = clock_set && (ip->lease.expires == 0 || ip->lease.expires - now < CONFIG_ESP_NETWORK_LEASE_CACHE_TTL / 2);
+    if (changed || stale)
+    {
+        ip->lease.ip_info = *ip_info;
+        ip->lease.dns = dns;
+        ip->lease.expires = clock_set ? now + CONFIG_ESP_NETWORK_LEASE_CACHE_TTL : 0;
+        net_ip_save_lease(ip);
+    }
+    return confirmed;
+}
+
+/* Restarts DHCP while the interface only has a link local address, backing off up to a limit */
+static void net_ip_link_local_retry(void *arg)
+{
+    net_ip_iface_t *ip = (net_ip_iface_t *)arg;
+    if (ip->link_state != NETWORK_LINK_LOCAL_ONLY || ip->netif == NULL)
+    {
+        return;
+    }
+    ip->link_local_stats.dhcp_retries++;
+    ESP_LOGW(TAG, "Only a link local %s address, restarting DHCP (retry %u)", ip->key, ip->link_local_stats.dhcp_retries);
+    esp_netif_dhcpc_stop(ip->netif);
+    esp_netif_dhcpc_start(ip->netif);
+
+    ip->link_local_delay_ms *= 2;
+    if (ip->link_local_delay_ms > CONFIG_ESP_NETWORK_LINK_LOCAL_RETRY_MAX * 1000)
+    {
+        ip->link_local_delay_ms = CONFIG_ESP_NETWORK_LINK_LOCAL_RETRY_MAX * 1000;
+    }
+    esp_timer_start_once(ip->link_local_timer, (uint64_t)ip->link_local_delay_ms * 1000);
+}
+
+void net_ip_set_link_state(uint32_t iface, esp_netif_t *netif, network_link_state_t state)
+{
+    net_ip_iface_t *ip = net_ip_find(iface);
+    if (ip == NULL || ip->link_state == state)
+    {
+        return;
+    }
+    if (netif != NULL)
+    {
+        ip->netif = netif;
+    }
+    if (ip->link_state == NETWORK_LINK_LOCAL_ONLY)
+    {
+        // Leaving link local
+        ip->link_local_stats.total_ms += (esp_timer_get_time() - ip->link_local_since_us) / 1000;
+        ip->link_local_since_us = 0;
+        if (ip->link_local_timer != NULL)
+        {
+            esp_timer_stop(ip->link_local_timer);
+        }
+    }
+    ip->link_state = state;
+    if (state != NETWORK_LINK_LOCAL_ONLY)
+    {
+        return;
+    }
+    ip->link_local_stats.entries++;
+    ip->link_local_since_us = esp_timer_get_time();
+    ip->link_local_delay_ms = CONFIG_ESP_NETWORK_LINK_LOCAL_RETRY_MS;
+    if (ip->link_local_timer == NULL)
+    {
+        const esp_timer_create_args_t args = {
+            .callback = net_ip_link_local_retry,
+            .arg = ip,
+            .name = "link_local"
+        };
+        if (esp_timer_create(&args, &ip->link_local_timer) != ESP_OK)
+        {
+            return;
+        }
+    }
+    esp_timer_start_once(ip->link_local_timer, (uint64_t)ip->link_local_delay_ms * 1000);
+}
+
+void net_ip_set_netif(uint32_t iface, esp_netif_t *netif)
+{
+    net_ip_iface_t *ip = net_ip_find(iface);
+    if (ip == NULL)
+    {
+        return;
+    }
+    // Stops the link local retries on the old netif
+    net_ip_set_link_state(iface, NULL, NETWORK_LINK_DOWN);
+    ip->netif = netif;
+    ip->confirming = false;
+    ip->cached_posted = false;
+}
+
+bool net_ip_link_local_allowed(void)
+{
+#ifdef CONFIG_ESP_NETWORK_LINK_LOCAL_CONNECTED
+    return true;
+#else
+    return false;
+#endif
+}
+
+network_link_state_t network_get_link_state(uint32_t iface)
+{
+    net_ip_iface_t *ip = net_ip_find(iface);
+    return (ip != NULL) ? ip->link_state : NETWORK_LINK_DOWN;
+}
+
+void network_get_link_local_stats(uint32_t iface, network_link_local_stats_t *stats)
+{
+    net_ip_iface_t *ip = net_ip_find(iface);
+    if (stats == NULL)
+    {
+        return;
+    }
+    if (ip == NULL)
+    {
+        memset(stats, 0, sizeof(network_link_local_stats_t));
+        return;
+    }
+    *stats = ip->link_local_stats;
+    if (ip->link_state == NETWORK_LINK_LOCAL_ONLY)
+    {
+        // Include the time in the current stay
+        stats->total_ms += (esp_timer_get_time() - ip->link_local_since_us) / 1000;
+    }
+}
@@ -0,0 +1,100 @@
+/*
+    Connection phase tracer
+
+    Each phase has a fixed size ring buffer of durations. Writers claim a slot with an atomic
+    increment, so recording from the event loop and the WIFI task needs no locks and no heap.
+    Readers copy the ring and sort the copy to calculate the percentiles.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include <string.h>
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "network_priv.h"
+
+#ifdef CONFIG_ESP_NETWORK_TRACE_ENABLED
+
+#define TRACE_SAMPLES CONFIG_ESP_NETWORK_TRACE_SAMPLES
+
+typedef struct {
+    uint32_t head;                  // Total samples recorded, the slot is head % TRACE_SAMPLES
+    uint32_t samples[TRACE_SAMPLES];
+} trace_ring_t;
+
+static trace_ring_t trace_rings[NETWORK_PHASE_MAX];
+
+void net_trace_record(network_phase_t phase, int64_t start_us)
+{
+    if (start_us == 0 || phase >= NETWORK_PHASE_MAX)
+    {
+        return;
+    }
+    int64_t elapsed_us = esp_timer_get_time() - start_us;
+    if (elapsed_us < 0)
+    {
+        return;
+    }
+    trace_ring_t *ring = &trace_rings[phase];
+    uint32_t slot = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED) % TRACE_SAMPLES;
+    __atomic_store_n(&ring->samples[slot], (elapsed_us > UINT32_MAX) ? UINT32_MAX : (uint32_t)elapsed_us, __ATOMIC_RELAXED);
+}
+
+esp_err_t network_get_phase_stats(network_phase_t phase, network_phase_stats_t *stats)
+{
+    if (phase >= NETWORK_PHASE_MAX || stats == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    trace_ring_t *ring = &trace_rings[phase];
+    uint32_t sorted[TRACE_SAMPLES];
+    uint32_t count = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    uint32_t samples = (count < TRACE_SAMPLES) ? count : TRACE_SAMPLES;
+
+    memset(stats, 0, sizeof(network_phase_stats_t));
+    stats->count = count;
+    stats->samples = samples;
+    if (samples == 0)
+    {
+        return ESP_OK;
+    }
+
+    // Insertion sort, the ring is small
+    for (uint32_t i = 0; i < samples; i++)
+    {
+        uint32_t value = __atomic_load_n(&ring->samples[i], __ATOMIC_RELAXED);
+        uint32_t j = i;
+        while (j > 0 && sorted[j - 1] > value)
+        {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = value;
+    }
+    stats->min_us = sorted[0];
+    stats->p50_us = sorted[(samples - 1) * 50 / 100];
+    stats->p99_us = sorted[(samples - 1) * 99 / 100];
+    stats->max_us = sorted[samples - 1];
+    return ESP_OK;
+}
+
+void network_reset_phase_stats(void)
+{
+    for (int i = 0; i < NETWORK_PHASE_MAX; i++)
+    {
+        __atomic_store_n(&trace_rings[i].head, 0, __ATOMIC_RELAXED);
+    }
+}
+
+#else
+
+esp_err_t network_get_phase_stats(network_phase_t phase, network_phase_stats_t *stats)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void network_reset_phase_stats(void)
+{
+}
+
+#endif
@@ -4,10 +4,15 @@
 #include "esp_event.h"
 #include "esp_log.h"
 #include "esp_netif.h"
-#include "network.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "network_priv.h"
 
 static const char *TAG = "NETCTRL";
 
+/* One bit per interface (NETWORK_IF_xxx), set while the interface has an IP number */
+static EventGroupHandle_t s_network_event_group = NULL;
+
 #if !CONFIG_ESP_ETHERNET_ENABLED && !CONFIG_ESP_WIFI_ENABLED
 #error Networking is required. WIFI or Ethernet must be defined.
 #endif
@@ -16,6 +21,10 @@ void network_setup(void)
     // Setup networking and the event loop
     ESP_ERROR_CHECK(esp_netif_init());
     ESP_ERROR_CHECK(esp_event_loop_create_default());
+    if (s_network_event_group == NULL)
+    {
+        s_network_event_group = xEventGroupCreate();
+    }
 
 #ifdef CONFIG_ESP_ETHERNET_ENABLED
     ESP_LOGI(TAG, "Configuring Ethernet");
@@ -25,21 +34,63 @@ void network_setup(void)
 #ifdef CONFIG_ESP_WIFI_ENABLED
     ESP_LOGI(TAG, "Configuring WIFI");
     wifi_setup();
+    // Started together with Ethernet, so a device whose Ethernet never connects still gets on WIFI
+    wifi_start();
 #endif
+    net_health_start();
 }
 
 void network_waitforconnect(void)
 {
-#ifdef CONFIG_ESP_ETHERNET_ENABLED
-    ESP_LOGI(TAG, "Waiting for ethernet to connect...");
-    ethernet_waitforconnect();
-#endif
+    ESP_LOGI(TAG, "Waiting for the network to connect...");
+    network_wait(NETWORK_IF_ANY, portMAX_DELAY);
+}
 
-#ifdef CONFIG_ESP_WIFI_ENABLED
-    ESP_LOGI(TAG, "Waiting for WIFI to connect...");
-    wifi_connect();
-    wifi_waitforconnect();
-#endif
+esp_err_t network_wait(uint32_t flags, TickType_t timeout)
+{
+    EventBits_t ifaces = flags & NETWORK_IF_ANY;
+    if (s_network_event_group == NULL || ifaces == 0)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    bool wait_all = (flags & NETWORK_WAIT_ALL) != 0;
+    EventBits_t bits = xEventGroupWaitBits(s_network_event_group,
+            ifaces,
+            pdFALSE,
+            wait_all ? pdTRUE : pdFALSE,
+            timeout);
+    bits &= ifaces;
+    if ((wait_all && bits == ifaces) || (!wait_all && bits != 0))
+    {
+        return ESP_OK;
+    }
+    return ESP_ERR_TIMEOUT;
+}
+
+uint32_t network_connected_interfaces(void)
+{
+    if (s_network_event_group == NULL)
+    {
+        return 0;
+    }
+    return xEventGroupGetBits(s_network_event_group) & NETWORK_IF_ANY;
+}
+
+void network_set_connected(uint32_t iface, bool connected)
+{
+    if (s_network_event_group == NULL)
+    {
+        return;
+    }
+    if (connected)
+    {
+        xEventGroupSetBits(s_network_event_group, iface);
+    }
+    else
+    {
+        xEventGroupClearBits(s_network_event_group, iface);
+    }
+    net_failover_update(xEventGroupGetBits(s_network_event_group) & NETWORK_IF_ANY);
 }
 
 void set_network_led_connected_callback(void (*callback)())
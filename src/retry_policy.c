@@ -0,0 +1,112 @@
+/*
+    Retry policy for network reconnects
+
+    Exponential backoff and jitter based on the AWS architecture blog post
+    "Exponential Backoff And Jitter".
+
+    (C) 2020 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include <stddef.h>
+#include "retry_policy.h"
+
+// xorshift32. Good enough for jitter and has no dependencies.
+static uint32_t retry_rand(retry_policy_t *policy)
+{
+    uint32_t x = policy->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    policy->rng = x;
+    return x;
+}
+
+// Random number between low and high inclusive
+static uint32_t retry_rand_between(retry_policy_t *policy, uint32_t low, uint32_t high)
+{
+    if (high <= low)
+    {
+        return low;
+    }
+    return low + (retry_rand(policy) % (high - low + 1));
+}
+
+static uint32_t retry_cap(const retry_policy_t *policy, uint32_t delay_ms)
+{
+    if (policy->config.max_ms > 0 && delay_ms > policy->config.max_ms)
+    {
+        return policy->config.max_ms;
+    }
+    return delay_ms;
+}
+
+void retry_policy_init(retry_policy_t *policy, const retry_policy_config_t *config, uint32_t seed)
+{
+    policy->config = *config;
+    policy->rng = (seed != 0) ? seed : 0x2545F491;
+    retry_policy_reset(policy);
+}
+
+void retry_policy_reset(retry_policy_t *policy)
+{
+    policy->attempt = 0;
+    policy->prev_ms = policy->config.base_ms;
+}
+
+uint32_t retry_policy_next_ms(retry_policy_t *policy)
+{
+    const retry_policy_config_t *config = &policy->config;
+    uint32_t attempt = policy->attempt++;
+    uint32_t delay_ms;
+
+    if (config->immediate_first)
+    {
+        if (attempt == 0)
+        {
+            return 0;
+        }
+        attempt--;
+    }
+
+    switch (config->type)
+    {
+        case RETRY_POLICY_CUSTOM:
+            delay_ms = (config->custom != NULL) ? config->custom(attempt, policy->prev_ms, config->custom_ctx) : config->base_ms;
+            break;
+        case RETRY_POLICY_EXPONENTIAL:
+            // Stop shifting once we pass the cap or would overflow
+            delay_ms = config->base_ms;
+            for (uint32_t i = 0; i < attempt && delay_ms < (UINT32_MAX / 2); i++)
+            {
+                delay_ms <<= 1;
+                if (config->max_ms > 0 && delay_ms >= config->max_ms)
+                {
+                    break;
+                }
+            }
+            break;
+        case RETRY_POLICY_FIXED:
+        default:
+            delay_ms = config->base_ms;
+            break;
+    }
+    delay_ms = retry_cap(policy, delay_ms);
+
+    switch (config->jitter)
+    {
+        case RETRY_JITTER_FULL:
+            delay_ms = retry_rand_between(policy, 0, delay_ms);
+            break;
+        case RETRY_JITTER_DECORRELATED: {
+            uint32_t high = (policy->prev_ms > UINT32_MAX / 3) ? UINT32_MAX : policy->prev_ms * 3;
+            delay_ms = retry_cap(policy, retry_rand_between(policy, config->base_ms, high));
+            break;
+        }
+        case RETRY_JITTER_NONE:
+        default:
+            break;
+    }
+
+    policy->prev_ms = delay_ms;
+    return delay_ms;
+}
@@ -7,10 +7,13 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "esp_system.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 
 #include "lwip/err.h"
@@ -26,42 +29,56 @@
 #endif
 
 #include "wifi.h"
-
-
-#if CONFIG_POWER_SAVE_MIN_MODEM
-#define DEFAULT_PS_MODE WIFI_PS_MIN_MODEM
-#elif CONFIG_POWER_SAVE_MAX_MODEM
-#define DEFAULT_PS_MODE WIFI_PS_MAX_MODEM
-#elif CONFIG_POWER_SAVE_NONE
-#define DEFAULT_PS_MODE WIFI_PS_NONE
+#include "retry_policy.h"
+#include "wifi_store.h"
+#include "wifi_scan.h"
+#include "wifi_sm.h"
+#include "network_priv.h"
+
+
+// Delay between reconnect attempts
+static retry_policy_t retry_policy;
+static const retry_policy_config_t default_retry_policy_config = {
+#ifdef CONFIG_ESP_WIFI_RETRY_POLICY_EXPONENTIAL
+    .type = RETRY_POLICY_EXPONENTIAL,
+    .base_ms = CONFIG_ESP_WIFI_RETRY_BASE_DELAY_MS,
+    .max_ms = CONFIG_ESP_WIFI_RETRY_MAX_DELAY * 1000,
 #else
-#define DEFAULT_PS_MODE WIFI_PS_NONE
-#endif /*CONFIG_POWER_SAVE_MODEM*/
-
-// Delay to recheck WIFI status
-static int WIFI_LOOP_DELAY_MS = CONFIG_ESP_WIFI_RETRY_DELAY;
+    .type = RETRY_POLICY_FIXED,
+    .base_ms = CONFIG_ESP_WIFI_RETRY_DELAY * 1000,
+    .max_ms = CONFIG_ESP_WIFI_RETRY_DELAY * 1000,
+#endif
+#if CONFIG_ESP_WIFI_RETRY_JITTER_FULL
+    .jitter = RETRY_JITTER_FULL,
+#elif CONFIG_ESP_WIFI_RETRY_JITTER_DECORRELATED
+    .jitter = RETRY_JITTER_DECORRELATED,
+#else
+    .jitter = RETRY_JITTER_NONE,
+#endif
+#ifdef CONFIG_ESP_WIFI_RETRY_IMMEDIATE_FIRST
+    .immediate_first = true,
+#else
+    .immediate_first = false,
+#endif
+};
 
 /* FreeRTOS event group to signal when we are connected*/
 static EventGroupHandle_t s_wifi_event_group;
 
 /* The event group allows multiple bits for each event, but we only care about two events:
  * - we are connected to the AP with an IP
- * - we failed to connect after the maximum amount of retries */
+ * - the state machine has processed wifi_disable */
 #define WIFI_CONNECTED_BIT BIT0
-#define WIFI_DISCONNECTED_BIT      BIT1
+#define WIFI_DISABLED_BIT      BIT1
 
 static void (*led_connected_callback)() = NULL;
 static void (*led_disconnected_callback)() = NULL;
 
 static const char *TAG = "WIFICTRL";
 
-static bool wifi_enabled = true;
-
 #ifdef CONFIG_ESP_BLUFI_ENABLED
 static const char *BLUFI_TAG = "BLUFI";
 
-static void (*custom_command_callback)(const char*) = NULL;
-
 /* store the station info for send back to phone */
 static bool gl_sta_connected = false;
 static bool ble_is_connected = false;
@@ -71,26 +88,35 @@ static int gl_sta_ssid_len;
 
 static void blufi_event_callback(esp_blufi_cb_event_t event, esp_blufi_cb_param_t *param);
 
-void set_custom_command_callback(void (*callback)(const char*))
+bool wifi_blufi_connected(void)
 {
-    if (callback!=NULL)
-    {
-        custom_command_callback = callback;
-    }
+    return ble_is_connected;
 }
 
-
 #endif
 
-#ifdef CONFIG_ESP_WIFI_REBOOT_ENABLED
+/* Failed attempts since the last connection, and how far up the recovery ladder they have gone */
 static uint16_t retrycount = 0;
+static wifi_recovery_stage_t recovery_stage = WIFI_RECOVERY_RECONNECT;
+static wifi_recovery_stats_t recovery_stats[WIFI_RECOVERY_STAGE_MAX];
+
+#ifdef CONFIG_ESP_WIFI_FAST_RECONNECT_ENABLED
+/* The last AP we were associated with. Used to reconnect without scanning all channels */
+static bool last_ap_valid = false;
+static uint8_t last_ap_bssid[6];
+static uint8_t last_ap_channel = 0;
+static bool fast_reconnect_tried = false;
 #endif
 
+/* Reconnect timing. Measured from the disconnect until an IP number is assigned again */
+static int64_t reconnect_start_us = 0;
+static int reconnect_path = -1;
+static wifi_reconnect_stats_t reconnect_stats[WIFI_RECONNECT_PATH_MAX];
+
+/* The credentials are filled in from the network store */
+static wifi_config_t sta_config = {
 #ifdef CONFIG_ESP_MANUAL_WIFI_ENABLED
-static wifi_config_t wifi_config_1 = {
         .sta = {
-            .ssid = CONFIG_ESP_WIFI_SSID,
-            .password = CONFIG_ESP_WIFI_PASSWORD,
             // authmode sets the minimum required auth mode in order to connect.
             // If this is configured for an auth mode that the AP does not support, it will not
             // connect. In fact, the WIFI driver will not even try to connect. Set this to the minimum
@@ -104,52 +130,43 @@ static wifi_config_t wifi_config_1 = {
                 .required = false
             },
         },
+#endif
     };
+static wifi_config_t *wifi_config = &sta_config;
 
-#ifdef CONFIG_ESP_WIFI_SSID2_ENABLED
-static wifi_config_t wifi_config_2 = {
-        .sta = {
-            .ssid = CONFIG_ESP_WIFI_SSID2,
-            .password = CONFIG_ESP_WIFI_PASSWORD2,
-            .threshold.authmode = WIFI_AUTH_WPA_PSK,
-            .scan_method = WIFI_ALL_CHANNEL_SCAN,
-            .sort_method = WIFI_CONNECT_AP_BY_SIGNAL,
-            .pmf_cfg = {
-                .capable = true,
-                .required = false
-            },
-        },
-    };
-#endif
+/* Index of the network in the store we are connecting to, or -1 */
+static esp_netif_t *sta_netif = NULL;
 
-static wifi_config_t *wifi_config = &wifi_config_1;
-#endif
+static int current_network = -1;
+static int64_t connect_start_us = 0;
+static int64_t associated_us = 0;
+
+/* Scan results used to pick the best stored network */
+static wifi_scan_result_t select_results[CONFIG_ESP_WIFI_SCAN_MAX_RECORDS];
+static wifi_store_scan_t store_scan[CONFIG_ESP_WIFI_SCAN_MAX_RECORDS];
 
 #ifdef CONFIG_ESP_BLUFI_ENABLED
-static wifi_config_t sta_config;
-static wifi_config_t *wifi_config = &sta_config;
+/* Scan results sent to the BluFi client. Static so a scan does not allocate on the event loop. */
+static esp_blufi_ap_record_t blufi_ap_list[CONFIG_ESP_WIFI_SCAN_MAX_RECORDS];
 #endif
 
 void wifi_waitforconnect(void)
 {
-    while (1)
+    while (!wifi_waitforconnect_timeout(portMAX_DELAY))
     {
-        // Sit and wait until something happens
-        EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group,
-                WIFI_CONNECTED_BIT,
-                pdFALSE,
-                pdFALSE,
-                portMAX_DELAY);
-
-        if (bits & WIFI_CONNECTED_BIT) {
-            return;
-        }
     }
 }
 
-void wifi_disable()
+bool wifi_waitforconnect_timeout(TickType_t timeout)
 {
-    wifi_enabled = false;
+    // Sit and wait until something happens
+    EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group,
+            WIFI_CONNECTED_BIT,
+            pdFALSE,
+            pdFALSE,
+            timeout);
+
+    return (bits & WIFI_CONNECTED_BIT) != 0;
 }
 
 void wifi_disconnect(void)
@@ -189,65 +206,658 @@ static void led_disconnected()
     }
 }
 
-static void wifi_connected(void *pvParameter)
+#ifdef CONFIG_ESP_BLUFI_ENABLED
+/**
+ * Adds the credentials in config to the network store. The ssid and password in a wifi_config_t
+ * are not always NUL terminated.
+ */
+static int wifi_store_add_config(const wifi_config_t *config)
+{
+    char ssid[WIFI_STORE_SSID_LEN + 1] = {0};
+    char password[WIFI_STORE_PASSWORD_LEN + 1] = {0};
+    memcpy(ssid, config->sta.ssid, WIFI_STORE_SSID_LEN);
+    memcpy(password, config->sta.password, WIFI_STORE_PASSWORD_LEN);
+    return wifi_store_add(ssid, password);
+}
+#endif
+
+/**
+ * Copies the credentials of the stored network at index into the station config.
+ */
+static bool wifi_use_network(int index)
 {
-    while (wifi_enabled)
+    wifi_store_entry_t entry;
+    if (!wifi_store_get(index, &entry))
     {
-        // Sit and wait until something happens
-        EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group,
-                WIFI_DISCONNECTED_BIT,
-                pdFALSE,
-                pdFALSE,
-                portMAX_DELAY);
+        return false;
+    }
+    if (index != current_network)
+    {
+        // Any BSSID belongs to the old network
+        sta_config.sta.bssid_set = false;
+    }
+    memset(sta_config.sta.ssid, 0, sizeof(sta_config.sta.ssid));
+    memset(sta_config.sta.password, 0, sizeof(sta_config.sta.password));
+    memcpy(sta_config.sta.ssid, entry.ssid, strnlen(entry.ssid, sizeof(sta_config.sta.ssid)));
+    memcpy(sta_config.sta.password, entry.password, strnlen(entry.password, sizeof(sta_config.sta.password)));
+    current_network = index;
+    return true;
+}
 
-        // xEventGroupWaitBits() returns the bits before the call returned, hence we can test which event actually
-        // happened.
-        if (bits & WIFI_DISCONNECTED_BIT) {
-            if (!wifi_enabled)
+/**
+ * Returns the index of the best stored network to connect to, using the cached scan results if scan_err
+ * is ESP_OK. If none of the stored networks are seen, the next one in turn is returned in case it is
+ * hidden. channel is set to the channel of the strongest AP for the network, or 0 if it was not seen.
+ */
+static int wifi_select_network(esp_err_t err, uint8_t *channel)
+{
+    int count = wifi_store_count();
+    *channel = 0;
+    if (count <= 1)
+    {
+        return count - 1;
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Network selection scan failed: %s", esp_err_to_name(err));
+    }
+    int result_count = (err == ESP_OK) ? wifi_scan_get_results(select_results, CONFIG_ESP_WIFI_SCAN_MAX_RECORDS) : 0;
+    for (int i = 0; i < result_count; i++)
+    {
+        store_scan[i].ssid = select_results[i].ssid;
+        store_scan[i].rssi = select_results[i].rssi;
+    }
+    int index = wifi_store_select(store_scan, result_count);
+    if (index >= 0)
+    {
+        // The results hold the strongest AP for each SSID, use its channel
+        wifi_store_entry_t entry;
+        wifi_store_get(index, &entry);
+        for (int i = 0; i < result_count; i++)
+        {
+            if (strncmp((const char *)select_results[i].ssid, entry.ssid, WIFI_STORE_SSID_LEN) == 0)
             {
-                ESP_LOGW(TAG, "Wifi has been disabled. Thread aborted.");
+                *channel = select_results[i].channel;
                 break;
             }
-            ESP_LOGI(TAG, "Disconnected from %s, retrying....", wifi_config->sta.ssid);
-            // Clean the disconnected bit so we don't hit this again unless 
-            // we don't connect again.
-            xEventGroupClearBits(s_wifi_event_group, WIFI_DISCONNECTED_BIT);
-            // Make sure the WIFI driver is offline
-            esp_wifi_disconnect();
+        }
+    }
+    else
+    {
+        index = (current_network + 1) % count;
+        ESP_LOGI(TAG, "No stored network seen, trying the next one");
+    }
+    return index;
+}
+
+/**
+ * Starts a connection attempt to the current network and records it in the store.
+ */
+static void wifi_start_connect()
+{
+    connect_start_us = esp_timer_get_time();
+    wifi_store_record_attempt(current_network);
+    esp_wifi_connect();
+}
+
+esp_netif_t *wifi_get_netif(void)
+{
+    return sta_netif;
+}
+
+bool wifi_set_listen_interval(uint16_t interval)
+{
+    if (sta_config.sta.listen_interval == interval)
+    {
+        return false;
+    }
+    // Every connection attempt gives the driver wifi_config, so it is not set here. That would also replace the
+    // pinned BSSID of a fast reconnect or roam in progress.
+    sta_config.sta.listen_interval = interval;
+    return true;
+}
+
+void wifi_force_reconnect(void)
+{
+    ESP_LOGW(TAG, "Dropping the connection to reconnect");
+    esp_wifi_disconnect();
+}
+
+#ifdef CONFIG_ESP_NETWORK_FAULT_INJECTION
+/* Reason reported for the next disconnect, so tests can simulate different failures */
+static uint8_t injected_reason = 0;
+
+void wifi_inject_disconnect(uint8_t reason)
+{
+    injected_reason = reason;
+    esp_wifi_disconnect();
+}
+#endif
+
+void wifi_get_reconnect_stats(wifi_reconnect_path_t path, wifi_reconnect_stats_t *stats)
+{
+    if (stats == NULL || path >= WIFI_RECONNECT_PATH_MAX)
+    {
+        return;
+    }
+    *stats = reconnect_stats[path];
+}
+
+void wifi_set_retry_policy(const retry_policy_config_t *config)
+{
+    if (config == NULL)
+    {
+        config = &default_retry_policy_config;
+    }
+    uint32_t seed;
+    esp_fill_random(&seed, sizeof(seed));
+    retry_policy_init(&retry_policy, config, seed);
+}
+
+static void reconnect_failed()
+{
+    if (reconnect_path >= 0)
+    {
+        reconnect_stats[reconnect_path].failures++;
+        reconnect_path = -1;
+    }
+}
+
+static void reconnect_succeeded()
+{
+    if (reconnect_start_us == 0 || reconnect_path < 0)
+    {
+        return;
+    }
+    uint32_t elapsed_ms = (uint32_t)((esp_timer_get_time() - reconnect_start_us) / 1000);
+    wifi_reconnect_stats_t *stats = &reconnect_stats[reconnect_path];
+    if (stats->count == 0 || elapsed_ms < stats->min_ms)
+    {
+        stats->min_ms = elapsed_ms;
+    }
+    if (elapsed_ms > stats->max_ms)
+    {
+        stats->max_ms = elapsed_ms;
+    }
+    stats->last_ms = elapsed_ms;
+    stats->total_ms += elapsed_ms;
+    stats->count++;
+    ESP_LOGI(TAG, "Reconnected in %u ms (%s)", elapsed_ms,
+        (reconnect_path == WIFI_RECONNECT_PATH_FAST) ? "fast" :
+        (reconnect_path == WIFI_RECONNECT_PATH_ROAM) ? "roam" : "full scan");
+    reconnect_start_us = 0;
+    reconnect_path = -1;
+    retry_policy_reset(&retry_policy);
+#ifdef CONFIG_ESP_WIFI_FAST_RECONNECT_ENABLED
+    fast_reconnect_tried = false;
+#endif
+}
+
+#if defined(CONFIG_ESP_WIFI_FAST_RECONNECT_ENABLED) || defined(CONFIG_ESP_WIFI_ROAM_ENABLED)
+/**
+ * Connect to one AP on its channel only. The config is a copy so the full scan
+ * config is left as is for the fallback.
+ */
+static void wifi_connect_bssid(const uint8_t *bssid, uint8_t channel, wifi_reconnect_path_t path)
+{
+    wifi_config_t ap_config = *wifi_config;
+    memcpy(ap_config.sta.bssid, bssid, 6);
+    ap_config.sta.bssid_set = true;
+    ap_config.sta.channel = channel;
+    ap_config.sta.scan_method = WIFI_FAST_SCAN;
+    ESP_LOGI(TAG, "%s to %s on channel %d", (path == WIFI_RECONNECT_PATH_ROAM) ? "Roaming" : "Fast reconnect",
+        wifi_config->sta.ssid, channel);
+    esp_wifi_set_config(ESP_IF_WIFI_STA, &ap_config);
+    reconnect_path = path;
+    wifi_start_connect();
+}
+#endif
+
+#ifdef CONFIG_ESP_WIFI_ROAM_ENABLED
+/* AP picked by the roaming monitor, used for the next connection */
+static bool roam_pending = false;
+static uint8_t roam_bssid[6];
+static uint8_t roam_channel = 0;
+
+void wifi_roam_to(const uint8_t *bssid, uint8_t channel)
+{
+    memcpy(roam_bssid, bssid, 6);
+    roam_channel = channel;
+    roam_pending = true;
+    // The reconnect task picks it up from the disconnect
+    esp_wifi_disconnect();
+}
+#endif
+
+/*
+ * Connection state machine. Events from the driver, the backoff timer, the scan task and the API are
+ * queued to the monitor task, which looks up the transition in the table (wifi_sm.c) and runs its action.
+ * Nothing sleeps, so a disconnect or wifi_disable is handled as soon as it is queued.
+ */
+#define WIFI_SM_QUEUE_LEN 8
+/* How long wifi_disable waits for room in a full queue, the state machine drains it in well under this */
+#define WIFI_SM_POST_TIMEOUT_MS 1000
+
+static QueueHandle_t sm_queue = NULL;
+/* Held while posting to sm_queue and while deleting it. The dispatcher, the timers and the scan task all post. */
+static StaticSemaphore_t sm_queue_lock_buffer;
+static SemaphoreHandle_t sm_queue_lock = NULL;
+static TaskHandle_t sm_task = NULL;
+static esp_timer_handle_t backoff_timer = NULL;
+static volatile wifi_state_t sm_state = WIFI_STATE_IDLE;
+static volatile int64_t sm_state_since_us = 0;
+static wifi_state_stats_t state_stats[WIFI_STATE_MAX];
+/* Result of the last network selection scan, set before WIFI_SM_EVENT_SCAN_DONE is queued */
+static esp_err_t sm_scan_err = ESP_OK;
+
+/* Start/stop cycles of the driver */
+static bool driver_started = false;
+static wifi_lifecycle_stats_t lifecycle_stats;
+static uint32_t cycle_free_heap = 0;
+static uint32_t first_stop_free_heap = 0;
+
+/**
+ * Queues event for the state machine, retrying for up to wait ticks while the queue is full. The lock is not held
+ * between tries, so the timers and the dispatcher are not held up. Returns false if the event was dropped
+ * because the queue stayed full or has been deleted.
+ */
+static bool wifi_sm_post_wait(wifi_sm_event_t event, TickType_t wait)
+{
+    if (sm_queue_lock == NULL)
+    {
+        return false;
+    }
+    TickType_t start = xTaskGetTickCount();
+    while (true)
+    {
+        xSemaphoreTake(sm_queue_lock, portMAX_DELAY);
+        bool deleted = sm_queue == NULL;
+        bool posted = !deleted && xQueueSend(sm_queue, &event, 0) == pdTRUE;
+        xSemaphoreGive(sm_queue_lock);
+        if (posted || deleted)
+        {
+            return posted;
+        }
+        if (xTaskGetTickCount() - start >= wait)
+        {
+            ESP_LOGE(TAG, "State machine queue full, dropped event %d", event);
+            return false;
+        }
+        vTaskDelay(1);
+    }
+}
+
+static void wifi_sm_post(wifi_sm_event_t event)
+{
+    wifi_sm_post_wait(event, 0);
+}
+
+static void wifi_sm_backoff_done(void *arg)
+{
+    wifi_sm_post(WIFI_SM_EVENT_BACKOFF_DONE);
+}
+
+static void wifi_sm_scan_done(esp_err_t err, void *ctx)
+{
+    sm_scan_err = err;
+    wifi_sm_post(WIFI_SM_EVENT_SCAN_DONE);
+}
+
+/* Bookkeeping shared by every way of handling a dropped connection or a failed attempt */
+static void wifi_sm_disconnected()
+{
+    ESP_LOGI(TAG, "Disconnected from %s, retrying....", wifi_config->sta.ssid);
+    // If the previous attempt got us here, it failed
+    reconnect_failed();
+    if (reconnect_start_us == 0)
+    {
+        reconnect_start_us = esp_timer_get_time();
+    }
+}
+
+static void wifi_driver_init(void);
+
+/* Runs on the dispatcher between events, so wifi_event_handler never sees the netif half replaced */
+static void wifi_netif_recreate(void *arg)
+{
+    esp_netif_t *old_netif = sta_netif;
+    esp_wifi_clear_default_wifi_driver_and_handlers(old_netif);
+    esp_netif_destroy(old_netif);
+    sta_netif = esp_netif_create_default_wifi_sta();
+    assert(sta_netif);
+    net_ip_set_netif(NETWORK_IF_WIFI, sta_netif);
+    net_fault_netif_replaced(old_netif, sta_netif);
+}
+
+/* Runs one rung of the recovery ladder. Each rung redoes more of the WIFI setup than the one before. */
+static void wifi_recover(wifi_recovery_stage_t stage)
+{
+    ESP_LOGW(TAG, "%u failed attempts, recovery stage %d", retrycount, stage);
+    recovery_stats[stage].attempts++;
+    switch (stage)
+    {
+        case WIFI_RECOVERY_DRIVER_RESTART:
+            esp_wifi_stop();
+            break;
+        case WIFI_RECOVERY_RADIO_REINIT:
+            // Deinit powers the PHY down, init calibrates it again
+            esp_wifi_stop();
+            esp_wifi_deinit();
+            wifi_driver_init();
+            break;
+        case WIFI_RECOVERY_NETIF_RECREATE:
+            esp_wifi_stop();
+            esp_wifi_deinit();
+            ESP_ERROR_CHECK(net_dispatch_call(wifi_netif_recreate, NULL));
+            wifi_driver_init();
+            break;
+        case WIFI_RECOVERY_REBOOT:
+            ESP_LOGE(TAG, "Retry count exceeded...rebooting...");
+            esp_restart();
+            break;
+        default:
+            return;
+    }
+    // The START this posts is ignored, the caller carries on connecting
+    esp_wifi_start();
+    wifi_power_apply();
+}
+
+/* Counts a failed attempt and climbs the recovery ladder every CONFIG_ESP_WIFI_RECOVERY_STAGE_FAILURES attempts */
+static void wifi_sm_count_retry()
+{
+    retrycount++;
+    if (retrycount == 1)
+    {
+        recovery_stage = WIFI_RECOVERY_RECONNECT;
+        recovery_stats[WIFI_RECOVERY_RECONNECT].attempts++;
+        return;
+    }
 #ifdef CONFIG_ESP_WIFI_REBOOT_ENABLED
-            retrycount++;
-            if (retrycount>CONFIG_ESP_WIFI_REBOOT_COUNT)
-            {
-                ESP_LOGE(TAG, "Retry count exceeded...rebooting...");
-                esp_restart();
-            }
+    if (retrycount>CONFIG_ESP_WIFI_REBOOT_COUNT)
+    {
+        wifi_recover(WIFI_RECOVERY_REBOOT);
+    }
 #endif
+    if (recovery_stage < WIFI_RECOVERY_NETIF_RECREATE && retrycount % CONFIG_ESP_WIFI_RECOVERY_STAGE_FAILURES == 0)
+    {
+        recovery_stage++;
+        wifi_recover(recovery_stage);
+    }
+}
 
-#ifdef CONFIG_ESP_WIFI_SSID2_ENABLED
-            // Flip between our two hard coded AP's
-            if (wifi_config == &wifi_config_1)
-            {
-                wifi_config = &wifi_config_2;
-                ESP_LOGI(TAG, "Switching to WIFI 2 config: %s", wifi_config_2.sta.ssid);
-            }
-            else
-            {
-                ESP_LOGI(TAG, "Switching to WIFI 1 config: %s", wifi_config_1.sta.ssid);
-                wifi_config = &wifi_config_1;
-            }
-            ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, wifi_config) );
+static void wifi_sm_connect_current()
+{
+    ESP_LOGI(TAG,"Attempting to connect to the %s", wifi_config->sta.ssid);
+    wifi_start_connect();
+}
+
+static void wifi_sm_connected()
+{
+    if (retrycount > 0)
+    {
+        recovery_stats[recovery_stage].successes++;
+        retrycount = 0;
+        recovery_stage = WIFI_RECOVERY_RECONNECT;
+    }
+    wifi_store_record_success(current_network, (uint32_t)((esp_timer_get_time() - connect_start_us) / 1000));
+    reconnect_succeeded();
+}
+
+#ifdef CONFIG_ESP_WIFI_ROAM_ENABLED
+/* A roam is not a failure, so it does not count towards a reboot. If it fails, the fast reconnect goes back to the old AP. */
+static void wifi_sm_connect_roam()
+{
+    wifi_sm_disconnected();
+    roam_pending = false;
+    wifi_connect_bssid(roam_bssid, roam_channel, WIFI_RECONNECT_PATH_ROAM);
+}
 #endif
-            ESP_LOGI(TAG, "Connecting to %s...", wifi_config->sta.ssid);
-            esp_wifi_connect();
-        } else {
-            ESP_LOGE(TAG, "UNEXPECTED EVENT");
+
+#ifdef CONFIG_ESP_WIFI_FAST_RECONNECT_ENABLED
+/* Coming back from wifi_stop, go straight to the last AP. If it fails, the disconnect does the full scan. */
+static void wifi_sm_resume_fast()
+{
+    reconnect_start_us = esp_timer_get_time();
+    fast_reconnect_tried = true;
+    wifi_connect_bssid(last_ap_bssid, last_ap_channel, WIFI_RECONNECT_PATH_FAST);
+}
+
+/* Try the last AP first, without a delay. If it fails, the next disconnect does the full scan. */
+static void wifi_sm_connect_fast()
+{
+    wifi_sm_disconnected();
+    wifi_sm_count_retry();
+    fast_reconnect_tried = true;
+    wifi_connect_bssid(last_ap_bssid, last_ap_channel, WIFI_RECONNECT_PATH_FAST);
+}
+#endif
+
+/* Delay so we don't hammer the AP */
+static void wifi_sm_start_backoff()
+{
+    wifi_sm_disconnected();
+    wifi_sm_count_retry();
+    uint32_t delay_ms = retry_policy_next_ms(&retry_policy);
+    if (delay_ms == 0)
+    {
+        wifi_sm_post(WIFI_SM_EVENT_BACKOFF_DONE);
+        return;
+    }
+    ESP_LOGI(TAG, "Waiting %u ms before reconnecting...", delay_ms);
+    esp_timer_start_once(backoff_timer, delay_ms * 1000ULL);
+}
+
+static void wifi_sm_start_scan()
+{
+    // A single network needs no scan to pick it. A recent scan (from BluFi or the last selection) is
+    // answered from the cache.
+    esp_err_t err = (wifi_store_count() > 1) ? wifi_scan_request(wifi_sm_scan_done, NULL) : ESP_ERR_NOT_FOUND;
+    if (err != ESP_OK)
+    {
+        wifi_sm_scan_done(err, NULL);
+    }
+}
+
+/* Pick the best network we know about and connect to it */
+static void wifi_sm_connect_selected()
+{
+    uint8_t channel;
+    int index = wifi_select_network(sm_scan_err, &channel);
+    if (index >= 0 && index != current_network)
+    {
+        wifi_use_network(index);
+        ESP_LOGI(TAG, "Switching to WIFI config: %s", wifi_config->sta.ssid);
+    }
+    // The driver scans the channel we just saw the network on first
+    sta_config.sta.channel = channel;
+    // Always set the config. A fast reconnect may have left a pinned BSSID/channel in the driver.
+    if (current_network >= 0)
+    {
+        ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, wifi_config) );
+    }
+    ESP_LOGI(TAG, "Connecting to %s...", wifi_config->sta.ssid);
+    reconnect_path = WIFI_RECONNECT_PATH_FULL_SCAN;
+    wifi_start_connect();
+}
+
+/* Something else (BluFi or the application) connected while a retry was pending */
+static void wifi_sm_cancel_retry()
+{
+    esp_timer_stop(backoff_timer);
+}
+
+static void wifi_sm_disable()
+{
+    // A scan still running finishes into the DISABLED state and is ignored
+    esp_timer_stop(backoff_timer);
+    reconnect_path = -1;
+    reconnect_start_us = 0;
+    ESP_LOGW(TAG, "Wifi has been disabled.");
+    xEventGroupSetBits(s_wifi_event_group, WIFI_DISABLED_BIT);
+}
+
+static void wifi_sm_enable()
+{
+    retry_policy_reset(&retry_policy);
+#ifdef CONFIG_ESP_WIFI_FAST_RECONNECT_ENABLED
+    fast_reconnect_tried = false;
+#endif
+}
+
+/* Indexed by wifi_sm_action_t */
+static void (*const wifi_sm_actions[WIFI_SM_ACTION_MAX])(void) = {
+    [WIFI_SM_ACTION_NONE] = NULL,
+#ifdef CONFIG_ESP_WIFI_FAST_RECONNECT_ENABLED
+    [WIFI_SM_ACTION_RESUME_FAST] = wifi_sm_resume_fast,
+    [WIFI_SM_ACTION_CONNECT_FAST] = wifi_sm_connect_fast,
+#endif
+    [WIFI_SM_ACTION_CONNECT_CURRENT] = wifi_sm_connect_current,
+    [WIFI_SM_ACTION_CANCEL_RETRY] = wifi_sm_cancel_retry,
+    [WIFI_SM_ACTION_CONNECTED] = wifi_sm_connected,
+#ifdef CONFIG_ESP_WIFI_ROAM_ENABLED
+    [WIFI_SM_ACTION_CONNECT_ROAM] = wifi_sm_connect_roam,
+#endif
+    [WIFI_SM_ACTION_START_BACKOFF] = wifi_sm_start_backoff,
+    [WIFI_SM_ACTION_START_SCAN] = wifi_sm_start_scan,
+    [WIFI_SM_ACTION_CONNECT_SELECTED] = wifi_sm_connect_selected,
+    [WIFI_SM_ACTION_DISABLE] = wifi_sm_disable,
+    [WIFI_SM_ACTION_ENABLE] = wifi_sm_enable,
+};
+
+/* What the guards of the table look at */
+static void wifi_sm_get_conditions(wifi_sm_conditions_t *conditions)
+{
+#ifdef CONFIG_ESP_WIFI_ROAM_ENABLED
+    conditions->roam_pending = roam_pending;
+#else
+    conditions->roam_pending = false;
+#endif
+#ifdef CONFIG_ESP_WIFI_FAST_RECONNECT_ENABLED
+    conditions->fast_reconnect_ready = last_ap_valid && !fast_reconnect_tried;
+#else
+    conditions->fast_reconnect_ready = false;
+#endif
+}
+
+static void wifi_sm_enter(wifi_state_t next)
+{
+    int64_t now = esp_timer_get_time();
+    wifi_state_stats_t *stats = &state_stats[sm_state];
+    stats->last_ms = (uint32_t)((now - sm_state_since_us) / 1000);
+    stats->total_ms += stats->last_ms;
+    state_stats[next].entries++;
+    sm_state_since_us = now;
+    sm_state = next;
+}
+
+static void wifi_connected(void *pvParameter)
+{
+    wifi_sm_event_t event;
+    while (true)
+    {
+        xQueueReceive(sm_queue, &event, portMAX_DELAY);
+        wifi_state_t state = sm_state;
+        wifi_sm_conditions_t conditions;
+        wifi_sm_get_conditions(&conditions);
+        const wifi_sm_transition_t *row = wifi_sm_find(state, event, &conditions);
+        if (row == NULL)
+        {
+            ESP_LOGD(TAG, "Event %d ignored in %s", event, wifi_sm_state_name(state));
+            continue;
+        }
+        if (row->next != state)
+        {
+            ESP_LOGD(TAG, "%s -> %s", wifi_sm_state_name(state), wifi_sm_state_name(row->next));
+            wifi_sm_enter(row->next);
+        }
+        if (wifi_sm_actions[row->action] != NULL)
+        {
+            wifi_sm_actions[row->action]();
         }
-        // Delay so we don't hammer the AP
-        vTaskDelay((WIFI_LOOP_DELAY_MS * 1000) / portTICK_PERIOD_MS);
     }
-    vTaskDelete(NULL);
 }
 
+wifi_state_t wifi_get_state(void)
+{
+    return sm_state;
+}
+
+void wifi_get_recovery_stats(wifi_recovery_stage_t stage, wifi_recovery_stats_t *stats)
+{
+    if (stats == NULL || stage >= WIFI_RECOVERY_STAGE_MAX)
+    {
+        return;
+    }
+    *stats = recovery_stats[stage];
+}
+
+void wifi_get_state_stats(wifi_state_t state, wifi_state_stats_t *stats)
+{
+    if (stats == NULL || state >= WIFI_STATE_MAX)
+    {
+        return;
+    }
+    *stats = state_stats[state];
+    if (state == sm_state && sm_state_since_us != 0)
+    {
+        stats->total_ms += (esp_timer_get_time() - sm_state_since_us) / 1000;
+    }
+}
+
+void wifi_disable()
+{
+    // The state machine can not make room in its own queue
+    bool on_sm_task = xTaskGetCurrentTaskHandle() == sm_task;
+    if (!wifi_sm_post_wait(WIFI_SM_EVENT_DISABLE, on_sm_task ? 0 : pdMS_TO_TICKS(WIFI_SM_POST_TIMEOUT_MS)))
+    {
+        return;
+    }
+    if (!on_sm_task)
+    {
+        // Wait for the state machine, so nothing it had pending reconnects after we return
+        xEventGroupWaitBits(s_wifi_event_group, WIFI_DISABLED_BIT, pdFALSE, pdFALSE, portMAX_DELAY);
+    }
+}
+
+#ifdef CONFIG_ESP_BLUFI_ENABLED
+static void wifi_blufi_copy_result(const wifi_scan_result_t *result, int index, void *ctx)
+{
+    blufi_ap_list[index].rssi = result->rssi;
+    memcpy(blufi_ap_list[index].ssid, result->ssid, sizeof(blufi_ap_list[index].ssid));
+    (*(uint16_t *)ctx)++;
+}
+
+/**
+ * Sends the cached scan results to the BluFi client.
+ */
+static void wifi_blufi_send_scan_results()
+{
+    uint16_t count = 0;
+    if (ble_is_connected == false) {
+        ESP_LOGI(BLUFI_TAG, "BLUFI BLE is not connected yet");
+        return;
+    }
+    wifi_scan_foreach(wifi_blufi_copy_result, &count);
+    if (count == 0) {
+        ESP_LOGI(BLUFI_TAG, "Nothing AP found");
+    }
+    esp_blufi_send_wifi_list(count, blufi_ap_list);
+}
+
+/**
+ * Called from the scan task when a scan requested by the BluFi client is done.
+ */
+static void wifi_blufi_scan_done(esp_err_t err, void *ctx)
+{
+    if (err != ESP_OK) {
+        esp_blufi_send_error_info(ESP_BLUFI_WIFI_SCAN_FAIL);
+        return;
+    }
+    wifi_blufi_send_scan_results();
+}
+#endif
+
 static void wifi_event_handler(void* arg, esp_event_base_t event_base,
                                 int32_t event_id, void* event_data)
 {
@@ -255,55 +865,37 @@ static void wifi_event_handler(void* arg, esp_event_base_t event_base,
     {
         switch (event_id) {
             case WIFI_EVENT_STA_START:
-                ESP_LOGI(TAG,"Attempting to connect to the %s", wifi_config->sta.ssid);
-                esp_wifi_connect();
+                wifi_sm_post(WIFI_SM_EVENT_START);
                 break;
-#ifdef CONFIG_ESP_BLUFI_ENABLED    
-            case WIFI_EVENT_STA_CONNECTED:
-                gl_sta_connected = true;
+            case WIFI_EVENT_STA_CONNECTED: {
+#if defined(CONFIG_ESP_WIFI_FAST_RECONNECT_ENABLED) || defined(CONFIG_ESP_BLUFI_ENABLED)
                 wifi_event_sta_connected_t *event = (wifi_event_sta_connected_t*) event_data;
+#endif
+                // Queued first, a cached address applied below reports GOT_IP straight away
+                wifi_sm_post(WIFI_SM_EVENT_ASSOCIATED);
+                associated_us = esp_timer_get_time();
+                net_trace_record(NETWORK_PHASE_WIFI_ASSOCIATE, connect_start_us);
+                net_ip_apply(NETWORK_IF_WIFI, sta_netif);
+                net_fault_dhcp_hold(sta_netif);
+#ifdef CONFIG_ESP_WIFI_FAST_RECONNECT_ENABLED
+                // Remember where we connected so a reconnect can skip the scan
+                memcpy(last_ap_bssid, event->bssid, 6);
+                last_ap_channel = event->channel;
+                last_ap_valid = true;
+#endif
+#ifdef CONFIG_ESP_BLUFI_ENABLED
+                gl_sta_connected = true;
                 memcpy(gl_sta_bssid, event->bssid, 6);
                 memcpy(gl_sta_ssid, event->ssid, event->ssid_len);
                 gl_sta_ssid_len = event->ssid_len;
-                break;
-            case WIFI_EVENT_SCAN_DONE: {
-                uint16_t apCount = 0;
-                esp_wifi_scan_get_ap_num(&apCount);
-                if (apCount == 0) {
-                    ESP_LOGI(BLUFI_TAG, "Nothing AP found");
-                    break;
-                }
-                wifi_ap_record_t *ap_list = (wifi_ap_record_t *)malloc(sizeof(wifi_ap_record_t) * apCount);
-                if (!ap_list) {
-                    ESP_LOGE(BLUFI_TAG, "malloc error, ap_list is NULL");
-                    break;
-                }
-                ESP_ERROR_CHECK(esp_wifi_scan_get_ap_records(&apCount, ap_list));
-                esp_blufi_ap_record_t * blufi_ap_list = (esp_blufi_ap_record_t *)malloc(apCount * sizeof(esp_blufi_ap_record_t));
-                if (!blufi_ap_list) {
-                    if (ap_list) {
-                        free(ap_list);
-                    }
-                    ESP_LOGE(BLUFI_TAG, "malloc error, blufi_ap_list is NULL");
-                    break;
-                }
-                for (int i = 0; i < apCount; ++i)
-                {
-                    blufi_ap_list[i].rssi = ap_list[i].rssi;
-                    memcpy(blufi_ap_list[i].ssid, ap_list[i].ssid, sizeof(ap_list[i].ssid));
-                }
-
-                if (ble_is_connected == true) {
-                    esp_blufi_send_wifi_list(apCount, blufi_ap_list);
-                } else {
-                    ESP_LOGI(BLUFI_TAG, "BLUFI BLE is not connected yet\n");
-                }
-
-                esp_wifi_scan_stop();
-                free(ap_list);
-                free(blufi_ap_list);
+#endif
                 break;
             }
+            case WIFI_EVENT_SCAN_DONE:
+                // The scan task reads the results
+                wifi_scan_done();
+                break;
+#ifdef CONFIG_ESP_BLUFI_ENABLED    
             case WIFI_EVENT_AP_START: {
                 wifi_mode_t mode;
                 if (ble_is_connected == true) {
@@ -319,9 +911,21 @@ static void wifi_event_handler(void* arg, esp_event_base_t event_base,
                 break;
             }
 #endif    
-            case WIFI_EVENT_STA_DISCONNECTED:
+            case WIFI_EVENT_STA_DISCONNECTED: {
+                wifi_event_sta_disconnected_t *event = (wifi_event_sta_disconnected_t*) event_data;
+                uint8_t reason = event->reason;
+#ifdef CONFIG_ESP_NETWORK_FAULT_INJECTION
+                if (injected_reason != 0)
+                {
+                    reason = injected_reason;
+                    injected_reason = 0;
+                }
+#endif
                 xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
-                xEventGroupSetBits(s_wifi_event_group, WIFI_DISCONNECTED_BIT);
+                net_failover_lost(NETWORK_IF_WIFI, esp_timer_get_time());
+                network_set_connected(NETWORK_IF_WIFI, false);
+                net_ip_set_link_state(NETWORK_IF_WIFI, sta_netif, NETWORK_LINK_DOWN);
+                net_event_publish(NETWORK_EVENT_DISCONNECTED, NETWORK_IF_WIFI, NULL, reason, 0);
                 led_disconnected();
 #ifdef CONFIG_ESP_BLUFI_ENABLED    
                 gl_sta_connected = false;
@@ -329,8 +933,10 @@ static void wifi_event_handler(void* arg, esp_event_base_t event_base,
                 memset(gl_sta_bssid, 0, 6);
                 gl_sta_ssid_len = 0;
 #endif
-                ESP_LOGI(TAG,"Disconnected from the %s", wifi_config->sta.ssid);
+                ESP_LOGI(TAG,"Disconnected from the %s, reason %d", wifi_config->sta.ssid, reason);
+                wifi_sm_post(WIFI_SM_EVENT_DISCONNECTED);
                 break;
+            }
             default:
                 break;
         }
@@ -344,6 +950,11 @@ static void wifi_event_handler(void* arg, esp_event_base_t event_base,
         ESP_LOGI(TAG, "WIFIMASK:" IPSTR, IP2STR(&ip_info->netmask));
         ESP_LOGI(TAG, "WIFIGW:" IPSTR, IP2STR(&ip_info->gw));
         ESP_LOGI(TAG, "~~~~~~~~~~~");
+        if (net_ip_got_ip(NETWORK_IF_WIFI, event->esp_netif, ip_info))
+        {
+            // DHCP confirmed the cached address we are already using
+            return;
+        }
 
 #ifdef CONFIG_ESP_BLUFI_ENABLED
         wifi_mode_t mode;
@@ -362,44 +973,44 @@ static void wifi_event_handler(void* arg, esp_event_base_t event_base,
 
 #endif
         // Check if the IP number if valid before firing events
-        if (esp_ip4_addr1_16(&event->ip_info.ip)==169)
+        bool link_local = (esp_ip4_addr1_16(&event->ip_info.ip)==169);
+        if (link_local)
+        {
+            net_ip_set_link_state(NETWORK_IF_WIFI, event->esp_netif, NETWORK_LINK_LOCAL_ONLY);
+            net_event_publish(NETWORK_EVENT_LINK_LOCAL, NETWORK_IF_WIFI, &event->ip_info, 0, 0);
+        }
+        else
+        {
+            net_ip_set_link_state(NETWORK_IF_WIFI, event->esp_netif, NETWORK_LINK_UP);
+            net_trace_record(NETWORK_PHASE_WIFI_DHCP, associated_us);
+            net_trace_record(NETWORK_PHASE_WIFI_TOTAL, connect_start_us);
+            wifi_sm_post(WIFI_SM_EVENT_GOT_IP);
+        }
+        if (link_local && !net_ip_link_local_allowed())
         {
-            ESP_LOGW(TAG, "Got IP, but local one - not firing events");
+            ESP_LOGW(TAG, "Got IP, but local one - not firing events until DHCP succeeds");
         }
         else
         {
             led_connected();
-            xEventGroupClearBits(s_wifi_event_group, WIFI_DISCONNECTED_BIT);
             xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+            network_set_connected(NETWORK_IF_WIFI, true);
+            wifi_ap_record_t ap_info;
+            int8_t rssi = (esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK) ? ap_info.rssi : 0;
+            net_event_publish(NETWORK_EVENT_CONNECTED, NETWORK_IF_WIFI, &event->ip_info, 0, rssi);
         }
     }
 }
 
-void wifi_init_sta(void)
+/**
+ * Initialises the driver in station mode with the current network. Also used by the recovery ladder to
+ * bring the driver back after a deinit.
+ */
+static void wifi_driver_init(void)
 {
-    ESP_LOGI(TAG, "wifi_init_sta started");
-    s_wifi_event_group = xEventGroupCreate();
-
-    ESP_ERROR_CHECK(esp_netif_init());
-    esp_netif_t *sta_netif = esp_netif_create_default_wifi_sta();
-    assert(sta_netif);
-
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
 
-    esp_event_handler_instance_t instance_any_id;
-    esp_event_handler_instance_t instance_got_ip;
-    ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT,
-                                                        ESP_EVENT_ANY_ID,
-                                                        &wifi_event_handler,
-                                                        NULL,
-                                                        &instance_any_id));
-    ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT,
-                                                        IP_EVENT_STA_GOT_IP,
-                                                        &wifi_event_handler,
-                                                        NULL,
-                                                        &instance_got_ip));
-
     wifi_country_t wifi_country = {
         .cc = "CA",
         .schan = 1,
@@ -408,27 +1019,183 @@ void wifi_init_sta(void)
     };
     
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA) );
-#ifndef CONFIG_ESP_BLUFI_ENABLED
-    ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, wifi_config) );
-#endif
+    if (current_network >= 0)
+    {
+        ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, wifi_config) );
+    }
     ESP_ERROR_CHECK(esp_wifi_set_country(&wifi_country));
-    ESP_ERROR_CHECK(esp_wifi_start());
+}
 
-#ifndef CONFIG_ESP_BLUFI_ENABLED
-// WIFI Power management WIFI_PS_NONE not available when BLUFI is in use
-#ifdef CONFIG_PM_ENABLE
-    ESP_LOGI(TAG, "WIFI Power management configured");
-    esp_wifi_set_ps(DEFAULT_PS_MODE);
-#else
-    ESP_LOGI(TAG, "WIFI Power management disabled");
-    esp_wifi_set_ps(WIFI_PS_NONE);
+/**
+ * Creates everything the WIFI station needs: the netif, the driver, the event handlers and the state machine
+ * task. Done once, wifi_start and wifi_stop reuse them.
+ */
+static void wifi_init_sta(void)
+{
+    ESP_LOGI(TAG, "wifi_init_sta started");
+    if (s_wifi_event_group == NULL)
+    {
+        // Kept by wifi_deinit, a task may be waiting on it
+        s_wifi_event_group = xEventGroupCreate();
+    }
+    if (sm_queue_lock == NULL)
+    {
+        sm_queue_lock = xSemaphoreCreateMutexStatic(&sm_queue_lock_buffer);
+    }
+    sm_queue = xQueueCreate(WIFI_SM_QUEUE_LEN, sizeof(wifi_sm_event_t));
+    const esp_timer_create_args_t backoff_args = {
+        .callback = wifi_sm_backoff_done,
+        .name = "wifi_backoff"
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&backoff_args, &backoff_timer));
+    sm_state = WIFI_STATE_IDLE;
+    sm_state_since_us = esp_timer_get_time();
+    if (retry_policy.rng == 0)
+    {
+        wifi_set_retry_policy(NULL);
+    }
+
+    ESP_ERROR_CHECK(esp_netif_init());
+    sta_netif = esp_netif_create_default_wifi_sta();
+    assert(sta_netif);
+
+    ESP_ERROR_CHECK(net_dispatch_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler, NULL));
+    ESP_ERROR_CHECK(net_dispatch_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &wifi_event_handler, NULL));
+    wifi_driver_init();
+
+#ifdef CONFIG_ESP_BLUFI_ENABLED
+    // BluFi saves the last network in the driver. Make sure it is in the store.
+    wifi_config_t saved_config;
+    if (esp_wifi_get_config(ESP_IF_WIFI_STA, &saved_config) == ESP_OK && saved_config.sta.ssid[0] != 0)
+    {
+        sta_config = saved_config;
+        current_network = wifi_store_add_config(&saved_config);
+    }
 #endif
+    if (current_network < 0 && wifi_store_count() > 0)
+    {
+        wifi_use_network(0);
+    }
+#if defined(CONFIG_ESP_WIFI_ROAM_ENABLED) && defined(CONFIG_WPA_11KV_SUPPORT)
+    // Lets the AP ask for beacon reports and send BSS transition requests
+    sta_config.sta.rm_enabled = 1;
+    sta_config.sta.btm_enabled = 1;
 #endif
+    if (current_network >= 0)
+    {
+        ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, wifi_config) );
+    }
 
+    // Start a thread to run the connection state machine
+    xTaskCreate(wifi_connected, THREAD_WIFI_NAME, THREAD_WIFI_STACKSIZE, NULL, THREAD_WIFI_PRIORITY, &sm_task);
+    wifi_roam_init();
     ESP_LOGI(TAG, "wifi_init_sta finished.");
+}
+
+esp_err_t wifi_start(void)
+{
+    if (sm_queue == NULL)
+    {
+        ESP_LOGI(TAG, "ESP_WIFI_MODE_STA");
+        wifi_init_sta();
+    }
+    // Turns reconnects back on after wifi_disable or wifi_stop. Ignored on the first start. The bit is
+    // cleared here so a wifi_disable that follows waits for its own DISABLE.
+    xEventGroupClearBits(s_wifi_event_group, WIFI_DISABLED_BIT);
+    wifi_sm_post(WIFI_SM_EVENT_ENABLE);
+    if (driver_started)
+    {
+        // The driver is running, so there will be no WIFI_EVENT_STA_START to start connecting
+        wifi_sm_post(WIFI_SM_EVENT_START);
+        return ESP_OK;
+    }
+    lifecycle_stats.starts++;
+    cycle_free_heap = esp_get_free_heap_size();
+    esp_err_t err = esp_wifi_start();
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Unable to start WIFI: %s", esp_err_to_name(err));
+        return err;
+    }
+    driver_started = true;
+    wifi_power_apply();
+    return ESP_OK;
+}
+
+esp_err_t wifi_stop(void)
+{
+    if (!driver_started)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    // Nothing the state machine had pending may reconnect once the driver is stopped
+    wifi_disable();
+    esp_wifi_disconnect();
+    esp_err_t err = esp_wifi_stop();
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Unable to stop WIFI: %s", esp_err_to_name(err));
+        return err;
+    }
+    driver_started = false;
+    wifi_store_flush();
+
+    // Anything the cycle did not give back shows up as a change in the free heap
+    uint32_t free_heap = esp_get_free_heap_size();
+    lifecycle_stats.stops++;
+    lifecycle_stats.heap_delta_last = (int32_t)(free_heap - cycle_free_heap);
+    if (lifecycle_stats.stops == 1)
+    {
+        first_stop_free_heap = free_heap;
+    }
+    lifecycle_stats.heap_drift = (int32_t)(free_heap - first_stop_free_heap);
+    lifecycle_stats.min_free_heap = esp_get_minimum_free_heap_size();
+    lifecycle_stats.stack_high_water = uxTaskGetStackHighWaterMark(sm_task);
+    ESP_LOGI(TAG, "WIFI stopped, cycle %u, heap change %d bytes", lifecycle_stats.stops, lifecycle_stats.heap_delta_last);
+    return ESP_OK;
+}
+
+esp_err_t wifi_deinit(void)
+{
+    if (sm_queue == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (driver_started)
+    {
+        wifi_stop();
+    }
+    net_dispatch_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler);
+    net_dispatch_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP, &wifi_event_handler);
+    // The task is disabled and blocked on its queue, so it holds nothing
+    vTaskDelete(sm_task);
+    sm_task = NULL;
+    // A handler the dispatcher is still running, the scan task or a timer may be posting
+    esp_timer_stop(backoff_timer);
+    xSemaphoreTake(sm_queue_lock, portMAX_DELAY);
+    vQueueDelete(sm_queue);
+    sm_queue = NULL;
+    xSemaphoreGive(sm_queue_lock);
+    esp_timer_delete(backoff_timer);
+    backoff_timer = NULL;
+    esp_err_t err = esp_wifi_deinit();
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Unable to deinit WIFI: %s", esp_err_to_name(err));
+    }
+    esp_wifi_clear_default_wifi_driver_and_handlers(sta_netif);
+    esp_netif_destroy(sta_netif);
+    sta_netif = NULL;
+    ESP_LOGI(TAG, "WIFI deinitialised");
+    return err;
+}
 
-    // Start a thread to monitor the WIFI connection
-    xTaskCreate(wifi_connected, THREAD_WIFI_NAME, THREAD_WIFI_STACKSIZE, NULL, THREAD_WIFI_PRIORITY, NULL);
+void wifi_get_lifecycle_stats(wifi_lifecycle_stats_t *stats)
+{
+    if (stats != NULL)
+    {
+        *stats = lifecycle_stats;
+    }
 }
 
 #ifdef CONFIG_ESP_BLUFI_ENABLED
@@ -457,10 +1224,35 @@ void wifi_setup(void)
       ret = nvs_flash_init();
     }
     ESP_ERROR_CHECK(ret);
+    wifi_store_init();
+    wifi_scan_init();
+    // Also drops networks an earlier config added that are no longer configured
+    static const char *const config_ssids[] = {
+#ifdef CONFIG_ESP_MANUAL_WIFI_ENABLED
+        CONFIG_ESP_WIFI_SSID,
+#ifdef CONFIG_ESP_WIFI_SSID2_ENABLED
+        CONFIG_ESP_WIFI_SSID2,
+#endif
+#endif
+        NULL
+    };
+    static const char *const config_passwords[] = {
+#ifdef CONFIG_ESP_MANUAL_WIFI_ENABLED
+        CONFIG_ESP_WIFI_PASSWORD,
+#ifdef CONFIG_ESP_WIFI_SSID2_ENABLED
+        CONFIG_ESP_WIFI_PASSWORD2,
+#endif
+#endif
+        NULL
+    };
+    wifi_store_set_config(config_ssids, config_passwords, sizeof(config_ssids) / sizeof(config_ssids[0]) - 1);
     ESP_LOGI(TAG, "wifi_setup finished.");
 
 #ifdef CONFIG_ESP_BLUFI_ENABLED    
     ESP_LOGI(TAG, "blufli setup begin.");
+    blufi_cmd_init();
+    blufi_xfer_init();
+    blufi_teardown_init();
     ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT));
 
     esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
@@ -488,24 +1280,10 @@ void wifi_setup(void)
 
 void wifi_connect(void)
 {
-    wifi_enabled = true;
-    ESP_LOGI(TAG, "ESP_WIFI_MODE_STA");
-    wifi_init_sta();
+    wifi_start();
 }
 
 #ifdef CONFIG_ESP_BLUFI_ENABLED
-static bluficmd_t **blufi_commands = NULL;
-static int command_count = 0;
-
-void register_command_set(bluficmd_t *commands[], int count)
-{
-    blufi_commands = commands;
-    command_count = count;
-    for (int i=0; i<count; i++) {
-        ESP_LOGI(TAG, "Registered CMD: %s", blufi_commands[i]->command);
-    }
-}
-
 #ifdef CONFIG_BT_DEVICE_NAME
 // Unfortunately, the Espressif BluFi code hard codes the Bluetooth name for the device into the
 // BluFi library, once advertising starts, one can't change the name. So, we copy the init code here
@@ -551,7 +1329,7 @@ static void bt_advertise()
 #endif        
 }
 
-static void blufi_event_callback(esp_blufi_cb_event_t event, esp_blufi_cb_param_t *param)
+static void blufi_event_handle(esp_blufi_cb_event_t event, esp_blufi_cb_param_t *param)
 {
     /* actually, should post to blufi_task handle the procedure,
      * now, as a example, we do it more simply */
@@ -566,12 +1344,14 @@ static void blufi_event_callback(esp_blufi_cb_event_t event, esp_blufi_cb_param_
     case ESP_BLUFI_EVENT_BLE_CONNECT:
         ESP_LOGI(BLUFI_TAG, "BLUFI ble connect");
         ble_is_connected = true;
+        blufi_xfer_connected(param->connect.remote_bda);
         esp_blufi_adv_stop();
         blufi_security_init();
         break;
     case ESP_BLUFI_EVENT_BLE_DISCONNECT:
         ESP_LOGI(BLUFI_TAG, "BLUFI ble disconnect");
         ble_is_connected = false;
+        blufi_xfer_disconnected();
         blufi_security_deinit();
         bt_advertise();
         break;
@@ -581,6 +1361,7 @@ static void blufi_event_callback(esp_blufi_cb_event_t event, esp_blufi_cb_param_
         break;
     case ESP_BLUFI_EVENT_REQ_CONNECT_TO_AP:
         ESP_LOGI(BLUFI_TAG, "BLUFI request wifi connect to AP");
+        blufi_teardown_provisioned();
         /* there is no wifi callback when the device has already connected to this wifi
         so disconnect wifi before connection.
         */
@@ -628,6 +1409,10 @@ static void blufi_event_callback(esp_blufi_cb_event_t event, esp_blufi_cb_param_
         ESP_LOGI(BLUFI_TAG, "Recv STA BSSID %s", sta_config.sta.ssid);
         break;
 	case ESP_BLUFI_EVENT_RECV_STA_SSID:
+#ifdef CONFIG_ESP_WIFI_FAST_RECONNECT_ENABLED
+        // New network, so the last AP is no longer useful
+        last_ap_valid = false;
+#endif
         strncpy((char *)sta_config.sta.ssid, (char *)param->sta_ssid.ssid, param->sta_ssid.ssid_len);
         sta_config.sta.ssid[param->sta_ssid.ssid_len] = '\0';
         esp_wifi_set_config(WIFI_IF_STA, &sta_config);
@@ -637,6 +1422,8 @@ static void blufi_event_callback(esp_blufi_cb_event_t event, esp_blufi_cb_param_
         strncpy((char *)sta_config.sta.password, (char *)param->sta_passwd.passwd, param->sta_passwd.passwd_len);
         sta_config.sta.password[param->sta_passwd.passwd_len] = '\0';
         esp_wifi_set_config(WIFI_IF_STA, &sta_config);
+        // The password comes after the SSID, so the network is complete
+        current_network = wifi_store_add_config(&sta_config);
         ESP_LOGI(BLUFI_TAG, "Recv STA PASSWORD %s", sta_config.sta.password);
         break;
 	case ESP_BLUFI_EVENT_RECV_SOFTAP_SSID:
@@ -647,42 +1434,52 @@ static void blufi_event_callback(esp_blufi_cb_event_t event, esp_blufi_cb_param_
         ESP_LOGE(BLUFI_TAG, "Recv SOFTAP command but Ap Mode is not supported");
         break;
     case ESP_BLUFI_EVENT_GET_WIFI_LIST:{
-        wifi_scan_config_t scanConf = {
-            .ssid = NULL,
-            .bssid = NULL,
-            .channel = 0,
-            .show_hidden = false
-        };
-        esp_wifi_scan_start(&scanConf, true);
+        // The scan task replies, so the Bluetooth stack is not blocked for the scan
+        if (wifi_scan_request(wifi_blufi_scan_done, NULL) != ESP_OK) {
+            esp_blufi_send_error_info(ESP_BLUFI_WIFI_SCAN_FAIL);
+        }
         break;
     }
     case ESP_BLUFI_EVENT_RECV_CUSTOM_DATA:{
-        esp_log_buffer_hex("Custom Data", param->custom_data.data, param->custom_data.data_len);
-        char *buffer = (char*)param->custom_data.data;
-        buffer[param->custom_data.data_len] = '\0';
-        if (custom_command_callback==NULL)
-        {
-            ESP_LOGI(TAG, "Ignoring custom cmd: %s", buffer);
-        }
-        else
-        {
-            ESP_LOGI(TAG, "Processing Custom cmd: %s", buffer);
-            custom_command_callback(buffer);
+        // Copied to the command or transfer queue, the worker task runs it and replies
+        ESP_LOGD(BLUFI_TAG, "Recv custom data, %u bytes", param->custom_data.data_len);
+        if (blufi_xfer_is_frame(param->custom_data.data, param->custom_data.data_len)) {
+            blufi_xfer_post(param->custom_data.data, param->custom_data.data_len);
+        } else {
+            blufi_cmd_post(param->custom_data.data, param->custom_data.data_len);
         }
         break;
     }
-	case ESP_BLUFI_EVENT_RECV_USERNAME:
 	case ESP_BLUFI_EVENT_RECV_CA_CERT:
+        blufi_xfer_save_cert(BLUFI_CERT_CA, param->ca.cert, param->ca.cert_len);
+        break;
 	case ESP_BLUFI_EVENT_RECV_CLIENT_CERT:
+        blufi_xfer_save_cert(BLUFI_CERT_CLIENT, param->client_cert.cert, param->client_cert.cert_len);
+        break;
 	case ESP_BLUFI_EVENT_RECV_SERVER_CERT:
+        blufi_xfer_save_cert(BLUFI_CERT_SERVER, param->server_cert.cert, param->server_cert.cert_len);
+        break;
 	case ESP_BLUFI_EVENT_RECV_CLIENT_PRIV_KEY:
+        blufi_xfer_save_cert(BLUFI_KEY_CLIENT, param->client_pkey.pkey, param->client_pkey.pkey_len);
+        break;
 	case ESP_BLUFI_EVENT_RECV_SERVER_PRIV_KEY:
+        blufi_xfer_save_cert(BLUFI_KEY_SERVER, param->server_pkey.pkey, param->server_pkey.pkey_len);
+        break;
+	case ESP_BLUFI_EVENT_RECV_USERNAME:
         // Ignore these events
         break;
     default:
         break;
     }
 }
+
+/* Runs on the Bluetooth stack task. Timed so a slow handler shows up in the phase stats. */
+static void blufi_event_callback(esp_blufi_cb_event_t event, esp_blufi_cb_param_t *param)
+{
+    int64_t start_us = esp_timer_get_time();
+    blufi_event_handle(event, param);
+    net_trace_record(NETWORK_PHASE_BLUFI_CALLBACK, start_us);
+}
 #endif
 
 #endif
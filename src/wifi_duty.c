@@ -0,0 +1,182 @@
+/*
+    Duty cycled WIFI
+
+    For battery powered devices that only need the network now and then. The radio is kept off,
+    and a task turns it on for a window on a schedule or on demand: WIFI is started, the
+    application callback runs once connected, and WIFI is stopped again. The time the radio is
+    on is measured for each window, so battery life can be worked out from real numbers.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+#if CONFIG_ESP_WIFI_ENABLED
+
+#include "wifi.h"
+#include "network_priv.h"
+
+#ifdef CONFIG_ESP_WIFI_DUTY_CYCLE_ENABLED
+
+static const char *TAG = "WIFIDUTY";
+
+#define THREAD_DUTY_NAME "wifi_duty"
+#define THREAD_DUTY_PRIORITY 3
+
+static TaskHandle_t duty_task = NULL;
+static wifi_duty_config_t duty_config;
+static volatile bool duty_running = false;
+static wifi_duty_stats_t duty_stats;
+
+static void wifi_duty_window()
+{
+    int64_t start_us = esp_timer_get_time();
+    duty_stats.windows++;
+    if (wifi_start() != ESP_OK)
+    {
+        duty_stats.failures++;
+        return;
+    }
+    bool connected = wifi_waitforconnect_timeout(pdMS_TO_TICKS(duty_config.budget_ms));
+    uint32_t elapsed_ms = (uint32_t)((esp_timer_get_time() - start_us) / 1000);
+    if (connected)
+    {
+        duty_stats.last_connect_ms = elapsed_ms;
+        if (duty_config.callback != NULL)
+        {
+            uint32_t remaining_ms = (elapsed_ms < duty_config.budget_ms) ? duty_config.budget_ms - elapsed_ms : 0;
+            duty_config.callback(remaining_ms, duty_config.ctx);
+        }
+    }
+    else
+    {
+        ESP_LOGW(TAG, "Not connected within %u ms", duty_config.budget_ms);
+        duty_stats.failures++;
+    }
+    wifi_stop();
+
+    uint32_t on_ms = (uint32_t)((esp_timer_get_time() - start_us) / 1000);
+    duty_stats.last_on_ms = on_ms;
+    duty_stats.total_on_ms += on_ms;
+    if (on_ms > duty_stats.max_on_ms)
+    {
+        duty_stats.max_on_ms = on_ms;
+    }
+    if (on_ms > duty_config.budget_ms)
+    {
+        duty_stats.overruns++;
+    }
+    ESP_LOGI(TAG, "Window %u: radio on for %u ms", duty_stats.windows, on_ms);
+}
+
+static void wifi_duty_run(void *arg)
+{
+    while (duty_running)
+    {
+        // A trigger opens a window early, the schedule carries on from there
+        TickType_t wait = (duty_config.period_s == 0) ? portMAX_DELAY : pdMS_TO_TICKS(duty_config.period_s * 1000);
+        ulTaskNotifyTake(pdTRUE, wait);
+        if (!duty_running)
+        {
+            break;
+        }
+        wifi_duty_window();
+    }
+    duty_task = NULL;
+    vTaskDelete(NULL);
+}
+
+esp_err_t wifi_duty_start(const wifi_duty_config_t *config)
+{
+    if (duty_task != NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (config != NULL)
+    {
+        duty_config = *config;
+    }
+    else
+    {
+        memset(&duty_config, 0, sizeof(duty_config));
+        duty_config.period_s = CONFIG_ESP_WIFI_DUTY_PERIOD;
+    }
+    if (duty_config.budget_ms == 0)
+    {
+        duty_config.budget_ms = CONFIG_ESP_WIFI_DUTY_BUDGET_MS;
+    }
+    // The radio stays off until the first window
+    wifi_stop();
+    duty_running = true;
+    if (xTaskCreate(wifi_duty_run, THREAD_DUTY_NAME, CONFIG_ESP_WIFI_DUTY_STACKSIZE, NULL, THREAD_DUTY_PRIORITY,
+            &duty_task) != pdPASS)
+    {
+        duty_running = false;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t wifi_duty_trigger(void)
+{
+    if (duty_task == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xTaskNotifyGive(duty_task);
+    return ESP_OK;
+}
+
+esp_err_t wifi_duty_stop(void)
+{
+    if (duty_task == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    // A window in progress finishes, the task exits after it
+    duty_running = false;
+    xTaskNotifyGive(duty_task);
+    return ESP_OK;
+}
+
+void wifi_duty_get_stats(wifi_duty_stats_t *stats)
+{
+    if (stats != NULL)
+    {
+        *stats = duty_stats;
+    }
+}
+
+#else
+
+esp_err_t wifi_duty_start(const wifi_duty_config_t *config)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t wifi_duty_trigger(void)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t wifi_duty_stop(void)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void wifi_duty_get_stats(wifi_duty_stats_t *stats)
+{
+    if (stats != NULL)
+    {
+        memset(stats, 0, sizeof(wifi_duty_stats_t));
+    }
+}
+
+#endif
+
+#endif
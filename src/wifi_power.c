@@ -0,0 +1,296 @@
+/*
+    WIFI power profiles
+
+    Named power save profiles that can be switched at run time, e.g. low latency for an OTA
+    update and back to low power afterwards. The optional benchmark measures ping round trip
+    time and TCP throughput to a local test server under each profile.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "sdkconfig.h"
+
+#if CONFIG_ESP_WIFI_ENABLED
+
+#ifdef CONFIG_ESP_BLUFI_ENABLED
+#include "esp_bt.h"
+#endif
+#ifdef CONFIG_ESP_WIFI_POWER_BENCHMARK
+#include "lwip/sockets.h"
+#include "ping/ping_sock.h"
+#endif
+
+#include "wifi.h"
+#include "network_priv.h"
+
+static const char *TAG = "WIFIPOWER";
+
+#if CONFIG_ESP_WIFI_POWER_LOW_POWER
+#define DEFAULT_POWER_PROFILE WIFI_POWER_LOW_POWER
+#elif CONFIG_ESP_WIFI_POWER_BALANCED
+#define DEFAULT_POWER_PROFILE WIFI_POWER_BALANCED
+#else
+#define DEFAULT_POWER_PROFILE WIFI_POWER_LOW_LATENCY
+#endif
+
+static const wifi_ps_type_t profile_ps_modes[WIFI_POWER_PROFILE_MAX] = {
+    WIFI_PS_NONE, WIFI_PS_MIN_MODEM, WIFI_PS_MAX_MODEM
+};
+static const char *profile_names[WIFI_POWER_PROFILE_MAX] = {
+    "low latency", "balanced", "low power"
+};
+
+static wifi_power_profile_t power_profile = DEFAULT_POWER_PROFILE;
+
+/*
+   Applies a profile to the driver. The listen interval is only used with maximum modem power save, and the AP
+   only learns it when the station associates, so a change while connected reassociates. reassociating is set
+   when it does.
+ */
+static esp_err_t wifi_power_set(wifi_power_profile_t profile, bool *reassociating)
+{
+    *reassociating = false;
+#ifdef CONFIG_ESP_BLUFI_ENABLED
+    // The radio is shared with Bluetooth, which needs WIFI to sleep
+    if (profile == WIFI_POWER_LOW_LATENCY && esp_bt_controller_get_status() == ESP_BT_CONTROLLER_STATUS_ENABLED)
+    {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+#endif
+    esp_err_t err = esp_wifi_set_ps(profile_ps_modes[profile]);
+    if (err == ESP_OK &&
+        wifi_set_listen_interval((profile == WIFI_POWER_LOW_POWER) ? CONFIG_ESP_WIFI_LISTEN_INTERVAL : 0) &&
+        (network_connected_interfaces() & NETWORK_IF_WIFI) != 0)
+    {
+        ESP_LOGI(TAG, "Reassociating for the listen interval of the %s profile", profile_names[profile]);
+        wifi_force_reconnect();
+        *reassociating = true;
+    }
+    return err;
+}
+
+esp_err_t wifi_set_power_profile(wifi_power_profile_t profile)
+{
+    if (profile >= WIFI_POWER_PROFILE_MAX)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (wifi_get_netif() == NULL)
+    {
+        // Not initialised yet, applied when WIFI starts
+        power_profile = profile;
+        return ESP_OK;
+    }
+    bool reassociating;
+    esp_err_t err = wifi_power_set(profile, &reassociating);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Unable to use the %s profile: %s", profile_names[profile], esp_err_to_name(err));
+        return err;
+    }
+    ESP_LOGI(TAG, "Power profile %s", profile_names[profile]);
+    power_profile = profile;
+    return ESP_OK;
+}
+
+wifi_power_profile_t wifi_get_power_profile(void)
+{
+    return power_profile;
+}
+
+void wifi_power_apply(void)
+{
+    bool reassociating;
+    if (wifi_power_set(power_profile, &reassociating) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "The %s profile is not available with Bluetooth enabled, using balanced", profile_names[power_profile]);
+        power_profile = WIFI_POWER_BALANCED;
+        wifi_power_set(power_profile, &reassociating);
+    }
+}
+
+#ifdef CONFIG_ESP_WIFI_POWER_BENCHMARK
+
+#define BENCH_PING_INTERVAL_MS 200
+#define BENCH_PING_TIMEOUT_MS 1000
+#define BENCH_TCP_CHUNK 1460
+/* Until the station notices the disconnect it asked for, and until it is back on with the new listen interval */
+#define BENCH_DISCONNECT_MS 2000
+#define BENCH_REASSOCIATE_MS 15000
+
+static uint8_t bench_buffer[BENCH_TCP_CHUNK];
+
+typedef struct {
+    wifi_power_bench_t *result;
+    TaskHandle_t waiter;
+} bench_ping_ctx_t;
+
+static void bench_ping_success(esp_ping_handle_t hdl, void *args)
+{
+    bench_ping_ctx_t *ctx = (bench_ping_ctx_t *)args;
+    uint32_t rtt_ms;
+    esp_ping_get_profile(hdl, ESP_PING_PROF_TIMEGAP, &rtt_ms, sizeof(rtt_ms));
+    if (rtt_ms > ctx->result->rtt_max_ms)
+    {
+        ctx->result->rtt_max_ms = rtt_ms;
+    }
+}
+
+static void bench_ping_end(esp_ping_handle_t hdl, void *args)
+{
+    bench_ping_ctx_t *ctx = (bench_ping_ctx_t *)args;
+    uint32_t total_ms;
+    esp_ping_get_profile(hdl, ESP_PING_PROF_REQUEST, &ctx->result->ping_sent, sizeof(ctx->result->ping_sent));
+    esp_ping_get_profile(hdl, ESP_PING_PROF_REPLY, &ctx->result->ping_received, sizeof(ctx->result->ping_received));
+    // The duration is the sum of the round trip times of the replies
+    esp_ping_get_profile(hdl, ESP_PING_PROF_DURATION, &total_ms, sizeof(total_ms));
+    if (ctx->result->ping_received > 0)
+    {
+        ctx->result->rtt_avg_ms = total_ms / ctx->result->ping_received;
+    }
+    xTaskNotifyGive(ctx->waiter);
+}
+
+static esp_err_t bench_ping(const char *host, wifi_power_bench_t *result)
+{
+    esp_ping_config_t config = ESP_PING_DEFAULT_CONFIG();
+    bench_ping_ctx_t ctx = {
+        .result = result,
+        .waiter = xTaskGetCurrentTaskHandle()
+    };
+    esp_ping_callbacks_t callbacks = {
+        .cb_args = &ctx,
+        .on_ping_success = bench_ping_success,
+        .on_ping_timeout = NULL,
+        .on_ping_end = bench_ping_end
+    };
+    esp_ping_handle_t ping;
+    if (ipaddr_aton(host, &config.target_addr) == 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    config.count = CONFIG_ESP_WIFI_POWER_BENCHMARK_PINGS;
+    config.interval_ms = BENCH_PING_INTERVAL_MS;
+    config.timeout_ms = BENCH_PING_TIMEOUT_MS;
+    esp_err_t err = esp_ping_new_session(&config, &callbacks, &ping);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    ulTaskNotifyTake(pdTRUE, 0);
+    esp_ping_start(ping);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    esp_ping_delete_session(ping);
+    return ESP_OK;
+}
+
+/* Waits for the reassociation wifi_power_set started, so the profile is measured with its own listen interval */
+static esp_err_t bench_reassociate(void)
+{
+    int64_t end_us = esp_timer_get_time() + BENCH_DISCONNECT_MS * 1000LL;
+    while ((network_connected_interfaces() & NETWORK_IF_WIFI) != 0 && esp_timer_get_time() < end_us)
+    {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    return network_wait(NETWORK_IF_WIFI, pdMS_TO_TICKS(BENCH_REASSOCIATE_MS));
+}
+
+/* Sends as much as it can to the server for the configured time */
+static esp_err_t bench_tcp(const char *host, uint16_t port, wifi_power_bench_t *result)
+{
+    struct sockaddr_in to = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = inet_addr(host)
+    };
+    struct timeval timeout = {
+        .tv_sec = 2,
+        .tv_usec = 0
+    };
+    uint64_t sent = 0;
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock < 0)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (connect(sock, (struct sockaddr *)&to, sizeof(to)) != 0)
+    {
+        ESP_LOGE(TAG, "Unable to connect to %s:%u: %d", host, port, errno);
+        close(sock);
+        return ESP_FAIL;
+    }
+    int64_t start_us = esp_timer_get_time();
+    int64_t end_us = start_us + CONFIG_ESP_WIFI_POWER_BENCHMARK_TCP_SECONDS * 1000000LL;
+    while (esp_timer_get_time() < end_us)
+    {
+        int len = send(sock, bench_buffer, sizeof(bench_buffer), 0);
+        if (len < 0)
+        {
+            break;
+        }
+        sent += len;
+    }
+    int64_t elapsed_us = esp_timer_get_time() - start_us;
+    close(sock);
+    result->tcp_kbps = (elapsed_us > 0) ? (uint32_t)(sent * 8000 / elapsed_us) : 0;
+    return ESP_OK;
+}
+
+esp_err_t wifi_power_benchmark(const char *host, uint16_t port, wifi_power_bench_t results[WIFI_POWER_PROFILE_MAX])
+{
+    if (host == NULL || results == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (network_get_link_state(NETWORK_IF_WIFI) != NETWORK_LINK_UP)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    wifi_power_profile_t saved = power_profile;
+    memset(results, 0, WIFI_POWER_PROFILE_MAX * sizeof(wifi_power_bench_t));
+    for (int profile = 0; profile < WIFI_POWER_PROFILE_MAX; profile++)
+    {
+        wifi_power_bench_t *result = &results[profile];
+        result->profile = profile;
+        bool reassociating;
+        result->err = wifi_power_set(profile, &reassociating);
+        if (result->err == ESP_OK && reassociating)
+        {
+            result->err = bench_reassociate();
+        }
+        if (result->err != ESP_OK)
+        {
+            continue;
+        }
+        // Let the power save mode settle before measuring
+        vTaskDelay(pdMS_TO_TICKS(1000));
+        result->err = bench_ping(host, result);
+        if (result->err == ESP_OK)
+        {
+            result->err = bench_tcp(host, port, result);
+        }
+        ESP_LOGI(TAG, "%s: ping %u/%u avg %u ms max %u ms, TCP %u kbit/s", profile_names[profile],
+            result->ping_received, result->ping_sent, result->rtt_avg_ms, result->rtt_max_ms, result->tcp_kbps);
+    }
+    bool reassociating;
+    wifi_power_set(saved, &reassociating);
+    return ESP_OK;
+}
+
+#else
+
+esp_err_t wifi_power_benchmark(const char *host, uint16_t port, wifi_power_bench_t results[WIFI_POWER_PROFILE_MAX])
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,233 @@
+/*
+    WIFI roaming monitor
+
+    Checks the RSSI of the connected AP at a fixed interval. While it is below the roaming
+    threshold, the channels are scanned a few at a time in the background, looking for a
+    stronger AP with the same SSID. If one is found and it is stronger by the hysteresis
+    margin, the connection is moved to it. When the AP supports 802.11v, it is asked for a
+    BSS transition instead and the supplicant makes the move.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include <string.h>
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "sdkconfig.h"
+
+#if CONFIG_ESP_WIFI_ENABLED
+
+#include "wifi.h"
+#include "wifi_scan.h"
+#include "network_priv.h"
+
+#ifdef CONFIG_ESP_WIFI_ROAM_ENABLED
+
+#ifdef CONFIG_WPA_11KV_SUPPORT
+#include "esp_wnm.h"
+#endif
+
+static const char *TAG = "WIFIROAM";
+
+#define ROAM_MAX_CHANNEL 13
+
+typedef struct {
+    bool valid;
+    uint8_t bssid[6];
+    uint8_t channel;
+    int8_t rssi;
+} roam_candidate_t;
+
+static esp_timer_handle_t roam_timer = NULL;
+static wifi_roam_stats_t roam_stats;
+
+/* The AP we are connected to, from the last check */
+static uint8_t current_ssid[33];
+static uint8_t current_bssid[6];
+static int8_t current_rssi = 0;
+
+/* Background sweep of the channels */
+static volatile bool roam_scanning = false;
+static uint8_t sweep_channel = 0;
+static int sweep_remaining = 0;
+static int sweep_tick_channels = 0;
+static int64_t last_sweep_us = 0;
+static roam_candidate_t candidate;
+
+static int64_t below_since_us = 0;
+
+static void wifi_roam_end_below()
+{
+    if (below_since_us != 0)
+    {
+        roam_stats.below_threshold_ms += (esp_timer_get_time() - below_since_us) / 1000;
+        below_since_us = 0;
+    }
+}
+
+static void wifi_roam_check_result(const wifi_scan_result_t *result, int index, void *ctx)
+{
+    // The channel results list every AP, so the other APs of the current network are there
+    if (strncmp((const char *)result->ssid, (const char *)current_ssid, sizeof(current_ssid)) != 0 ||
+        memcmp(result->bssid, current_bssid, sizeof(current_bssid)) == 0)
+    {
+        return;
+    }
+    if (!candidate.valid || result->rssi > candidate.rssi)
+    {
+        candidate.valid = true;
+        memcpy(candidate.bssid, result->bssid, sizeof(candidate.bssid));
+        candidate.channel = result->channel;
+        candidate.rssi = result->rssi;
+    }
+}
+
+static void wifi_roam_scan_next();
+
+/* Called from the scan task when one channel has been scanned */
+static void wifi_roam_scan_done(esp_err_t err, void *ctx)
+{
+    if (sweep_remaining <= 0)
+    {
+        // The sweep was cancelled while the channel was scanned
+        roam_scanning = false;
+        return;
+    }
+    if (err == ESP_OK)
+    {
+        wifi_scan_foreach_channel(wifi_roam_check_result, NULL);
+    }
+    sweep_channel++;
+    sweep_remaining--;
+    if (sweep_remaining > 0 && sweep_tick_channels < CONFIG_ESP_WIFI_ROAM_SCAN_CHANNELS)
+    {
+        wifi_roam_scan_next();
+        return;
+    }
+    roam_scanning = false;
+    if (sweep_remaining > 0)
+    {
+        // Carry on at the next check, so the radio is only away from the AP briefly
+        return;
+    }
+    if (candidate.valid && candidate.rssi >= current_rssi + CONFIG_ESP_WIFI_ROAM_HYSTERESIS)
+    {
+        ESP_LOGI(TAG, "Roaming from %d dBm to " MACSTR " on channel %d at %d dBm", current_rssi,
+            MAC2STR(candidate.bssid), candidate.channel, candidate.rssi);
+        roam_stats.roams++;
+        wifi_roam_to(candidate.bssid, candidate.channel);
+    }
+    else
+    {
+        ESP_LOGD(TAG, "No better AP found");
+    }
+}
+
+static void wifi_roam_scan_next()
+{
+    roam_scanning = true;
+    sweep_tick_channels++;
+    if (wifi_scan_request_channel(sweep_channel, wifi_roam_scan_done, NULL) != ESP_OK)
+    {
+        // Try again at the next check
+        roam_scanning = false;
+    }
+}
+
+static void wifi_roam_check(void *arg)
+{
+    wifi_ap_record_t ap;
+    if (network_get_link_state(NETWORK_IF_WIFI) != NETWORK_LINK_UP || esp_wifi_sta_get_ap_info(&ap) != ESP_OK)
+    {
+        wifi_roam_end_below();
+        sweep_remaining = 0;
+        return;
+    }
+    memcpy(current_ssid, ap.ssid, sizeof(current_ssid));
+    memcpy(current_bssid, ap.bssid, sizeof(current_bssid));
+    current_rssi = ap.rssi;
+    if (ap.rssi >= CONFIG_ESP_WIFI_ROAM_RSSI_THRESHOLD)
+    {
+        wifi_roam_end_below();
+        sweep_remaining = 0;
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+    if (below_since_us == 0)
+    {
+        below_since_us = now;
+    }
+    if (roam_scanning)
+    {
+        return;
+    }
+    if (sweep_remaining == 0)
+    {
+        if (last_sweep_us != 0 && now - last_sweep_us < CONFIG_ESP_WIFI_ROAM_SCAN_INTERVAL * 1000000LL)
+        {
+            return;
+        }
+        last_sweep_us = now;
+#ifdef CONFIG_WPA_11KV_SUPPORT
+        if (esp_wnm_is_btm_supported_connection())
+        {
+            // The AP knows its neighbours, let it pick the target
+            ESP_LOGI(TAG, "RSSI %d dBm, asking the AP for a BSS transition", ap.rssi);
+            roam_stats.btm_queries++;
+            esp_wnm_send_bss_transition_mgmt_query(REASON_RSSI, NULL, 0);
+            return;
+        }
+#endif
+        ESP_LOGI(TAG, "RSSI %d dBm, looking for a better AP", ap.rssi);
+        roam_stats.sweeps++;
+        candidate.valid = false;
+        sweep_channel = 1;
+        sweep_remaining = ROAM_MAX_CHANNEL;
+    }
+    sweep_tick_channels = 0;
+    wifi_roam_scan_next();
+}
+
+void wifi_roam_init(void)
+{
+    if (roam_timer != NULL)
+    {
+        return;
+    }
+    const esp_timer_create_args_t args = {
+        .callback = wifi_roam_check,
+        .name = "wifi_roam"
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&args, &roam_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(roam_timer, CONFIG_ESP_WIFI_ROAM_CHECK_INTERVAL * 1000ULL));
+}
+
+void wifi_get_roam_stats(wifi_roam_stats_t *stats)
+{
+    if (stats == NULL)
+    {
+        return;
+    }
+    *stats = roam_stats;
+    int64_t below_since = below_since_us;
+    if (below_since != 0)
+    {
+        stats->below_threshold_ms += (esp_timer_get_time() - below_since) / 1000;
+    }
+}
+
+#else
+
+void wifi_get_roam_stats(wifi_roam_stats_t *stats)
+{
+    if (stats != NULL)
+    {
+        memset(stats, 0, sizeof(wifi_roam_stats_t));
+    }
+}
+
+#endif
+
+#endif
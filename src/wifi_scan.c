@@ -0,0 +1,353 @@
+/*
+    WIFI scan results for ESP32
+
+    The scan records are read into a statically allocated pool and reduced to the strongest AP
+    for each SSID, sorted by RSSI. The results are cached with a timestamp so BluFi and the
+    network selector can reuse a recent scan instead of scanning again. Single channel scans,
+    used by the roaming sweep, are kept in a buffer of their own so they do not replace the
+    cached results of a full scan. They keep every AP, since roaming looks for another AP of
+    the network it is already on.
+
+    Scans are run by a task with a request queue, so callers (such as the BluFi callback, which
+    runs on the Bluetooth stack task) do not block for the length of a scan. Requests that
+    arrive while a scan is running are answered by that scan.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "sdkconfig.h"
+
+#if CONFIG_ESP_WIFI_ENABLED
+
+#include "wifi_scan.h"
+#include "network_priv.h"
+
+static const char *TAG = "WIFISCAN";
+
+#define THREAD_SCAN_NAME "wifi_scan"
+#define THREAD_SCAN_STACKSIZE configMINIMAL_STACK_SIZE * 4
+#define THREAD_SCAN_PRIORITY 4
+
+#define SCAN_QUEUE_LEN 4
+#define SCAN_CHANNELS 14
+#ifdef CONFIG_ESP_WIFI_SCAN_PASSIVE
+#define SCAN_TIMEOUT_MS (SCAN_CHANNELS * CONFIG_ESP_WIFI_SCAN_PASSIVE_TIME + 2000)
+#else
+#define SCAN_TIMEOUT_MS (SCAN_CHANNELS * CONFIG_ESP_WIFI_SCAN_ACTIVE_MAX_TIME + 2000)
+#endif
+
+typedef struct {
+    wifi_scan_done_cb_t done;
+    void *ctx;
+    uint8_t channel;            // 0 for all channels
+} wifi_scan_request_t;
+
+static StaticQueue_t scan_queue_buffer;
+static uint8_t scan_queue_storage[SCAN_QUEUE_LEN * sizeof(wifi_scan_request_t)];
+static QueueHandle_t scan_queue = NULL;
+static TaskHandle_t scan_task = NULL;
+static wifi_scan_stats_t scan_stats;
+/* A request taken from the queue that the last scan could not answer */
+static wifi_scan_request_t carry_request;
+static bool has_carry_request = false;
+
+/* Raw records from the driver. Only touched by wifi_scan_collect, under the lock. */
+static wifi_ap_record_t scan_records[CONFIG_ESP_WIFI_SCAN_MAX_RECORDS];
+
+static wifi_scan_result_t scan_results[CONFIG_ESP_WIFI_SCAN_MAX_RECORDS];
+static int scan_result_count = 0;
+static int64_t scan_time_us = 0;
+
+/* Results of the last single channel scan, one entry per BSSID */
+static wifi_scan_result_t channel_results[CONFIG_ESP_WIFI_SCAN_MAX_RECORDS];
+static int channel_result_count = 0;
+
+static StaticSemaphore_t scan_lock_buffer;
+static SemaphoreHandle_t scan_lock = NULL;
+
+static void wifi_scan_lock()
+{
+    xSemaphoreTake(scan_lock, portMAX_DELAY);
+}
+
+static void wifi_scan_unlock()
+{
+    xSemaphoreGive(scan_lock);
+}
+
+/* Adds a record to results, keeping them sorted by RSSI with one entry per SSID, or per BSSID if per_bssid is set */
+static void wifi_scan_add(wifi_scan_result_t *results, int *count, const wifi_ap_record_t *record, bool per_bssid)
+{
+    int pos;
+    for (pos = 0; pos < *count; pos++)
+    {
+        if (per_bssid ? memcmp(results[pos].bssid, record->bssid, sizeof(results[pos].bssid)) == 0 :
+            strncmp((const char *)results[pos].ssid, (const char *)record->ssid, sizeof(results[pos].ssid)) == 0)
+        {
+            break;
+        }
+    }
+    if (pos < *count)
+    {
+        if (record->rssi <= results[pos].rssi)
+        {
+            return;
+        }
+    }
+    else
+    {
+        pos = (*count)++;
+    }
+    // Move weaker entries down to make room
+    while (pos > 0 && results[pos - 1].rssi < record->rssi)
+    {
+        results[pos] = results[pos - 1];
+        pos--;
+    }
+    wifi_scan_result_t *result = &results[pos];
+    memcpy(result->ssid, record->ssid, sizeof(result->ssid));
+    result->ssid[sizeof(result->ssid) - 1] = '\0';
+    memcpy(result->bssid, record->bssid, sizeof(result->bssid));
+    result->channel = record->primary;
+    result->rssi = record->rssi;
+    result->authmode = record->authmode;
+}
+
+/*
+ * Reads the records of the last scan from the driver into the pool. A full scan replaces the cached results,
+ * keeping the strongest AP for each SSID. A single channel scan replaces the channel results, keeping every AP.
+ * The driver frees its records when they are read.
+ */
+static int wifi_scan_collect(bool all_channels)
+{
+    wifi_scan_result_t *results = all_channels ? scan_results : channel_results;
+    int *result_count = all_channels ? &scan_result_count : &channel_result_count;
+    uint16_t count = CONFIG_ESP_WIFI_SCAN_MAX_RECORDS;
+    wifi_scan_lock();
+    esp_err_t err = esp_wifi_scan_get_ap_records(&count, scan_records);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Unable to read the scan results: %s", esp_err_to_name(err));
+        count = 0;
+    }
+    *result_count = 0;
+    for (int i = 0; i < count; i++)
+    {
+        // Hidden networks have no SSID to offer
+        if (scan_records[i].ssid[0] != '\0')
+        {
+            wifi_scan_add(results, result_count, &scan_records[i], !all_channels);
+        }
+    }
+    if (all_channels)
+    {
+        scan_time_us = esp_timer_get_time();
+    }
+    int networks = *result_count;
+    wifi_scan_unlock();
+    ESP_LOGD(TAG, "%d APs, %d results", count, networks);
+    return networks;
+}
+
+/* Runs one scan and waits for the driver to finish it */
+static esp_err_t wifi_scan_run(uint8_t channel)
+{
+    wifi_scan_config_t scan_config = {
+        .ssid = NULL,
+        .bssid = NULL,
+        .channel = channel,
+        .show_hidden = false,
+#ifdef CONFIG_ESP_WIFI_SCAN_PASSIVE
+        .scan_type = WIFI_SCAN_TYPE_PASSIVE,
+        .scan_time.passive = CONFIG_ESP_WIFI_SCAN_PASSIVE_TIME,
+#else
+        .scan_type = WIFI_SCAN_TYPE_ACTIVE,
+        .scan_time.active.min = CONFIG_ESP_WIFI_SCAN_ACTIVE_MIN_TIME,
+        .scan_time.active.max = CONFIG_ESP_WIFI_SCAN_ACTIVE_MAX_TIME,
+#endif
+    };
+    // Drop a notification left over from a scan that timed out
+    ulTaskNotifyTake(pdTRUE, 0);
+    int64_t scan_start_us = esp_timer_get_time();
+    esp_err_t err = esp_wifi_scan_start(&scan_config, false);
+    if (err == ESP_OK && ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SCAN_TIMEOUT_MS)) == 0)
+    {
+        esp_wifi_scan_stop();
+        err = ESP_ERR_TIMEOUT;
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Scan failed: %s", esp_err_to_name(err));
+        scan_stats.failures++;
+        return err;
+    }
+    scan_stats.scans++;
+    if (channel == 0)
+    {
+        net_trace_record(NETWORK_PHASE_WIFI_SCAN, scan_start_us);
+        scan_stats.last_scan_ms = (uint32_t)((esp_timer_get_time() - scan_start_us) / 1000);
+    }
+    wifi_scan_collect(channel == 0);
+    return ESP_OK;
+}
+
+static void wifi_scan_task(void *arg)
+{
+    wifi_scan_request_t pending[SCAN_QUEUE_LEN];
+    wifi_scan_request_t request;
+    while (true)
+    {
+        int count = 0;
+        if (has_carry_request)
+        {
+            pending[count++] = carry_request;
+            has_carry_request = false;
+        }
+        else
+        {
+            xQueueReceive(scan_queue, &pending[count++], portMAX_DELAY);
+        }
+        uint8_t channel = pending[0].channel;
+        esp_err_t err = ESP_OK;
+        if (channel == 0 && wifi_scan_is_fresh())
+        {
+            scan_stats.cached++;
+        }
+        else
+        {
+            err = wifi_scan_run(channel);
+        }
+        // Everything queued while the scan ran gets the same results, if it asked for the same channels. A
+        // full scan does not fill the channel results. The first request that needs another scan is kept for
+        // the next round.
+        while (count < SCAN_QUEUE_LEN && xQueueReceive(scan_queue, &request, 0) == pdTRUE)
+        {
+            if (request.channel != channel)
+            {
+                carry_request = request;
+                has_carry_request = true;
+                break;
+            }
+            pending[count++] = request;
+            scan_stats.coalesced++;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            pending[i].done(err, pending[i].ctx);
+        }
+    }
+}
+
+void wifi_scan_init(void)
+{
+    if (scan_lock != NULL)
+    {
+        return;
+    }
+    scan_lock = xSemaphoreCreateMutexStatic(&scan_lock_buffer);
+    scan_queue = xQueueCreateStatic(SCAN_QUEUE_LEN, sizeof(wifi_scan_request_t), scan_queue_storage, &scan_queue_buffer);
+    xTaskCreate(wifi_scan_task, THREAD_SCAN_NAME, THREAD_SCAN_STACKSIZE, NULL, THREAD_SCAN_PRIORITY, &scan_task);
+}
+
+esp_err_t wifi_scan_request_channel(uint8_t channel, wifi_scan_done_cb_t done, void *ctx)
+{
+    wifi_scan_request_t request = {
+        .done = done,
+        .ctx = ctx,
+        .channel = channel
+    };
+    if (scan_queue == NULL || done == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    scan_stats.requests++;
+    if (xQueueSend(scan_queue, &request, 0) != pdTRUE)
+    {
+        ESP_LOGW(TAG, "Scan request queue is full");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t wifi_scan_request(wifi_scan_done_cb_t done, void *ctx)
+{
+    return wifi_scan_request_channel(0, done, ctx);
+}
+
+void wifi_scan_done(void)
+{
+    if (scan_task != NULL)
+    {
+        xTaskNotifyGive(scan_task);
+    }
+}
+
+void wifi_scan_get_stats(wifi_scan_stats_t *stats)
+{
+    if (stats != NULL)
+    {
+        *stats = scan_stats;
+    }
+}
+
+uint32_t wifi_scan_age_ms(void)
+{
+    int64_t scan_time = scan_time_us;
+    if (scan_time == 0)
+    {
+        return UINT32_MAX;
+    }
+    return (uint32_t)((esp_timer_get_time() - scan_time) / 1000);
+}
+
+bool wifi_scan_is_fresh(void)
+{
+    return wifi_scan_age_ms() < CONFIG_ESP_WIFI_SCAN_CACHE_TIME * 1000;
+}
+
+int wifi_scan_get_results(wifi_scan_result_t *results, int max)
+{
+    wifi_scan_lock();
+    int count = (scan_result_count < max) ? scan_result_count : max;
+    memcpy(results, scan_results, count * sizeof(wifi_scan_result_t));
+    wifi_scan_unlock();
+    return count;
+}
+
+void wifi_scan_foreach(void (*callback)(const wifi_scan_result_t *result, int index, void *ctx), void *ctx)
+{
+    wifi_scan_lock();
+    for (int i = 0; i < scan_result_count; i++)
+    {
+        callback(&scan_results[i], i, ctx);
+    }
+    wifi_scan_unlock();
+}
+
+void wifi_scan_foreach_channel(void (*callback)(const wifi_scan_result_t *result, int index, void *ctx), void *ctx)
+{
+    wifi_scan_lock();
+    for (int i = 0; i < channel_result_count; i++)
+    {
+        callback(&channel_results[i], i, ctx);
+    }
+    wifi_scan_unlock();
+}
+
+void wifi_scan_invalidate(void)
+{
+    wifi_scan_lock();
+    scan_result_count = 0;
+    scan_time_us = 0;
+    wifi_scan_unlock();
+}
+
+#endif
@@ -0,0 +1,87 @@
+/*
+    WIFI connection state machine table
+
+    The table only says where each event leads. The actions are run by the state machine
+    task in wifi.c, and the guards only read the conditions they are given.
+
+    (C) 2021 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include "sdkconfig.h"
+#include "wifi_sm.h"
+
+#if CONFIG_ESP_WIFI_ENABLED
+
+static const char *wifi_state_names[WIFI_STATE_MAX] = {
+    "IDLE", "SCANNING", "ASSOCIATING", "DHCP", "CONNECTED", "BACKOFF", "DISABLED"
+};
+
+#ifdef CONFIG_ESP_WIFI_ROAM_ENABLED
+static bool wifi_sm_roam_pending(const wifi_sm_conditions_t *conditions)
+{
+    return conditions->roam_pending;
+}
+#endif
+
+#ifdef CONFIG_ESP_WIFI_FAST_RECONNECT_ENABLED
+static bool wifi_sm_fast_reconnect_ready(const wifi_sm_conditions_t *conditions)
+{
+    return conditions->fast_reconnect_ready;
+}
+#endif
+
+const wifi_sm_transition_t wifi_sm_table[] = {
+#ifdef CONFIG_ESP_WIFI_FAST_RECONNECT_ENABLED
+    { WIFI_SM_STATE(WIFI_STATE_IDLE), WIFI_SM_EVENT_START, wifi_sm_fast_reconnect_ready, WIFI_STATE_ASSOCIATING,
+        WIFI_SM_ACTION_RESUME_FAST },
+#endif
+    { WIFI_SM_STATE(WIFI_STATE_IDLE), WIFI_SM_EVENT_START, NULL, WIFI_STATE_ASSOCIATING,
+        WIFI_SM_ACTION_CONNECT_CURRENT },
+    { WIFI_SM_STATE(WIFI_STATE_ASSOCIATING), WIFI_SM_EVENT_ASSOCIATED, NULL, WIFI_STATE_DHCP, WIFI_SM_ACTION_NONE },
+    { WIFI_SM_STATE(WIFI_STATE_IDLE) | WIFI_SM_STATE(WIFI_STATE_BACKOFF) | WIFI_SM_STATE(WIFI_STATE_SCANNING),
+        WIFI_SM_EVENT_ASSOCIATED, NULL, WIFI_STATE_DHCP, WIFI_SM_ACTION_CANCEL_RETRY },
+    { WIFI_SM_STATE(WIFI_STATE_ASSOCIATING) | WIFI_SM_STATE(WIFI_STATE_DHCP), WIFI_SM_EVENT_GOT_IP, NULL,
+        WIFI_STATE_CONNECTED, WIFI_SM_ACTION_CONNECTED },
+    // DHCP renewed with a new address
+    { WIFI_SM_STATE(WIFI_STATE_CONNECTED), WIFI_SM_EVENT_GOT_IP, NULL, WIFI_STATE_CONNECTED, WIFI_SM_ACTION_NONE },
+#ifdef CONFIG_ESP_WIFI_ROAM_ENABLED
+    { WIFI_SM_LINKING, WIFI_SM_EVENT_DISCONNECTED, wifi_sm_roam_pending, WIFI_STATE_ASSOCIATING,
+        WIFI_SM_ACTION_CONNECT_ROAM },
+#endif
+#ifdef CONFIG_ESP_WIFI_FAST_RECONNECT_ENABLED
+    { WIFI_SM_LINKING, WIFI_SM_EVENT_DISCONNECTED, wifi_sm_fast_reconnect_ready, WIFI_STATE_ASSOCIATING,
+        WIFI_SM_ACTION_CONNECT_FAST },
+#endif
+    { WIFI_SM_LINKING, WIFI_SM_EVENT_DISCONNECTED, NULL, WIFI_STATE_BACKOFF, WIFI_SM_ACTION_START_BACKOFF },
+    { WIFI_SM_STATE(WIFI_STATE_BACKOFF), WIFI_SM_EVENT_BACKOFF_DONE, NULL, WIFI_STATE_SCANNING,
+        WIFI_SM_ACTION_START_SCAN },
+    { WIFI_SM_STATE(WIFI_STATE_SCANNING), WIFI_SM_EVENT_SCAN_DONE, NULL, WIFI_STATE_ASSOCIATING,
+        WIFI_SM_ACTION_CONNECT_SELECTED },
+    { WIFI_SM_ENABLED, WIFI_SM_EVENT_DISABLE, NULL, WIFI_STATE_DISABLED, WIFI_SM_ACTION_DISABLE },
+    // Connecting starts with the START that follows
+    { WIFI_SM_STATE(WIFI_STATE_DISABLED), WIFI_SM_EVENT_ENABLE, NULL, WIFI_STATE_IDLE, WIFI_SM_ACTION_ENABLE },
+};
+
+const size_t wifi_sm_table_size = sizeof(wifi_sm_table) / sizeof(wifi_sm_table[0]);
+
+const wifi_sm_transition_t *wifi_sm_find(wifi_state_t state, wifi_sm_event_t event,
+    const wifi_sm_conditions_t *conditions)
+{
+    for (size_t i = 0; i < wifi_sm_table_size; i++)
+    {
+        const wifi_sm_transition_t *row = &wifi_sm_table[i];
+        if ((row->states & WIFI_SM_STATE(state)) != 0 && row->event == event &&
+            (row->guard == NULL || row->guard(conditions)))
+        {
+            return row;
+        }
+    }
+    return NULL;
+}
+
+const char *wifi_sm_state_name(wifi_state_t state)
+{
+    return (state < WIFI_STATE_MAX) ? wifi_state_names[state] : "?";
+}
+
+#endif
@@ -0,0 +1,359 @@
+/*
+    WIFI credential store
+
+    Keeps a list of known networks and their connection statistics in NVS. The statistics change
+    on every connection attempt, so they are counted in RAM and saved by a timer, or at once when
+    they change the order of the networks.
+
+    (C) 2020 Mark Buckaway - Apache License Version 2.0, January 2004
+*/
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+
+#if CONFIG_ESP_WIFI_ENABLED
+
+#include "wifi_store.h"
+
+#define WIFI_STORE_NAMESPACE "wifistore"
+#define WIFI_STORE_KEY "networks"
+
+static const char *TAG = "WIFISTORE";
+
+/* Saved as one blob. If the size changes (different number of networks), the blob is discarded. */
+typedef struct {
+    uint32_t count;
+    wifi_store_entry_t entries[CONFIG_ESP_WIFI_STORE_MAX_NETWORKS];
+} wifi_store_t;
+
+static wifi_store_t store;
+/* What is written to NVS, copied from store under store_lock since the save timer runs on its own task */
+static wifi_store_t saved;
+static portMUX_TYPE store_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t save_timer = NULL;
+static bool save_pending = false;
+
+static void wifi_store_save()
+{
+    nvs_handle_t handle;
+    portENTER_CRITICAL(&store_lock);
+    saved = store;
+    save_pending = false;
+    portEXIT_CRITICAL(&store_lock);
+    if (save_timer != NULL)
+    {
+        esp_timer_stop(save_timer);
+    }
+    esp_err_t err = nvs_open(WIFI_STORE_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Unable to open NVS: %s", esp_err_to_name(err));
+        return;
+    }
+    err = nvs_set_blob(handle, WIFI_STORE_KEY, &saved, sizeof(saved));
+    if (err == ESP_OK)
+    {
+        err = nvs_commit(handle);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Unable to save networks: %s", esp_err_to_name(err));
+    }
+    nvs_close(handle);
+}
+
+static void wifi_store_save_expired(void *arg)
+{
+    wifi_store_save();
+}
+
+/* Called after the statistics changed */
+static void wifi_store_save_later()
+{
+    portENTER_CRITICAL(&store_lock);
+    bool start = !save_pending;
+    save_pending = true;
+    portEXIT_CRITICAL(&store_lock);
+    if (start && save_timer != NULL)
+    {
+        esp_timer_start_once(save_timer, CONFIG_ESP_WIFI_STORE_SAVE_INTERVAL * 1000000ULL);
+    }
+}
+
+esp_err_t wifi_store_init(void)
+{
+    nvs_handle_t handle;
+    if (save_timer == NULL)
+    {
+        const esp_timer_create_args_t args = {
+            .callback = wifi_store_save_expired,
+            .name = "wifi_store"
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&args, &save_timer));
+    }
+    memset(&store, 0, sizeof(store));
+    esp_err_t err = nvs_open(WIFI_STORE_NAMESPACE, NVS_READONLY, &handle);
+    if (err == ESP_ERR_NVS_NOT_FOUND)
+    {
+        // Nothing saved yet
+        return ESP_OK;
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Unable to open NVS: %s", esp_err_to_name(err));
+        return err;
+    }
+    size_t size = sizeof(store);
+    err = nvs_get_blob(handle, WIFI_STORE_KEY, &store, &size);
+    nvs_close(handle);
+    if (err != ESP_OK || size != sizeof(store) || store.count > CONFIG_ESP_WIFI_STORE_MAX_NETWORKS)
+    {
+        if (err != ESP_ERR_NVS_NOT_FOUND)
+        {
+            ESP_LOGW(TAG, "Discarding saved networks");
+        }
+        memset(&store, 0, sizeof(store));
+        return ESP_OK;
+    }
+    ESP_LOGI(TAG, "Loaded %u networks", store.count);
+    return ESP_OK;
+}
+
+static int wifi_store_find(const char *ssid)
+{
+    for (int i = 0; i < store.count; i++)
+    {
+        if (strncmp(store.entries[i].ssid, ssid, WIFI_STORE_SSID_LEN) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Success rate as a percentage. Networks with no history get 50%.
+static uint32_t wifi_store_success_rate(const wifi_store_entry_t *entry)
+{
+    return ((entry->stats.successes + 1) * 100) / (entry->stats.attempts + 2);
+}
+
+// Number of networks with a better success rate than the one at index
+static int wifi_store_rank(int index)
+{
+    int rank = 0;
+    uint32_t rate = wifi_store_success_rate(&store.entries[index]);
+    for (int i = 0; i < store.count; i++)
+    {
+        if (wifi_store_success_rate(&store.entries[i]) > rate)
+        {
+            rank++;
+        }
+    }
+    return rank;
+}
+
+static int wifi_store_add_entry(const char *ssid, const char *password, bool from_config)
+{
+    if (ssid == NULL || ssid[0] == '\0')
+    {
+        return -1;
+    }
+    int index = wifi_store_find(ssid);
+    if (index < 0)
+    {
+        if (store.count < CONFIG_ESP_WIFI_STORE_MAX_NETWORKS)
+        {
+            index = store.count++;
+        }
+        else
+        {
+            // Replace the least successful network
+            index = 0;
+            for (int i = 1; i < store.count; i++)
+            {
+                if (wifi_store_success_rate(&store.entries[i]) < wifi_store_success_rate(&store.entries[index]))
+                {
+                    index = i;
+                }
+            }
+            ESP_LOGW(TAG, "Store full, replacing %s", store.entries[index].ssid);
+        }
+        memset(&store.entries[index], 0, sizeof(wifi_store_entry_t));
+        strncpy(store.entries[index].ssid, ssid, WIFI_STORE_SSID_LEN);
+    }
+    else if (strncmp(store.entries[index].password, (password != NULL) ? password : "", WIFI_STORE_PASSWORD_LEN) == 0 &&
+        store.entries[index].from_config == from_config)
+    {
+        // Nothing changed, save a flash write
+        return index;
+    }
+    store.entries[index].from_config = from_config;
+    memset(store.entries[index].password, 0, sizeof(store.entries[index].password));
+    if (password != NULL)
+    {
+        strncpy(store.entries[index].password, password, WIFI_STORE_PASSWORD_LEN);
+    }
+    ESP_LOGI(TAG, "Stored network %s", store.entries[index].ssid);
+    wifi_store_save();
+    return index;
+}
+
+int wifi_store_add(const char *ssid, const char *password)
+{
+    return wifi_store_add_entry(ssid, password, false);
+}
+
+static void wifi_store_remove_entry(int index)
+{
+    ESP_LOGI(TAG, "Removed network %s", store.entries[index].ssid);
+    portENTER_CRITICAL(&store_lock);
+    store.count--;
+    memmove(&store.entries[index], &store.entries[index + 1], (store.count - index) * sizeof(wifi_store_entry_t));
+    memset(&store.entries[store.count], 0, sizeof(wifi_store_entry_t));
+    portEXIT_CRITICAL(&store_lock);
+}
+
+esp_err_t wifi_store_remove(const char *ssid)
+{
+    int index = wifi_store_find(ssid);
+    if (index < 0)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    wifi_store_remove_entry(index);
+    wifi_store_save();
+    return ESP_OK;
+}
+
+void wifi_store_set_config(const char *const ssids[], const char *const passwords[], int count)
+{
+    bool removed = false;
+    for (int i = store.count - 1; i >= 0; i--)
+    {
+        if (!store.entries[i].from_config)
+        {
+            continue;
+        }
+        bool configured = false;
+        for (int j = 0; j < count && !configured; j++)
+        {
+            configured = (strncmp(store.entries[i].ssid, ssids[j], WIFI_STORE_SSID_LEN) == 0);
+        }
+        if (!configured)
+        {
+            wifi_store_remove_entry(i);
+            removed = true;
+        }
+    }
+    for (int i = 0; i < count; i++)
+    {
+        wifi_store_add_entry(ssids[i], passwords[i], true);
+    }
+    if (removed)
+    {
+        wifi_store_save();
+    }
+}
+
+int wifi_store_count(void)
+{
+    return store.count;
+}
+
+bool wifi_store_get(int index, wifi_store_entry_t *entry)
+{
+    if (index < 0 || index >= store.count || entry == NULL)
+    {
+        return false;
+    }
+    *entry = store.entries[index];
+    return true;
+}
+
+int wifi_store_select(const wifi_store_scan_t *scan, int count)
+{
+    int best = -1;
+    int best_score = 0;
+    for (int i = 0; i < store.count; i++)
+    {
+        const wifi_store_entry_t *entry = &store.entries[i];
+        bool seen = false;
+        int rssi = 0;
+        for (int j = 0; j < count; j++)
+        {
+            if (strncmp((const char *)scan[j].ssid, entry->ssid, WIFI_STORE_SSID_LEN) == 0 && (!seen || scan[j].rssi > rssi))
+            {
+                rssi = scan[j].rssi;
+                seen = true;
+            }
+        }
+        if (!seen)
+        {
+            continue;
+        }
+        // RSSI in dBm plus up to CONFIG_ESP_WIFI_STORE_SUCCESS_WEIGHT dB for a network that always connects
+        int score = rssi + (int)(wifi_store_success_rate(entry) * CONFIG_ESP_WIFI_STORE_SUCCESS_WEIGHT) / 100;
+        ESP_LOGI(TAG, "%s: rssi %d, success %u/%u, score %d", entry->ssid, rssi,
+            entry->stats.successes, entry->stats.attempts, score);
+        if (best < 0 || score > best_score)
+        {
+            best = i;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+void wifi_store_record_attempt(int index)
+{
+    if (index < 0 || index >= store.count)
+    {
+        return;
+    }
+    int rank = wifi_store_rank(index);
+    portENTER_CRITICAL(&store_lock);
+    store.entries[index].stats.attempts++;
+    portEXIT_CRITICAL(&store_lock);
+    wifi_store_save_later();
+    if (wifi_store_rank(index) != rank)
+    {
+        wifi_store_save();
+    }
+}
+
+void wifi_store_record_success(int index, uint32_t time_to_ip_ms)
+{
+    if (index < 0 || index >= store.count)
+    {
+        return;
+    }
+    int rank = wifi_store_rank(index);
+    portENTER_CRITICAL(&store_lock);
+    store.entries[index].stats.successes++;
+    if (store.entries[index].stats.attempts < store.entries[index].stats.successes)
+    {
+        // Connected without going through the selector, e.g. a BluFi connect request
+        store.entries[index].stats.attempts = store.entries[index].stats.successes;
+    }
+    store.entries[index].stats.total_time_to_ip_ms += time_to_ip_ms;
+    portEXIT_CRITICAL(&store_lock);
+    wifi_store_save_later();
+    if (wifi_store_rank(index) != rank)
+    {
+        wifi_store_save();
+    }
+}
+
+void wifi_store_flush(void)
+{
+    if (save_pending)
+    {
+        wifi_store_save();
+    }
+}
+
+#endif